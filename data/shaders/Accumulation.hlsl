@@ -31,6 +31,8 @@ RWTexture2D<float4> TextureColorSumUAV: register(u0);
 [numthreads(THREAD_GROUP_SIZE_X, THREAD_GROUP_SIZE_Y, 1)]
 void Accumulate(uint3 thredID: SV_GroupThreadID, uint3 groupID: SV_GroupID) {
     uint2 id = GetThreadIDFromTileList(BufferDispersionTiles, groupID.x, thredID.xy);
-    float alpha = 1.0f / (FrameBuffer.FrameIndex + 1.0f);
-    TextureColorSumUAV[id] = lerp(TextureColorSumUAV[id], float4(TextureColorSRV[id].xyz, 1.0), float4(alpha, alpha, alpha, alpha));
+    // alpha stores the per-pixel sample count, it may be seeded from the reprojected history
+    float4 colorSum = TextureColorSumUAV[id];
+    float count = colorSum.a + 1.0f;
+    TextureColorSumUAV[id] = float4(lerp(colorSum.xyz, TextureColorSRV[id].xyz, 1.0f / count), count);
 }
\ No newline at end of file
@@ -0,0 +1,81 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2021 Mikhail Gorobets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright noticeand this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "Common.hlsl"
+#include "EmptySpaceSkipping.hlsl"
+
+Texture3D<float2> TextureVolumeMinMax: register(t0);
+Texture2D<float>  TextureTransferFunctionOpacityRange: register(t1);
+Texture3D<uint>   TextureVolumeLabelMask: register(t2);
+Texture2DArray<float> TextureTransferFunctionLabelOpacityRange: register(t3);
+
+// set by MCVolumeRenderer::updateClipBox, the hidden labels of a label volume shrink the box like a zero opacity
+cbuffer ConstantClipBoxBuffer: register(b1) {
+    struct {
+        uint  IsLabelEnabled;
+        uint  LabelVisibilityMask;
+        uint2 Padding;
+    } ClipBoxBuffer;
+}
+
+// min node coordinates in [0, 3), complemented max node coordinates in [3, 6), so that both reduce with InterlockedMin from 0xFFFFFFFF
+RWStructuredBuffer<uint> BufferClipBoxUAV: register(u0);
+
+groupshared uint SharedBounds[6];
+
+// Bounds of the level 0 nodes of the min / max pyramid with a non zero opacity, reduced per thread group before going to memory
+[numthreads(4, 4, 4)]
+void ComputeClipBox(uint3 thredID: SV_DispatchThreadID, uint lineID: SV_GroupIndex) {
+    if (lineID < 6)
+        SharedBounds[lineID] = 0xFFFFFFFF;
+    GroupMemoryBarrierWithGroupSync();
+
+    uint3 dimension;
+    TextureVolumeMinMax.GetDimensions(dimension.x, dimension.y, dimension.z);
+
+    bool isEmpty = true;
+    [branch]
+    if (all(thredID < dimension)) {
+        [branch]
+        if (ClipBoxBuffer.IsLabelEnabled)
+            isEmpty = IsEmptyNode(TextureVolumeMinMax, TextureVolumeLabelMask, TextureTransferFunctionLabelOpacityRange, ClipBoxBuffer.LabelVisibilityMask, thredID, 0);
+        else
+            isEmpty = IsEmptyNode(TextureVolumeMinMax, TextureTransferFunctionOpacityRange, thredID, 0);
+    }
+
+    [branch]
+    if (!isEmpty) {
+        InterlockedMin(SharedBounds[0], thredID.x);
+        InterlockedMin(SharedBounds[1], thredID.y);
+        InterlockedMin(SharedBounds[2], thredID.z);
+        InterlockedMin(SharedBounds[3], ~thredID.x);
+        InterlockedMin(SharedBounds[4], ~thredID.y);
+        InterlockedMin(SharedBounds[5], ~thredID.z);
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    if (lineID < 6 && SharedBounds[lineID] != 0xFFFFFFFF)
+        InterlockedMin(BufferClipBoxUAV[lineID], SharedBounds[lineID]);
+}
@@ -0,0 +1,61 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2021 Mikhail Gorobets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright noticeand this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+// Requires Common.hlsl, mirrored on the CPU by ClipBuffer and MCVolumeRenderer::MaxClipPlaneCount
+// The clip region is the intersection of the half-spaces dot(Plane.xyz, p) + Plane.w >= 0 in the volume space of the rays,
+// the oriented crop box contributes six of them
+static const uint MAX_CLIP_PLANE_COUNT = 16;
+
+cbuffer ConstantClipBuffer: register(b2) {
+    struct {
+        float4 Planes[MAX_CLIP_PLANE_COUNT];
+        uint   PlaneCount;
+        float3 Padding;
+    } ClipBuffer;
+}
+
+// narrows [intersect.Min, intersect.Max] to the part of the ray inside the clip region, empty when Max < Min
+Intersection IntersectClipRegion(Ray ray, Intersection intersect) {
+    [loop]
+    for (uint index = 0; index < ClipBuffer.PlaneCount; index++) {
+        const float4 plane = ClipBuffer.Planes[index];
+        const float distance = dot(plane.xyz, ray.Origin) + plane.w;
+        const float rate = dot(plane.xyz, ray.Direction);
+        [branch]
+        if (rate == 0.0f) {
+            // parallel to the plane, the whole ray is either inside or outside
+            if (distance < 0.0f)
+                intersect.Max = -FLT_MAX;
+        } else {
+            const float t = -distance / rate;
+            if (rate > 0.0f)
+                intersect.Min = max(intersect.Min, t);
+            else
+                intersect.Max = min(intersect.Max, t);
+        }
+    }
+    return intersect;
+}
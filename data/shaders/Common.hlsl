@@ -47,6 +47,8 @@ cbuffer ConstantFrameBuffer: register(b0) {
         float4x4 InvWorldMatrix;
         float4x4 InvNormalMatrix;
 
+        float4x4 PrevWorldViewProjectionMatrix;
+
         uint   FrameIndex;
         float  StepSize;
         float2 FrameOffset;
@@ -59,6 +61,27 @@ cbuffer ConstantFrameBuffer: register(b0) {
 
         float  Exposure;
         float3 BoundingBoxMax;
+
+        uint   RenderScale;
+        uint   EnvironmentWidth;
+        uint   EnvironmentHeight;
+        uint   BounceCount;
+
+        uint   IsBounceStatisticsEnabled;
+        uint   IsEmptySpaceSkippingEnabled;
+        float  RadianceLodBias;
+        float  RadianceLodBounceScale;
+
+        float3 ClipBoxMin;
+        uint   SampleOffset;
+
+        float3 ClipBoxMax;
+        uint   IsPreIntegrationEnabled;
+
+        uint   IsOpacity2DEnabled;
+        float  GradientMagnitudeScale;
+        uint   IsLabelEnabled;
+        uint   LabelVisibilityMask;
     } FrameBuffer;
 }
 
@@ -23,11 +23,23 @@
  */
 
 #include "Common.hlsl"
+#include "Sampler.hlsl"
+#include "EmptySpaceSkipping.hlsl"
+#include "ClipRegion.hlsl"
 
 struct VolumeDesc {
     AABB  BoundingBox;
+    AABB  ClipBox;
     float StepSize;
     float DensityScale;
+    float Lod;
+};
+
+struct EnvironmentAliasEntry {
+    float Threshold;
+    uint  Alias;
+    float Pdf;
+    float Padding;
 };
 
 struct GBuffer {
@@ -47,8 +59,23 @@ Texture2D<float4> TextureNormal: register(t4);
 Texture2D<float>  TextureDepth: register(t5);
 Texture2D<float3> TextureEnvironment: register(t6);
 StructuredBuffer<uint> BufferDispersionTiles: register(t7);
+StructuredBuffer<EnvironmentAliasEntry> BufferEnvironmentAlias: register(t8);
+Texture3D<float4> TextureVolumeGradient: register(t9);
+Texture1DArray<float4> TextureTransferFunctionMaterial: register(t10);
+Texture3D<float2> TextureVolumeMinMax: register(t11);
+Texture2D<float>  TextureTransferFunctionOpacityRange: register(t12);
+Texture2D<float>  TextureTransferFunctionPreIntegration: register(t13);
+Texture2D<float>  TextureTransferFunctionOpacity2D: register(t14);
+Texture3D<uint>   TextureVolumeLabel: register(t15);
+Texture3D<uint>   TextureVolumeLabelMask: register(t16);
+Texture1DArray<float> TextureTransferFunctionLabelOpacity: register(t17);
+Texture2DArray<float> TextureTransferFunctionLabelOpacityRange: register(t18);
+Texture1DArray<float4> TextureTransferFunctionLabelMaterial: register(t19);
 
 RWTexture2D<float3> TextureRadianceAV:  register(u0);
+RWStructuredBuffer<uint> BufferBounceStatisticsUAV: register(u1);
+
+static const uint MAX_BOUNCE_COUNT = 16;
 
 SamplerState SamplerPoint: register(s0);
 SamplerState SamplerLinear: register(s1);
@@ -76,8 +103,7 @@ float GGX_Distribution(float NdotH, float alpha) {
     return aa / (M_PI * f * f);
 }
 
-float3 GGX_SampleHemisphere(float3 normal, float alpha, inout CRNG rng) {
-    float2 e = float2(Rand(rng), Rand(rng));
+float3 GGX_SampleHemisphere(float3 normal, float alpha, float2 e) {
     float phi = 2.0 * M_PI * e.x;
     float cosTheta = sqrt(max(0.0f, (1.0 - e.y) / (1.0 + alpha * alpha * e.y - e.y)));
     float sinTheta = sqrt(max(0.0f, 1.0 - cosTheta * cosTheta));
@@ -85,11 +111,71 @@ float3 GGX_SampleHemisphere(float3 normal, float alpha, inout CRNG rng) {
 }
 
 float GetIntensity(VolumeDesc desc, float3 position) {
-    return TextureVolumeIntensity.SampleLevel(SamplerLinear, GetNormalizedTexcoord(position, desc.BoundingBox), 0);
+    return TextureVolumeIntensity.SampleLevel(SamplerLinear, GetNormalizedTexcoord(position, desc.BoundingBox), desc.Lod);
+}
+
+float GetOpacity(float intensity) {
+    return TextureTransferFunctionOpacity.SampleLevel(SamplerLinear, intensity, 0);
+}
+
+// mean opacity of a segment whose intensity runs linearly from intensityFront to intensityBack, texel i of an axis is intensity i / (width - 1)
+float GetSegmentOpacity(float intensityFront, float intensityBack) {
+    float width, height;
+    TextureTransferFunctionPreIntegration.GetDimensions(width, height);
+    const float2 texcoord = (float2(intensityFront, intensityBack) * (width - 1.0f) + 0.5f) / width;
+    return TextureTransferFunctionPreIntegration.SampleLevel(SamplerLinear, texcoord, 0);
+}
+
+// opacity over the intensity and the gradient magnitude, v of the table is the magnitude scaled to [0, 1], texel i of an axis at i / (size - 1)
+float GetOpacity2D(float intensity, float gradientMagnitude) {
+    float width, height;
+    TextureTransferFunctionOpacity2D.GetDimensions(width, height);
+    const float2 coordinate = float2(intensity, saturate(gradientMagnitude * FrameBuffer.GradientMagnitudeScale));
+    return TextureTransferFunctionOpacity2D.SampleLevel(SamplerLinear, (coordinate * (float2(width, height) - 1.0f) + 0.5f) / float2(width, height), 0);
+}
+
+float4 GetGradient(VolumeDesc desc, float3 position) {
+    return TextureVolumeGradient.SampleLevel(SamplerLinear, GetNormalizedTexcoord(position, desc.BoundingBox), 0);
+}
+
+// the material table holds diffuse and opacity in slice 0, specular and roughness in slice 1
+float4 GetDiffuseOpacity(float intensity) {
+    return TextureTransferFunctionMaterial.SampleLevel(SamplerLinear, float2(intensity, 0.0f), 0);
+}
+
+float4 GetSpecularRoughness(float intensity) {
+    return TextureTransferFunctionMaterial.SampleLevel(SamplerLinear, float2(intensity, 1.0f), 0);
+}
+
+// labels are point sampled, a position reads the label of its nearest voxel
+uint GetLabel(VolumeDesc desc, float3 position) {
+    int3 dimension;
+    TextureVolumeLabel.GetDimensions(dimension.x, dimension.y, dimension.z);
+    const int3 voxel = clamp(int3(floor(GetNormalizedTexcoord(position, desc.BoundingBox) * dimension)), 0, dimension - 1);
+    return TextureVolumeLabel.Load(int4(voxel, 0));
 }
 
-float GetOpacity(VolumeDesc desc, float3 position) {
-    return TextureTransferFunctionOpacity.SampleLevel(SamplerLinear, GetIntensity(desc, position), 0);
+bool IsLabelVisible(uint label) {
+    return ((FrameBuffer.LabelVisibilityMask >> label) & 1) != 0;
+}
+
+// slice l of the label opacity belongs to label l, slices 2 * l and 2 * l + 1 of the label material
+float GetLabelOpacity(float intensity, uint label) {
+    return TextureTransferFunctionLabelOpacity.SampleLevel(SamplerLinear, float2(intensity, label), 0);
+}
+
+float4 GetDiffuseOpacity(float intensity, uint label) {
+    [branch]
+    if (FrameBuffer.IsLabelEnabled)
+        return TextureTransferFunctionLabelMaterial.SampleLevel(SamplerLinear, float2(intensity, 2 * label), 0);
+    return GetDiffuseOpacity(intensity);
+}
+
+float4 GetSpecularRoughness(float intensity, uint label) {
+    [branch]
+    if (FrameBuffer.IsLabelEnabled)
+        return TextureTransferFunctionLabelMaterial.SampleLevel(SamplerLinear, float2(intensity, 2 * label + 1), 0);
+    return GetSpecularRoughness(intensity);
 }
 
 float3 GetEnvironment(float3 direction) {
@@ -99,6 +185,29 @@ float3 GetEnvironment(float3 direction) {
     //return float3(0.3f, 0.3f, 0.3f);
 }
 
+// Solid angle density of sampling the environment direction with the alias table
+float GetEnvironmentPdf(float3 direction) {
+    const uint2 dimension = uint2(FrameBuffer.EnvironmentWidth, FrameBuffer.EnvironmentHeight);
+    const float theta = acos(clamp(direction.y, -1.0f, 1.0f));
+    const float2 texcoord = float2(frac(atan2(direction.x, -direction.z) / M_PI * 0.5f), theta / M_PI);
+    const uint2 texel = min(uint2(texcoord * dimension), dimension - 1);
+    const float sinTheta = sin(theta);
+    return sinTheta > 0.0f ? BufferEnvironmentAlias[texel.y * dimension.x + texel.x].Pdf / (2.0f * M_PI * M_PI * sinTheta) : 0.0f;
+}
+
+// Picks a texel proportional to luminance * sin(theta) in O(1) and jitters the direction inside it
+float3 SampleEnvironment(float2 uTexel, float2 uJitter) {
+    const uint2 dimension = uint2(FrameBuffer.EnvironmentWidth, FrameBuffer.EnvironmentHeight);
+    uint index = min(uint(uTexel.x * dimension.x * dimension.y), dimension.x * dimension.y - 1);
+    const EnvironmentAliasEntry entry = BufferEnvironmentAlias[index];
+    index = uTexel.y < entry.Threshold ? index : entry.Alias;
+
+    const float2 texcoord = (float2(index % dimension.x, index / dimension.x) + uJitter) / dimension;
+    const float phi = 2.0f * M_PI * texcoord.x;
+    const float theta = M_PI * texcoord.y;
+    return float3(sin(theta) * sin(phi), cos(theta), -sin(theta) * cos(phi));
+}
+
 GBuffer LoadGBuffer(uint2 id, float2 offset, float2 invDimension, float4x4 invWVP) {
     float2 ncdXY = 2.0f * (id + offset) * invDimension - 1.0f;
     ncdXY.y *= -1.0f;
@@ -120,8 +229,67 @@ GBuffer LoadGBuffer(uint2 id, float2 offset, float2 invDimension, float4x4 invWV
     return buffer;
 }
 
-bool RayMarching(Ray ray, VolumeDesc desc, inout CRNG rng) {
-    Intersection intersect = IntersectAABB(ray, desc.BoundingBox);
+// Scatter event at a secondary vertex, built the same way GenerateRays builds the primary one from the intensity of the last march step
+bool LoadScatterEvent(VolumeDesc desc, float3 position, float intensity, float3 direction, out GBuffer buffer) {
+    const float4 gradient = GetGradient(desc, position);
+    buffer.Normal = -normalize(gradient.xyz);
+    buffer.Normal = dot(buffer.Normal, -direction) < 0.0f ? -buffer.Normal : buffer.Normal;
+    buffer.Position = position + 0.001 * buffer.Normal;
+    buffer.View = -direction;
+    const uint label = FrameBuffer.IsLabelEnabled ? GetLabel(desc, position) : 0;
+    const float4 diffuseOpacity = GetDiffuseOpacity(intensity, label);
+    const float4 specularRoughness = GetSpecularRoughness(intensity, label);
+    buffer.Diffuse = diffuseOpacity.rgb;
+    buffer.Specular = specularRoughness.rgb;
+    buffer.Roughness = specularRoughness.a;
+    return gradient.a >= FLT_EPSILON;
+}
+
+// Samples the surface-like BSDF of the scatter event, returns the throughput weight of the sampled direction
+float3 SampleBSDF(GBuffer buffer, Sampler samples, uint bounce, out float3 direction) {
+    const float3 N = buffer.Normal;
+    const float3 V = buffer.View;
+    const float alpha = buffer.Roughness * buffer.Roughness;
+        
+    const float3 H = GGX_SampleHemisphere(N, alpha, Sample2D(samples, GetBounceDimension(bounce, SAMPLER_DIMENSION_MICROFACET)));
+    const float3 F = FresnelSchlick(buffer.Specular, saturate(dot(V, H)));
+					
+    const float pd = length(1 - F);
+    const float ps = length(F);
+    const float pdf = ps / (ps + pd);
+     	
+    if (Sample1D(samples, GetBounceDimension(bounce, SAMPLER_DIMENSION_LOBE)) < pdf) {
+        // reflection
+        const float3 L = reflect(-V, H);
+        const float NdotL = saturate(dot(N, L));
+        const float NdotV = saturate(dot(N, V));
+        const float NdotH = saturate(dot(N, H));
+        const float VdotH = saturate(dot(V, H));
+		
+        const float G = GGX_PartialGeometry(NdotV, alpha) * GGX_PartialGeometry(NdotL, alpha);
+        direction = L;
+        return (G * F * VdotH) / (NdotV * NdotH + M_EPSILON) / (pdf);
+    } else {
+        // refraction, one-sample MIS of the cosine lobe and the environment with the balance heuristic
+        const float2 uEnvironmentTexel = Sample2D(samples, GetBounceDimension(bounce, SAMPLER_DIMENSION_ENVIRONMENT_TEXEL));
+        const float2 uEnvironmentJitter = Sample2D(samples, GetBounceDimension(bounce, SAMPLER_DIMENSION_ENVIRONMENT_JITTER));
+        const float3 L = Sample1D(samples, GetBounceDimension(bounce, SAMPLER_DIMENSION_STRATEGY)) < 0.5f
+            ? GGX_SampleHemisphere(N, 1.0, Sample2D(samples, GetBounceDimension(bounce, SAMPLER_DIMENSION_DIFFUSE)))
+            : mul((float3x3)FrameBuffer.InvNormalMatrix, SampleEnvironment(uEnvironmentTexel, uEnvironmentJitter));
+        const float NdotL = saturate(dot(N, L));
+        const float pdfBRDF = NdotL / M_PI;
+        const float pdfEnvironment = GetEnvironmentPdf(mul((float3x3)FrameBuffer.NormalMatrix, L));
+        direction = L;
+        return (1 - F) * buffer.Diffuse * pdfBRDF / max(0.5f * (pdfBRDF + pdfEnvironment), FLT_EPSILON) / (1 - pdf);
+    }
+}
+
+bool RayMarching(Ray ray, VolumeDesc desc, float2 u, out float3 position, out float intensity, out uint stepCount) {
+    Intersection intersect = IntersectAABB(ray, desc.ClipBox);
+    intersect = IntersectClipRegion(ray, intersect);
+    position = float3(0.0, 0.0, 0.0f);
+    intensity = 0.0f;
+    stepCount = 0;
 	
     [branch]
     if (intersect.Max < intersect.Min)
@@ -130,19 +298,89 @@ bool RayMarching(Ray ray, VolumeDesc desc, inout CRNG rng) {
     const float minT = max(intersect.Min, ray.Min);
     const float maxT = min(intersect.Max, ray.Max);
     
-    const float threshold = -log(Rand(rng)) / desc.DensityScale;
+    const float threshold = -log(1.0f - u.x) / desc.DensityScale;
 	
     float sum = 0.0f;
-    float t = minT + Rand(rng) * desc.StepSize; 
-    float3 position = float3(0.0, 0.0, 0.0f);
+    float t = minT + u.y * desc.StepSize;
+    float leafExit = -FLT_MAX;
+
+    float3 dimension;
+    TextureVolumeIntensity.GetDimensions(dimension.x, dimension.y, dimension.z);
+    const EmptySpaceRay skipRay = CreateEmptySpaceRay(ray, desc.BoundingBox, dimension);
+
+    // the pre-integrated segments run between the jittered samples, the first one from the entry of the interval
+    float tFront = minT;
+    [branch]
+    if (FrameBuffer.IsPreIntegrationEnabled) {
+        intensity = GetIntensity(desc, ray.Origin + tFront * ray.Direction);
+        stepCount++;
+    }
     
     [loop]
     while (sum < threshold) {
+        [branch]
+        if (t >= maxT) {
+            // the last pre-integrated segment ends on the exit of the interval
+            [branch]
+            if (!FrameBuffer.IsPreIntegrationEnabled || tFront >= maxT)
+                return false;
+            t = maxT;
+        }
         position = ray.Origin + t * ray.Direction;
+
+        [branch]
+        if (FrameBuffer.IsPreIntegrationEnabled) {
+            const float intensityBack = GetIntensity(desc, position);
+            const float depth = desc.DensityScale * GetSegmentOpacity(intensity, intensityBack) * (t - tFront);
+            stepCount++;
+            // the free path ends inside the segment, its opacity is taken as constant along it
+            [branch]
+            if (sum + depth >= threshold) {
+                const float fraction = (threshold - sum) / max(depth, FLT_MIN);
+                position = ray.Origin + lerp(tFront, t, fraction) * ray.Direction;
+                intensity = lerp(intensity, intensityBack, fraction);
+                return true;
+            }
+            sum += depth;
+            intensity = intensityBack;
+            tFront = t;
+        }
+
+        // samples inside an empty node add no opacity, resume on the step grid past its exit
         [branch]
-        if (t >= maxT)
-            return false;
-        sum += desc.DensityScale * GetOpacity(desc, position) * desc.StepSize;
+        if (FrameBuffer.IsEmptySpaceSkippingEnabled && t >= leafExit) {
+            const float tExit = GetEmptySpaceExit(TextureVolumeMinMax, TextureTransferFunctionOpacityRange, TextureVolumeLabelMask, TextureTransferFunctionLabelOpacityRange,
+                                                  FrameBuffer.IsLabelEnabled, FrameBuffer.LabelVisibilityMask, skipRay, t, leafExit);
+            [branch]
+            if (tExit > t) {
+                t = max(minT + (ceil((tExit - minT) / desc.StepSize - u.y) + u.y) * desc.StepSize, t + desc.StepSize);
+                // the next segment starts on the exit of the node
+                [branch]
+                if (FrameBuffer.IsPreIntegrationEnabled) {
+                    tFront = tExit;
+                    intensity = GetIntensity(desc, ray.Origin + tExit * ray.Direction);
+                    stepCount++;
+                }
+                continue;
+            }
+        }
+
+        [branch]
+        if (!FrameBuffer.IsPreIntegrationEnabled) {
+            intensity = GetIntensity(desc, position);
+            // the gradient is only fetched for a 2D opacity, a hidden label adds no opacity
+            float opacity = 0.0f;
+            [branch]
+            if (FrameBuffer.IsLabelEnabled) {
+                const uint label = GetLabel(desc, position);
+                opacity = IsLabelVisible(label) ? GetLabelOpacity(intensity, label) : 0.0f;
+            } else if (FrameBuffer.IsOpacity2DEnabled)
+                opacity = GetOpacity2D(intensity, GetGradient(desc, position).a);
+            else
+                opacity = GetOpacity(intensity);
+            sum += desc.DensityScale * opacity * desc.StepSize;
+            stepCount++;
+        }
         t += desc.StepSize;
     }
     return true;
@@ -151,53 +389,70 @@ bool RayMarching(Ray ray, VolumeDesc desc, inout CRNG rng) {
 [numthreads(THREAD_GROUP_SIZE_X, THREAD_GROUP_SIZE_Y, 1)]
 void ComputeRadiance(uint3 thredID: SV_GroupThreadID, uint3 groupID: SV_GroupID) {
     uint2 id = GetThreadIDFromTileList(BufferDispersionTiles, groupID.x, thredID.xy);    
-    CRNG rng = InitCRND(id, FrameBuffer.FrameIndex + 1);
+    Sampler samples = InitSampler(id, FrameBuffer.SampleOffset + FrameBuffer.FrameIndex);
     GBuffer buffer = LoadGBuffer(id, FrameBuffer.FrameOffset, FrameBuffer.InvRenderTargetDim, FrameBuffer.InvWorldViewProjectionMatrix);
 
     if (any(buffer.Diffuse)) {
         VolumeDesc desc;
         desc.BoundingBox.Min = FrameBuffer.BoundingBoxMin;
         desc.BoundingBox.Max = FrameBuffer.BoundingBoxMax;
+        desc.ClipBox.Min = FrameBuffer.ClipBoxMin;
+        desc.ClipBox.Max = FrameBuffer.ClipBoxMax;
         desc.StepSize = FrameBuffer.StepSize;
         desc.DensityScale = FrameBuffer.Density;
+        desc.Lod = 0.0f;
+
+        uint3 dimension;
+        uint lodCount;
+        TextureVolumeIntensity.GetDimensions(0, dimension.x, dimension.y, dimension.z, lodCount);
       
-        Ray ray;
-        ray.Min = 0;
-        ray.Max = FLT_MAX;
-        ray.Origin = buffer.Position;
+        float3 radiance = float3(0.0, 0.0, 0.0);
+        float3 throughput = float3(1.0, 1.0, 1.0);
+        const uint bounceCount = min(FrameBuffer.BounceCount, MAX_BOUNCE_COUNT);
      
-        float3 throughput = float3(0.0, 0.0, 0.0);
-        
-        const float3 N = buffer.Normal;
-        const float3 V = buffer.View;
-        const float alpha = buffer.Roughness * buffer.Roughness;
-        
-        const float3 H = GGX_SampleHemisphere(N, alpha, rng);
-        const float3 F = FresnelSchlick(buffer.Specular, saturate(dot(V, H)));
-					
-        const float pd = length(1 - F);
-        const float ps = length(F);
-        const float pdf = ps / (ps + pd);
-     	
-        if (Rand(rng) < pdf) {
-            // reflection
-            const float3 L = reflect(-V, H);
-            const float NdotL = saturate(dot(N, L));
-            const float NdotV = saturate(dot(N, V));
-            const float NdotH = saturate(dot(N, H));
-            const float VdotH = saturate(dot(V, H));
-		
-            const float G = GGX_PartialGeometry(NdotV, alpha) * GGX_PartialGeometry(NdotL, alpha);
-            ray.Direction = L;
-            throughput = (G * F * VdotH) / (NdotV * NdotH + M_EPSILON) / (pdf);
-        } else {
-            // refraction
-            const float3 L = GGX_SampleHemisphere(N, 1.0, rng);
-            ray.Direction = L;
-            throughput = (1 - F) * buffer.Diffuse / (1 - pdf);
+        [loop]
+        for (uint bounce = 0; bounce < bounceCount; bounce++) {
+            Ray ray;
+            ray.Min = 0;
+            ray.Max = FLT_MAX;
+            ray.Origin = buffer.Position;
+
+            // deeper segments read coarser mips, the step grows with the voxel footprint of the mip
+            desc.Lod = clamp(FrameBuffer.RadianceLodBias + bounce * FrameBuffer.RadianceLodBounceScale, 0.0f, lodCount - 1.0f);
+            desc.StepSize = FrameBuffer.StepSize * exp2(desc.Lod);
+            throughput *= SampleBSDF(buffer, samples, bounce, ray.Direction);
+
+            float3 position;
+            float intensity;
+            uint stepCount;
+            const bool isIntersect = RayMarching(ray, desc, float2(Sample1D(samples, GetBounceDimension(bounce, SAMPLER_DIMENSION_DISTANCE)), Sample1D(samples, GetBounceDimension(bounce, SAMPLER_DIMENSION_JITTER))), position, intensity, stepCount);
+
+            [branch]
+            if (FrameBuffer.IsBounceStatisticsEnabled) {
+                InterlockedAdd(BufferBounceStatisticsUAV[2 * bounce + 0], 1);
+                InterlockedAdd(BufferBounceStatisticsUAV[2 * bounce + 1], stepCount);
+            }
+
+            [branch]
+            if (!isIntersect) {
+                radiance += throughput * GetEnvironment(mul((float3x3)FrameBuffer.NormalMatrix, ray.Direction));
+                break;
+            }
+
+            [branch]
+            if (!LoadScatterEvent(desc, position, intensity, ray.Direction, buffer))
+                break;
+
+            // Russian roulette on the throughput once the path has scattered twice
+            [branch]
+            if (bounce > 0) {
+                const float survival = min(max(throughput.x, max(throughput.y, throughput.z)), 0.95f);
+                [branch]
+                if (Sample1D(samples, GetBounceDimension(bounce, SAMPLER_DIMENSION_ROULETTE)) >= survival)
+                    break;
+                throughput /= survival;
+            }
         }
-             
-        bool isIntersect = RayMarching(ray, desc, rng);     
-        TextureRadianceAV[id] = !isIntersect * throughput * GetEnvironment(mul((float3x3)FrameBuffer.NormalMatrix, ray.Direction));
+        TextureRadianceAV[id] = radiance;
     }
 }
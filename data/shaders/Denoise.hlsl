@@ -0,0 +1,103 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2021 Mikhail Gorobets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright noticeand this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "Common.hlsl"
+
+cbuffer ConstantDenoiseBuffer: register(b1) {
+    struct {
+        uint   StepWidth;
+        float  SigmaColor;
+        float  SigmaNormal;
+        float  SigmaDepth;
+
+        float  SigmaAlbedo;
+        float3 Padding;
+    } DenoiseBuffer;
+}
+
+Texture2D<float4>   TextureColorSRV: register(t0);
+Texture2D<float3>   TextureDiffuseSRV: register(t1);
+Texture2D<float4>   TextureNormalSRV: register(t2);
+Texture2D<float>    TextureDepthSRV: register(t3);
+RWTexture2D<float4> TextureColorUAV: register(u0);
+
+// B3 spline kernel of the a-trous wavelet transform
+static const float Kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+float Luminance(float3 color) {
+    return dot(float3(0.2126, 0.7152, 0.0722), color);
+}
+
+// One iteration of the edge-avoiding a-trous filter [Dammertz et al. 2010], the taps are spread by StepWidth.
+// Edges are detected from the G-buffer, the color weight is relaxed as the per-pixel sample count grows.
+[numthreads(THREAD_GROUP_SIZE_X, THREAD_GROUP_SIZE_Y, 1)]
+void DenoiseATrous(uint3 thredID: SV_DispatchThreadID) {
+    const int2 id = int2(thredID.xy);
+    const int2 maxID = int2(FrameBuffer.RenderTargetDim) - 1;
+
+    [branch]
+    if (any(id > maxID))
+        return;
+
+    const float4 colorCenter = TextureColorSRV[id];
+    const float3 albedoCenter = TextureDiffuseSRV[id];
+    const float3 normalCenter = TextureNormalSRV[id].xyz;
+    const float  depthCenter = TextureDepthSRV[id];
+    const float  luminanceCenter = Luminance(colorCenter.xyz);
+    const float  sigmaColor = DenoiseBuffer.SigmaColor / sqrt(max(colorCenter.a, 1.0f)) + FLT_EPSILON;
+    const float  sigmaDepth = DenoiseBuffer.SigmaDepth * DenoiseBuffer.StepWidth + FLT_EPSILON;
+
+    float3 colorSum = float3(0.0f, 0.0f, 0.0f);
+    float  weightSum = 0.0f;
+
+    [unroll]
+    for (int y = -2; y <= 2; y++) {
+        [unroll]
+        for (int x = -2; x <= 2; x++) {
+            const int2 tapID = id + int2(x, y) * DenoiseBuffer.StepWidth;
+            [branch]
+            if (any(tapID < int2(0, 0)) || any(tapID > maxID))
+                continue;
+
+            const float3 color = TextureColorSRV[tapID].xyz;
+            const float3 normal = TextureNormalSRV[tapID].xyz;
+
+            [branch]
+            if (any(normal) != any(normalCenter))
+                continue;
+
+            const float weightKernel = Kernel[abs(x)] * Kernel[abs(y)];
+            const float weightColor = exp(-abs(Luminance(color) - luminanceCenter) / sigmaColor);
+            const float weightNormal = any(normal) ? pow(saturate(dot(normal, normalCenter)), DenoiseBuffer.SigmaNormal) : 1.0f;
+            const float weightDepth = exp(-abs(TextureDepthSRV[tapID] - depthCenter) / sigmaDepth);
+            const float weightAlbedo = exp(-length(TextureDiffuseSRV[tapID] - albedoCenter) / DenoiseBuffer.SigmaAlbedo);
+            const float weight = weightKernel * weightColor * weightNormal * weightDepth * weightAlbedo;
+
+            colorSum += weight * color;
+            weightSum += weight;
+        }
+    }
+    TextureColorUAV[id] = float4(weightSum > FLT_EPSILON ? colorSum / weightSum : colorCenter.xyz, colorCenter.a);
+}
@@ -0,0 +1,107 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2021 Mikhail Gorobets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright noticeand this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+// Requires Common.hlsl, mirrored on the CPU by MCVolumeDataLoader::MinMaxCellSize / MinMaxLevelCount
+// A node of level l covers (MINMAX_CELL_SIZE << l)^3 cells of the trilinear footprint, its min / max bound every voxel it interpolates
+static const uint MINMAX_CELL_SIZE = 4;
+static const uint MINMAX_LEVEL_COUNT = 6;
+
+// ray expressed in the texel space of the trilinear footprint, voxel centers at integer coordinates
+struct EmptySpaceRay {
+    float3 Origin;
+    float3 Direction;
+    float3 InvDirection;
+};
+
+EmptySpaceRay CreateEmptySpaceRay(Ray ray, AABB aabb, float3 dimension) {
+    const float3 scale = dimension / (aabb.Max - aabb.Min);
+    EmptySpaceRay result;
+    result.Origin = (ray.Origin - aabb.Min) * scale - 0.5f;
+    result.Direction = ray.Direction * scale;
+    result.InvDirection = rcp(result.Direction);
+    return result;
+}
+
+// texels of the opacity range table around the intensity range of a node
+int2 GetOpacityRangeTexel(float2 range, uint width) {
+    return clamp(int2(floor(range.x * width - 0.5f), ceil(range.y * width - 0.5f)), 0, int(width) - 1);
+}
+
+// the table stores the largest opacity of the transfer function between two of its texels
+bool IsEmptyNode(Texture3D<float2> pyramid, Texture2D<float> opacityRange, int3 node, uint level) {
+    uint width, height;
+    opacityRange.GetDimensions(width, height);
+
+    const int2 texel = GetOpacityRangeTexel(pyramid.Load(int4(node, level)), width);
+    return opacityRange.Load(int3(texel, 0)) <= 0.0f;
+}
+
+// with a label volume slice l of the table belongs to label l, a node is empty when none of the visible labels it holds has an opacity
+// over its intensities. A node holding hidden labels only is culled whatever its intensities
+bool IsEmptyNode(Texture3D<float2> pyramid, Texture3D<uint> labelPyramid, Texture2DArray<float> labelOpacityRange, uint visibleLabels, int3 node, uint level) {
+    uint width, height, sliceCount;
+    labelOpacityRange.GetDimensions(width, height, sliceCount);
+
+    const int2 texel = GetOpacityRangeTexel(pyramid.Load(int4(node, level)), width);
+    uint labels = labelPyramid.Load(int4(node, level)) & visibleLabels;
+
+    [loop]
+    while (labels != 0) {
+        [branch]
+        if (labelOpacityRange.Load(int4(texel, firstbitlow(labels), 0)) > 0.0f)
+            return false;
+        labels &= labels - 1;
+    }
+    return true;
+}
+
+// Top-down descent: returns the exit distance of the coarsest empty node around t,
+// or t itself when the cell is occupied down to level 0, leafExit is then the exit distance of that cell
+float GetEmptySpaceExit(Texture3D<float2> pyramid, Texture2D<float> opacityRange, Texture3D<uint> labelPyramid, Texture2DArray<float> labelOpacityRange,
+                        bool isLabeled, uint visibleLabels, EmptySpaceRay ray, float t, out float leafExit) {
+    const float3 position = ray.Origin + t * ray.Direction;
+    leafExit = t;
+
+    [loop]
+    for (int level = MINMAX_LEVEL_COUNT - 1; level >= 0; level--) {
+        const float size = float(MINMAX_CELL_SIZE << level);
+        const int3 node = max(int3(floor(position / size)), 0);
+        const float3 boundary = (node + (ray.Direction > 0.0f ? 1.0f : 0.0f)) * size;
+        const float3 tBoundary = (boundary - ray.Origin) * ray.InvDirection;
+        leafExit = min(min(tBoundary.x, tBoundary.y), tBoundary.z);
+
+        bool isEmpty = false;
+        [branch]
+        if (isLabeled)
+            isEmpty = IsEmptyNode(pyramid, labelPyramid, labelOpacityRange, visibleLabels, node, level);
+        else
+            isEmpty = IsEmptyNode(pyramid, opacityRange, node, level);
+
+        [branch]
+        if (isEmpty)
+            return leafExit;
+    }
+    return t;
+}
@@ -0,0 +1,41 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2021 Mikhail Gorobets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright noticeand this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+Texture2D<float3>   TextureEnvironment: register(t0);
+RWTexture2D<float>  TextureLuminanceUAV: register(u0);
+
+cbuffer ConstantEnvironmentBuffer: register(b0) {
+    uint  MipLevel;
+    uint2 Dimension;
+    uint  Padding;
+}
+
+// Luminance of the environment map at the resolution of the alias table, the sin-theta weight is applied on the CPU
+[numthreads(THREAD_GROUP_SIZE_X, THREAD_GROUP_SIZE_Y, 1)]
+void ComputeEnvironmentLuminance(uint3 thredID: SV_DispatchThreadID) {
+    [branch]
+    if (any(thredID.xy >= Dimension))
+        return;
+    TextureLuminanceUAV[thredID.xy] = dot(float3(0.2126, 0.7152, 0.0722), TextureEnvironment.Load(int3(thredID.xy, MipLevel)));
+}
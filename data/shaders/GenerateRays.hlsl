@@ -23,9 +23,13 @@
  */
 
 #include "Common.hlsl"
+#include "Sampler.hlsl"
+#include "EmptySpaceSkipping.hlsl"
+#include "ClipRegion.hlsl"
 
 struct VolumeDesc {
     AABB  BoundingBox;
+    AABB  ClipBox;
     float StepSize;
     float DensityScale;
 };
@@ -41,11 +45,18 @@ struct ScatterEvent {
 
 Texture3D<float>  TextureVolumeIntensity: register(t0);
 Texture3D<float4> TextureVolumeGradient: register(t1);
-Texture1D<float3> TextureTransferFunctionDiffuse: register(t2);
-Texture1D<float3> TextureTransferFunctionSpecular: register(t3);
-Texture1D<float1> TextureTransferFunctionRoughness: register(t4);
-Texture1D<float1> TextureTransferFunctionOpacity: register(t5);
-StructuredBuffer<uint> BufferDispersionTiles: register(t6);
+Texture1DArray<float4> TextureTransferFunctionMaterial: register(t2);
+Texture1D<float1> TextureTransferFunctionOpacity: register(t3);
+StructuredBuffer<uint> BufferDispersionTiles: register(t4);
+Texture3D<float2> TextureVolumeMinMax: register(t5);
+Texture2D<float>  TextureTransferFunctionOpacityRange: register(t6);
+Texture2D<float>  TextureTransferFunctionPreIntegration: register(t7);
+Texture2D<float>  TextureTransferFunctionOpacity2D: register(t8);
+Texture3D<uint>   TextureVolumeLabel: register(t9);
+Texture3D<uint>   TextureVolumeLabelMask: register(t10);
+Texture1DArray<float> TextureTransferFunctionLabelOpacity: register(t11);
+Texture2DArray<float> TextureTransferFunctionLabelOpacityRange: register(t12);
+Texture1DArray<float4> TextureTransferFunctionLabelMaterial: register(t13);
 
 RWTexture2D<float3> TextureDiffuseUAV: register(u0);
 RWTexture2D<float3> TextureSpecularUAV: register(u1);
@@ -65,24 +76,68 @@ float4 GetGradient(VolumeDesc desc, float3 position) {
     return TextureVolumeGradient.SampleLevel(SamplerLinear, GetNormalizedTexcoord(position, desc.BoundingBox), 0);
 }
  
-float GetOpacity(VolumeDesc desc, float3 position) {
-    return TextureTransferFunctionOpacity.SampleLevel(SamplerLinear, GetIntensity(desc, position), 0);
+float GetOpacity(float intensity) {
+    return TextureTransferFunctionOpacity.SampleLevel(SamplerLinear, intensity, 0);
 }
 
-float3 GetDiffuse(VolumeDesc desc, float3 position) {
-    return TextureTransferFunctionDiffuse.SampleLevel(SamplerLinear, GetIntensity(desc, position), 0);
+// mean opacity of a segment whose intensity runs linearly from intensityFront to intensityBack, texel i of an axis is intensity i / (width - 1)
+float GetSegmentOpacity(float intensityFront, float intensityBack) {
+    float width, height;
+    TextureTransferFunctionPreIntegration.GetDimensions(width, height);
+    const float2 texcoord = (float2(intensityFront, intensityBack) * (width - 1.0f) + 0.5f) / width;
+    return TextureTransferFunctionPreIntegration.SampleLevel(SamplerLinear, texcoord, 0);
 }
 
-float3 GetSpecular(VolumeDesc desc, float3 position) {
-    return TextureTransferFunctionSpecular.SampleLevel(SamplerLinear, GetIntensity(desc, position), 0);
+// opacity over the intensity and the gradient magnitude, v of the table is the magnitude scaled to [0, 1], texel i of an axis at i / (size - 1)
+float GetOpacity2D(float intensity, float gradientMagnitude) {
+    float width, height;
+    TextureTransferFunctionOpacity2D.GetDimensions(width, height);
+    const float2 coordinate = float2(intensity, saturate(gradientMagnitude * FrameBuffer.GradientMagnitudeScale));
+    return TextureTransferFunctionOpacity2D.SampleLevel(SamplerLinear, (coordinate * (float2(width, height) - 1.0f) + 0.5f) / float2(width, height), 0);
 }
 
-float GetRoughness(VolumeDesc desc, float3 position) {
-    return TextureTransferFunctionRoughness.SampleLevel(SamplerLinear, GetIntensity(desc, position), 0);
+// the material table holds diffuse and opacity in slice 0, specular and roughness in slice 1
+float4 GetDiffuseOpacity(float intensity) {
+    return TextureTransferFunctionMaterial.SampleLevel(SamplerLinear, float2(intensity, 0.0f), 0);
 }
 
+float4 GetSpecularRoughness(float intensity) {
+    return TextureTransferFunctionMaterial.SampleLevel(SamplerLinear, float2(intensity, 1.0f), 0);
+}
+
+// labels are point sampled, a position reads the label of its nearest voxel
+uint GetLabel(VolumeDesc desc, float3 position) {
+    int3 dimension;
+    TextureVolumeLabel.GetDimensions(dimension.x, dimension.y, dimension.z);
+    const int3 voxel = clamp(int3(floor(GetNormalizedTexcoord(position, desc.BoundingBox) * dimension)), 0, dimension - 1);
+    return TextureVolumeLabel.Load(int4(voxel, 0));
+}
+
+bool IsLabelVisible(uint label) {
+    return ((FrameBuffer.LabelVisibilityMask >> label) & 1) != 0;
+}
+
+// slice l of the label opacity belongs to label l, slices 2 * l and 2 * l + 1 of the label material
+float GetLabelOpacity(float intensity, uint label) {
+    return TextureTransferFunctionLabelOpacity.SampleLevel(SamplerLinear, float2(intensity, label), 0);
+}
+
+float4 GetDiffuseOpacity(float intensity, uint label) {
+    [branch]
+    if (FrameBuffer.IsLabelEnabled)
+        return TextureTransferFunctionLabelMaterial.SampleLevel(SamplerLinear, float2(intensity, 2 * label), 0);
+    return GetDiffuseOpacity(intensity);
+}
 
-ScatterEvent RayMarching(Ray ray, VolumeDesc desc, inout CRNG rng) {
+float4 GetSpecularRoughness(float intensity, uint label) {
+    [branch]
+    if (FrameBuffer.IsLabelEnabled)
+        return TextureTransferFunctionLabelMaterial.SampleLevel(SamplerLinear, float2(intensity, 2 * label + 1), 0);
+    return GetSpecularRoughness(intensity);
+}
+
+
+ScatterEvent RayMarching(Ray ray, VolumeDesc desc, float2 u) {
     ScatterEvent event;
     event.Position = float3(0.0f, 0.0f, 0.0f);
     event.Normal = float3(0.0f, 0.0f, 0.0f);
@@ -91,7 +146,8 @@ ScatterEvent RayMarching(Ray ray, VolumeDesc desc, inout CRNG rng) {
     event.Roughness = 0.0f;
     event.IsValid = false;
       
-    Intersection intersect = IntersectAABB(ray, desc.BoundingBox);
+    Intersection intersect = IntersectAABB(ray, desc.ClipBox);
+    intersect = IntersectClipRegion(ray, intersect);
 	
     [branch]
     if (intersect.Max < intersect.Min)
@@ -100,20 +156,87 @@ ScatterEvent RayMarching(Ray ray, VolumeDesc desc, inout CRNG rng) {
     const float minT = max(intersect.Min, ray.Min);
     const float maxT = min(intersect.Max, ray.Max);
     
-    const float threshold = -log(Rand(rng)) / desc.DensityScale;
+    const float threshold = -log(1.0f - u.x) / desc.DensityScale;
 	
     float sum = 0.0f;
-    float t = minT + Rand(rng) * desc.StepSize;
+    float t = minT + u.y * desc.StepSize;
+    float leafExit = -FLT_MAX;
+
+    float3 dimension;
+    TextureVolumeIntensity.GetDimensions(dimension.x, dimension.y, dimension.z);
+    const EmptySpaceRay skipRay = CreateEmptySpaceRay(ray, desc.BoundingBox, dimension);
+
     float3 position = float3(0.0, 0.0, 0.0f);
+    float intensity = 0.0f;
+
+    // the pre-integrated segments run between the jittered samples, the first one from the entry of the interval
+    float tFront = minT;
+    [branch]
+    if (FrameBuffer.IsPreIntegrationEnabled)
+        intensity = GetIntensity(desc, ray.Origin + tFront * ray.Direction);
     
     [loop]
     while (sum < threshold) {
+        [branch]
+        if (t >= maxT) {
+            // the last pre-integrated segment ends on the exit of the interval
+            [branch]
+            if (!FrameBuffer.IsPreIntegrationEnabled || tFront >= maxT)
+                return event;
+            t = maxT;
+        }
         position = ray.Origin + t * ray.Direction;
+
         [branch]
-        if (t >= maxT)
-            return event;
+        if (FrameBuffer.IsPreIntegrationEnabled) {
+            const float intensityBack = GetIntensity(desc, position);
+            const float depth = desc.DensityScale * GetSegmentOpacity(intensity, intensityBack) * (t - tFront);
+            // the free path ends inside the segment, its opacity is taken as constant along it
+            [branch]
+            if (sum + depth >= threshold) {
+                const float fraction = (threshold - sum) / max(depth, FLT_MIN);
+                position = ray.Origin + lerp(tFront, t, fraction) * ray.Direction;
+                intensity = lerp(intensity, intensityBack, fraction);
+                break;
+            }
+            sum += depth;
+            intensity = intensityBack;
+            tFront = t;
+        }
 
-        sum += desc.DensityScale * GetOpacity(desc, position) * desc.StepSize;
+        // samples inside an empty node add no opacity, resume on the step grid past its exit
+        [branch]
+        if (FrameBuffer.IsEmptySpaceSkippingEnabled && t >= leafExit) {
+            const float tExit = GetEmptySpaceExit(TextureVolumeMinMax, TextureTransferFunctionOpacityRange, TextureVolumeLabelMask, TextureTransferFunctionLabelOpacityRange,
+                                                  FrameBuffer.IsLabelEnabled, FrameBuffer.LabelVisibilityMask, skipRay, t, leafExit);
+            [branch]
+            if (tExit > t) {
+                t = max(minT + (ceil((tExit - minT) / desc.StepSize - u.y) + u.y) * desc.StepSize, t + desc.StepSize);
+                // the next segment starts on the exit of the node
+                [branch]
+                if (FrameBuffer.IsPreIntegrationEnabled) {
+                    tFront = tExit;
+                    intensity = GetIntensity(desc, ray.Origin + tExit * ray.Direction);
+                }
+                continue;
+            }
+        }
+
+        [branch]
+        if (!FrameBuffer.IsPreIntegrationEnabled) {
+            intensity = GetIntensity(desc, position);
+            // the gradient is only fetched for a 2D opacity, a hidden label adds no opacity
+            float opacity = 0.0f;
+            [branch]
+            if (FrameBuffer.IsLabelEnabled) {
+                const uint label = GetLabel(desc, position);
+                opacity = IsLabelVisible(label) ? GetLabelOpacity(intensity, label) : 0.0f;
+            } else if (FrameBuffer.IsOpacity2DEnabled)
+                opacity = GetOpacity2D(intensity, GetGradient(desc, position).a);
+            else
+                opacity = GetOpacity(intensity);
+            sum += desc.DensityScale * opacity * desc.StepSize;
+        }
         t += desc.StepSize;
     }
    
@@ -123,17 +246,18 @@ ScatterEvent RayMarching(Ray ray, VolumeDesc desc, inout CRNG rng) {
     if (gradient.a < FLT_EPSILON) 
         return event;
     
-    const float3 diffuse = GetDiffuse(desc, position);
-    const float3 specular = GetSpecular(desc, position);
-    const float roughness = GetRoughness(desc, position);
+    // the scatter event is the last step of the march, its intensity is reused for the material
+    const uint label = FrameBuffer.IsLabelEnabled ? GetLabel(desc, position) : 0;
+    const float4 diffuseOpacity = GetDiffuseOpacity(intensity, label);
+    const float4 specularRoughness = GetSpecularRoughness(intensity, label);
     
     event.IsValid = true;
     event.Normal = -normalize(gradient.xyz);
     event.Normal = dot(event.Normal, -ray.Direction) < 0.0f ? -event.Normal : event.Normal;
     event.Position = position + 0.001 * event.Normal; 
-    event.Diffuse = diffuse;
-    event.Specular = specular;
-    event.Roughness = roughness;
+    event.Diffuse = diffuseOpacity.rgb;
+    event.Specular = specularRoughness.rgb;
+    event.Roughness = specularRoughness.a;
     return event;
 }
 
@@ -141,16 +265,18 @@ ScatterEvent RayMarching(Ray ray, VolumeDesc desc, inout CRNG rng) {
 void GenerateRays(uint3 thredID: SV_GroupThreadID, uint3 groupID: SV_GroupID) {
     uint2 id = GetThreadIDFromTileList(BufferDispersionTiles, groupID.x, thredID.xy);
     
-    CRNG rng = InitCRND(id, FrameBuffer.FrameIndex);
+    Sampler samples = InitSampler(id, FrameBuffer.SampleOffset + FrameBuffer.FrameIndex);
     Ray ray = CreateCameraRay(id, FrameBuffer.FrameOffset, FrameBuffer.InvRenderTargetDim, FrameBuffer.InvWorldViewProjectionMatrix);
  	
     VolumeDesc desc;
     desc.BoundingBox.Min = FrameBuffer.BoundingBoxMin;
     desc.BoundingBox.Max = FrameBuffer.BoundingBoxMax;
+    desc.ClipBox.Min = FrameBuffer.ClipBoxMin;
+    desc.ClipBox.Max = FrameBuffer.ClipBoxMax;
     desc.StepSize = FrameBuffer.StepSize;
     desc.DensityScale = FrameBuffer.Density;
        
-    ScatterEvent event = RayMarching(ray, desc, rng);
+    ScatterEvent event = RayMarching(ray, desc, float2(Sample1D(samples, SAMPLER_DIMENSION_CAMERA_DISTANCE), Sample1D(samples, SAMPLER_DIMENSION_CAMERA_JITTER)));
     if (event.IsValid) {
         float3 normal = { 0.0f, 0.0f, 0.0f };
         float4 position = { 0.0f, 0.0f, 0.0f, 0.0f };
@@ -13,4 +13,69 @@ float Mip(uint3 position) {
 [numthreads(4, 4, 4)]
 void GenerateMipLevel(uint3 thredID: SV_DispatchThreadID, uint lineID: SV_GroupIndex) {
     TextureDst[thredID] = Mip(thredID);
-}
\ No newline at end of file
+}
+
+static const uint MINMAX_CELL_SIZE = 4;
+
+Texture3D<float2>   TextureMinMaxSrc: register(t1);
+RWTexture3D<float2> TextureMinMaxDst: register(u1);
+
+// the node covers the voxels [x, x + MINMAX_CELL_SIZE] inclusive, the last one is shared with the next node through trilinear filtering
+[numthreads(4, 4, 4)]
+void GenerateMinMaxBase(uint3 thredID: SV_DispatchThreadID) {
+    int3 dimension;
+    TextureSrc.GetDimensions(dimension.x, dimension.y, dimension.z);
+
+    float2 range = float2(1.0f, 0.0f);
+    for (uint z = 0; z <= MINMAX_CELL_SIZE; z++) {
+        for (uint y = 0; y <= MINMAX_CELL_SIZE; y++) {
+            for (uint x = 0; x <= MINMAX_CELL_SIZE; x++) {
+                const int3 voxel = min(int3(thredID * MINMAX_CELL_SIZE + uint3(x, y, z)), dimension - 1);
+                const float intensity = TextureSrc.Load(int4(voxel, 0));
+                range = float2(min(range.x, intensity), max(range.y, intensity));
+            }
+        }
+    }
+    TextureMinMaxDst[thredID] = range;
+}
+
+[numthreads(4, 4, 4)]
+void GenerateMinMaxLevel(uint3 thredID: SV_DispatchThreadID) {
+    float2 range = float2(1.0f, 0.0f);
+    for (uint index = 0; index < 8; index++) {
+        const float2 child = TextureMinMaxSrc.Load(int4(2 * thredID + uint3(index & 1, (index >> 1) & 1, index >> 2), 0));
+        range = float2(min(range.x, child.x), max(range.y, child.y));
+    }
+    TextureMinMaxDst[thredID] = range;
+}
+
+
+Texture3D<uint>   TextureLabelSrc: register(t2);
+Texture3D<uint>   TextureLabelMaskSrc: register(t3);
+RWTexture3D<uint> TextureLabelMaskDst: register(u2);
+
+// bit l is set when label l occurs in the same voxels as the min / max of the node, labels are point sampled
+[numthreads(4, 4, 4)]
+void GenerateLabelMaskBase(uint3 thredID: SV_DispatchThreadID) {
+    int3 dimension;
+    TextureLabelSrc.GetDimensions(dimension.x, dimension.y, dimension.z);
+
+    uint mask = 0;
+    for (uint z = 0; z <= MINMAX_CELL_SIZE; z++) {
+        for (uint y = 0; y <= MINMAX_CELL_SIZE; y++) {
+            for (uint x = 0; x <= MINMAX_CELL_SIZE; x++) {
+                const int3 voxel = min(int3(thredID * MINMAX_CELL_SIZE + uint3(x, y, z)), dimension - 1);
+                mask |= 1u << TextureLabelSrc.Load(int4(voxel, 0));
+            }
+        }
+    }
+    TextureLabelMaskDst[thredID] = mask;
+}
+
+[numthreads(4, 4, 4)]
+void GenerateLabelMaskLevel(uint3 thredID: SV_DispatchThreadID) {
+    uint mask = 0;
+    for (uint index = 0; index < 8; index++)
+        mask |= TextureLabelMaskSrc.Load(int4(2 * thredID + uint3(index & 1, (index >> 1) & 1, index >> 2), 0));
+    TextureLabelMaskDst[thredID] = mask;
+}
@@ -0,0 +1,65 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2021 Mikhail Gorobets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright noticeand this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "Common.hlsl"
+
+#define WAVEFRONT_SIZE (THREAD_GROUP_SIZE_X) * (THREAD_GROUP_SIZE_Y)
+
+Texture2D<float4> TextureReferenceSRV: register(t0);
+Texture2D<float4> TextureFilteredSRV: register(t1);
+Texture2D<float4> TextureUnfilteredSRV: register(t2);
+RWStructuredBuffer<float2> BufferErrorUAV: register(u0);
+
+groupshared float2 SharedBuffer[WAVEFRONT_SIZE];
+
+float Luminance(float3 color) {
+    return dot(float3(0.2126, 0.7152, 0.0722), color);
+}
+
+float RelativeSquaredError(float value, float reference) {
+    const float error = value - reference;
+    return min(error * error / (reference * reference + 1.0e-2f), 1.0f);
+}
+
+// Per thread group sums of the relative squared luminance error of the filtered and unfiltered images against a reference
+[numthreads(THREAD_GROUP_SIZE_X, THREAD_GROUP_SIZE_Y, 1)]
+void ComputeError(uint3 thredID: SV_DispatchThreadID, uint lineID: SV_GroupIndex, uint3 groupID: SV_GroupID) {
+    const float reference = Luminance(TextureReferenceSRV[thredID.xy].xyz);
+    SharedBuffer[lineID] = float2(
+        RelativeSquaredError(Luminance(TextureFilteredSRV[thredID.xy].xyz), reference),
+        RelativeSquaredError(Luminance(TextureUnfilteredSRV[thredID.xy].xyz), reference));
+    GroupMemoryBarrierWithGroupSync();
+
+    [unroll]
+    for (uint stride = WAVEFRONT_SIZE / 2; stride > 0; stride = stride >> 1) {
+        if (lineID < stride)
+            SharedBuffer[lineID] += SharedBuffer[lineID + stride];
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    const uint2 dimension = uint2(ceil(FrameBuffer.RenderTargetDim / float2(THREAD_GROUP_SIZE_X, THREAD_GROUP_SIZE_Y)));
+    if (lineID == 0)
+        BufferErrorUAV[groupID.y * dimension.x + groupID.x] = SharedBuffer[0];
+}
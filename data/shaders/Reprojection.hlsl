@@ -0,0 +1,103 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2021 Mikhail Gorobets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright noticeand this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "Common.hlsl"
+
+Texture2D<float4>   TextureColorSumHistory: register(t0);
+Texture2D<float4>   TextureNormalHistory: register(t1);
+Texture2D<float>    TextureDepthHistory: register(t2);
+Texture2D<float4>   TextureNormal: register(t3);
+Texture2D<float>    TextureDepth: register(t4);
+StructuredBuffer<uint> BufferDispersionTiles: register(t5);
+RWTexture2D<float4> TextureColorSumUAV: register(u0);
+
+static const float DepthSigma = 0.01f;
+static const float NormalThreshold = 0.8f;
+static const float MaxHistorySamples = 32.0f;
+
+float HistoryConfidence(float depth, float3 normal, float depthHistory, float3 normalHistory) {
+    [branch]
+    if (!any(normalHistory))
+        return 0.0f;
+    const float weightDepth = exp(-abs(depth - depthHistory) / DepthSigma);
+    const float weightNormal = saturate((dot(normal, normalHistory) - NormalThreshold) / (1.0f - NormalThreshold));
+    return weightDepth * weightNormal;
+}
+
+// Warps the accumulation of the previous view into the current one. The current scatter position is projected with the
+// previous view-projection, history taps that fail the depth and normal tests are rejected as disoccluded and
+// the surviving sample count is scaled by the confidence before it seeds the accumulation.
+[numthreads(THREAD_GROUP_SIZE_X, THREAD_GROUP_SIZE_Y, 1)]
+void Reproject(uint3 thredID: SV_GroupThreadID, uint3 groupID: SV_GroupID) {
+    uint2 id = GetThreadIDFromTileList(BufferDispersionTiles, groupID.x, thredID.xy);
+
+    const float3 normal = TextureNormal[id].xyz;
+    float4 result = float4(0.0f, 0.0f, 0.0f, 0.0f);
+
+    [branch]
+    if (any(normal)) {
+        float2 ncdXY = 2.0f * (id + FrameBuffer.FrameOffset) * FrameBuffer.InvRenderTargetDim - 1.0f;
+        ncdXY.y *= -1.0f;
+
+        float4 position = mul(FrameBuffer.InvWorldViewProjectionMatrix, float4(ncdXY, TextureDepth[id], 1.0f));
+        position /= position.w;
+
+        float4 positionHistory = mul(FrameBuffer.PrevWorldViewProjectionMatrix, float4(position.xyz, 1.0f));
+        positionHistory /= positionHistory.w;
+
+        const float2 pixelHistory = (float2(positionHistory.x, -positionHistory.y) * 0.5f + 0.5f) * FrameBuffer.RenderTargetDim;
+        const int2 base = int2(floor(pixelHistory));
+        const float2 fraction = pixelHistory - base;
+        const int2 maxID = int2(FrameBuffer.RenderTargetDim) - 1;
+
+        float3 colorSum = float3(0.0f, 0.0f, 0.0f);
+        float  countSum = 0.0f;
+        float  weightSum = 0.0f;
+
+        [unroll]
+        for (int y = 0; y <= 1; y++) {
+            [unroll]
+            for (int x = 0; x <= 1; x++) {
+                const int2 tapID = base + int2(x, y);
+                [branch]
+                if (any(tapID < int2(0, 0)) || any(tapID > maxID))
+                    continue;
+
+                const float weightBilinear = (x ? fraction.x : 1.0f - fraction.x) * (y ? fraction.y : 1.0f - fraction.y);
+                const float weight = weightBilinear * HistoryConfidence(positionHistory.z, normal, TextureDepthHistory[tapID], TextureNormalHistory[tapID].xyz);
+                const float4 history = TextureColorSumHistory[tapID];
+
+                colorSum += weight * history.xyz;
+                countSum += weight * min(history.a, MaxHistorySamples);
+                weightSum += weight;
+            }
+        }
+
+        [branch]
+        if (weightSum > FLT_EPSILON)
+            result = float4(colorSum / weightSum, countSum);
+    }
+    TextureColorSumUAV[id] = result;
+}
@@ -0,0 +1,139 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2021 Mikhail Gorobets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright noticeand this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+// Requires Common.hlsl, mirrored on the CPU by src/volume/MCSampler.h
+#define SAMPLER_WHITE_NOISE      0
+#define SAMPLER_SOBOL_SCRAMBLED  1
+#define SAMPLER_SOBOL_OWEN       2
+#define SAMPLER_BLUE_NOISE_RANK1 3
+
+#ifndef SAMPLER_TYPE
+#define SAMPLER_TYPE SAMPLER_SOBOL_OWEN
+#endif
+
+// Fixed dimension layout, a decision draws from the same dimension whichever branch the path took before it
+static const uint SAMPLER_DIMENSION_CAMERA_DISTANCE = 0;
+static const uint SAMPLER_DIMENSION_CAMERA_JITTER = 1;
+static const uint SAMPLER_DIMENSION_BOUNCE = 2;
+
+// offsets inside the dimensions of a bounce, the 2D ones consume a single dimension index
+static const uint SAMPLER_DIMENSION_LOBE = 0;
+static const uint SAMPLER_DIMENSION_MICROFACET = 1;
+static const uint SAMPLER_DIMENSION_STRATEGY = 2;
+static const uint SAMPLER_DIMENSION_DIFFUSE = 3;
+static const uint SAMPLER_DIMENSION_ENVIRONMENT_TEXEL = 4;
+static const uint SAMPLER_DIMENSION_ENVIRONMENT_JITTER = 5;
+static const uint SAMPLER_DIMENSION_DISTANCE = 6;
+static const uint SAMPLER_DIMENSION_JITTER = 7;
+static const uint SAMPLER_DIMENSION_ROULETTE = 8;
+static const uint SAMPLER_DIMENSIONS_PER_BOUNCE = 9;
+
+// R2 / golden ratio generators of the rank-1 lattices in 0.32 fixed point
+static const uint SAMPLER_RANK1_ALPHA_1D = 2654435769u;
+static const uint2 SAMPLER_RANK1_ALPHA_2D = uint2(3242174890u, 2447445414u);
+
+struct Sampler {
+    uint2 Pixel;
+    uint  Index;
+    uint  Seed;
+};
+
+uint HashCombine(uint seed, uint value) {
+    return Hash(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+uint LaineKarrasPermutation(uint x, uint seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// Owen scrambling with a hash [Burley 2020], also used to shuffle the sample index per dimension
+uint NestedUniformScramble(uint x, uint seed) {
+    return reversebits(LaineKarrasPermutation(reversebits(x), seed));
+}
+
+uint SobolSecondDimension(uint index) {
+    uint result = 0;
+    [loop]
+    for (uint v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if (index & 1)
+            result ^= v;
+    }
+    return result;
+}
+
+float ToUnitFloat(uint x) {
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+Sampler InitSampler(uint2 id, uint sampleIndex) {
+    Sampler samples;
+    samples.Pixel = id;
+    samples.Index = sampleIndex;
+    samples.Seed = Hash((id.x << 16) | id.y);
+    return samples;
+}
+
+uint GetBounceDimension(uint bounce, uint offset) {
+    return SAMPLER_DIMENSION_BOUNCE + bounce * SAMPLER_DIMENSIONS_PER_BOUNCE + offset;
+}
+
+float Sample1D(Sampler samples, uint dimension) {
+    const uint seed = HashCombine(samples.Seed, dimension);
+#if SAMPLER_TYPE == SAMPLER_WHITE_NOISE
+    return ToUnitFloat(HashCombine(seed, samples.Index));
+#elif SAMPLER_TYPE == SAMPLER_SOBOL_SCRAMBLED
+    return ToUnitFloat(reversebits(NestedUniformScramble(samples.Index, seed)) ^ Hash(seed ^ 1u));
+#elif SAMPLER_TYPE == SAMPLER_SOBOL_OWEN
+    return ToUnitFloat(NestedUniformScramble(reversebits(NestedUniformScramble(samples.Index, seed)), Hash(seed ^ 1u)));
+#else
+    // the R2 dither of the pixel is a blue-noise Cranley-Patterson rotation, the hash decorrelates the dimensions
+    const uint dither = samples.Pixel.x * SAMPLER_RANK1_ALPHA_2D.x + samples.Pixel.y * SAMPLER_RANK1_ALPHA_2D.y;
+    return ToUnitFloat(dither + Hash(seed ^ 1u) + samples.Index * SAMPLER_RANK1_ALPHA_1D);
+#endif
+}
+
+float2 Sample2D(Sampler samples, uint dimension) {
+    const uint seed = HashCombine(samples.Seed, dimension);
+#if SAMPLER_TYPE == SAMPLER_WHITE_NOISE
+    const uint x = HashCombine(seed, samples.Index);
+    return float2(ToUnitFloat(x), ToUnitFloat(Hash(x)));
+#elif SAMPLER_TYPE == SAMPLER_SOBOL_SCRAMBLED
+    const uint index = NestedUniformScramble(samples.Index, seed);
+    return float2(ToUnitFloat(reversebits(index) ^ Hash(seed ^ 1u)), ToUnitFloat(SobolSecondDimension(index) ^ Hash(seed ^ 2u)));
+#elif SAMPLER_TYPE == SAMPLER_SOBOL_OWEN
+    const uint index = NestedUniformScramble(samples.Index, seed);
+    return float2(ToUnitFloat(NestedUniformScramble(reversebits(index), Hash(seed ^ 1u))), ToUnitFloat(NestedUniformScramble(SobolSecondDimension(index), Hash(seed ^ 2u))));
+#else
+    const uint dither = samples.Pixel.x * SAMPLER_RANK1_ALPHA_2D.x + samples.Pixel.y * SAMPLER_RANK1_ALPHA_2D.y;
+    const uint2 offset = dither + uint2(Hash(seed ^ 1u), Hash(seed ^ 2u));
+    const uint2 bits = offset + samples.Index * SAMPLER_RANK1_ALPHA_2D;
+    return float2(ToUnitFloat(bits.x), ToUnitFloat(bits.y));
+#endif
+}
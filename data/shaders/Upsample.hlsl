@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ *
+ * Copyright(c) 2021 Mikhail Gorobets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this softwareand associated documentation files(the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions :
+ *
+ * The above copyright noticeand this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "Common.hlsl"
+
+Texture2D<float4>   TextureColorSRV: register(t0);
+Texture2D<float4>   TextureNormalSRV: register(t1);
+Texture2D<float>    TextureDepthSRV: register(t2);
+RWTexture2D<float4> TextureColorUAV: register(u0);
+
+static const float DepthSigma = 0.02f;
+static const float NormalPower = 8.0f;
+
+float GeometryWeight(float depth, float3 normal, float depthRef, float3 normalRef) {
+    const bool isHit = any(normal);
+    const bool isHitRef = any(normalRef);
+    [branch]
+    if (isHit != isHitRef)
+        return 0.0f;
+    [branch]
+    if (!isHit)
+        return 1.0f;
+    const float weightDepth = exp(-abs(depth - depthRef) / DepthSigma);
+    const float weightNormal = pow(saturate(dot(normal, normalRef)), NormalPower);
+    return weightDepth * weightNormal;
+}
+
+// Joint bilateral upsampling of the low resolution image rendered in interactive mode.
+// The nearest low resolution sample is the reference, the remaining bilinear taps are rejected across depth and normal edges.
+[numthreads(THREAD_GROUP_SIZE_X, THREAD_GROUP_SIZE_Y, 1)]
+void Upsample(uint3 thredID: SV_DispatchThreadID) {
+    const float2 position = (thredID.xy + 0.5f) / FrameBuffer.RenderScale - 0.5f;
+    const int2 maxID = int2(FrameBuffer.RenderTargetDim) - 1;
+    const int2 base = int2(floor(position));
+    const float2 fraction = position - base;
+
+    const int2 nearestID = clamp(int2(round(position)), int2(0, 0), maxID);
+    const float  depthRef = TextureDepthSRV[nearestID];
+    const float3 normalRef = TextureNormalSRV[nearestID].xyz;
+
+    float4 colorSum = float4(0.0f, 0.0f, 0.0f, 0.0f);
+    float  weightSum = 0.0f;
+
+    [unroll]
+    for (int y = 0; y <= 1; y++) {
+        [unroll]
+        for (int x = 0; x <= 1; x++) {
+            const int2 id = clamp(base + int2(x, y), int2(0, 0), maxID);
+            const float weightBilinear = (x ? fraction.x : 1.0f - fraction.x) * (y ? fraction.y : 1.0f - fraction.y);
+            const float weight = weightBilinear * GeometryWeight(TextureDepthSRV[id], TextureNormalSRV[id].xyz, depthRef, normalRef);
+            colorSum += weight * TextureColorSRV[id];
+            weightSum += weight;
+        }
+    }
+    TextureColorUAV[thredID.xy] = weightSum > FLT_EPSILON ? colorSum / weightSum : TextureColorSRV[nearestID];
+}
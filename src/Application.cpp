@@ -38,6 +38,8 @@ void Application::Initialize(HWND window, int width, int height)
 
     // initialize volume renderer
     m_volumeRenderer = std::make_unique<MCVolumeRenderer>(m_deviceResources);
+    if (m_distributedSettings.isEnabled())
+        m_volumeRenderer->initializeDistributed(m_distributedSettings);
 
     // TODO: Change the timer settings if you want something other than the default variable timestep mode.
     // e.g. for 60 FPS fixed timestep update logic, call:
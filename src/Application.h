@@ -47,6 +47,9 @@ public:
     // Properties
     void GetDefaultSize( int& width, int& height ) const noexcept;
 
+    // must be set before Initialize
+    void SetDistributedSettings(MCDistributedSettings const& settings) noexcept { m_distributedSettings = settings; }
+
 private:
 
     void Update(DX::StepTimer const& timer);
@@ -67,4 +70,7 @@ private:
 
     // Mouse
     std::unique_ptr<DirectX::Mouse> m_mouse;
+
+    // sample streams shared with other local processes
+    MCDistributedSettings m_distributedSettings;
 };
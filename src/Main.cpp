@@ -4,6 +4,11 @@
 
 #include "pch.h"
 #include "Application.h"
+#include "volume/MCSampler.h"
+#include "volume/MCSortLast.h"
+#include "volume/MCTransferFunction.h"
+#include "fmt/format.h"
+#include <filesystem>
 
 using namespace DirectX;
 
@@ -35,7 +40,41 @@ extern "C"
 int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR lpCmdLine, _In_ int nCmdShow)
 {
     UNREFERENCED_PARAMETER(hPrevInstance);
-    UNREFERENCED_PARAMETER(lpCmdLine);
+
+    // offline comparison of the sample sequences selectable with SAMPLER_TYPE, reported on the debug output
+    if (lpCmdLine && wcsstr(lpCmdLine, L"-benchmark-sampler")) {
+        MCSamplerBenchmark benchmark(64, 64, 0.01f, 4096);
+        for (auto const& result : benchmark.runAll())
+            OutputDebugStringA(fmt::format("{}: {} samples to reach relative RMSE {:.4f}\n", MCSampler::getName(result.Type), result.SampleCount, result.RMSE).c_str());
+        return 0;
+    }
+
+    if (lpCmdLine && wcsstr(lpCmdLine, L"-benchmark-transfer-function")) {
+        MCTransferFunctionBenchmark benchmark(1 << 22);
+        for (auto const& result : benchmark.runAll())
+            OutputDebugStringA(fmt::format("{} nodes: linear {:.2f} ns, binary search {:.2f} ns, table {:.2f} ns, batch {:.2f} ns, table error {:.2e}\n", result.NodeCount, result.LinearTime, result.BinarySearchTime, result.TableTime, result.BatchTime, result.TableError).c_str());
+        return 0;
+    }
+
+    // compiles every JSON preset next to the default one into a .mctf with its tables baked at the largest sampling
+    if (lpCmdLine && wcsstr(lpCmdLine, L"-convert-transfer-functions")) {
+        for (auto const& entry : std::filesystem::directory_iterator("data/config")) {
+            if (entry.path().extension() != ".json")
+                continue;
+            try {
+                const std::string fileName = MCTransferFunction::convert(entry.path().string(), 4096);
+                OutputDebugStringA(fmt::format("{} -> {}\n", entry.path().string(), fileName).c_str());
+            } catch (std::exception const& e) {
+                OutputDebugStringA(fmt::format("{}: {}\n", entry.path().string(), e.what()).c_str());
+            }
+        }
+        return 0;
+    }
+
+    // a sort-last rank renders its slab of the volume on the CPU for the rank that spawned it, it never opens a window
+    const MCDistributedSettings distributedSettings = MCDistributedSettings::parse(lpCmdLine);
+    if (distributedSettings.IsSortLastRank)
+        return MCSortLastNode::runRank(distributedSettings);
 
     if (!XMVerifyCPUSupport())
         return 1;
@@ -45,6 +84,7 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         return 1;
 
     m_app = std::make_unique<Application>();
+    m_app->SetDistributedSettings(distributedSettings);
 
     // Register class and create window
     {
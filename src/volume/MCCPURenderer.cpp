@@ -0,0 +1,733 @@
+#include "pch.h"
+#include "MCCPURenderer.h"
+#include "fmt/format.h"
+#include <chrono>
+#include <limits>
+
+namespace {
+    constexpr F32 FltEpsilon = std::numeric_limits<F32>::epsilon();
+    constexpr F32 FltMax = std::numeric_limits<F32>::max();
+
+    // size of the data cache of the first core at the given level
+    auto GetCacheSize(uint32_t level, size_t fallback) -> size_t {
+        DWORD length = 0;
+        GetLogicalProcessorInformation(nullptr, &length);
+        std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+        if (!std::empty(infos) && GetLogicalProcessorInformation(infos.data(), &length)) {
+            for (auto const& info : infos) {
+                if (info.Relationship == RelationCache && info.Cache.Level == level && info.Cache.Type != CacheInstruction)
+                    return info.Cache.Size;
+            }
+        }
+        return fallback;
+    }
+
+    // interleaves the lower 10 bits of x, y and z
+    auto MortonEncode(uint32_t x, uint32_t y, uint32_t z) -> uint32_t {
+        auto expandBits = [](uint32_t v) -> uint32_t {
+            v = (v * 0x00010001u) & 0xFF0000FFu;
+            v = (v * 0x00000101u) & 0x0F00F00Fu;
+            v = (v * 0x00000011u) & 0xC30C30C3u;
+            v = (v * 0x00000005u) & 0x49249249u;
+            return v;
+        };
+        return (expandBits(z & 0x3FF) << 2) | (expandBits(y & 0x3FF) << 1) | expandBits(x & 0x3FF);
+    }
+
+    auto GetTangentSpace(Hawk::Math::Vec3 const& normal, Hawk::Math::Vec3 const& v) -> Hawk::Math::Vec3 {
+        const Hawk::Math::Vec3 helper = std::abs(normal.x) > 0.999f ? Hawk::Math::Vec3(0.0f, 0.0f, 1.0f) : Hawk::Math::Vec3(1.0f, 0.0f, 0.0f);
+        const Hawk::Math::Vec3 tangent = Hawk::Math::Normalize(Hawk::Math::Cross(normal, helper));
+        const Hawk::Math::Vec3 binormal = Hawk::Math::Normalize(Hawk::Math::Cross(normal, tangent));
+        return v.x * tangent + v.y * binormal + v.z * normal;
+    }
+
+    auto FresnelSchlick(Hawk::Math::Vec3 const& F0, F32 VdotH) -> Hawk::Math::Vec3 {
+        return F0 + (Hawk::Math::Vec3(1.0f) - F0) * std::pow(1.0f - VdotH, 5.0f);
+    }
+
+    auto GGX_PartialGeometry(F32 NdotX, F32 alpha) -> F32 {
+        const F32 aa = alpha * alpha;
+        return 2.0f * NdotX / (std::max)((NdotX + std::sqrt(aa + (1.0f - aa) * (NdotX * NdotX))), FltEpsilon);
+    }
+
+    auto GGX_SampleHemisphere(Hawk::Math::Vec3 const& normal, F32 alpha, Hawk::Math::Vec2 const& e) -> Hawk::Math::Vec3 {
+        const F32 phi = 2.0f * Hawk::Math::PI<F32> * e.x;
+        const F32 cosTheta = std::sqrt((std::max)(0.0f, (1.0f - e.y) / (1.0f + alpha * alpha * e.y - e.y)));
+        const F32 sinTheta = std::sqrt((std::max)(0.0f, 1.0f - cosTheta * cosTheta));
+        return GetTangentSpace(normal, Hawk::Math::Vec3(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta));
+    }
+
+    auto Saturate(F32 x) -> F32 {
+        return Hawk::Math::Clamp(x, 0.0f, 1.0f);
+    }
+
+    auto GetPlacementName(MCVolumePlacement placement) -> char const* {
+        switch (placement) {
+            case MCVolumePlacement::FirstTouch:  return "first touch";
+            case MCVolumePlacement::Interleaved: return "interleaved";
+            case MCVolumePlacement::Replicated:  return "replicated";
+        }
+        return "";
+    }
+}
+
+auto MCCPURayQueue::reserve(size_t capacity) -> void {
+    for (auto pArray : { &OriginX, &OriginY, &OriginZ, &DirectionX, &DirectionY, &DirectionZ, &ThroughputR, &ThroughputG, &ThroughputB, &MaxT })
+        pArray->resize(capacity);
+    PixelIndex.resize(capacity);
+    Count = 0;
+}
+
+auto MCCPURayQueue::push(Hawk::Math::Vec3 const& origin, Hawk::Math::Vec3 const& direction, Hawk::Math::Vec3 const& throughput, F32 maxT, uint32_t pixelIndex) -> void {
+    OriginX[Count] = origin.x;
+    OriginY[Count] = origin.y;
+    OriginZ[Count] = origin.z;
+    DirectionX[Count] = direction.x;
+    DirectionY[Count] = direction.y;
+    DirectionZ[Count] = direction.z;
+    ThroughputR[Count] = throughput.x;
+    ThroughputG[Count] = throughput.y;
+    ThroughputB[Count] = throughput.z;
+    MaxT[Count] = maxT;
+    PixelIndex[Count] = pixelIndex;
+    Count++;
+}
+
+auto MCCPURayQueue::getOrigin(size_t index) const -> Hawk::Math::Vec3 {
+    return Hawk::Math::Vec3(OriginX[index], OriginY[index], OriginZ[index]);
+}
+
+auto MCCPURayQueue::getDirection(size_t index) const -> Hawk::Math::Vec3 {
+    return Hawk::Math::Vec3(DirectionX[index], DirectionY[index], DirectionZ[index]);
+}
+
+auto MCCPURayQueue::getThroughput(size_t index) const -> Hawk::Math::Vec3 {
+    return Hawk::Math::Vec3(ThroughputR[index], ThroughputG[index], ThroughputB[index]);
+}
+
+auto MCCPURayQueue::setOrigin(size_t index, Hawk::Math::Vec3 const& origin) -> void {
+    OriginX[index] = origin.x;
+    OriginY[index] = origin.y;
+    OriginZ[index] = origin.z;
+}
+
+auto MCCPURayQueue::gather(MCCPURayQueue const& source, std::vector<uint32_t> const& indices) -> void {
+    for (size_t index = 0; index < source.Count; index++) {
+        const uint32_t sourceIndex = indices[index];
+        OriginX[index] = source.OriginX[sourceIndex];
+        OriginY[index] = source.OriginY[sourceIndex];
+        OriginZ[index] = source.OriginZ[sourceIndex];
+        DirectionX[index] = source.DirectionX[sourceIndex];
+        DirectionY[index] = source.DirectionY[sourceIndex];
+        DirectionZ[index] = source.DirectionZ[sourceIndex];
+        ThroughputR[index] = source.ThroughputR[sourceIndex];
+        ThroughputG[index] = source.ThroughputG[sourceIndex];
+        ThroughputB[index] = source.ThroughputB[sourceIndex];
+        MaxT[index] = source.MaxT[sourceIndex];
+        PixelIndex[index] = source.PixelIndex[sourceIndex];
+    }
+    Count = source.Count;
+}
+
+auto MCCPURayQueue::compact(std::vector<uint8_t> const& isAlive) -> void {
+    size_t countAlive = 0;
+    for (size_t index = 0; index < Count; index++) {
+        if (!isAlive[index])
+            continue;
+        if (countAlive != index) {
+            for (auto pArray : { &OriginX, &OriginY, &OriginZ, &DirectionX, &DirectionY, &DirectionZ, &ThroughputR, &ThroughputG, &ThroughputB, &MaxT })
+                (*pArray)[countAlive] = (*pArray)[index];
+            PixelIndex[countAlive] = PixelIndex[index];
+        }
+        countAlive++;
+    }
+    Count = countAlive;
+}
+
+auto MCCPUCacheModel::reset(size_t cacheSize, size_t lineSize, size_t associativity) -> void {
+    LineSize = lineSize;
+    Associativity = associativity;
+    SetCount = (std::max)(cacheSize / (lineSize * associativity), size_t(1));
+    Tags.assign(SetCount * Associativity, std::numeric_limits<uint64_t>::max());
+    AccessCount = 0;
+    MissCount = 0;
+}
+
+auto MCCPUCacheModel::access(size_t address) -> void {
+    const uint64_t line = address / LineSize;
+    const auto setBegin = std::begin(Tags) + (line % SetCount) * Associativity;
+    const auto setEnd = setBegin + Associativity;
+
+    // the ways of a set are kept in most recently used order
+    auto way = std::find(setBegin, setEnd, line);
+    if (way == setEnd) {
+        MissCount++;
+        way = setEnd - 1;
+        *way = line;
+    }
+    std::rotate(setBegin, way, way + 1);
+    AccessCount++;
+}
+
+auto MCCPUTransferFunctionLUTs::create(MCTransferFunction const& transferFunctions, uint32_t samplingCount) -> std::shared_ptr<MCCPUTransferFunctionLUTs const> {
+    // the march reads only the opacity, a scatter event reads the whole material texel
+    auto pLUTs = std::make_shared<MCCPUTransferFunctionLUTs>();
+    pLUTs->Opacity.resize(samplingCount);
+    transferFunctions.opacityTF.EvaluateBatch(GenerateSampling(samplingCount), pLUTs->Opacity);
+    pLUTs->Material = transferFunctions.generateMaterialTable(samplingCount);
+    pLUTs->PreIntegration = transferFunctions.opacityTF.GeneratePreIntegrationTable(samplingCount, pLUTs->PreIntegrationSampling);
+    return pLUTs;
+}
+
+MCCPURenderer::MCCPURenderer(uint16_t const* pIntensity, uint32_t dimensionX, uint32_t dimensionY, uint32_t dimensionZ, MCTransferFunction& transferFunctions, uint32_t samplingCount)
+    : MCCPURenderer(pIntensity, dimensionX, dimensionY, dimensionZ, MCCPUTransferFunctionLUTs::create(transferFunctions, samplingCount)) {
+}
+
+MCCPURenderer::MCCPURenderer(uint16_t const* pIntensity, uint32_t dimensionX, uint32_t dimensionY, uint32_t dimensionZ, std::shared_ptr<MCCPUTransferFunctionLUTs const> pLUTs)
+    : m_pIntensity(pIntensity)
+    , m_DimensionX(dimensionX)
+    , m_DimensionY(dimensionY)
+    , m_DimensionZ(dimensionZ)
+    , m_SliceEnd(dimensionZ)
+    , m_pLUTs(std::move(pLUTs)) {
+
+    // both queues and the alive flags of a batch share the L2 cache
+    const size_t bytesPerRay = 2 * (10 * sizeof(F32) + sizeof(uint32_t)) + sizeof(uint8_t);
+    m_BatchSize = (std::max)(GetCacheSize(2, 1024 * 1024) / bytesPerRay, size_t(64));
+    m_PrimaryQueue.reserve(m_BatchSize);
+    m_SecondaryQueue.reserve(m_BatchSize);
+    m_SortedQueue.reserve(m_BatchSize);
+    m_IsAlive.resize(m_BatchSize);
+    m_SortKeys.resize(m_BatchSize);
+    m_SortIndices.resize(m_BatchSize);
+}
+
+auto MCCPURenderer::renderWavefront(MCCPUFrame const& frame, std::vector<Hawk::Math::Vec3>& colorSum) -> MCCPURenderStatistics {
+    return renderWavefrontRange(frame, 0, frame.Width * frame.Height, colorSum);
+}
+
+auto MCCPURenderer::renderWavefrontRange(MCCPUFrame const& frame, uint32_t pixelBegin, uint32_t pixelEnd, std::vector<Hawk::Math::Vec3>& colorSum) -> MCCPURenderStatistics {
+    MCCPURenderStatistics statistics = {};
+    const auto timeBegin = std::chrono::high_resolution_clock::now();
+    for (uint32_t batchBegin = pixelBegin; batchBegin < pixelEnd; batchBegin += static_cast<uint32_t>(m_BatchSize)) {
+        const uint32_t batchEnd = (std::min)(batchBegin + static_cast<uint32_t>(m_BatchSize), pixelEnd);
+        stageGenerate(frame, batchBegin, batchEnd);
+        statistics.PrimaryRayCount += m_PrimaryQueue.Count;
+        stageMarch(frame);
+        stageShade(frame);
+        statistics.SecondaryRayCount += m_SecondaryQueue.Count;
+
+        const auto timeSort = std::chrono::high_resolution_clock::now();
+        if (m_IsRaySortingEnabled)
+            stageSort(frame);
+
+        // only the fetches of the secondary rays go through the cache model
+        const auto timeShadowMarch = std::chrono::high_resolution_clock::now();
+        m_pCacheModel = m_IsCacheModelEnabled ? &m_CacheModel : nullptr;
+        stageShadowMarch(frame);
+        m_pCacheModel = nullptr;
+        statistics.SortTime += std::chrono::duration<F64, std::milli>(timeShadowMarch - timeSort).count();
+        statistics.ShadowMarchTime += std::chrono::duration<F64, std::milli>(std::chrono::high_resolution_clock::now() - timeShadowMarch).count();
+        stageAccumulate(colorSum);
+    }
+    statistics.ElapsedTime = std::chrono::duration<F64, std::milli>(std::chrono::high_resolution_clock::now() - timeBegin).count();
+    if (m_IsCacheModelEnabled) {
+        statistics.CacheAccessCount = m_CacheModel.AccessCount;
+        statistics.CacheMissCount = m_CacheModel.MissCount;
+    }
+    return statistics;
+}
+
+auto MCCPURenderer::renderMegakernel(MCCPUFrame const& frame, std::vector<Hawk::Math::Vec3>& colorSum) -> MCCPURenderStatistics {
+    MCCPURenderStatistics statistics = {};
+    const auto timeBegin = std::chrono::high_resolution_clock::now();
+    const uint32_t pixelCount = frame.Width * frame.Height;
+    for (uint32_t pixelIndex = 0; pixelIndex < pixelCount; pixelIndex++) {
+        Hawk::Math::Vec3 radiance;
+        if (tracePath(frame, pixelIndex, statistics, radiance))
+            colorSum[pixelIndex] += radiance;
+    }
+    statistics.ElapsedTime = std::chrono::duration<F64, std::milli>(std::chrono::high_resolution_clock::now() - timeBegin).count();
+    return statistics;
+}
+
+auto MCCPURenderer::renderPartial(MCCPUFrame const& frame, std::vector<Hawk::Math::Vec4>& colorSum, std::vector<Hawk::Math::Vec2>& depthRange) -> MCCPURenderStatistics {
+    MCCPURenderStatistics statistics = {};
+    const auto timeBegin = std::chrono::high_resolution_clock::now();
+    const uint32_t pixelCount = frame.Width * frame.Height;
+    for (uint32_t pixelIndex = 0; pixelIndex < pixelCount; pixelIndex++) {
+        Hawk::Math::Vec3 origin;
+        Hawk::Math::Vec3 direction;
+        F32 maxT = 0.0f;
+        F32 intersectMin = 0.0f;
+        F32 intersectMax = 0.0f;
+        generateCameraRay(frame, pixelIndex, origin, direction, maxT);
+        const bool isHit = intersectClipBox(frame, origin, direction, intersectMin, intersectMax) && intersectMax >= 0.0f;
+        depthRange[pixelIndex] = isHit ? Hawk::Math::Vec2((std::max)(intersectMin, 0.0f), (std::min)(intersectMax, maxT)) : Hawk::Math::Vec2(FltMax, -FltMax);
+
+        // the scattered rays hide what lies behind the box even when their shadow ray is blocked
+        Hawk::Math::Vec3 radiance;
+        if (tracePath(frame, pixelIndex, statistics, radiance))
+            colorSum[pixelIndex] += Hawk::Math::Vec4(radiance, 1.0f);
+    }
+    statistics.ElapsedTime = std::chrono::duration<F64, std::milli>(std::chrono::high_resolution_clock::now() - timeBegin).count();
+    return statistics;
+}
+
+auto MCCPURenderer::runBenchmark(MCCPUFrame frame, uint32_t sampleCount) -> std::string {
+    std::vector<Hawk::Math::Vec3> colorSumWavefront(size_t(frame.Width) * frame.Height, Hawk::Math::Vec3(0.0f));
+    std::vector<Hawk::Math::Vec3> colorSumMegakernel(size_t(frame.Width) * frame.Height, Hawk::Math::Vec3(0.0f));
+
+    MCCPURenderStatistics statisticsWavefront = {};
+    MCCPURenderStatistics statisticsMegakernel = {};
+    for (uint32_t sampleIndex = 0; sampleIndex < sampleCount; sampleIndex++) {
+        frame.SampleIndex = sampleIndex;
+        auto wavefront = renderWavefront(frame, colorSumWavefront);
+        auto megakernel = renderMegakernel(frame, colorSumMegakernel);
+        statisticsWavefront.PrimaryRayCount += wavefront.PrimaryRayCount;
+        statisticsWavefront.SecondaryRayCount += wavefront.SecondaryRayCount;
+        statisticsWavefront.ElapsedTime += wavefront.ElapsedTime;
+        statisticsMegakernel.PrimaryRayCount += megakernel.PrimaryRayCount;
+        statisticsMegakernel.SecondaryRayCount += megakernel.SecondaryRayCount;
+        statisticsMegakernel.ElapsedTime += megakernel.ElapsedTime;
+    }
+
+    // both paths draw the same sample dimensions, the images only differ by float rounding
+    F32 maximumDifference = 0.0f;
+    for (size_t index = 0; index < std::size(colorSumWavefront); index++) {
+        const Hawk::Math::Vec3 difference = Hawk::Math::Abs(colorSumWavefront[index] - colorSumMegakernel[index]) / static_cast<F32>(sampleCount);
+        maximumDifference = (std::max)({ maximumDifference, difference.x, difference.y, difference.z });
+    }
+
+    auto getThroughput = [](MCCPURenderStatistics const& statistics) -> F64 {
+        return (statistics.PrimaryRayCount + statistics.SecondaryRayCount) / (1000.0 * statistics.ElapsedTime);
+    };
+
+    return fmt::format("CPU renderer {}x{}, {} spp: wavefront {:.2f} Mrays/s (batch {} rays), megakernel {:.2f} Mrays/s, speedup {:.2f}x, max difference {:.2e}\n",
+        frame.Width, frame.Height, sampleCount, getThroughput(statisticsWavefront), m_BatchSize, getThroughput(statisticsMegakernel),
+        statisticsMegakernel.ElapsedTime / statisticsWavefront.ElapsedTime, maximumDifference);
+}
+
+auto MCCPURenderer::runSortingBenchmark(MCCPUFrame frame, uint32_t sampleCount) -> std::string {
+    std::vector<Hawk::Math::Vec3> colorSum(size_t(frame.Width) * frame.Height, Hawk::Math::Vec3(0.0f));
+    std::string message = fmt::format("CPU renderer {}x{}, {} spp, secondary ray sorting by {}^3 voxel bricks:\n", frame.Width, frame.Height, sampleCount, m_BrickSize);
+
+    const bool isRaySortingEnabled = m_IsRaySortingEnabled;
+    for (const bool isSorted : { false, true }) {
+        m_IsRaySortingEnabled = isSorted;
+
+        // timed without the cache model, then one more sample with it
+        MCCPURenderStatistics statistics = {};
+        for (uint32_t sampleIndex = 0; sampleIndex < sampleCount; sampleIndex++) {
+            frame.SampleIndex = sampleIndex;
+            auto sample = renderWavefront(frame, colorSum);
+            statistics.SecondaryRayCount += sample.SecondaryRayCount;
+            statistics.SortTime += sample.SortTime;
+            statistics.ShadowMarchTime += sample.ShadowMarchTime;
+        }
+
+        m_CacheModel.reset(GetCacheSize(1, 32 * 1024), 64, 8);
+        m_IsCacheModelEnabled = true;
+        const auto cache = renderWavefront(frame, colorSum);
+        m_IsCacheModelEnabled = false;
+
+        message += fmt::format("  {}: shadow march {:.2f} Mrays/s, sort {:.3f} ms, L1 miss rate {:.2f}%\n", isSorted ? "sorted" : "unsorted",
+            statistics.SecondaryRayCount / (1000.0 * statistics.ShadowMarchTime), statistics.SortTime,
+            cache.CacheAccessCount ? 100.0 * cache.CacheMissCount / cache.CacheAccessCount : 0.0);
+    }
+    m_IsRaySortingEnabled = isRaySortingEnabled;
+    return message;
+}
+
+auto MCCPURenderer::getSampler(MCCPUFrame const& frame, uint32_t pixelIndex) const -> MCSampler {
+    return MCSampler(MCSamplerType::SobolOwen, pixelIndex % frame.Width, pixelIndex / frame.Width, frame.SampleIndex);
+}
+
+auto MCCPURenderer::stageGenerate(MCCPUFrame const& frame, uint32_t pixelBegin, uint32_t pixelEnd) -> void {
+    m_PrimaryQueue.Count = 0;
+    for (uint32_t pixelIndex = pixelBegin; pixelIndex < pixelEnd; pixelIndex++) {
+        Hawk::Math::Vec3 origin;
+        Hawk::Math::Vec3 direction;
+        F32 maxT = 0.0f;
+        generateCameraRay(frame, pixelIndex, origin, direction, maxT);
+        m_PrimaryQueue.push(origin, direction, Hawk::Math::Vec3(1.0f), maxT, pixelIndex);
+    }
+}
+
+auto MCCPURenderer::stageMarch(MCCPUFrame const& frame) -> void {
+    for (size_t index = 0; index < m_PrimaryQueue.Count; index++) {
+        const MCSampler sampler = getSampler(frame, m_PrimaryQueue.PixelIndex[index]);
+        const Hawk::Math::Vec2 u = Hawk::Math::Vec2(sampler.get1D(MCSamplerDimension::CameraDistance), sampler.get1D(MCSamplerDimension::CameraJitter));
+
+        Hawk::Math::Vec3 position;
+        m_IsAlive[index] = rayMarching(frame, m_PrimaryQueue.getOrigin(index), m_PrimaryQueue.getDirection(index), m_PrimaryQueue.MaxT[index], u, position);
+        m_PrimaryQueue.setOrigin(index, position);
+    }
+    m_PrimaryQueue.compact(m_IsAlive);
+}
+
+auto MCCPURenderer::stageShade(MCCPUFrame const& frame) -> void {
+    m_SecondaryQueue.Count = 0;
+    for (size_t index = 0; index < m_PrimaryQueue.Count; index++) {
+        const ScatterEvent event = loadScatterEvent(frame, m_PrimaryQueue.getOrigin(index), m_PrimaryQueue.getDirection(index));
+        if (!event.IsValid)
+            continue;
+
+        Hawk::Math::Vec3 direction;
+        const MCSampler sampler = getSampler(frame, m_PrimaryQueue.PixelIndex[index]);
+        const Hawk::Math::Vec3 throughput = sampleBSDF(event, sampler, direction);
+        if (Hawk::Math::Dot(throughput, throughput) > 0.0f)
+            m_SecondaryQueue.push(event.Position, direction, throughput, FltMax, m_PrimaryQueue.PixelIndex[index]);
+    }
+}
+
+auto MCCPURenderer::stageSort(MCCPUFrame const& frame) -> void {
+    const Hawk::Math::Vec3 extent = frame.BoundingBoxMax - frame.BoundingBoxMin;
+    const Hawk::Math::Vec3 brickCount = Hawk::Math::Vec3(static_cast<F32>(m_DimensionX), static_cast<F32>(m_DimensionY), static_cast<F32>(m_DimensionZ)) / static_cast<F32>(m_BrickSize);
+
+    for (size_t index = 0; index < m_SecondaryQueue.Count; index++) {
+        const Hawk::Math::Vec3 direction = m_SecondaryQueue.getDirection(index);
+        const Hawk::Math::Vec3 texcoord = (m_SecondaryQueue.getOrigin(index) - frame.BoundingBoxMin) / extent;
+        const Hawk::Math::Vec3 brick = Hawk::Math::Vec3(Saturate(texcoord.x), Saturate(texcoord.y), Saturate(texcoord.z)) * brickCount;
+        const uint32_t octant = (direction.x < 0.0f ? 1 : 0) | (direction.y < 0.0f ? 2 : 0) | (direction.z < 0.0f ? 4 : 0);
+
+        // direction inside the octant, 3 bits per axis of the octahedral projection
+        const F32 norm = std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z);
+        const uint32_t u = (std::min)(static_cast<uint32_t>(8.0f * std::abs(direction.x) / norm), 7u);
+        const uint32_t v = (std::min)(static_cast<uint32_t>(8.0f * std::abs(direction.y) / norm), 7u);
+
+        const uint64_t morton = MortonEncode(static_cast<uint32_t>(brick.x), static_cast<uint32_t>(brick.y), static_cast<uint32_t>(brick.z));
+        m_SortKeys[index] = (uint64_t(octant) << 36) | (morton << 6) | (u << 3) | v;
+        m_SortIndices[index] = static_cast<uint32_t>(index);
+    }
+
+    std::sort(std::begin(m_SortIndices), std::begin(m_SortIndices) + m_SecondaryQueue.Count, [&](uint32_t lhs, uint32_t rhs) -> bool {
+        return m_SortKeys[lhs] < m_SortKeys[rhs];
+    });
+    m_SortedQueue.gather(m_SecondaryQueue, m_SortIndices);
+    std::swap(m_SecondaryQueue, m_SortedQueue);
+}
+
+auto MCCPURenderer::stageShadowMarch(MCCPUFrame const& frame) -> void {
+    for (size_t index = 0; index < m_SecondaryQueue.Count; index++) {
+        const MCSampler sampler = getSampler(frame, m_SecondaryQueue.PixelIndex[index]);
+        const Hawk::Math::Vec2 u = Hawk::Math::Vec2(sampler.get1D(MCSamplerDimension::getBounceDimension(0, MCSamplerDimension::Distance)), sampler.get1D(MCSamplerDimension::getBounceDimension(0, MCSamplerDimension::Jitter)));
+
+        Hawk::Math::Vec3 position;
+        m_IsAlive[index] = !rayMarching(frame, m_SecondaryQueue.getOrigin(index), m_SecondaryQueue.getDirection(index), m_SecondaryQueue.MaxT[index], u, position);
+    }
+    m_SecondaryQueue.compact(m_IsAlive);
+}
+
+auto MCCPURenderer::stageAccumulate(std::vector<Hawk::Math::Vec3>& colorSum) -> void {
+    for (size_t index = 0; index < m_SecondaryQueue.Count; index++)
+        colorSum[m_SecondaryQueue.PixelIndex[index]] += m_SecondaryQueue.getThroughput(index) * m_EnvironmentColor;
+}
+
+auto MCCPURenderer::generateCameraRay(MCCPUFrame const& frame, uint32_t pixelIndex, Hawk::Math::Vec3& origin, Hawk::Math::Vec3& direction, F32& maxT) const -> void {
+    const Hawk::Math::Vec2 id = Hawk::Math::Vec2(static_cast<F32>(pixelIndex % frame.Width), static_cast<F32>(pixelIndex / frame.Width));
+    Hawk::Math::Vec2 ncdXY = 2.0f * (id + frame.FrameOffset) / Hawk::Math::Vec2(static_cast<F32>(frame.Width), static_cast<F32>(frame.Height)) - Hawk::Math::Vec2(1.0f);
+    ncdXY.y *= -1.0f;
+
+    Hawk::Math::Vec4 rayStart = frame.InvWorldViewProjectionMatrix * Hawk::Math::Vec4(ncdXY, -1.0f, 1.0f);
+    Hawk::Math::Vec4 rayEnd = frame.InvWorldViewProjectionMatrix * Hawk::Math::Vec4(ncdXY, 1.0f, 1.0f);
+    const Hawk::Math::Vec3 start = Hawk::Math::Vec3(rayStart.x, rayStart.y, rayStart.z) / rayStart.w;
+    const Hawk::Math::Vec3 end = Hawk::Math::Vec3(rayEnd.x, rayEnd.y, rayEnd.z) / rayEnd.w;
+
+    origin = start;
+    direction = Hawk::Math::Normalize(end - start);
+    maxT = Hawk::Math::Length(end - start);
+}
+
+auto MCCPURenderer::tracePath(MCCPUFrame const& frame, uint32_t pixelIndex, MCCPURenderStatistics& statistics, Hawk::Math::Vec3& radiance) const -> bool {
+    const MCSampler sampler = getSampler(frame, pixelIndex);
+    radiance = Hawk::Math::Vec3(0.0f);
+
+    Hawk::Math::Vec3 origin;
+    Hawk::Math::Vec3 direction;
+    Hawk::Math::Vec3 position;
+    F32 maxT = 0.0f;
+    generateCameraRay(frame, pixelIndex, origin, direction, maxT);
+    statistics.PrimaryRayCount++;
+
+    const Hawk::Math::Vec2 uCamera = Hawk::Math::Vec2(sampler.get1D(MCSamplerDimension::CameraDistance), sampler.get1D(MCSamplerDimension::CameraJitter));
+    if (!rayMarching(frame, origin, direction, maxT, uCamera, position))
+        return false;
+
+    const ScatterEvent event = loadScatterEvent(frame, position, direction);
+    if (!event.IsValid)
+        return true;
+
+    const Hawk::Math::Vec3 throughput = sampleBSDF(event, sampler, direction);
+    if (Hawk::Math::Dot(throughput, throughput) <= 0.0f)
+        return true;
+    statistics.SecondaryRayCount++;
+
+    const Hawk::Math::Vec2 uBounce = Hawk::Math::Vec2(sampler.get1D(MCSamplerDimension::getBounceDimension(0, MCSamplerDimension::Distance)), sampler.get1D(MCSamplerDimension::getBounceDimension(0, MCSamplerDimension::Jitter)));
+    if (!rayMarching(frame, event.Position, direction, FltMax, uBounce, position))
+        radiance = throughput * m_EnvironmentColor;
+    return true;
+}
+
+auto MCCPURenderer::intersectClipBox(MCCPUFrame const& frame, Hawk::Math::Vec3 const& origin, Hawk::Math::Vec3 const& direction, F32& intersectMin, F32& intersectMax) const -> bool {
+    const Hawk::Math::Vec3 extent = frame.BoundingBoxMax - frame.BoundingBoxMin;
+    const Hawk::Math::Vec3 invR = Hawk::Math::Vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    const Hawk::Math::Vec3 bot = invR * (frame.BoundingBoxMin + extent * frame.ClipBoxMin - origin);
+    const Hawk::Math::Vec3 top = invR * (frame.BoundingBoxMin + extent * frame.ClipBoxMax - origin);
+    intersectMin = (std::max)({ (std::min)(top.x, bot.x), (std::min)(top.y, bot.y), (std::min)(top.z, bot.z) });
+    intersectMax = (std::min)({ (std::max)(top.x, bot.x), (std::max)(top.y, bot.y), (std::max)(top.z, bot.z) });
+    return intersectMax >= intersectMin;
+}
+
+auto MCCPURenderer::rayMarching(MCCPUFrame const& frame, Hawk::Math::Vec3 const& origin, Hawk::Math::Vec3 const& direction, F32 maxT, Hawk::Math::Vec2 const& u, Hawk::Math::Vec3& position) const -> bool {
+    F32 intersectMin = 0.0f;
+    F32 intersectMax = 0.0f;
+    position = Hawk::Math::Vec3(0.0f);
+    if (!intersectClipBox(frame, origin, direction, intersectMin, intersectMax))
+        return false;
+
+    const F32 minT = (std::max)(intersectMin, 0.0f);
+    const F32 endT = (std::min)(intersectMax, maxT);
+    const F32 threshold = -std::log(1.0f - u.x) / frame.Density;
+
+    F32 sum = 0.0f;
+    if (!frame.IsPreIntegrationEnabled) {
+        F32 t = minT + u.y * frame.StepSize;
+        while (sum < threshold) {
+            position = origin + t * direction;
+            if (t >= endT)
+                return false;
+            sum += frame.Density * sampleLUT(m_pLUTs->Opacity, getIntensity(frame, position)) * frame.StepSize;
+            t += frame.StepSize;
+        }
+        return true;
+    }
+
+    // segments between the jittered samples, the first one from the entry of the interval and the last one to its exit
+    F32 tFront = minT;
+    F32 t = minT + u.y * frame.StepSize;
+    F32 intensityFront = getIntensity(frame, origin + tFront * direction);
+    while (tFront < endT) {
+        t = (std::min)(t, endT);
+        position = origin + t * direction;
+        const F32 intensityBack = getIntensity(frame, position);
+        const F32 depth = frame.Density * samplePreIntegrationLUT(intensityFront, intensityBack) * (t - tFront);
+
+        // the free path ends inside the segment, its opacity is taken as constant along it
+        if (sum + depth >= threshold) {
+            position = origin + Hawk::Math::Lerp(tFront, t, (threshold - sum) / (std::max)(depth, std::numeric_limits<F32>::min())) * direction;
+            return true;
+        }
+        sum += depth;
+        tFront = t;
+        intensityFront = intensityBack;
+        t += frame.StepSize;
+    }
+    return false;
+}
+
+auto MCCPURenderer::loadScatterEvent(MCCPUFrame const& frame, Hawk::Math::Vec3 const& position, Hawk::Math::Vec3 const& direction) const -> ScatterEvent {
+    ScatterEvent event = {};
+
+    // central differences in texture space, the GPU precomputes a Sobel filtered gradient instead
+    const Hawk::Math::Vec3 extent = frame.BoundingBoxMax - frame.BoundingBoxMin;
+    const Hawk::Math::Vec3 dt = extent / Hawk::Math::Vec3(static_cast<F32>(m_DimensionX), static_cast<F32>(m_DimensionY), static_cast<F32>(m_DimensionZ));
+    const Hawk::Math::Vec3 gradient = Hawk::Math::Vec3(
+        getIntensity(frame, position + Hawk::Math::Vec3(dt.x, 0.0f, 0.0f)) - getIntensity(frame, position - Hawk::Math::Vec3(dt.x, 0.0f, 0.0f)),
+        getIntensity(frame, position + Hawk::Math::Vec3(0.0f, dt.y, 0.0f)) - getIntensity(frame, position - Hawk::Math::Vec3(0.0f, dt.y, 0.0f)),
+        getIntensity(frame, position + Hawk::Math::Vec3(0.0f, 0.0f, dt.z)) - getIntensity(frame, position - Hawk::Math::Vec3(0.0f, 0.0f, dt.z)));
+
+    const F32 magnitude = Hawk::Math::Length(gradient);
+    if (magnitude < FltEpsilon)
+        return event;
+
+    const MCMaterialTexel material = sampleMaterialLUT(getIntensity(frame, position));
+    event.Normal = -gradient / magnitude;
+    event.Normal = Hawk::Math::Dot(event.Normal, -direction) < 0.0f ? -event.Normal : event.Normal;
+    event.Position = position + 0.001f * event.Normal;
+    event.View = -direction;
+    event.Diffuse = Hawk::Math::Vec3(material.DiffuseOpacity.x, material.DiffuseOpacity.y, material.DiffuseOpacity.z);
+    event.Specular = Hawk::Math::Vec3(material.SpecularRoughness.x, material.SpecularRoughness.y, material.SpecularRoughness.z);
+    event.Roughness = material.SpecularRoughness.w;
+    event.IsValid = true;
+    return event;
+}
+
+auto MCCPURenderer::sampleBSDF(ScatterEvent const& event, MCSampler const& sampler, Hawk::Math::Vec3& direction) const -> Hawk::Math::Vec3 {
+    const Hawk::Math::Vec3 N = event.Normal;
+    const Hawk::Math::Vec3 V = event.View;
+    const F32 alpha = event.Roughness * event.Roughness;
+
+    const Hawk::Math::Vec3 H = GGX_SampleHemisphere(N, alpha, sampler.get2D(MCSamplerDimension::getBounceDimension(0, MCSamplerDimension::Microfacet)));
+    const Hawk::Math::Vec3 F = FresnelSchlick(event.Specular, Saturate(Hawk::Math::Dot(V, H)));
+
+    const F32 pd = Hawk::Math::Length(Hawk::Math::Vec3(1.0f) - F);
+    const F32 ps = Hawk::Math::Length(F);
+    const F32 pdf = ps / (ps + pd);
+
+    if (sampler.get1D(MCSamplerDimension::getBounceDimension(0, MCSamplerDimension::Lobe)) < pdf) {
+        // reflection
+        const Hawk::Math::Vec3 L = 2.0f * Hawk::Math::Dot(V, H) * H - V;
+        const F32 NdotL = Saturate(Hawk::Math::Dot(N, L));
+        const F32 NdotV = Saturate(Hawk::Math::Dot(N, V));
+        const F32 NdotH = Saturate(Hawk::Math::Dot(N, H));
+        const F32 VdotH = Saturate(Hawk::Math::Dot(V, H));
+
+        const F32 G = GGX_PartialGeometry(NdotV, alpha) * GGX_PartialGeometry(NdotL, alpha);
+        direction = L;
+        return (G * F * VdotH) / (NdotV * NdotH + 1.0e-3f) / pdf;
+    }
+
+    // refraction, cosine sampled: the environment is constant on the CPU so there is nothing to importance sample
+    direction = GGX_SampleHemisphere(N, 1.0f, sampler.get2D(MCSamplerDimension::getBounceDimension(0, MCSamplerDimension::Diffuse)));
+    return (Hawk::Math::Vec3(1.0f) - F) * event.Diffuse / (1.0f - pdf);
+}
+
+auto MCCPURenderer::getIntensity(MCCPUFrame const& frame, Hawk::Math::Vec3 const& position) const -> F32 {
+    // trilinear filtering with texel centers at half integers, as the linear sampler of the GPU path
+    const Hawk::Math::Vec3 texcoord = (position - frame.BoundingBoxMin) / (frame.BoundingBoxMax - frame.BoundingBoxMin);
+    const F32 x = Hawk::Math::Clamp(texcoord.x * m_DimensionX - 0.5f, 0.0f, m_DimensionX - 1.0f);
+    const F32 y = Hawk::Math::Clamp(texcoord.y * m_DimensionY - 0.5f, 0.0f, m_DimensionY - 1.0f);
+    const F32 z = Hawk::Math::Clamp(texcoord.z * m_DimensionZ - 0.5f, static_cast<F32>(m_SliceBegin), m_SliceEnd - 1.0f);
+
+    const uint32_t x0 = static_cast<uint32_t>(x);
+    const uint32_t y0 = static_cast<uint32_t>(y);
+    const uint32_t z0 = static_cast<uint32_t>(z);
+    const uint32_t x1 = (std::min)(x0 + 1, m_DimensionX - 1);
+    const uint32_t y1 = (std::min)(y0 + 1, m_DimensionY - 1);
+    const uint32_t z1 = (std::min)(z0 + 1, m_SliceEnd - 1);
+    const F32 fx = x - x0;
+    const F32 fy = y - y0;
+    const F32 fz = z - z0;
+
+    auto fetch = [&](uint32_t ix, uint32_t iy, uint32_t iz) -> F32 {
+        const size_t index = (size_t(iz - m_SliceBegin) * m_DimensionY + iy) * m_DimensionX + ix;
+        if (m_pCacheModel)
+            m_pCacheModel->access(index * sizeof(uint16_t));
+        return m_pIntensity[index];
+    };
+
+    const F32 c00 = Hawk::Math::Lerp(fetch(x0, y0, z0), fetch(x1, y0, z0), fx);
+    const F32 c10 = Hawk::Math::Lerp(fetch(x0, y1, z0), fetch(x1, y1, z0), fx);
+    const F32 c01 = Hawk::Math::Lerp(fetch(x0, y0, z1), fetch(x1, y0, z1), fx);
+    const F32 c11 = Hawk::Math::Lerp(fetch(x0, y1, z1), fetch(x1, y1, z1), fx);
+    return Hawk::Math::Lerp(Hawk::Math::Lerp(c00, c10, fy), Hawk::Math::Lerp(c01, c11, fy), fz) / std::numeric_limits<uint16_t>::max();
+}
+
+template<typename T>
+auto MCCPURenderer::sampleLUT(std::vector<T> const& lut, F32 intensity) const -> T {
+    const F32 x = Hawk::Math::Clamp(intensity, 0.0f, 1.0f) * (std::size(lut) - 1);
+    const size_t x0 = static_cast<size_t>(x);
+    const size_t x1 = (std::min)(x0 + 1, std::size(lut) - 1);
+    const F32 t = x - x0;
+    return lut[x0] + t * (lut[x1] - lut[x0]);
+}
+
+auto MCCPURenderer::sampleMaterialLUT(F32 intensity) const -> MCMaterialTexel {
+    auto const& lut = m_pLUTs->Material;
+    const F32 x = Hawk::Math::Clamp(intensity, 0.0f, 1.0f) * (std::size(lut) - 1);
+    const size_t x0 = static_cast<size_t>(x);
+    const size_t x1 = (std::min)(x0 + 1, std::size(lut) - 1);
+    const F32 t = x - x0;
+
+    MCMaterialTexel texel;
+    texel.DiffuseOpacity = lut[x0].DiffuseOpacity + t * (lut[x1].DiffuseOpacity - lut[x0].DiffuseOpacity);
+    texel.SpecularRoughness = lut[x0].SpecularRoughness + t * (lut[x1].SpecularRoughness - lut[x0].SpecularRoughness);
+    return texel;
+}
+
+auto MCCPURenderer::samplePreIntegrationLUT(F32 intensityFront, F32 intensityBack) const -> F32 {
+    const uint32_t sampling = m_pLUTs->PreIntegrationSampling;
+    const F32 x = Hawk::Math::Clamp(intensityFront, 0.0f, 1.0f) * (sampling - 1);
+    const F32 y = Hawk::Math::Clamp(intensityBack, 0.0f, 1.0f) * (sampling - 1);
+    const size_t x0 = (std::min)(static_cast<size_t>(x), size_t(sampling) - 2);
+    const size_t y0 = (std::min)(static_cast<size_t>(y), size_t(sampling) - 2);
+    const F32 tx = x - x0;
+    const F32 ty = y - y0;
+
+    F32 const* pRow0 = std::data(m_pLUTs->PreIntegration) + y0 * sampling;
+    F32 const* pRow1 = pRow0 + sampling;
+    const F32 value0 = pRow0[x0] + tx * (pRow0[x0 + 1] - pRow0[x0]);
+    const F32 value1 = pRow1[x0] + tx * (pRow1[x0 + 1] - pRow1[x0]);
+    return value0 + ty * (value1 - value0);
+}
+
+MCCPUParallelRenderer::MCCPUParallelRenderer(MCThreadPool& pool, MCNumaVolume const& volume, uint32_t dimensionX, uint32_t dimensionY, uint32_t dimensionZ, MCTransferFunction& transferFunctions, uint32_t samplingCount)
+    : m_Pool(pool) {
+
+    // the tables are built once and only read, each renderer is constructed by the worker that owns it so that its queues,
+    // zero filled by the constructor, are first touched on the node of that worker
+    const auto pLUTs = MCCPUTransferFunctionLUTs::create(transferFunctions, samplingCount);
+    m_Renderers.resize(m_Pool.getWorkerCount());
+    m_Pool.broadcast([&](uint32_t workerIndex) {
+        m_Renderers[workerIndex] = std::make_unique<MCCPURenderer>(volume.getData(m_Pool.getWorkerNode(workerIndex)), dimensionX, dimensionY, dimensionZ, pLUTs);
+    });
+    m_WorkerStatistics.resize(m_Pool.getWorkerCount());
+}
+
+auto MCCPUParallelRenderer::render(MCCPUFrame const& frame, std::vector<Hawk::Math::Vec3>& colorSum) -> MCCPURenderStatistics {
+    const auto timeBegin = std::chrono::high_resolution_clock::now();
+    const uint32_t pixelCount = frame.Width * frame.Height;
+
+    // enough tasks to balance the workers, no larger than the batch of one wavefront
+    const uint32_t taskSize = Hawk::Math::Clamp(pixelCount / (8 * m_Pool.getWorkerCount()), 64u, static_cast<uint32_t>(m_Renderers.front()->getBatchSize()));
+    const uint32_t taskCount = (pixelCount + taskSize - 1) / taskSize;
+
+    for (auto& statistics : m_WorkerStatistics)
+        statistics = {};
+
+    m_Pool.dispatch(taskCount, [&](uint32_t taskIndex, uint32_t workerIndex) {
+        const uint32_t pixelBegin = taskIndex * taskSize;
+        const uint32_t pixelEnd = (std::min)(pixelBegin + taskSize, pixelCount);
+        const auto task = m_Renderers[workerIndex]->renderWavefrontRange(frame, pixelBegin, pixelEnd, colorSum);
+        m_WorkerStatistics[workerIndex].PrimaryRayCount += task.PrimaryRayCount;
+        m_WorkerStatistics[workerIndex].SecondaryRayCount += task.SecondaryRayCount;
+        m_Pool.addRays(workerIndex, task.PrimaryRayCount + task.SecondaryRayCount);
+    });
+
+    MCCPURenderStatistics statistics = {};
+    for (auto const& worker : m_WorkerStatistics) {
+        statistics.PrimaryRayCount += worker.PrimaryRayCount;
+        statistics.SecondaryRayCount += worker.SecondaryRayCount;
+    }
+    statistics.ElapsedTime = std::chrono::duration<F64, std::milli>(std::chrono::high_resolution_clock::now() - timeBegin).count();
+    return statistics;
+}
+
+auto MCCPUParallelRenderer::runScalingBenchmark(std::vector<uint16_t> const& intensity, uint32_t dimensionX, uint32_t dimensionY, uint32_t dimensionZ, MCTransferFunction& transferFunctions, uint32_t samplingCount, MCCPUFrame frame, uint32_t sampleCount) -> std::string {
+    const MCNumaTopology topology = MCNumaTopology::query();
+    const uint32_t nodeCount = static_cast<uint32_t>(std::size(topology.Nodes));
+    std::string message = fmt::format("CPU renderer {}x{}, {} spp, scaling over {} NUMA nodes:\n", frame.Width, frame.Height, sampleCount, nodeCount);
+
+    for (uint32_t poolNodeCount = 1; poolNodeCount <= nodeCount; poolNodeCount++) {
+        MCThreadPool pool(topology, poolNodeCount);
+        for (const auto placement : { MCVolumePlacement::FirstTouch, MCVolumePlacement::Interleaved, MCVolumePlacement::Replicated }) {
+            // all the placements are the same memory on a single node
+            if (poolNodeCount == 1 && placement != MCVolumePlacement::FirstTouch)
+                continue;
+
+            MCNumaVolume volume(intensity.data(), std::size(intensity), pool, placement);
+            MCCPUParallelRenderer renderer(pool, volume, dimensionX, dimensionY, dimensionZ, transferFunctions, samplingCount);
+            std::vector<Hawk::Math::Vec3> colorSum(size_t(frame.Width) * frame.Height, Hawk::Math::Vec3(0.0f));
+
+            pool.resetStatistics();
+            MCCPURenderStatistics statistics = {};
+            for (uint32_t sampleIndex = 0; sampleIndex < sampleCount; sampleIndex++) {
+                frame.SampleIndex = sampleIndex;
+                const auto sample = renderer.render(frame, colorSum);
+                statistics.PrimaryRayCount += sample.PrimaryRayCount;
+                statistics.SecondaryRayCount += sample.SecondaryRayCount;
+                statistics.ElapsedTime += sample.ElapsedTime;
+            }
+
+            message += fmt::format("  {} node(s), {} workers, {}: {:.2f} Mrays/s\n", poolNodeCount, pool.getWorkerCount(), GetPlacementName(placement),
+                (statistics.PrimaryRayCount + statistics.SecondaryRayCount) / (1000.0 * statistics.ElapsedTime));
+            const auto nodes = pool.getNodeStatistics();
+            for (uint32_t nodeIndex = 0; nodeIndex < poolNodeCount; nodeIndex++) {
+                message += fmt::format("    node {}: {} local / {} stolen tasks, {:.2f} Mrays, busy {:.1f} ms\n", pool.getNodeNumber(nodeIndex),
+                    nodes[nodeIndex].LocalTaskCount, nodes[nodeIndex].StolenTaskCount, nodes[nodeIndex].RayCount / 1.0e6, nodes[nodeIndex].BusyTime);
+            }
+        }
+    }
+    return message;
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include "pch.h"
+#include "MCSampler.h"
+#include "MCTransferFunction.h"
+#include "MCThreadPool.h"
+#include <Hawk/Math/Functions.hpp>
+#include <Hawk/Math/Transform.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Subset of the FrameBuffer constants the CPU renderer needs
+struct MCCPUFrame {
+	Hawk::Math::Mat4x4 InvWorldViewProjectionMatrix;
+	Hawk::Math::Vec3   BoundingBoxMin;
+	Hawk::Math::Vec3   BoundingBoxMax;
+	Hawk::Math::Vec2   FrameOffset;
+	F32                StepSize;
+	F32                Density;
+	uint32_t           Width;
+	uint32_t           Height;
+	uint32_t           SampleIndex;
+	// rays are cut to this box, in texture coordinates of the bounding box
+	Hawk::Math::Vec3   ClipBoxMin = Hawk::Math::Vec3(0.0f, 0.0f, 0.0f);
+	Hawk::Math::Vec3   ClipBoxMax = Hawk::Math::Vec3(1.0f, 1.0f, 1.0f);
+	// the march integrates the opacity over the segments between its samples, StepSize is then the pre-integrated one
+	bool               IsPreIntegrationEnabled = false;
+};
+
+struct MCCPURenderStatistics {
+	uint64_t PrimaryRayCount = 0;
+	uint64_t SecondaryRayCount = 0;
+	uint64_t CacheAccessCount = 0;
+	uint64_t CacheMissCount = 0;
+	F64      ElapsedTime = 0.0;
+	F64      SortTime = 0.0;
+	F64      ShadowMarchTime = 0.0;
+};
+
+// Set associative LRU cache model fed with the volume fetches, hardware counters are not portable
+struct MCCPUCacheModel {
+	std::vector<uint64_t> Tags;
+	size_t                LineSize = 64;
+	size_t                Associativity = 8;
+	size_t                SetCount = 0;
+	uint64_t              AccessCount = 0;
+	uint64_t              MissCount = 0;
+
+	auto reset(size_t cacheSize, size_t lineSize, size_t associativity) -> void;
+
+	auto access(size_t address) -> void;
+};
+
+// Structure of arrays queue of the rays in flight between two wavefront stages
+struct MCCPURayQueue {
+	std::vector<F32>      OriginX;
+	std::vector<F32>      OriginY;
+	std::vector<F32>      OriginZ;
+	std::vector<F32>      DirectionX;
+	std::vector<F32>      DirectionY;
+	std::vector<F32>      DirectionZ;
+	std::vector<F32>      ThroughputR;
+	std::vector<F32>      ThroughputG;
+	std::vector<F32>      ThroughputB;
+	std::vector<F32>      MaxT;
+	std::vector<uint32_t> PixelIndex;
+	size_t                Count = 0;
+
+	auto reserve(size_t capacity) -> void;
+
+	auto push(Hawk::Math::Vec3 const& origin, Hawk::Math::Vec3 const& direction, Hawk::Math::Vec3 const& throughput, F32 maxT, uint32_t pixelIndex) -> void;
+
+	auto getOrigin(size_t index) const -> Hawk::Math::Vec3;
+
+	auto getDirection(size_t index) const -> Hawk::Math::Vec3;
+
+	auto getThroughput(size_t index) const -> Hawk::Math::Vec3;
+
+	auto setOrigin(size_t index, Hawk::Math::Vec3 const& origin) -> void;
+
+	// copies the rays of source in the order given by indices
+	auto gather(MCCPURayQueue const& source, std::vector<uint32_t> const& indices) -> void;
+
+	// stream compaction, moves the rays flagged alive to the front of the queue keeping their order
+	auto compact(std::vector<uint8_t> const& isAlive) -> void;
+};
+
+// transfer function tables of the CPU renderer, the renderers of a MCCPUParallelRenderer share one read only copy
+struct MCCPUTransferFunctionLUTs {
+	std::vector<F32>             Opacity;
+	std::vector<MCMaterialTexel> Material;
+	std::vector<F32>             PreIntegration;
+	uint32_t                     PreIntegrationSampling = 256;
+
+	static auto create(MCTransferFunction const& transferFunctions, uint32_t samplingCount) -> std::shared_ptr<MCCPUTransferFunctionLUTs const>;
+};
+
+/*
+* CPU port of the single scattering pipeline (GenerateRays + ComputeRadiance) organised as a wavefront:
+* generate -> march -> shade -> shadow march -> accumulate, each stage streams over a batch sized to the L2 cache.
+* The environment is a constant color on the CPU, the importance sampled environment map stays on the GPU.
+*/
+class MCCPURenderer {
+	public:
+		MCCPURenderer(uint16_t const* pIntensity, uint32_t dimensionX, uint32_t dimensionY, uint32_t dimensionZ, MCTransferFunction& transferFunctions, uint32_t samplingCount);
+
+		// the queues are allocated and zero filled by the calling thread, their pages go to its node on first touch
+		MCCPURenderer(uint16_t const* pIntensity, uint32_t dimensionX, uint32_t dimensionY, uint32_t dimensionZ, std::shared_ptr<MCCPUTransferFunctionLUTs const> pLUTs);
+
+		auto renderWavefront(MCCPUFrame const& frame, std::vector<Hawk::Math::Vec3>& colorSum) -> MCCPURenderStatistics;
+
+		// wavefront over the pixels [pixelBegin, pixelEnd) only, the unit of work of MCCPUParallelRenderer
+		auto renderWavefrontRange(MCCPUFrame const& frame, uint32_t pixelBegin, uint32_t pixelEnd, std::vector<Hawk::Math::Vec3>& colorSum) -> MCCPURenderStatistics;
+
+		// reference implementation, one pixel at a time through all the stages
+		auto renderMegakernel(MCCPUFrame const& frame, std::vector<Hawk::Math::Vec3>& colorSum) -> MCCPURenderStatistics;
+
+		/*
+		* Megakernel restricted to the clip box, the partial image of a sort-last domain: rgb is premultiplied, alpha counts
+		* the camera rays that scattered inside the box and depthRange is the interval of the pixel ray in the box.
+		* Shadow rays are marched inside the clip box only, occlusion by the volume outside of it is ignored.
+		*/
+		auto renderPartial(MCCPUFrame const& frame, std::vector<Hawk::Math::Vec4>& colorSum, std::vector<Hawk::Math::Vec2>& depthRange) -> MCCPURenderStatistics;
+
+		// pIntensity holds the slices [sliceBegin, sliceEnd) of the volume only, the fetches are clamped to them
+		auto setSlab(uint32_t sliceBegin, uint32_t sliceEnd) -> void { m_SliceBegin = sliceBegin; m_SliceEnd = sliceEnd; }
+
+		auto runBenchmark(MCCPUFrame frame, uint32_t sampleCount) -> std::string;
+
+		// shadow march throughput and cache miss rate of the wavefront with and without sorting the secondary rays
+		auto runSortingBenchmark(MCCPUFrame frame, uint32_t sampleCount) -> std::string;
+
+		auto getBatchSize() const -> size_t { return m_BatchSize; }
+
+		auto setRaySorting(bool isEnabled) -> void { m_IsRaySortingEnabled = isEnabled; }
+
+	private:
+		struct ScatterEvent {
+			Hawk::Math::Vec3 Position;
+			Hawk::Math::Vec3 Normal;
+			Hawk::Math::Vec3 View;
+			Hawk::Math::Vec3 Diffuse;
+			Hawk::Math::Vec3 Specular;
+			F32              Roughness;
+			bool             IsValid;
+		};
+
+		auto generateCameraRay(MCCPUFrame const& frame, uint32_t pixelIndex, Hawk::Math::Vec3& origin, Hawk::Math::Vec3& direction, F32& maxT) const -> void;
+
+		// interval of the ray in the clip box of the frame, false when it misses the box
+		auto intersectClipBox(MCCPUFrame const& frame, Hawk::Math::Vec3 const& origin, Hawk::Math::Vec3 const& direction, F32& intersectMin, F32& intersectMax) const -> bool;
+
+		// single scattering path of one pixel, false when the camera ray leaves the clip box without scattering
+		auto tracePath(MCCPUFrame const& frame, uint32_t pixelIndex, MCCPURenderStatistics& statistics, Hawk::Math::Vec3& radiance) const -> bool;
+
+		auto rayMarching(MCCPUFrame const& frame, Hawk::Math::Vec3 const& origin, Hawk::Math::Vec3 const& direction, F32 maxT, Hawk::Math::Vec2 const& u, Hawk::Math::Vec3& position) const -> bool;
+
+		auto loadScatterEvent(MCCPUFrame const& frame, Hawk::Math::Vec3 const& position, Hawk::Math::Vec3 const& direction) const -> ScatterEvent;
+
+		auto sampleBSDF(ScatterEvent const& event, MCSampler const& sampler, Hawk::Math::Vec3& direction) const -> Hawk::Math::Vec3;
+
+		auto getIntensity(MCCPUFrame const& frame, Hawk::Math::Vec3 const& position) const -> F32;
+
+		auto getSampler(MCCPUFrame const& frame, uint32_t pixelIndex) const -> MCSampler;
+
+		template<typename T>
+		auto sampleLUT(std::vector<T> const& lut, F32 intensity) const -> T;
+
+		// interpolates both halves of the material texel, the two neighbouring entries span 64 contiguous bytes
+		auto sampleMaterialLUT(F32 intensity) const -> MCMaterialTexel;
+
+		// bilinear in the pre-integration table, rows are indexed by the back and columns by the front intensity
+		auto samplePreIntegrationLUT(F32 intensityFront, F32 intensityBack) const -> F32;
+
+		auto stageGenerate(MCCPUFrame const& frame, uint32_t pixelBegin, uint32_t pixelEnd) -> void;
+
+		auto stageMarch(MCCPUFrame const& frame) -> void;
+
+		auto stageShade(MCCPUFrame const& frame) -> void;
+
+		// orders the secondary rays by direction octant, origin brick Morton code and quantized direction
+		auto stageSort(MCCPUFrame const& frame) -> void;
+
+		auto stageShadowMarch(MCCPUFrame const& frame) -> void;
+
+		auto stageAccumulate(std::vector<Hawk::Math::Vec3>& colorSum) -> void;
+
+		uint16_t const*               m_pIntensity = nullptr;
+		uint32_t                      m_DimensionX = 0;
+		uint32_t                      m_DimensionY = 0;
+		uint32_t                      m_DimensionZ = 0;
+		uint32_t                      m_SliceBegin = 0;
+		uint32_t                      m_SliceEnd = 0;
+
+		std::shared_ptr<MCCPUTransferFunctionLUTs const> m_pLUTs;
+		Hawk::Math::Vec3              m_EnvironmentColor = Hawk::Math::Vec3(1.0f, 1.0f, 1.0f);
+
+		size_t                        m_BatchSize = 0;
+		MCCPURayQueue                 m_PrimaryQueue;
+		MCCPURayQueue                 m_SecondaryQueue;
+		MCCPURayQueue                 m_SortedQueue;
+		std::vector<uint8_t>          m_IsAlive;
+
+		bool                          m_IsRaySortingEnabled = false;
+		uint32_t                      m_BrickSize = 8;
+		std::vector<uint64_t>         m_SortKeys;
+		std::vector<uint32_t>         m_SortIndices;
+
+		bool                          m_IsCacheModelEnabled = false;
+		MCCPUCacheModel               m_CacheModel;
+		MCCPUCacheModel*              m_pCacheModel = nullptr;
+};
+
+/*
+* Wavefront renderer spread over the workers of a MCThreadPool, each worker owns a MCCPURenderer reading the volume copy
+* of its node. A task is a range of consecutive pixels, the pool keeps consecutive ranges on the same node.
+*/
+class MCCPUParallelRenderer {
+	public:
+		MCCPUParallelRenderer(MCThreadPool& pool, MCNumaVolume const& volume, uint32_t dimensionX, uint32_t dimensionY, uint32_t dimensionZ, MCTransferFunction& transferFunctions, uint32_t samplingCount);
+
+		auto render(MCCPUFrame const& frame, std::vector<Hawk::Math::Vec3>& colorSum) -> MCCPURenderStatistics;
+
+		// throughput from 1 to all the NUMA nodes for each volume placement, with the counters of every node
+		static auto runScalingBenchmark(std::vector<uint16_t> const& intensity, uint32_t dimensionX, uint32_t dimensionY, uint32_t dimensionZ, MCTransferFunction& transferFunctions, uint32_t samplingCount, MCCPUFrame frame, uint32_t sampleCount) -> std::string;
+
+	private:
+		MCThreadPool&                               m_Pool;
+		std::vector<std::unique_ptr<MCCPURenderer>> m_Renderers;
+		std::vector<MCCPURenderStatistics>          m_WorkerStatistics;
+};
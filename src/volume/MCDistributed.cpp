@@ -0,0 +1,346 @@
+#include "pch.h"
+#include "MCDistributed.h"
+#include "fmt/format.h"
+#include <ws2tcpip.h>
+#include <chrono>
+#include <cwchar>
+#include <system_error>
+#include <utility>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace {
+    struct MessageHeader {
+        uint32_t Type;
+        uint32_t Size;
+    };
+
+    struct AccumulationHeader {
+        uint32_t Generation;
+        uint32_t Width;
+        uint32_t Height;
+        uint32_t Padding;
+    };
+
+    // an accumulation of the view is the largest message a worker sends
+    auto GetAccumulationSize(MCDistributedView const& view) -> size_t {
+        return sizeof(AccumulationHeader) + size_t(view.Width) * view.Height * sizeof(Hawk::Math::Vec4);
+    }
+
+    auto ThrowSocketError(char const* pFunction) -> void {
+        throw std::system_error(std::error_code(WSAGetLastError(), std::system_category()), pFunction);
+    }
+
+    auto GetArgument(wchar_t const* pCommandLine, wchar_t const* pName, uint32_t fallback) -> uint32_t {
+        wchar_t const* pArgument = std::wcsstr(pCommandLine, pName);
+        return pArgument ? static_cast<uint32_t>(std::wcstoul(pArgument + std::wcslen(pName), nullptr, 10)) : fallback;
+    }
+
+    auto GetLoopbackAddress(uint16_t port) -> sockaddr_in {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return address;
+    }
+}
+
+auto MCDistributedSettings::parse(wchar_t const* pCommandLine) -> MCDistributedSettings {
+    MCDistributedSettings settings;
+    if (!pCommandLine)
+        return settings;
+    // test the worker flag first, "-distributed-worker " is a prefix of "-distributed-workers"
+    settings.IsWorker = std::wcsstr(pCommandLine, L"-distributed-worker ") != nullptr;
+    settings.WorkerIndex = GetArgument(pCommandLine, L"-distributed-worker ", 0);
+    settings.WorkerCount = settings.IsWorker ? 0 : GetArgument(pCommandLine, L"-distributed-workers ", 0);
+    settings.Port = static_cast<uint16_t>(GetArgument(pCommandLine, L"-distributed-port ", 0));
+    // the trailing spaces keep "-sort-last " and "-sort-last-rank " apart from the longer flags
+    settings.IsSortLastRank = std::wcsstr(pCommandLine, L"-sort-last-rank ") != nullptr;
+    settings.SortLastRank = GetArgument(pCommandLine, L"-sort-last-rank ", 0);
+    settings.SortLastRankCount = GetArgument(pCommandLine, settings.IsSortLastRank ? L"-sort-last-ranks " : L"-sort-last ", 0);
+    return settings;
+}
+
+MCDistributedConnection::~MCDistributedConnection() {
+    close();
+}
+
+MCDistributedConnection::MCDistributedConnection(MCDistributedConnection&& other) noexcept
+    : m_Socket(std::exchange(other.m_Socket, INVALID_SOCKET))
+    , m_Buffer(std::move(other.m_Buffer))
+    , m_MaxMessageSize(other.m_MaxMessageSize) {
+}
+
+auto MCDistributedConnection::operator=(MCDistributedConnection&& other) noexcept -> MCDistributedConnection& {
+    if (this != &other) {
+        close();
+        m_Socket = std::exchange(other.m_Socket, INVALID_SOCKET);
+        m_Buffer = std::move(other.m_Buffer);
+        m_MaxMessageSize = other.m_MaxMessageSize;
+    }
+    return *this;
+}
+
+auto MCDistributedConnection::send(Message type, void const* pData, size_t size) -> bool {
+    auto sendAll = [this](char const* pBytes, size_t count) -> bool {
+        while (count > 0) {
+            const int sent = ::send(m_Socket, pBytes, static_cast<int>((std::min)(count, size_t(1) << 20)), 0);
+            if (sent == SOCKET_ERROR)
+                return false;
+            pBytes += sent;
+            count -= sent;
+        }
+        return true;
+    };
+
+    if (!isConnected())
+        return false;
+    const MessageHeader header = { static_cast<uint32_t>(type), static_cast<uint32_t>(size) };
+    if (!sendAll(reinterpret_cast<char const*>(&header), sizeof(header)) || !sendAll(static_cast<char const*>(pData), size)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+auto MCDistributedConnection::receive(Message& type, std::vector<uint8_t>& payload) -> bool {
+    // drain what the socket holds without waiting
+    while (isConnected()) {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(m_Socket, &readSet);
+        timeval timeout = {};
+        if (select(0, &readSet, nullptr, nullptr, &timeout) <= 0)
+            break;
+
+        char chunk[64 * 1024];
+        const int received = recv(m_Socket, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            close();
+            break;
+        }
+        m_Buffer.insert(std::end(m_Buffer), chunk, chunk + received);
+    }
+
+    if (std::size(m_Buffer) < sizeof(MessageHeader))
+        return false;
+    MessageHeader header = {};
+    std::memcpy(&header, m_Buffer.data(), sizeof(header));
+    if (header.Size > m_MaxMessageSize) {
+        OutputDebugStringA(fmt::format("Distributed: message of {} bytes rejected, at most {} are expected\n", header.Size, m_MaxMessageSize).c_str());
+        close();
+        m_Buffer.clear();
+        return false;
+    }
+    if (std::size(m_Buffer) < sizeof(MessageHeader) + header.Size)
+        return false;
+
+    type = static_cast<Message>(header.Type);
+    payload.assign(std::begin(m_Buffer) + sizeof(MessageHeader), std::begin(m_Buffer) + sizeof(MessageHeader) + header.Size);
+    m_Buffer.erase(std::begin(m_Buffer), std::begin(m_Buffer) + sizeof(MessageHeader) + header.Size);
+    return true;
+}
+
+auto MCDistributedConnection::receive(Message& type, std::vector<uint8_t>& payload, uint32_t timeout) -> bool {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    while (!receive(type, payload)) {
+        const auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (!isConnected() || remaining <= 0)
+            return false;
+
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(m_Socket, &readSet);
+        timeval timeoutSelect = {};
+        timeoutSelect.tv_sec = static_cast<long>(remaining / 1000000);
+        timeoutSelect.tv_usec = static_cast<long>(remaining % 1000000);
+        select(0, &readSet, nullptr, nullptr, &timeoutSelect);
+    }
+    return true;
+}
+
+auto MCDistributedConnection::duplicate() const -> MCDistributedConnection {
+    WSAPROTOCOL_INFOW info = {};
+    if (!isConnected() || WSADuplicateSocketW(m_Socket, GetCurrentProcessId(), &info) == SOCKET_ERROR)
+        return MCDistributedConnection();
+    return MCDistributedConnection(WSASocketW(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &info, 0, 0));
+}
+
+auto MCDistributedConnection::close() -> void {
+    if (m_Socket != INVALID_SOCKET)
+        closesocket(m_Socket);
+    m_Socket = INVALID_SOCKET;
+}
+
+MCDistributedCoordinator::MCDistributedCoordinator(uint32_t workerCount, uint16_t port)
+    : m_WorkerCount(workerCount) {
+
+    WSADATA data = {};
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+        ThrowSocketError("WSAStartup");
+
+    // loopback only, the workers run on this machine
+    m_ListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (m_ListenSocket == INVALID_SOCKET)
+        ThrowSocketError("socket");
+    sockaddr_in address = GetLoopbackAddress(port);
+    if (bind(m_ListenSocket, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) == SOCKET_ERROR)
+        ThrowSocketError("bind");
+    if (listen(m_ListenSocket, static_cast<int>(workerCount)) == SOCKET_ERROR)
+        ThrowSocketError("listen");
+    int addressSize = sizeof(address);
+    if (getsockname(m_ListenSocket, reinterpret_cast<sockaddr*>(&address), &addressSize) == SOCKET_ERROR)
+        ThrowSocketError("getsockname");
+    u_long isNonBlocking = 1;
+    ioctlsocket(m_ListenSocket, FIONBIO, &isNonBlocking);
+
+    wchar_t path[MAX_PATH] = {};
+    GetModuleFileNameW(nullptr, path, MAX_PATH);
+    for (uint32_t workerIndex = 0; workerIndex < workerCount; workerIndex++) {
+        std::wstring commandLine = L"\"" + std::wstring(path) + L"\" -distributed-worker " + std::to_wstring(workerIndex + 1) + L" -distributed-port " + std::to_wstring(ntohs(address.sin_port));
+
+        // hidden rather than minimized, a minimized window has an empty client area. The workers take the size of the view
+        STARTUPINFOW startup = {};
+        startup.cb = sizeof(startup);
+        startup.dwFlags = STARTF_USESHOWWINDOW;
+        startup.wShowWindow = SW_HIDE;
+        PROCESS_INFORMATION process = {};
+        if (!CreateProcessW(path, commandLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process))
+            throw std::system_error(std::error_code(static_cast<int>(GetLastError()), std::system_category()), "CreateProcessW");
+        m_Processes.push_back(process);
+    }
+}
+
+MCDistributedCoordinator::~MCDistributedCoordinator() {
+    m_Connections.clear();
+    if (m_ListenSocket != INVALID_SOCKET)
+        closesocket(m_ListenSocket);
+    for (auto const& process : m_Processes) {
+        TerminateProcess(process.hProcess, 0);
+        CloseHandle(process.hThread);
+        CloseHandle(process.hProcess);
+    }
+    WSACleanup();
+}
+
+auto MCDistributedCoordinator::poll() -> bool {
+    for (SOCKET socket = accept(m_ListenSocket, nullptr, nullptr); socket != INVALID_SOCKET; socket = accept(m_ListenSocket, nullptr, nullptr)) {
+        // accepted sockets inherit the non-blocking mode of the listening one
+        u_long isNonBlocking = 0;
+        ioctlsocket(socket, FIONBIO, &isNonBlocking);
+        m_Connections.emplace_back(socket);
+        m_Accumulations.emplace_back();
+        if (m_IsViewValid)
+            m_Connections.back().setMaxMessageSize(GetAccumulationSize(m_View));
+    }
+
+    bool isUpdated = false;
+    MCDistributedConnection::Message type = {};
+    std::vector<uint8_t> payload;
+    for (size_t index = 0; index < std::size(m_Connections); index++) {
+        while (m_Connections[index].receive(type, payload)) {
+            if (type == MCDistributedConnection::Message::Hello) {
+                uint32_t workerIndex = 0;
+                std::memcpy(&workerIndex, payload.data(), (std::min)(sizeof(workerIndex), std::size(payload)));
+                OutputDebugStringA(fmt::format("Distributed: worker {} connected\n", workerIndex).c_str());
+                if (m_IsViewValid)
+                    m_Connections[index].send(MCDistributedConnection::Message::View, &m_View, sizeof(m_View));
+            }
+            if (type == MCDistributedConnection::Message::Accumulation && std::size(payload) >= sizeof(AccumulationHeader)) {
+                AccumulationHeader header = {};
+                std::memcpy(&header, payload.data(), sizeof(header));
+                if (std::size(payload) != sizeof(header) + size_t(header.Width) * header.Height * sizeof(Hawk::Math::Vec4))
+                    continue;
+                auto& accumulation = m_Accumulations[index];
+                accumulation.Generation = header.Generation;
+                accumulation.Width = header.Width;
+                accumulation.Height = header.Height;
+                accumulation.Pixels.resize(size_t(header.Width) * header.Height);
+                std::memcpy(accumulation.Pixels.data(), payload.data() + sizeof(header), std::size(accumulation.Pixels) * sizeof(Hawk::Math::Vec4));
+                isUpdated |= header.Generation == m_View.Generation;
+            }
+        }
+    }
+    return isUpdated;
+}
+
+auto MCDistributedCoordinator::broadcastView(MCDistributedView const& view) -> void {
+    m_View = view;
+    m_IsViewValid = true;
+    for (auto& connection : m_Connections) {
+        connection.setMaxMessageSize(GetAccumulationSize(m_View));
+        connection.send(MCDistributedConnection::Message::View, &m_View, sizeof(m_View));
+    }
+}
+
+auto MCDistributedCoordinator::merge(std::vector<Hawk::Math::Vec4>& colorSum, uint32_t width, uint32_t height) const -> uint32_t {
+    uint32_t mergedCount = 0;
+    for (auto const& accumulation : m_Accumulations) {
+        if (accumulation.Generation != m_View.Generation || std::empty(accumulation.Pixels))
+            continue;
+        if (accumulation.Width != width || accumulation.Height != height) {
+            OutputDebugStringA(fmt::format("Distributed: {}x{} accumulation skipped, the coordinator renders {}x{}\n", accumulation.Width, accumulation.Height, width, height).c_str());
+            continue;
+        }
+
+        // weighted by the per-pixel sample counts, a running average stays a running average
+        for (size_t index = 0; index < std::size(colorSum); index++) {
+            const Hawk::Math::Vec4 source = accumulation.Pixels[index];
+            const F32 count = colorSum[index].w + source.w;
+            if (count <= 0.0f)
+                continue;
+            const F32 weight = source.w / count;
+            colorSum[index] = Hawk::Math::Vec4(
+                colorSum[index].x + weight * (source.x - colorSum[index].x),
+                colorSum[index].y + weight * (source.y - colorSum[index].y),
+                colorSum[index].z + weight * (source.z - colorSum[index].z), count);
+        }
+        mergedCount++;
+    }
+    return mergedCount;
+}
+
+MCDistributedWorker::MCDistributedWorker(uint32_t workerIndex, uint16_t port)
+    : m_WorkerIndex(workerIndex) {
+
+    WSADATA data = {};
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+        ThrowSocketError("WSAStartup");
+
+    SOCKET socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (socket == INVALID_SOCKET)
+        ThrowSocketError("socket");
+    const sockaddr_in address = GetLoopbackAddress(port);
+    if (connect(socket, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) == SOCKET_ERROR) {
+        closesocket(socket);
+        ThrowSocketError("connect");
+    }
+    m_Connection = MCDistributedConnection(socket);
+    m_Connection.send(MCDistributedConnection::Message::Hello, &m_WorkerIndex, sizeof(m_WorkerIndex));
+}
+
+MCDistributedWorker::~MCDistributedWorker() {
+    m_Connection = MCDistributedConnection();
+    WSACleanup();
+}
+
+auto MCDistributedWorker::poll(MCDistributedView& view) -> bool {
+    bool isUpdated = false;
+    MCDistributedConnection::Message type = {};
+    std::vector<uint8_t> payload;
+    while (m_Connection.receive(type, payload)) {
+        if (type == MCDistributedConnection::Message::View && std::size(payload) == sizeof(view)) {
+            std::memcpy(&view, payload.data(), sizeof(view));
+            isUpdated = true;
+        }
+    }
+    return isUpdated;
+}
+
+auto MCDistributedWorker::sendAccumulation(MCDistributedAccumulation const& accumulation) -> void {
+    const AccumulationHeader header = { accumulation.Generation, accumulation.Width, accumulation.Height, 0 };
+    std::vector<uint8_t> payload(sizeof(header) + std::size(accumulation.Pixels) * sizeof(Hawk::Math::Vec4));
+    std::memcpy(payload.data(), &header, sizeof(header));
+    std::memcpy(payload.data() + sizeof(header), accumulation.Pixels.data(), std::size(accumulation.Pixels) * sizeof(Hawk::Math::Vec4));
+    m_Connection.send(MCDistributedConnection::Message::Accumulation, payload.data(), std::size(payload));
+}
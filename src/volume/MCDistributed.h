@@ -0,0 +1,141 @@
+#pragma once
+
+#include "pch.h"
+#include <winsock2.h>
+#include <Hawk/Math/Functions.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// command line of the distributed mode, -distributed-workers N on the coordinator, the workers are spawned with -distributed-worker I -distributed-port P
+// -sort-last N runs the sort-last benchmark up to N ranks, its ranks are spawned with -sort-last-rank R -sort-last-ranks N -distributed-port P
+struct MCDistributedSettings {
+	uint32_t WorkerCount = 0;
+	uint32_t WorkerIndex = 0;
+	uint16_t Port = 0;
+	bool     IsWorker = false;
+	uint32_t SortLastRankCount = 0;
+	uint32_t SortLastRank = 0;
+	bool     IsSortLastRank = false;
+
+	static auto parse(wchar_t const* pCommandLine) -> MCDistributedSettings;
+
+	auto isEnabled() const -> bool { return IsWorker || WorkerCount > 0 || SortLastRankCount > 0; }
+};
+
+// view of the coordinator, the workers render the same image with their own sample stream
+struct MCDistributedView {
+	Hawk::Math::Mat4x4 ViewMatrix;
+	F32                Zoom;
+	uint32_t           Generation;
+	uint32_t           Width;
+	uint32_t           Height;
+};
+
+// running average in rgb and sample count in alpha, the layout of the color sum texture
+struct MCDistributedAccumulation {
+	uint32_t                      Generation = 0;
+	uint32_t                      Width = 0;
+	uint32_t                      Height = 0;
+	std::vector<Hawk::Math::Vec4> Pixels;
+};
+
+// framed messages over a blocking TCP socket, receiving never blocks: partial messages wait in the buffer
+class MCDistributedConnection {
+	public:
+		enum class Message : uint32_t {
+			Hello = 1,
+			View = 2,
+			Accumulation = 3,
+			DomainSetup = 4,
+			DomainReady = 5,
+			DomainStart = 6,
+			DomainPartial = 7,
+			DomainResult = 8
+		};
+
+		MCDistributedConnection() = default;
+
+		explicit MCDistributedConnection(SOCKET socket) : m_Socket(socket) {}
+
+		~MCDistributedConnection();
+
+		MCDistributedConnection(MCDistributedConnection&& other) noexcept;
+
+		auto operator=(MCDistributedConnection&& other) noexcept -> MCDistributedConnection&;
+
+		auto send(Message type, void const* pData, size_t size) -> bool;
+
+		// next complete message if one has arrived, false when there is none yet or the peer is gone
+		auto receive(Message& type, std::vector<uint8_t>& payload) -> bool;
+
+		// waits up to timeout milliseconds for the next complete message
+		auto receive(Message& type, std::vector<uint8_t>& payload, uint32_t timeout) -> bool;
+
+		auto isConnected() const -> bool { return m_Socket != INVALID_SOCKET; }
+
+		// a message announcing a larger payload closes the connection before anything is allocated for it
+		auto setMaxMessageSize(size_t size) -> void { m_MaxMessageSize = size; }
+
+		// a handle of its own on the same socket, for a thread sending while another one receives: either of them closing
+		// its handle on an error leaves the other one valid. Not connected when the socket cannot be duplicated
+		auto duplicate() const -> MCDistributedConnection;
+
+	private:
+		auto close() -> void;
+
+		// the control messages until a view or a setup gives the size of the images
+		static constexpr size_t DefaultMaxMessageSize = 64 * 1024;
+
+		SOCKET               m_Socket = INVALID_SOCKET;
+		std::vector<uint8_t> m_Buffer;
+		size_t               m_MaxMessageSize = DefaultMaxMessageSize;
+};
+
+/*
+* Spawns the worker processes and merges their accumulation buffers with its own, weighted by the sample counts.
+* The sample streams are disjoint ranges of the sequence: stream k starts at k times the per process sample budget.
+*/
+class MCDistributedCoordinator {
+	public:
+		MCDistributedCoordinator(uint32_t workerCount, uint16_t port);
+
+		~MCDistributedCoordinator();
+
+		// accepts the workers that connected since the last call and collects the accumulations they sent
+		auto poll() -> bool;
+
+		auto broadcastView(MCDistributedView const& view) -> void;
+
+		// merges the received accumulations of the current view into colorSum, returns the number of merged workers
+		auto merge(std::vector<Hawk::Math::Vec4>& colorSum, uint32_t width, uint32_t height) const -> uint32_t;
+
+		auto getWorkerCount() const -> uint32_t { return m_WorkerCount; }
+
+	private:
+		uint32_t                                m_WorkerCount = 0;
+		SOCKET                                  m_ListenSocket = INVALID_SOCKET;
+		std::vector<MCDistributedConnection>    m_Connections;
+		std::vector<MCDistributedAccumulation>  m_Accumulations;
+		std::vector<PROCESS_INFORMATION>        m_Processes;
+		MCDistributedView                       m_View = {};
+		bool                                    m_IsViewValid = false;
+};
+
+class MCDistributedWorker {
+	public:
+		MCDistributedWorker(uint32_t workerIndex, uint16_t port);
+
+		~MCDistributedWorker();
+
+		// latest view sent by the coordinator, false when it has not changed
+		auto poll(MCDistributedView& view) -> bool;
+
+		auto sendAccumulation(MCDistributedAccumulation const& accumulation) -> void;
+
+		auto getWorkerIndex() const -> uint32_t { return m_WorkerIndex; }
+
+	private:
+		uint32_t                m_WorkerIndex = 0;
+		MCDistributedConnection m_Connection;
+};
@@ -0,0 +1,69 @@
+#include "pch.h"
+#include "MCProfiler.h"
+
+MCProfiler::MCProfiler(DX::ComPtr<ID3D11Device> pDevice) : m_pDevice(pDevice) {
+    for (auto& frame : m_Frames) {
+        D3D11_QUERY_DESC desc = {};
+        desc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+        DX::ThrowIfFailed(m_pDevice->CreateQuery(&desc, frame.pQueryDisjoint.GetAddressOf()));
+    }
+}
+
+auto MCProfiler::beginFrame(DX::ComPtr<ID3D11DeviceContext> pContext) -> void {
+    auto& frame = m_Frames[m_FrameIndex % FrameLatency];
+    if (frame.IsIssued)
+        resolve(pContext, frame);
+    pContext->Begin(frame.pQueryDisjoint.Get());
+}
+
+auto MCProfiler::endFrame(DX::ComPtr<ID3D11DeviceContext> pContext) -> void {
+    auto& frame = m_Frames[m_FrameIndex % FrameLatency];
+    pContext->End(frame.pQueryDisjoint.Get());
+    frame.IsIssued = true;
+    m_FrameIndex++;
+}
+
+auto MCProfiler::begin(DX::ComPtr<ID3D11DeviceContext> pContext, std::string const& name) -> void {
+    auto& interval = m_Frames[m_FrameIndex % FrameLatency].Intervals[name];
+    if (!interval.pQueryBegin) {
+        D3D11_QUERY_DESC desc = {};
+        desc.Query = D3D11_QUERY_TIMESTAMP;
+        DX::ThrowIfFailed(m_pDevice->CreateQuery(&desc, interval.pQueryBegin.GetAddressOf()));
+        DX::ThrowIfFailed(m_pDevice->CreateQuery(&desc, interval.pQueryEnd.GetAddressOf()));
+    }
+    pContext->End(interval.pQueryBegin.Get());
+}
+
+auto MCProfiler::end(DX::ComPtr<ID3D11DeviceContext> pContext, std::string const& name) -> void {
+    auto& interval = m_Frames[m_FrameIndex % FrameLatency].Intervals[name];
+    pContext->End(interval.pQueryEnd.Get());
+    interval.IsIssued = true;
+}
+
+auto MCProfiler::getElapsedTime(std::string const& name) const -> F32 {
+    auto iterator = m_ElapsedTime.find(name);
+    return iterator != m_ElapsedTime.end() ? iterator->second : 0.0f;
+}
+
+auto MCProfiler::resolve(DX::ComPtr<ID3D11DeviceContext> pContext, FrameQueries& frame) -> void {
+    D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint = {};
+    while (pContext->GetData(frame.pQueryDisjoint.Get(), &disjoint, sizeof(disjoint), 0) == S_FALSE)
+        std::this_thread::yield();
+
+    for (auto& [name, interval] : frame.Intervals) {
+        if (!interval.IsIssued)
+            continue;
+        interval.IsIssued = false;
+
+        uint64_t timestampBegin = 0;
+        uint64_t timestampEnd = 0;
+        while (pContext->GetData(interval.pQueryBegin.Get(), &timestampBegin, sizeof(uint64_t), 0) == S_FALSE)
+            std::this_thread::yield();
+        while (pContext->GetData(interval.pQueryEnd.Get(), &timestampEnd, sizeof(uint64_t), 0) == S_FALSE)
+            std::this_thread::yield();
+
+        if (!disjoint.Disjoint)
+            m_ElapsedTime[name] = 1000.0f * static_cast<F32>(timestampEnd - timestampBegin) / static_cast<F32>(disjoint.Frequency);
+    }
+    frame.IsIssued = false;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "pch.h"
+#include "../DeviceResources.h"
+#include <Hawk/Common/Defines.hpp>
+#include <array>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+/*
+* GPU timestamp profiler, results are resolved a few frames later to avoid stalling the pipeline
+*/
+class MCProfiler
+{
+	public:
+		MCProfiler(DX::ComPtr<ID3D11Device> pDevice);
+
+		auto beginFrame(DX::ComPtr<ID3D11DeviceContext> pContext) -> void;
+
+		auto endFrame(DX::ComPtr<ID3D11DeviceContext> pContext) -> void;
+
+		auto begin(DX::ComPtr<ID3D11DeviceContext> pContext, std::string const& name) -> void;
+
+		auto end(DX::ComPtr<ID3D11DeviceContext> pContext, std::string const& name) -> void;
+
+		// last resolved duration of the interval in milliseconds
+		auto getElapsedTime(std::string const& name) const -> F32;
+
+	private:
+		struct Interval {
+			DX::ComPtr<ID3D11Query> pQueryBegin;
+			DX::ComPtr<ID3D11Query> pQueryEnd;
+			bool IsIssued = false;
+		};
+
+		struct FrameQueries {
+			DX::ComPtr<ID3D11Query> pQueryDisjoint;
+			std::unordered_map<std::string, Interval> Intervals;
+			bool IsIssued = false;
+		};
+
+		auto resolve(DX::ComPtr<ID3D11DeviceContext> pContext, FrameQueries& frame) -> void;
+
+		static constexpr uint32_t FrameLatency = 4;
+
+		DX::ComPtr<ID3D11Device> m_pDevice;
+		std::array<FrameQueries, FrameLatency> m_Frames;
+		std::unordered_map<std::string, F32> m_ElapsedTime;
+		uint32_t m_FrameIndex = 0;
+};
@@ -0,0 +1,171 @@
+#include "pch.h"
+#include "MCSampler.h"
+
+namespace {
+    constexpr uint32_t Rank1Alpha1D = 2654435769u;
+    constexpr uint32_t Rank1Alpha2DX = 3242174890u;
+    constexpr uint32_t Rank1Alpha2DY = 2447445414u;
+
+    auto Hash(uint32_t seed) -> uint32_t {
+        seed = (seed ^ 61) ^ (seed >> 16);
+        seed *= 9;
+        seed = seed ^ (seed >> 4);
+        seed *= 0x27d4eb2d;
+        seed = seed ^ (seed >> 15);
+        return seed;
+    }
+
+    auto HashCombine(uint32_t seed, uint32_t value) -> uint32_t {
+        return Hash(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+    }
+
+    auto ReverseBits(uint32_t x) -> uint32_t {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    auto LaineKarrasPermutation(uint32_t x, uint32_t seed) -> uint32_t {
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
+    }
+
+    auto NestedUniformScramble(uint32_t x, uint32_t seed) -> uint32_t {
+        return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+    }
+
+    auto SobolSecondDimension(uint32_t index) -> uint32_t {
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+            if (index & 1)
+                result ^= v;
+        }
+        return result;
+    }
+
+    auto ToUnitFloat(uint32_t x) -> F32 {
+        return (x >> 8) * (1.0f / 16777216.0f);
+    }
+}
+
+MCSampler::MCSampler(MCSamplerType type, uint32_t pixelX, uint32_t pixelY, uint32_t sampleIndex)
+    : m_Type(type)
+    , m_PixelX(pixelX)
+    , m_PixelY(pixelY)
+    , m_Index(sampleIndex)
+    , m_Seed(Hash((pixelX << 16) | pixelY)) {
+
+}
+
+auto MCSampler::get1D(uint32_t dimension) const -> F32 {
+    const uint32_t seed = HashCombine(m_Seed, dimension);
+    switch (m_Type) {
+    case MCSamplerType::WhiteNoise:
+        return ToUnitFloat(HashCombine(seed, m_Index));
+    case MCSamplerType::SobolScrambled:
+        return ToUnitFloat(ReverseBits(NestedUniformScramble(m_Index, seed)) ^ Hash(seed ^ 1u));
+    case MCSamplerType::SobolOwen:
+        return ToUnitFloat(NestedUniformScramble(ReverseBits(NestedUniformScramble(m_Index, seed)), Hash(seed ^ 1u)));
+    default: {
+        const uint32_t dither = m_PixelX * Rank1Alpha2DX + m_PixelY * Rank1Alpha2DY;
+        return ToUnitFloat(dither + Hash(seed ^ 1u) + m_Index * Rank1Alpha1D);
+    }
+    }
+}
+
+auto MCSampler::get2D(uint32_t dimension) const -> Hawk::Math::Vec2 {
+    const uint32_t seed = HashCombine(m_Seed, dimension);
+    switch (m_Type) {
+    case MCSamplerType::WhiteNoise: {
+        const uint32_t x = HashCombine(seed, m_Index);
+        return Hawk::Math::Vec2(ToUnitFloat(x), ToUnitFloat(Hash(x)));
+    }
+    case MCSamplerType::SobolScrambled: {
+        const uint32_t index = NestedUniformScramble(m_Index, seed);
+        return Hawk::Math::Vec2(ToUnitFloat(ReverseBits(index) ^ Hash(seed ^ 1u)), ToUnitFloat(SobolSecondDimension(index) ^ Hash(seed ^ 2u)));
+    }
+    case MCSamplerType::SobolOwen: {
+        const uint32_t index = NestedUniformScramble(m_Index, seed);
+        return Hawk::Math::Vec2(ToUnitFloat(NestedUniformScramble(ReverseBits(index), Hash(seed ^ 1u))), ToUnitFloat(NestedUniformScramble(SobolSecondDimension(index), Hash(seed ^ 2u))));
+    }
+    default: {
+        const uint32_t dither = m_PixelX * Rank1Alpha2DX + m_PixelY * Rank1Alpha2DY;
+        return Hawk::Math::Vec2(ToUnitFloat(dither + Hash(seed ^ 1u) + m_Index * Rank1Alpha2DX), ToUnitFloat(dither + Hash(seed ^ 2u) + m_Index * Rank1Alpha2DY));
+    }
+    }
+}
+
+auto MCSampler::getName(MCSamplerType type) -> const char* {
+    switch (type) {
+    case MCSamplerType::WhiteNoise:
+        return "White noise";
+    case MCSamplerType::SobolScrambled:
+        return "Sobol (XOR scrambled)";
+    case MCSamplerType::SobolOwen:
+        return "Sobol (Owen scrambled)";
+    default:
+        return "Blue-noise rank-1";
+    }
+}
+
+MCSamplerBenchmark::MCSamplerBenchmark(uint32_t width, uint32_t height, F32 targetRMSE, uint32_t maximumSamples)
+    : m_Width(width)
+    , m_Height(height)
+    , m_TargetRMSE(targetRMSE)
+    , m_MaximumSamples(maximumSamples) {
+
+}
+
+auto MCSamplerBenchmark::run(MCSamplerType type) const -> MCSamplerBenchmarkResult {
+    // dimensions used by the first bounce of ComputeRadiance.hlsl
+    constexpr uint32_t dimensionDirection = MCSamplerDimension::getBounceDimension(0, MCSamplerDimension::Diffuse);
+    constexpr uint32_t dimensionDistance = MCSamplerDimension::getBounceDimension(0, MCSamplerDimension::Distance);
+
+    // the sun radius and the transmittance vary over the image so that every pixel integrates a different discontinuity
+    auto getRadius = [&](uint32_t x) -> F64 { return 0.2 + 0.6 * (x + 0.5) / m_Width; };
+    auto getTransmittance = [&](uint32_t y) -> F64 { return 0.1 + 0.8 * (y + 0.5) / m_Height; };
+    auto getReference = [&](uint32_t x, uint32_t y) -> F64 {
+        const F64 radius = getRadius(x);
+        return Hawk::Math::PI<F64> * radius * radius * getTransmittance(y) / 4.0 + 4.0 / (Hawk::Math::PI<F64> * Hawk::Math::PI<F64>);
+    };
+
+    std::vector<F64> sum(size_t(m_Width) * size_t(m_Height), 0.0);
+    F64 rmse = 0.0;
+    for (uint32_t sampleIndex = 0; sampleIndex < m_MaximumSamples; sampleIndex++) {
+        F64 error = 0.0;
+        for (uint32_t y = 0; y < m_Height; y++) {
+            for (uint32_t x = 0; x < m_Width; x++) {
+                const MCSampler sampler(type, x, y, sampleIndex);
+                const Hawk::Math::Vec2 direction = sampler.get2D(dimensionDirection);
+                const F64 distance = sampler.get1D(dimensionDistance);
+                const F64 radius = getRadius(x);
+
+                const bool isSun = direction.x * direction.x + direction.y * direction.y < radius * radius;
+                const F64 sky = std::sin(Hawk::Math::PI<F64> * direction.x) * std::sin(Hawk::Math::PI<F64> * direction.y);
+                const F64 value = (isSun && distance < getTransmittance(y) ? 1.0 : 0.0) + sky;
+
+                auto& pixel = sum[size_t(y) * m_Width + x];
+                pixel += value;
+                const F64 relative = (pixel / (sampleIndex + 1) - getReference(x, y)) / getReference(x, y);
+                error += relative * relative;
+            }
+        }
+        rmse = std::sqrt(error / std::size(sum));
+        if (rmse <= m_TargetRMSE)
+            return { type, sampleIndex + 1, static_cast<F32>(rmse) };
+    }
+    return { type, m_MaximumSamples, static_cast<F32>(rmse) };
+}
+
+auto MCSamplerBenchmark::runAll() const -> std::vector<MCSamplerBenchmarkResult> {
+    std::vector<MCSamplerBenchmarkResult> results;
+    for (auto type : { MCSamplerType::WhiteNoise, MCSamplerType::SobolScrambled, MCSamplerType::SobolOwen, MCSamplerType::BlueNoiseRank1 })
+        results.push_back(run(type));
+    return results;
+}
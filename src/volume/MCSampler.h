@@ -0,0 +1,82 @@
+#pragma once
+
+#include "pch.h"
+#include <Hawk/Common/Defines.hpp>
+#include <Hawk/Math/Functions.hpp>
+#include <vector>
+
+// Values match the SAMPLER_TYPE macro of data/shaders/Sampler.hlsl
+enum class MCSamplerType : uint32_t {
+	WhiteNoise = 0,
+	SobolScrambled = 1,
+	SobolOwen = 2,
+	BlueNoiseRank1 = 3
+};
+
+// Dimension layout of data/shaders/Sampler.hlsl
+struct MCSamplerDimension {
+	static constexpr uint32_t CameraDistance = 0;
+	static constexpr uint32_t CameraJitter = 1;
+	static constexpr uint32_t Bounce = 2;
+
+	static constexpr uint32_t Lobe = 0;
+	static constexpr uint32_t Microfacet = 1;
+	static constexpr uint32_t Strategy = 2;
+	static constexpr uint32_t Diffuse = 3;
+	static constexpr uint32_t EnvironmentTexel = 4;
+	static constexpr uint32_t EnvironmentJitter = 5;
+	static constexpr uint32_t Distance = 6;
+	static constexpr uint32_t Jitter = 7;
+	static constexpr uint32_t Roulette = 8;
+	static constexpr uint32_t PerBounce = 9;
+
+	static constexpr auto getBounceDimension(uint32_t bounce, uint32_t offset) -> uint32_t {
+		return Bounce + bounce * PerBounce + offset;
+	}
+};
+
+/*
+* CPU mirror of data/shaders/Sampler.hlsl, evaluates the same bits as the shaders for a pixel and sample index
+*/
+class MCSampler {
+	public:
+		MCSampler(MCSamplerType type, uint32_t pixelX, uint32_t pixelY, uint32_t sampleIndex);
+
+		auto get1D(uint32_t dimension) const -> F32;
+
+		auto get2D(uint32_t dimension) const -> Hawk::Math::Vec2;
+
+		static auto getName(MCSamplerType type) -> const char*;
+
+	private:
+		MCSamplerType m_Type;
+		uint32_t      m_PixelX;
+		uint32_t      m_PixelY;
+		uint32_t      m_Index;
+		uint32_t      m_Seed;
+};
+
+struct MCSamplerBenchmarkResult {
+	MCSamplerType Type;
+	uint32_t      SampleCount;
+	F32           RMSE;
+};
+
+/*
+* Samples-to-target-RMSE of every sampler on a per-pixel integrand shaped like a diffuse bounce:
+* a quarter disk "sun" in the 2D direction dimension gated by a 1D free-flight test, plus a smooth sky term
+*/
+class MCSamplerBenchmark {
+	public:
+		MCSamplerBenchmark(uint32_t width, uint32_t height, F32 targetRMSE, uint32_t maximumSamples);
+
+		auto run(MCSamplerType type) const -> MCSamplerBenchmarkResult;
+
+		auto runAll() const -> std::vector<MCSamplerBenchmarkResult>;
+
+	private:
+		uint32_t m_Width;
+		uint32_t m_Height;
+		F32      m_TargetRMSE;
+		uint32_t m_MaximumSamples;
+};
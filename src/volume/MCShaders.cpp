@@ -2,7 +2,7 @@
 #include "MCShaders.h"
 #include <string>
 
-MCShaders::MCShaders(DX::ComPtr<ID3D11Device1> m_pDevice) {
+MCShaders::MCShaders(DX::ComPtr<ID3D11Device1> m_pDevice, MCSamplerType samplerType) {
     auto compileShader = [](auto fileName, auto entrypoint, auto target, auto macros) -> DX::ComPtr<ID3DBlob> {
         DX::ComPtr<ID3DBlob> pCodeBlob;
         DX::ComPtr<ID3DBlob> pErrorBlob;
@@ -22,10 +22,12 @@ MCShaders::MCShaders(DX::ComPtr<ID3D11Device1> m_pDevice) {
     //TODO AMD 8x8x1 NV 8x4x1
     std::string threadSizeX = std::to_string(8);
     std::string threadSizeY = std::to_string(8);
+    std::string samplerTypeName = std::to_string(static_cast<uint32_t>(samplerType));
 
     D3D_SHADER_MACRO macros[] = {
         {"THREAD_GROUP_SIZE_X", threadSizeX.c_str()},
         {"THREAD_GROUP_SIZE_Y", threadSizeY.c_str()},
+        {"SAMPLER_TYPE", samplerTypeName.c_str()},
         { nullptr, nullptr}
     };
 
@@ -34,8 +36,18 @@ MCShaders::MCShaders(DX::ComPtr<ID3D11Device1> m_pDevice) {
     auto pBlobCSAccumulate = compileShader(L"data/shaders/Accumulation.hlsl", "Accumulate", "cs_5_0", macros);
     auto pBlobCSComputeTiles = compileShader(L"data/shaders/ComputeTiles.hlsl", "ComputeTiles", "cs_5_0", macros);
     auto pBlobCSToneMap = compileShader(L"data/shaders/ToneMap.hlsl", "ToneMap", "cs_5_0", macros);
+    auto pBlobCSUpsample = compileShader(L"data/shaders/Upsample.hlsl", "Upsample", "cs_5_0", macros);
+    auto pBlobCSReproject = compileShader(L"data/shaders/Reprojection.hlsl", "Reproject", "cs_5_0", macros);
+    auto pBlobCSDenoise = compileShader(L"data/shaders/Denoise.hlsl", "DenoiseATrous", "cs_5_0", macros);
+    auto pBlobCSComputeError = compileShader(L"data/shaders/Metrics.hlsl", "ComputeError", "cs_5_0", macros);
+    auto pBlobCSEnvironmentLuminance = compileShader(L"data/shaders/EnvironmentSampling.hlsl", "ComputeEnvironmentLuminance", "cs_5_0", macros);
     auto pBlobCSComputeGradient = compileShader(L"data/shaders/Gradient.hlsl", "ComputeGradient", "cs_5_0", macros);
     auto pBlobCSGenerateMipLevel = compileShader(L"data/shaders/LevelOfDetail.hlsl", "GenerateMipLevel", "cs_5_0", macros);
+    auto pBlobCSGenerateMinMaxBase = compileShader(L"data/shaders/LevelOfDetail.hlsl", "GenerateMinMaxBase", "cs_5_0", macros);
+    auto pBlobCSGenerateMinMaxLevel = compileShader(L"data/shaders/LevelOfDetail.hlsl", "GenerateMinMaxLevel", "cs_5_0", macros);
+    auto pBlobCSGenerateLabelMaskBase = compileShader(L"data/shaders/LevelOfDetail.hlsl", "GenerateLabelMaskBase", "cs_5_0", macros);
+    auto pBlobCSGenerateLabelMaskLevel = compileShader(L"data/shaders/LevelOfDetail.hlsl", "GenerateLabelMaskLevel", "cs_5_0", macros);
+    auto pBlobCSComputeClipBox = compileShader(L"data/shaders/ClipBox.hlsl", "ComputeClipBox", "cs_5_0", macros);
     auto pBlobCSResetTiles = compileShader(L"data/shaders/ResetTiles.hlsl", "ResetTiles", "cs_5_0", macros);
     auto pBlobVSBlit = compileShader(L"data/shaders/Blitting.hlsl", "BlitVS", "vs_5_0", macros);
     auto pBlobPSBlit = compileShader(L"data/shaders/Blitting.hlsl", "BlitPS", "ps_5_0", macros);
@@ -49,8 +61,18 @@ MCShaders::MCShaders(DX::ComPtr<ID3D11Device1> m_pDevice) {
     DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSAccumulate->GetBufferPointer(), pBlobCSAccumulate->GetBufferSize(), nullptr, m_PSOAccumulate.pCS.ReleaseAndGetAddressOf()));
     DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSComputeTiles->GetBufferPointer(), pBlobCSComputeTiles->GetBufferSize(), nullptr, m_PSOComputeTiles.pCS.ReleaseAndGetAddressOf()));
     DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSToneMap->GetBufferPointer(), pBlobCSToneMap->GetBufferSize(), nullptr, m_PSOToneMap.pCS.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSUpsample->GetBufferPointer(), pBlobCSUpsample->GetBufferSize(), nullptr, m_PSOUpsample.pCS.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSReproject->GetBufferPointer(), pBlobCSReproject->GetBufferSize(), nullptr, m_PSOReproject.pCS.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSDenoise->GetBufferPointer(), pBlobCSDenoise->GetBufferSize(), nullptr, m_PSODenoise.pCS.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSComputeError->GetBufferPointer(), pBlobCSComputeError->GetBufferSize(), nullptr, m_PSOComputeError.pCS.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSEnvironmentLuminance->GetBufferPointer(), pBlobCSEnvironmentLuminance->GetBufferSize(), nullptr, m_PSOEnvironmentLuminance.pCS.ReleaseAndGetAddressOf()));
     DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSGenerateMipLevel->GetBufferPointer(), pBlobCSGenerateMipLevel->GetBufferSize(), nullptr, m_PSOGenerateMipLevel.pCS.ReleaseAndGetAddressOf()));
     DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSComputeGradient->GetBufferPointer(), pBlobCSComputeGradient->GetBufferSize(), nullptr, m_PSOComputeGradient.pCS.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSGenerateMinMaxBase->GetBufferPointer(), pBlobCSGenerateMinMaxBase->GetBufferSize(), nullptr, m_PSOGenerateMinMaxBase.pCS.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSGenerateMinMaxLevel->GetBufferPointer(), pBlobCSGenerateMinMaxLevel->GetBufferSize(), nullptr, m_PSOGenerateMinMaxLevel.pCS.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSGenerateLabelMaskBase->GetBufferPointer(), pBlobCSGenerateLabelMaskBase->GetBufferSize(), nullptr, m_PSOGenerateLabelMaskBase.pCS.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSGenerateLabelMaskLevel->GetBufferPointer(), pBlobCSGenerateLabelMaskLevel->GetBufferSize(), nullptr, m_PSOGenerateLabelMaskLevel.pCS.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSComputeClipBox->GetBufferPointer(), pBlobCSComputeClipBox->GetBufferSize(), nullptr, m_PSOComputeClipBox.pCS.ReleaseAndGetAddressOf()));
     DX::ThrowIfFailed(m_pDevice->CreateComputeShader(pBlobCSResetTiles->GetBufferPointer(), pBlobCSResetTiles->GetBufferSize(), nullptr, m_PSOResetTiles.pCS.ReleaseAndGetAddressOf()));
 
     DX::ThrowIfFailed(m_pDevice->CreateVertexShader(pBlobVSBlit->GetBufferPointer(), pBlobVSBlit->GetBufferSize(), nullptr, m_PSOBlit.pVS.ReleaseAndGetAddressOf()));
@@ -1,10 +1,11 @@
 #include "pch.h"
 #include "../DeviceResources.h"
+#include "MCSampler.h"
 
 class MCShaders
 {
 	public:
-		MCShaders(DX::ComPtr<ID3D11Device1> m_pDevice);
+		MCShaders(DX::ComPtr<ID3D11Device1> m_pDevice, MCSamplerType samplerType = MCSamplerType::SobolOwen);
 
         DX::GraphicsPSO m_PSODefault = {};
         DX::GraphicsPSO m_PSOBlit = {};
@@ -17,6 +18,16 @@ class MCShaders
         DX::ComputePSO  m_PSOComputeTiles = {};
         DX::ComputePSO  m_PSOResetTiles = {};
         DX::ComputePSO  m_PSOToneMap = {};
+        DX::ComputePSO  m_PSOUpsample = {};
+        DX::ComputePSO  m_PSOReproject = {};
+        DX::ComputePSO  m_PSODenoise = {};
+        DX::ComputePSO  m_PSOComputeError = {};
+        DX::ComputePSO  m_PSOEnvironmentLuminance = {};
         DX::ComputePSO  m_PSOGenerateMipLevel = {};
         DX::ComputePSO  m_PSOComputeGradient = {};
+        DX::ComputePSO  m_PSOGenerateMinMaxBase = {};
+        DX::ComputePSO  m_PSOGenerateMinMaxLevel = {};
+        DX::ComputePSO  m_PSOGenerateLabelMaskBase = {};
+        DX::ComputePSO  m_PSOGenerateLabelMaskLevel = {};
+        DX::ComputePSO  m_PSOComputeClipBox = {};
 };
@@ -0,0 +1,421 @@
+#include "pch.h"
+#include "MCSortLast.h"
+#include "MCVolumeDataLoader.h"
+#include "fmt/format.h"
+#include <ws2tcpip.h>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+namespace {
+    // the ranks wait for the slowest one at every exchange, long enough for a large slab at many samples
+    constexpr uint32_t ReceiveTimeout = 5 * 60 * 1000;
+
+    struct HelloPayload {
+        uint32_t Rank;
+        uint32_t Port;
+    };
+
+    // region of the pixels in a partial image, the statistics are only filled in the result sent to rank 0
+    struct PartialHeader {
+        uint32_t Begin;
+        uint32_t End;
+        F64      RenderTime;
+        F64      CompositeTime;
+        uint64_t BytesSent;
+        uint64_t SlabBytes;
+    };
+
+    auto ThrowSocketError(char const* pFunction) -> void {
+        throw std::system_error(std::error_code(WSAGetLastError(), std::system_category()), pFunction);
+    }
+
+    auto GetLoopbackAddress(uint16_t port) -> sockaddr_in {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return address;
+    }
+
+    // loopback socket on a port picked by the system
+    auto CreateListenSocket(uint16_t& port) -> SOCKET {
+        SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listenSocket == INVALID_SOCKET)
+            ThrowSocketError("socket");
+        sockaddr_in address = GetLoopbackAddress(0);
+        if (bind(listenSocket, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) == SOCKET_ERROR)
+            ThrowSocketError("bind");
+        if (listen(listenSocket, SOMAXCONN) == SOCKET_ERROR)
+            ThrowSocketError("listen");
+        int addressSize = sizeof(address);
+        if (getsockname(listenSocket, reinterpret_cast<sockaddr*>(&address), &addressSize) == SOCKET_ERROR)
+            ThrowSocketError("getsockname");
+        port = ntohs(address.sin_port);
+        return listenSocket;
+    }
+
+    auto ConnectLoopback(uint16_t port) -> MCDistributedConnection {
+        SOCKET connectSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (connectSocket == INVALID_SOCKET)
+            ThrowSocketError("socket");
+        const sockaddr_in address = GetLoopbackAddress(port);
+        if (connect(connectSocket, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) == SOCKET_ERROR) {
+            closesocket(connectSocket);
+            ThrowSocketError("connect");
+        }
+        return MCDistributedConnection(connectSocket);
+    }
+}
+
+MCSortLastNode::MCSortLastNode(MCSortLastSetup const& setup)
+    : m_Rank(0)
+    , m_Setup(setup) {
+
+    const uint32_t rankCount = m_Setup.RankCount;
+    if (rankCount == 0 || rankCount > MCSortLastSetup::MaxRankCount || (rankCount & (rankCount - 1)) != 0)
+        throw std::invalid_argument(fmt::format("MCSortLastNode: {} ranks, binary swap needs a power of two up to {}", rankCount, MCSortLastSetup::MaxRankCount));
+    m_Peers.resize(rankCount);
+
+    WSADATA data = {};
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+        ThrowSocketError("WSAStartup");
+    m_ListenSocket = CreateListenSocket(m_Setup.Ports[0]);
+
+    wchar_t path[MAX_PATH] = {};
+    GetModuleFileNameW(nullptr, path, MAX_PATH);
+    for (uint32_t rank = 1; rank < rankCount; rank++) {
+        std::wstring commandLine = L"\"" + std::wstring(path) + L"\" -sort-last-rank " + std::to_wstring(rank) + L" -sort-last-ranks " + std::to_wstring(rankCount) + L" -distributed-port " + std::to_wstring(m_Setup.Ports[0]);
+
+        STARTUPINFOW startup = {};
+        startup.cb = sizeof(startup);
+        PROCESS_INFORMATION process = {};
+        if (!CreateProcessW(path, commandLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process))
+            throw std::system_error(std::error_code(static_cast<int>(GetLastError()), std::system_category()), "CreateProcessW");
+        m_Processes.push_back(process);
+    }
+
+    // the ranks introduce themselves with the port their binary swap partners connect to
+    for (uint32_t index = 1; index < rankCount; index++) {
+        uint32_t rank = 0;
+        uint16_t port = 0;
+        MCDistributedConnection connection = acceptRank(rank, port);
+        m_Setup.Ports[rank] = port;
+        m_Peers[rank] = std::move(connection);
+    }
+    for (uint32_t rank = 1; rank < rankCount; rank++)
+        m_Peers[rank].send(MCDistributedConnection::Message::DomainSetup, &m_Setup, sizeof(m_Setup));
+
+    loadSlab();
+    connectPartners();
+
+    std::vector<uint8_t> payload;
+    for (uint32_t rank = 1; rank < rankCount; rank++)
+        waitMessage(rank, MCDistributedConnection::Message::DomainReady, payload);
+}
+
+MCSortLastNode::MCSortLastNode(uint32_t rank, uint32_t rankCount, uint16_t port)
+    : m_Rank(rank) {
+
+    if (rank == 0 || rank >= rankCount || rankCount > MCSortLastSetup::MaxRankCount)
+        throw std::invalid_argument(fmt::format("MCSortLastNode: rank {} of {}", rank, rankCount));
+    m_Peers.resize(rankCount);
+
+    WSADATA data = {};
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+        ThrowSocketError("WSAStartup");
+
+    uint16_t listenPort = 0;
+    m_ListenSocket = CreateListenSocket(listenPort);
+    m_Peers[0] = ConnectLoopback(port);
+    const HelloPayload hello = { m_Rank, listenPort };
+    m_Peers[0].send(MCDistributedConnection::Message::Hello, &hello, sizeof(hello));
+
+    std::vector<uint8_t> payload;
+    waitMessage(0, MCDistributedConnection::Message::DomainSetup, payload);
+    if (std::size(payload) != sizeof(m_Setup))
+        throw std::runtime_error(fmt::format("Sort-last: rank {} received a setup of {} bytes", m_Rank, std::size(payload)));
+    std::memcpy(&m_Setup, payload.data(), sizeof(m_Setup));
+    if (m_Setup.RankCount != rankCount)
+        throw std::runtime_error(fmt::format("Sort-last: rank {} was started for {} ranks, the setup has {}", m_Rank, rankCount, m_Setup.RankCount));
+
+    loadSlab();
+    connectPartners();
+    m_Peers[0].send(MCDistributedConnection::Message::DomainReady, nullptr, 0);
+}
+
+MCSortLastNode::~MCSortLastNode() {
+    m_Peers.clear();
+    if (m_ListenSocket != INVALID_SOCKET)
+        closesocket(m_ListenSocket);
+
+    // the ranks exit once their result is sent, a rank still running has lost its peers
+    for (auto const& process : m_Processes) {
+        if (WaitForSingleObject(process.hProcess, 10000) == WAIT_TIMEOUT)
+            TerminateProcess(process.hProcess, 1);
+        CloseHandle(process.hThread);
+        CloseHandle(process.hProcess);
+    }
+    WSACleanup();
+}
+
+auto MCSortLastNode::run(std::vector<MCSortLastStatistics>& statistics) -> std::vector<MCSortLastFragment> {
+    std::vector<uint8_t> payload;
+    if (m_Rank == 0) {
+        for (uint32_t rank = 1; rank < m_Setup.RankCount; rank++)
+            m_Peers[rank].send(MCDistributedConnection::Message::DomainStart, nullptr, 0);
+    } else {
+        waitMessage(0, MCDistributedConnection::Message::DomainStart, payload);
+    }
+
+    MCSortLastStatistics local = {};
+    local.SlabBytes = std::size(m_Intensity) * sizeof(uint16_t);
+
+    // the domain is the slab cut by the clip box of the frame, it can be empty
+    MCCPUFrame frame = m_Setup.Frame;
+    frame.ClipBoxMin.z = (std::max)(frame.ClipBoxMin.z, m_SliceBegin / static_cast<F32>(m_DimensionZ));
+    frame.ClipBoxMax.z = (std::min)(frame.ClipBoxMax.z, m_SliceEnd / static_cast<F32>(m_DimensionZ));
+    const bool isEmpty = frame.ClipBoxMin.z >= frame.ClipBoxMax.z;
+
+    const uint32_t pixelCount = frame.Width * frame.Height;
+    std::vector<Hawk::Math::Vec4> colorSum(pixelCount, Hawk::Math::Vec4(0.0f));
+    std::vector<Hawk::Math::Vec2> depthRange(pixelCount, Hawk::Math::Vec2(std::numeric_limits<F32>::max(), -std::numeric_limits<F32>::max()));
+
+    const auto timeRender = std::chrono::high_resolution_clock::now();
+    for (uint32_t sampleIndex = 0; sampleIndex < m_Setup.SampleCount && !isEmpty; sampleIndex++) {
+        frame.SampleIndex = sampleIndex;
+        m_Renderer->renderPartial(frame, colorSum, depthRange);
+    }
+    std::vector<MCSortLastFragment> image(pixelCount);
+    for (uint32_t index = 0; index < pixelCount; index++)
+        image[index] = { colorSum[index] / static_cast<F32>((std::max)(m_Setup.SampleCount, 1u)), depthRange[index] };
+    local.RenderTime = std::chrono::duration<F64, std::milli>(std::chrono::high_resolution_clock::now() - timeRender).count();
+
+    const auto timeComposite = std::chrono::high_resolution_clock::now();
+    uint32_t regionBegin = 0;
+    uint32_t regionEnd = pixelCount;
+    binarySwap(image, regionBegin, regionEnd, local);
+    local.CompositeTime = std::chrono::duration<F64, std::milli>(std::chrono::high_resolution_clock::now() - timeComposite).count();
+
+    if (m_Rank != 0) {
+        sendPartial(m_Peers[0], MCDistributedConnection::Message::DomainResult, image, regionBegin, regionEnd, local);
+        return {};
+    }
+
+    // the regions owned after the last round tile the image, rank 0 keeps its own in place
+    statistics.assign(m_Setup.RankCount, MCSortLastStatistics());
+    statistics[0] = local;
+    for (uint32_t rank = 1; rank < m_Setup.RankCount; rank++) {
+        waitMessage(rank, MCDistributedConnection::Message::DomainResult, payload);
+        PartialHeader header = {};
+        std::memcpy(&header, payload.data(), (std::min)(sizeof(header), std::size(payload)));
+        if (header.End > pixelCount || header.Begin > header.End || std::size(payload) != sizeof(header) + size_t(header.End - header.Begin) * sizeof(MCSortLastFragment))
+            throw std::runtime_error(fmt::format("Sort-last: malformed result from rank {}", rank));
+        std::memcpy(image.data() + header.Begin, payload.data() + sizeof(header), size_t(header.End - header.Begin) * sizeof(MCSortLastFragment));
+        statistics[rank] = { header.RenderTime, header.CompositeTime, header.BytesSent, header.SlabBytes };
+    }
+    return image;
+}
+
+auto MCSortLastNode::runRank(MCDistributedSettings const& settings) -> int {
+    try {
+        MCSortLastNode node(settings.SortLastRank, settings.SortLastRankCount, settings.Port);
+        std::vector<MCSortLastStatistics> statistics;
+        node.run(statistics);
+    } catch (std::exception const& e) {
+        OutputDebugStringA(fmt::format("Sort-last: rank {} failed: {}\n", settings.SortLastRank, e.what()).c_str());
+        return 1;
+    }
+    return 0;
+}
+
+auto MCSortLastNode::runScalingBenchmark(MCSortLastSetup setup, uint32_t maxRankCount) -> std::string {
+    const uint32_t pixelCount = setup.Frame.Width * setup.Frame.Height;
+    std::string message = fmt::format("Sort-last {}x{}, {} spp, z slabs with binary swap compositing:\n", setup.Frame.Width, setup.Frame.Height, setup.SampleCount);
+
+    std::vector<MCSortLastFragment> reference;
+    F64 referenceTime = 0.0;
+    for (uint32_t rankCount = 1; rankCount <= (std::min)(maxRankCount, MCSortLastSetup::MaxRankCount); rankCount *= 2) {
+        setup.RankCount = rankCount;
+        MCSortLastNode node(setup);
+
+        // the processes are started and their slabs loaded, only rendering, compositing and gathering are timed
+        std::vector<MCSortLastStatistics> statistics;
+        const auto timeBegin = std::chrono::high_resolution_clock::now();
+        const std::vector<MCSortLastFragment> image = node.run(statistics);
+        const F64 elapsedTime = std::chrono::duration<F64, std::milli>(std::chrono::high_resolution_clock::now() - timeBegin).count();
+        if (rankCount == 1) {
+            reference = image;
+            referenceTime = elapsedTime;
+        }
+
+        // shadow rays cut at the slab boundaries, plus the noise of camera rays marched per slab
+        F64 squaredError = 0.0;
+        for (uint32_t index = 0; index < pixelCount; index++) {
+            const Hawk::Math::Vec4 difference = image[index].Color - reference[index].Color;
+            squaredError += difference.x * difference.x + difference.y * difference.y + difference.z * difference.z;
+        }
+
+        MCSortLastStatistics maximum = {};
+        F64 renderTimeMin = std::numeric_limits<F64>::max();
+        for (auto const& rank : statistics) {
+            renderTimeMin = (std::min)(renderTimeMin, rank.RenderTime);
+            maximum.RenderTime = (std::max)(maximum.RenderTime, rank.RenderTime);
+            maximum.CompositeTime = (std::max)(maximum.CompositeTime, rank.CompositeTime);
+            maximum.BytesSent = (std::max)(maximum.BytesSent, rank.BytesSent);
+            maximum.SlabBytes = (std::max)(maximum.SlabBytes, rank.SlabBytes);
+        }
+
+        message += fmt::format("  {} rank(s): {:.1f} ms, speedup {:.2f}x, efficiency {:.0f}%, render {:.1f} .. {:.1f} ms, binary swap {:.1f} ms, {:.2f} MB sent and {:.1f} MB of volume per rank, RMSE {:.2e} against 1 rank\n",
+            rankCount, elapsedTime, referenceTime / elapsedTime, 100.0 * referenceTime / (elapsedTime * rankCount), renderTimeMin, maximum.RenderTime, maximum.CompositeTime,
+            maximum.BytesSent / 1.0e6, maximum.SlabBytes / 1.0e6, std::sqrt(squaredError / (3.0 * pixelCount)));
+    }
+    return message;
+}
+
+auto MCSortLastNode::getSlab(uint32_t rank, uint32_t rankCount, uint32_t dimensionZ, uint32_t& sliceBegin, uint32_t& sliceEnd) -> void {
+    sliceBegin = static_cast<uint32_t>(uint64_t(dimensionZ) * rank / rankCount);
+    sliceEnd = static_cast<uint32_t>(uint64_t(dimensionZ) * (rank + 1) / rankCount);
+}
+
+auto MCSortLastNode::composite(MCSortLastFragment const& lhs, MCSortLastFragment const& rhs) -> MCSortLastFragment {
+    // the domains are disjoint convex boxes, their intervals along a ray do not overlap
+    auto const& front = lhs.DepthRange.x <= rhs.DepthRange.x ? lhs : rhs;
+    auto const& back = lhs.DepthRange.x <= rhs.DepthRange.x ? rhs : lhs;
+
+    MCSortLastFragment result;
+    result.Color = front.Color + (1.0f - front.Color.w) * back.Color;
+    result.DepthRange = Hawk::Math::Vec2((std::min)(lhs.DepthRange.x, rhs.DepthRange.x), (std::max)(lhs.DepthRange.y, rhs.DepthRange.y));
+    return result;
+}
+
+auto MCSortLastNode::loadSlab() -> void {
+    // the header alone gives the depth of the volume
+    MCVolumeDataLoader::readIntensity(m_Setup.VolumeFileName, 0, 0, m_DimensionX, m_DimensionY, m_DimensionZ);
+    getSlab(m_Rank, m_Setup.RankCount, m_DimensionZ, m_SliceBegin, m_SliceEnd);
+
+    // ghost slices for the trilinear fetches and the central differences at the faces of the slab
+    const uint32_t loadBegin = m_SliceBegin > GhostSliceCount ? m_SliceBegin - GhostSliceCount : 0;
+    const uint32_t loadEnd = (std::min)(m_SliceEnd + GhostSliceCount, static_cast<uint32_t>(m_DimensionZ));
+    m_Intensity = MCVolumeDataLoader::readIntensity(m_Setup.VolumeFileName, loadBegin, loadEnd, m_DimensionX, m_DimensionY, m_DimensionZ);
+
+    m_TransferFunctions = std::make_unique<MCTransferFunction>(m_Setup.TransferFunctionFileName);
+    m_Renderer = std::make_unique<MCCPURenderer>(m_Intensity.data(), m_DimensionX, m_DimensionY, m_DimensionZ, *m_TransferFunctions, m_Setup.SamplingCount);
+    m_Renderer->setSlab(loadBegin, loadEnd);
+}
+
+auto MCSortLastNode::connectPartners() -> void {
+    // the lower rank of a pair listens, connecting first then accepting cannot deadlock as the listen backlog holds the connections
+    uint32_t acceptCount = 0;
+    for (uint32_t bit = 1; bit < m_Setup.RankCount; bit <<= 1) {
+        const uint32_t partner = m_Rank ^ bit;
+        if (partner == 0 || m_Rank == 0)
+            continue;
+        if (partner < m_Rank) {
+            m_Peers[partner] = ConnectLoopback(m_Setup.Ports[partner]);
+            const HelloPayload hello = { m_Rank, 0 };
+            m_Peers[partner].send(MCDistributedConnection::Message::Hello, &hello, sizeof(hello));
+        } else {
+            acceptCount++;
+        }
+    }
+
+    for (uint32_t index = 0; index < acceptCount; index++) {
+        uint32_t rank = 0;
+        uint16_t port = 0;
+        MCDistributedConnection connection = acceptRank(rank, port);
+        m_Peers[rank] = std::move(connection);
+    }
+
+    // a partial image of the whole frame is the largest message of a run
+    const size_t maxMessageSize = sizeof(PartialHeader) + size_t(m_Setup.Frame.Width) * m_Setup.Frame.Height * sizeof(MCSortLastFragment);
+    for (auto& peer : m_Peers)
+        peer.setMaxMessageSize(maxMessageSize);
+}
+
+auto MCSortLastNode::binarySwap(std::vector<MCSortLastFragment>& image, uint32_t& regionBegin, uint32_t& regionEnd, MCSortLastStatistics& statistics) -> void {
+    std::vector<uint8_t> payload;
+    for (uint32_t bit = 1; bit < m_Setup.RankCount; bit <<= 1) {
+        const uint32_t partner = m_Rank ^ bit;
+        const uint32_t regionMiddle = regionBegin + (regionEnd - regionBegin) / 2;
+        const bool isLower = (m_Rank & bit) == 0;
+        const uint32_t keepBegin = isLower ? regionBegin : regionMiddle;
+        const uint32_t keepEnd = isLower ? regionMiddle : regionEnd;
+        const uint32_t sendBegin = isLower ? regionMiddle : regionBegin;
+        const uint32_t sendEnd = isLower ? regionEnd : regionMiddle;
+
+        // both halves cross at once, a pair sending first and receiving after would block on full socket buffers.
+        // The sender has its own handle, the connection is only touched by this thread
+        MCDistributedConnection senderConnection = m_Peers[partner].duplicate();
+        if (!senderConnection.isConnected())
+            throw std::runtime_error(fmt::format("Sort-last: rank {} cannot send to rank {}", m_Rank, partner));
+
+        uint64_t bytesSent = 0;
+        std::thread sender([&]() {
+            bytesSent = sendPartial(senderConnection, MCDistributedConnection::Message::DomainPartial, image, sendBegin, sendEnd, statistics);
+        });
+        MCDistributedConnection::Message type = {};
+        const bool isReceived = m_Peers[partner].receive(type, payload, ReceiveTimeout);
+        sender.join();
+        statistics.BytesSent += bytesSent;
+
+        PartialHeader header = {};
+        std::memcpy(&header, payload.data(), (std::min)(sizeof(header), std::size(payload)));
+        if (!isReceived || type != MCDistributedConnection::Message::DomainPartial || header.Begin != keepBegin || header.End != keepEnd
+            || std::size(payload) != sizeof(header) + size_t(keepEnd - keepBegin) * sizeof(MCSortLastFragment))
+            throw std::runtime_error(fmt::format("Sort-last: rank {} got no partial image from rank {}", m_Rank, partner));
+
+        for (uint32_t index = keepBegin; index < keepEnd; index++) {
+            MCSortLastFragment fragment;
+            std::memcpy(&fragment, payload.data() + sizeof(header) + size_t(index - keepBegin) * sizeof(MCSortLastFragment), sizeof(fragment));
+            image[index] = composite(image[index], fragment);
+        }
+        regionBegin = keepBegin;
+        regionEnd = keepEnd;
+    }
+}
+
+auto MCSortLastNode::sendPartial(MCDistributedConnection& connection, MCDistributedConnection::Message type, std::vector<MCSortLastFragment> const& image, uint32_t regionBegin, uint32_t regionEnd, MCSortLastStatistics const& statistics) -> uint64_t {
+    const PartialHeader header = { regionBegin, regionEnd, statistics.RenderTime, statistics.CompositeTime, statistics.BytesSent, statistics.SlabBytes };
+    std::vector<uint8_t> payload(sizeof(header) + size_t(regionEnd - regionBegin) * sizeof(MCSortLastFragment));
+    std::memcpy(payload.data(), &header, sizeof(header));
+    std::memcpy(payload.data() + sizeof(header), image.data() + regionBegin, size_t(regionEnd - regionBegin) * sizeof(MCSortLastFragment));
+    if (!connection.send(type, payload.data(), std::size(payload)))
+        return 0;
+    return std::size(payload);
+}
+
+auto MCSortLastNode::waitMessage(uint32_t rank, MCDistributedConnection::Message type, std::vector<uint8_t>& payload) -> void {
+    MCDistributedConnection::Message received = {};
+    if (!m_Peers[rank].receive(received, payload, ReceiveTimeout) || received != type)
+        throw std::runtime_error(fmt::format("Sort-last: rank {} expected message {} from rank {}", m_Rank, static_cast<uint32_t>(type), rank));
+}
+
+auto MCSortLastNode::acceptRank(uint32_t& rank, uint16_t& port) -> MCDistributedConnection {
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(m_ListenSocket, &readSet);
+    timeval timeout = {};
+    timeout.tv_sec = ReceiveTimeout / 1000;
+    if (select(0, &readSet, nullptr, nullptr, &timeout) <= 0)
+        throw std::runtime_error(fmt::format("Sort-last: rank {} timed out waiting for a connection", m_Rank));
+
+    SOCKET acceptSocket = accept(m_ListenSocket, nullptr, nullptr);
+    if (acceptSocket == INVALID_SOCKET)
+        ThrowSocketError("accept");
+    MCDistributedConnection connection(acceptSocket);
+
+    MCDistributedConnection::Message type = {};
+    std::vector<uint8_t> payload;
+    HelloPayload hello = {};
+    if (!connection.receive(type, payload, ReceiveTimeout) || type != MCDistributedConnection::Message::Hello || std::size(payload) != sizeof(hello))
+        throw std::runtime_error(fmt::format("Sort-last: rank {} got a connection without hello", m_Rank));
+    std::memcpy(&hello, payload.data(), sizeof(hello));
+    if (hello.Rank == m_Rank || hello.Rank >= std::size(m_Peers))
+        throw std::runtime_error(fmt::format("Sort-last: rank {} got a hello from rank {}", m_Rank, hello.Rank));
+    rank = hello.Rank;
+    port = static_cast<uint16_t>(hello.Port);
+    return connection;
+}
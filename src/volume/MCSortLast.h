@@ -0,0 +1,107 @@
+#pragma once
+
+#include "pch.h"
+#include "MCCPURenderer.h"
+#include "MCDistributed.h"
+#include "MCTransferFunction.h"
+#include <Hawk/Math/Functions.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+// premultiplied color and coverage of a domain in one pixel, with the interval of the pixel ray inside the domain
+struct MCSortLastFragment {
+	Hawk::Math::Vec4 Color;
+	Hawk::Math::Vec2 DepthRange;
+};
+
+// sent by rank 0 to every rank of a run, the ranks read their slab of the volume file themselves
+struct MCSortLastSetup {
+	static constexpr uint32_t MaxRankCount = 64;
+
+	MCCPUFrame Frame;
+	uint32_t   RankCount;
+	uint32_t   SampleCount;
+	uint32_t   SamplingCount;
+	uint16_t   Ports[MaxRankCount];
+	char       VolumeFileName[MAX_PATH];
+	char       TransferFunctionFileName[MAX_PATH];
+};
+
+struct MCSortLastStatistics {
+	F64      RenderTime = 0.0;
+	F64      CompositeTime = 0.0;
+	uint64_t BytesSent = 0;
+	uint64_t SlabBytes = 0;
+};
+
+/*
+* Sort-last rendering of a volume split in z slabs, one per rank, every rank is a process holding only its slab and two ghost slices
+* on each side. A rank path traces its slab into a partial image, then binary swap composites the ranks in log2(rankCount) rounds:
+* the ranks of a pair exchange half of the pixels they own and keep the other half composited front to back by the depth ranges.
+* Rank 0 gathers the composited pieces. The rank count is a power of two.
+*
+* Camera rays are exact across the domains, the over operator carries the transmittance of the slabs in front. Shadow rays are only
+* marched through the slab of their scatter event, the occlusion by the other slabs is ignored and the regions shadowed across a slab
+* boundary come out too bright. The scaling benchmark reports this error against the image of a single rank.
+*/
+class MCSortLastNode {
+	public:
+		// rank 0 in the calling process, spawns the other ranks of the run on this machine
+		MCSortLastNode(MCSortLastSetup const& setup);
+
+		// rank 1 .. rankCount - 1, in a process spawned by rank 0 listening on port
+		MCSortLastNode(uint32_t rank, uint32_t rankCount, uint16_t port);
+
+		~MCSortLastNode();
+
+		MCSortLastNode(MCSortLastNode const&) = delete;
+
+		auto operator=(MCSortLastNode const&) -> MCSortLastNode& = delete;
+
+		// renders the slab, composites and gathers: the statistics of every rank and the final image on rank 0, nothing on the others
+		auto run(std::vector<MCSortLastStatistics>& statistics) -> std::vector<MCSortLastFragment>;
+
+		// entry point of the processes spawned with -sort-last-rank
+		static auto runRank(MCDistributedSettings const& settings) -> int;
+
+		// runs 1, 2, 4 .. maxRankCount ranks on the frame of the setup
+		static auto runScalingBenchmark(MCSortLastSetup setup, uint32_t maxRankCount) -> std::string;
+
+		// slices [sliceBegin, sliceEnd) of the domain of a rank
+		static auto getSlab(uint32_t rank, uint32_t rankCount, uint32_t dimensionZ, uint32_t& sliceBegin, uint32_t& sliceEnd) -> void;
+
+		// over operator, the fragment nearer along the pixel ray is in front
+		static auto composite(MCSortLastFragment const& lhs, MCSortLastFragment const& rhs) -> MCSortLastFragment;
+
+		static constexpr uint32_t GhostSliceCount = 2;
+
+	private:
+		auto loadSlab() -> void;
+
+		// the partners of the binary swap rounds, rank 0 is already connected to every rank
+		auto connectPartners() -> void;
+
+		auto binarySwap(std::vector<MCSortLastFragment>& image, uint32_t& regionBegin, uint32_t& regionEnd, MCSortLastStatistics& statistics) -> void;
+
+		auto sendPartial(MCDistributedConnection& connection, MCDistributedConnection::Message type, std::vector<MCSortLastFragment> const& image, uint32_t regionBegin, uint32_t regionEnd, MCSortLastStatistics const& statistics) -> uint64_t;
+
+		auto waitMessage(uint32_t rank, MCDistributedConnection::Message type, std::vector<uint8_t>& payload) -> void;
+
+		auto acceptRank(uint32_t& rank, uint16_t& port) -> MCDistributedConnection;
+
+		uint32_t                                m_Rank = 0;
+		MCSortLastSetup                         m_Setup = {};
+		SOCKET                                  m_ListenSocket = INVALID_SOCKET;
+		std::vector<MCDistributedConnection>    m_Peers;
+		std::vector<PROCESS_INFORMATION>        m_Processes;
+
+		uint32_t                                m_SliceBegin = 0;
+		uint32_t                                m_SliceEnd = 0;
+		uint16_t                                m_DimensionX = 0;
+		uint16_t                                m_DimensionY = 0;
+		uint16_t                                m_DimensionZ = 0;
+		std::vector<uint16_t>                   m_Intensity;
+		std::unique_ptr<MCTransferFunction>     m_TransferFunctions;
+		std::unique_ptr<MCCPURenderer>          m_Renderer;
+};
@@ -0,0 +1,231 @@
+#include "pch.h"
+#include "MCThreadPool.h"
+#include <chrono>
+#include <system_error>
+
+auto MCNumaTopology::query() -> MCNumaTopology {
+    MCNumaTopology topology;
+
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationNumaNode, nullptr, &length);
+    std::vector<uint8_t> buffer(length);
+    if (!std::empty(buffer) && GetLogicalProcessorInformationEx(RelationNumaNode, reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data()), &length)) {
+        for (DWORD offset = 0; offset < length;) {
+            auto const& info = *reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data() + offset);
+            offset += info.Size;
+
+            Node node;
+            node.NodeNumber = info.NumaNode.NodeNumber;
+            for (uint32_t bit = 0; bit < 8 * sizeof(KAFFINITY); bit++) {
+                if (info.NumaNode.GroupMask.Mask & (KAFFINITY(1) << bit)) {
+                    GROUP_AFFINITY affinity = {};
+                    affinity.Group = info.NumaNode.GroupMask.Group;
+                    affinity.Mask = KAFFINITY(1) << bit;
+                    node.Processors.push_back(affinity);
+                }
+            }
+            // memory only nodes have nothing to run workers on
+            if (!std::empty(node.Processors))
+                topology.Nodes.push_back(std::move(node));
+        }
+    }
+
+    if (std::empty(topology.Nodes)) {
+        Node node;
+        const uint32_t processorCount = (std::min)((std::max)(std::thread::hardware_concurrency(), 1u), static_cast<uint32_t>(8 * sizeof(KAFFINITY)));
+        for (uint32_t bit = 0; bit < processorCount; bit++) {
+            GROUP_AFFINITY affinity = {};
+            affinity.Mask = KAFFINITY(1) << bit;
+            node.Processors.push_back(affinity);
+        }
+        topology.Nodes.push_back(std::move(node));
+    }
+    return topology;
+}
+
+MCThreadPool::MCThreadPool(MCNumaTopology const& topology, uint32_t nodeCount)
+    : m_NodeCount((std::max)(1u, (std::min)(nodeCount, static_cast<uint32_t>(std::size(topology.Nodes)))))
+    , m_NodeQueues(m_NodeCount) {
+
+    for (uint32_t nodeIndex = 0; nodeIndex < m_NodeCount; nodeIndex++) {
+        m_NodeNumbers.push_back(topology.Nodes[nodeIndex].NodeNumber);
+        for (size_t index = 0; index < std::size(topology.Nodes[nodeIndex].Processors); index++)
+            m_WorkerNodes.push_back(nodeIndex);
+    }
+    m_WorkerStatistics.resize(std::size(m_WorkerNodes));
+
+    // workers are numbered node by node, the slabs written by MCNumaVolume follow the same order
+    uint32_t workerIndex = 0;
+    for (uint32_t nodeIndex = 0; nodeIndex < m_NodeCount; nodeIndex++) {
+        for (auto const& affinity : topology.Nodes[nodeIndex].Processors)
+            m_Workers.emplace_back(&MCThreadPool::workerMain, this, workerIndex++, affinity);
+    }
+}
+
+MCThreadPool::~MCThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_IsStopping = true;
+    }
+    m_WakeCondition.notify_all();
+    for (auto& worker : m_Workers)
+        worker.join();
+}
+
+auto MCThreadPool::dispatch(uint32_t taskCount, std::function<void(uint32_t, uint32_t)> const& task) -> void {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    for (uint32_t nodeIndex = 0; nodeIndex < m_NodeCount; nodeIndex++) {
+        m_NodeQueues[nodeIndex].Cursor.store(static_cast<uint32_t>(uint64_t(taskCount) * nodeIndex / m_NodeCount), std::memory_order_relaxed);
+        m_NodeQueues[nodeIndex].End = static_cast<uint32_t>(uint64_t(taskCount) * (nodeIndex + 1) / m_NodeCount);
+    }
+    m_pTask = &task;
+    m_IsBroadcast = false;
+    m_PendingWorkers = getWorkerCount();
+    m_Generation++;
+    m_WakeCondition.notify_all();
+    m_DoneCondition.wait(lock, [this]() { return m_PendingWorkers == 0; });
+    m_pTask = nullptr;
+}
+
+auto MCThreadPool::broadcast(std::function<void(uint32_t)> const& task) -> void {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_pBroadcastTask = &task;
+    m_IsBroadcast = true;
+    m_PendingWorkers = getWorkerCount();
+    m_Generation++;
+    m_WakeCondition.notify_all();
+    m_DoneCondition.wait(lock, [this]() { return m_PendingWorkers == 0; });
+    m_pBroadcastTask = nullptr;
+}
+
+auto MCThreadPool::getNodeStatistics() const -> std::vector<MCThreadPoolNodeStatistics> {
+    std::vector<MCThreadPoolNodeStatistics> statistics(m_NodeCount);
+    for (uint32_t workerIndex = 0; workerIndex < getWorkerCount(); workerIndex++) {
+        auto& node = statistics[m_WorkerNodes[workerIndex]];
+        node.LocalTaskCount += m_WorkerStatistics[workerIndex].LocalTaskCount;
+        node.StolenTaskCount += m_WorkerStatistics[workerIndex].StolenTaskCount;
+        node.RayCount += m_WorkerStatistics[workerIndex].RayCount;
+        node.BusyTime += m_WorkerStatistics[workerIndex].BusyTime;
+    }
+    return statistics;
+}
+
+auto MCThreadPool::resetStatistics() -> void {
+    for (auto& statistics : m_WorkerStatistics)
+        statistics = {};
+}
+
+auto MCThreadPool::workerMain(uint32_t workerIndex, GROUP_AFFINITY affinity) -> void {
+    // the scheduler keeps the thread on this processor, its first touch allocations land on the local node
+    SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+
+    uint64_t generation = 0;
+    for (;;) {
+        bool isBroadcast = false;
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_WakeCondition.wait(lock, [&]() { return m_IsStopping || m_Generation != generation; });
+            if (m_IsStopping)
+                return;
+            generation = m_Generation;
+            isBroadcast = m_IsBroadcast;
+        }
+
+        if (isBroadcast)
+            (*m_pBroadcastTask)(workerIndex);
+        else
+            runTasks(workerIndex);
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (--m_PendingWorkers == 0)
+            m_DoneCondition.notify_one();
+    }
+}
+
+auto MCThreadPool::runTasks(uint32_t workerIndex) -> void {
+    const auto timeBegin = std::chrono::high_resolution_clock::now();
+    auto& statistics = m_WorkerStatistics[workerIndex];
+    const uint32_t workerNode = m_WorkerNodes[workerIndex];
+
+    // own node first, then steal from the next nodes in turn
+    for (uint32_t offset = 0; offset < m_NodeCount; offset++) {
+        auto& queue = m_NodeQueues[(workerNode + offset) % m_NodeCount];
+        for (uint32_t taskIndex = queue.Cursor.fetch_add(1, std::memory_order_relaxed); taskIndex < queue.End; taskIndex = queue.Cursor.fetch_add(1, std::memory_order_relaxed)) {
+            (*m_pTask)(taskIndex, workerIndex);
+            if (offset == 0)
+                statistics.LocalTaskCount++;
+            else
+                statistics.StolenTaskCount++;
+        }
+    }
+    statistics.BusyTime += std::chrono::duration<F64, std::milli>(std::chrono::high_resolution_clock::now() - timeBegin).count();
+}
+
+MCNumaVolume::MCNumaVolume(uint16_t const* pSource, size_t count, MCThreadPool& pool, MCVolumePlacement placement)
+    : m_Placement(placement) {
+
+    const size_t size = count * sizeof(uint16_t);
+    const uint32_t workerCount = pool.getWorkerCount();
+
+    switch (placement) {
+        case MCVolumePlacement::FirstTouch: {
+            // committed but not backed yet, each page is placed on the node of the worker that writes it first
+            m_Copies.push_back(static_cast<uint16_t*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE)));
+            if (!m_Copies.back())
+                throw std::system_error(std::error_code(static_cast<int>(GetLastError()), std::system_category()), "VirtualAlloc");
+            pool.broadcast([&](uint32_t workerIndex) {
+                const size_t begin = count * workerIndex / workerCount;
+                const size_t end = count * (workerIndex + 1) / workerCount;
+                std::memcpy(m_Copies[0] + begin, pSource + begin, (end - begin) * sizeof(uint16_t));
+            });
+            break;
+        }
+        case MCVolumePlacement::Interleaved: {
+            SYSTEM_INFO info = {};
+            GetSystemInfo(&info);
+            const size_t chunkSize = info.dwAllocationGranularity;
+
+            auto pData = static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_READWRITE));
+            if (!pData)
+                throw std::system_error(std::error_code(static_cast<int>(GetLastError()), std::system_category()), "VirtualAlloc");
+            m_Copies.push_back(reinterpret_cast<uint16_t*>(pData));
+            for (size_t offset = 0; offset < size; offset += chunkSize) {
+                const DWORD nodeNumber = pool.getNodeNumber(static_cast<uint32_t>((offset / chunkSize) % pool.getNodeCount()));
+                if (!VirtualAllocExNuma(GetCurrentProcess(), pData + offset, (std::min)(chunkSize, size - offset), MEM_COMMIT, PAGE_READWRITE, nodeNumber))
+                    throw std::system_error(std::error_code(static_cast<int>(GetLastError()), std::system_category()), "VirtualAllocExNuma");
+            }
+            std::memcpy(m_Copies[0], pSource, size);
+            break;
+        }
+        case MCVolumePlacement::Replicated: {
+            for (uint32_t nodeIndex = 0; nodeIndex < pool.getNodeCount(); nodeIndex++)
+                m_Copies.push_back(allocate(size, pool.getNodeNumber(nodeIndex)));
+
+            // the workers of each node split the copy of their node
+            std::vector<uint32_t> nodeWorkerCount(pool.getNodeCount());
+            std::vector<uint32_t> workerRank(workerCount);
+            for (uint32_t workerIndex = 0; workerIndex < workerCount; workerIndex++)
+                workerRank[workerIndex] = nodeWorkerCount[pool.getWorkerNode(workerIndex)]++;
+
+            pool.broadcast([&](uint32_t workerIndex) {
+                const uint32_t nodeIndex = pool.getWorkerNode(workerIndex);
+                const size_t begin = count * workerRank[workerIndex] / nodeWorkerCount[nodeIndex];
+                const size_t end = count * (workerRank[workerIndex] + 1) / nodeWorkerCount[nodeIndex];
+                std::memcpy(m_Copies[nodeIndex] + begin, pSource + begin, (end - begin) * sizeof(uint16_t));
+            });
+            break;
+        }
+    }
+}
+
+MCNumaVolume::~MCNumaVolume() {
+    for (auto pCopy : m_Copies)
+        VirtualFree(pCopy, 0, MEM_RELEASE);
+}
+
+auto MCNumaVolume::allocate(size_t size, DWORD nodeNumber) -> uint16_t* {
+    auto pData = static_cast<uint16_t*>(VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, nodeNumber));
+    if (!pData)
+        throw std::system_error(std::error_code(static_cast<int>(GetLastError()), std::system_category()), "VirtualAllocExNuma");
+    return pData;
+}
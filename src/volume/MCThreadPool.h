@@ -0,0 +1,134 @@
+#pragma once
+
+#include "pch.h"
+#include <Hawk/Common/Defines.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// NUMA nodes of the machine, one per socket on the render nodes, with the logical processors of each
+struct MCNumaTopology {
+	struct Node {
+		uint32_t                    NodeNumber = 0;
+		std::vector<GROUP_AFFINITY> Processors;
+	};
+
+	std::vector<Node> Nodes;
+
+	static auto query() -> MCNumaTopology;
+};
+
+struct MCThreadPoolNodeStatistics {
+	uint64_t LocalTaskCount = 0;
+	uint64_t StolenTaskCount = 0;
+	uint64_t RayCount = 0;
+	F64      BusyTime = 0.0;
+};
+
+/*
+* Persistent worker pool, one worker pinned to each logical processor of the first nodeCount NUMA nodes.
+* dispatch splits the tasks into one contiguous range per node, the workers of a node drain their own range
+* before stealing from the other nodes so neighbouring tiles stay on the memory and caches of one socket.
+*/
+class MCThreadPool {
+	public:
+		MCThreadPool(MCNumaTopology const& topology, uint32_t nodeCount);
+
+		~MCThreadPool();
+
+		MCThreadPool(MCThreadPool const&) = delete;
+
+		auto operator=(MCThreadPool const&) -> MCThreadPool& = delete;
+
+		// runs task(taskIndex, workerIndex) for every task in [0, taskCount) and waits for completion
+		auto dispatch(uint32_t taskCount, std::function<void(uint32_t, uint32_t)> const& task) -> void;
+
+		// runs task(workerIndex) once on every worker, used for first touch initialization
+		auto broadcast(std::function<void(uint32_t)> const& task) -> void;
+
+		auto addRays(uint32_t workerIndex, uint64_t rayCount) -> void { m_WorkerStatistics[workerIndex].RayCount += rayCount; }
+
+		auto getNodeStatistics() const -> std::vector<MCThreadPoolNodeStatistics>;
+
+		auto resetStatistics() -> void;
+
+		auto getWorkerCount() const -> uint32_t { return static_cast<uint32_t>(std::size(m_Workers)); }
+
+		auto getNodeCount() const -> uint32_t { return m_NodeCount; }
+
+		// index of the node in the topology, not the NUMA node number
+		auto getWorkerNode(uint32_t workerIndex) const -> uint32_t { return m_WorkerNodes[workerIndex]; }
+
+		auto getNodeNumber(uint32_t nodeIndex) const -> uint32_t { return m_NodeNumbers[nodeIndex]; }
+
+	private:
+		// padded to a cache line, the cursors are hammered by all the workers of a node
+		struct alignas(64) NodeQueue {
+			std::atomic<uint32_t> Cursor = 0;
+			uint32_t              End = 0;
+		};
+
+		struct alignas(64) WorkerStatistics {
+			uint64_t LocalTaskCount = 0;
+			uint64_t StolenTaskCount = 0;
+			uint64_t RayCount = 0;
+			F64      BusyTime = 0.0;
+		};
+
+		auto workerMain(uint32_t workerIndex, GROUP_AFFINITY affinity) -> void;
+
+		auto runTasks(uint32_t workerIndex) -> void;
+
+		uint32_t                      m_NodeCount = 0;
+		std::vector<std::thread>      m_Workers;
+		std::vector<uint32_t>         m_WorkerNodes;
+		std::vector<uint32_t>         m_NodeNumbers;
+		std::vector<NodeQueue>        m_NodeQueues;
+		std::vector<WorkerStatistics> m_WorkerStatistics;
+
+		std::mutex                    m_Mutex;
+		std::condition_variable       m_WakeCondition;
+		std::condition_variable       m_DoneCondition;
+		uint64_t                      m_Generation = 0;
+		uint32_t                      m_PendingWorkers = 0;
+		bool                          m_IsStopping = false;
+		bool                          m_IsBroadcast = false;
+
+		std::function<void(uint32_t, uint32_t)> const* m_pTask = nullptr;
+		std::function<void(uint32_t)> const*           m_pBroadcastTask = nullptr;
+};
+
+enum class MCVolumePlacement {
+	FirstTouch,
+	Interleaved,
+	Replicated
+};
+
+/*
+* Copy of the volume in memory placed explicitly across the NUMA nodes of a pool:
+* FirstTouch  - z slabs are written by the workers of successive nodes, each slab lives on its writer's node
+* Interleaved - pages are committed round robin on the nodes, every socket sees the same average bandwidth
+* Replicated  - one copy per node written by a local worker, every fetch is local at the cost of N times the memory
+*/
+class MCNumaVolume {
+	public:
+		MCNumaVolume(uint16_t const* pSource, size_t count, MCThreadPool& pool, MCVolumePlacement placement);
+
+		~MCNumaVolume();
+
+		MCNumaVolume(MCNumaVolume const&) = delete;
+
+		auto operator=(MCNumaVolume const&) -> MCNumaVolume& = delete;
+
+		// copy read by the workers of the node, the only copy unless replicated
+		auto getData(uint32_t nodeIndex) const -> uint16_t const* { return m_Copies[m_Placement == MCVolumePlacement::Replicated ? nodeIndex : 0]; }
+
+	private:
+		auto allocate(size_t size, DWORD nodeNumber) -> uint16_t*;
+
+		MCVolumePlacement      m_Placement = MCVolumePlacement::FirstTouch;
+		std::vector<uint16_t*> m_Copies;
+};
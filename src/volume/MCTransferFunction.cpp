@@ -1,19 +1,294 @@
 #include "pch.h"
+#include <chrono>
+#include <cstring>
 #include <fstream>
+#include <random>
+#include <stdexcept>
 #include "MCTransferFunction.h"
 #include "nlohmann/json.hpp"
 
+namespace {
+    // a compiled preset is the header, the functions as node counts followed by their nodes, then the tables as texel counts followed
+    // by their texels. The tables are only used when the sizes of the header match the constants of the reading build
+    struct CompiledHeader {
+        char     Magic[4];
+        uint32_t Version;
+        uint32_t Sampling;
+        uint32_t RangeSampling;
+        uint32_t PreIntegrationSampling;
+        uint32_t GradientSampling;
+    };
+
+    constexpr char CompiledMagic[4] = { 'M', 'C', 'T', 'F' };
+    // version 2 adds the functions of the labels behind the 2D opacity, version 1 files are still read
+    constexpr uint32_t CompiledVersion = 2;
+    constexpr char const* CompiledExtension = ".mctf";
+    // bound of every sampling of the header, the sizes of the tables follow from them
+    constexpr uint32_t MaxCompiledSamplingCount = 16384;
+
+    auto ToHalfTexels(std::vector<Hawk::Math::Vec4> const& texels) -> std::vector<Hawk::Math::Vector<DirectX::PackedVector::HALF, 4>> {
+        std::vector<Hawk::Math::Vector<DirectX::PackedVector::HALF, 4>> data(std::size(texels));
+        for (size_t index = 0; index < std::size(texels); index++)
+            data[index] = Hawk::Math::Vector<DirectX::PackedVector::HALF, 4>(ToHalf(texels[index].x), ToHalf(texels[index].y), ToHalf(texels[index].z), ToHalf(texels[index].w));
+        return data;
+    }
+
+    // diffuse or specular in rgb, opacity or roughness in alpha, the texels of one material slice
+    auto BakeMaterialSlice(ColorTransferFunction1D const& color, ScalarTransferFunction1D const& scalar, std::vector<F32> const& intensities) -> std::vector<Hawk::Math::Vec4> {
+        const size_t sampling = std::size(intensities);
+        std::vector<F32> channels(4 * sampling);
+        auto getChannel = [&](uint32_t index) -> std::span<F32> { return std::span(channels).subspan(index * sampling, sampling); };
+
+        color.EvaluateBatch(intensities, getChannel(0), getChannel(1), getChannel(2));
+        scalar.EvaluateBatch(intensities, getChannel(3));
+
+        std::vector<Hawk::Math::Vec4> texels(sampling);
+        for (size_t index = 0; index < sampling; index++)
+            texels[index] = Hawk::Math::Vec4(getChannel(0)[index], getChannel(1)[index], getChannel(2)[index], getChannel(3)[index]);
+        return texels;
+    }
+
+    auto ToHalfValues(std::vector<F32> const& values) -> std::vector<DirectX::PackedVector::HALF> {
+        std::vector<DirectX::PackedVector::HALF> data(std::size(values));
+        std::transform(std::begin(values), std::end(values), std::begin(data), ToHalf);
+        return data;
+    }
+
+    auto ToFloats(DirectX::PackedVector::HALF const* pData, size_t count) -> std::vector<F32> {
+        std::vector<F32> values(count);
+        std::transform(pData, pData + count, std::begin(values), DirectX::PackedVector::XMConvertHalfToFloat);
+        return values;
+    }
+
+    // lerps two tables of texels into float16 texels, the tiny positive values are kept off zero as ToHalf does
+    auto BlendTable(std::vector<F32> const& from, std::vector<F32> const& to, F32 factor, std::vector<DirectX::PackedVector::HALF>& texels) -> void {
+        constexpr F32 HalfMin = 5.96046448e-8f;
+
+        texels.resize(std::size(from));
+        size_t index = 0;
+        if (IsAVX2Supported() && IsF16CSupported()) {
+            auto const weightFrom = _mm256_set1_ps(1.0f - factor);
+            auto const weightTo = _mm256_set1_ps(factor);
+            auto const halfMin = _mm256_set1_ps(HalfMin);
+            for (; index + 8 <= std::size(from); index += 8) {
+                auto value = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&from[index]), weightFrom), _mm256_mul_ps(_mm256_loadu_ps(&to[index]), weightTo));
+                auto const isTiny = _mm256_and_ps(_mm256_cmp_ps(value, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_cmp_ps(value, halfMin, _CMP_LT_OQ));
+                value = _mm256_blendv_ps(value, halfMin, isTiny);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&texels[index]), _mm256_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT));
+            }
+        }
+        for (; index < std::size(from); index++)
+            texels[index] = ToHalf((1.0f - factor) * from[index] + factor * to[index]);
+    }
+
+    auto CreateTexture1D(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, std::vector<DirectX::PackedVector::HALF> const& data, D3D11_USAGE usage = D3D11_USAGE_IMMUTABLE) -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+        D3D11_TEXTURE1D_DESC desc = {};
+        desc.Width = static_cast<uint32_t>(std::size(data));
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.Format = DXGI_FORMAT_R16_FLOAT;
+        desc.Usage = usage;
+
+        D3D11_SUBRESOURCE_DATA initData = {};
+        initData.pSysMem = std::data(data);
+
+        Microsoft::WRL::ComPtr<ID3D11Texture1D> pTexture;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSRV;
+        DX::ThrowIfFailed(pDevice->CreateTexture1D(&desc, &initData, pTexture.GetAddressOf()));
+        DX::ThrowIfFailed(pDevice->CreateShaderResourceView(pTexture.Get(), nullptr, pSRV.GetAddressOf()));
+        return pSRV;
+    }
+
+    auto CreateTexture2D(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, std::vector<DirectX::PackedVector::HALF> const& data, uint32_t width, uint32_t height, D3D11_USAGE usage = D3D11_USAGE_IMMUTABLE) -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = width;
+        desc.Height = height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.SampleDesc.Count = 1;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.Format = DXGI_FORMAT_R16_FLOAT;
+        desc.Usage = usage;
+
+        D3D11_SUBRESOURCE_DATA initData = {};
+        initData.pSysMem = std::data(data);
+        initData.SysMemPitch = width * sizeof(DirectX::PackedVector::HALF);
+
+        Microsoft::WRL::ComPtr<ID3D11Texture2D> pTexture;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSRV;
+        DX::ThrowIfFailed(pDevice->CreateTexture2D(&desc, &initData, pTexture.GetAddressOf()));
+        DX::ThrowIfFailed(pDevice->CreateShaderResourceView(pTexture.Get(), nullptr, pSRV.GetAddressOf()));
+        return pSRV;
+    }
+
+    // immutable Texture1DArray of arraySize slices of width texels one after the other
+    auto CreateTextureArray1D(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, DXGI_FORMAT format, void const* pData, uint32_t texelSize, uint32_t width, uint32_t arraySize) -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+        D3D11_TEXTURE1D_DESC desc = {};
+        desc.Width = width;
+        desc.MipLevels = 1;
+        desc.ArraySize = arraySize;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.Format = format;
+        desc.Usage = D3D11_USAGE_IMMUTABLE;
+
+        std::vector<D3D11_SUBRESOURCE_DATA> initData(arraySize);
+        for (uint32_t slice = 0; slice < arraySize; slice++)
+            initData[slice].pSysMem = static_cast<uint8_t const*>(pData) + size_t(slice) * width * texelSize;
+
+        Microsoft::WRL::ComPtr<ID3D11Texture1D> pTexture;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSRV;
+        DX::ThrowIfFailed(pDevice->CreateTexture1D(&desc, std::data(initData), pTexture.GetAddressOf()));
+        DX::ThrowIfFailed(pDevice->CreateShaderResourceView(pTexture.Get(), nullptr, pSRV.GetAddressOf()));
+        return pSRV;
+    }
+
+    // immutable R16F Texture2DArray of arraySize slices of width x height texels one after the other
+    auto CreateTextureArray2D(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, std::vector<DirectX::PackedVector::HALF> const& data, uint32_t width, uint32_t height, uint32_t arraySize) -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = width;
+        desc.Height = height;
+        desc.MipLevels = 1;
+        desc.ArraySize = arraySize;
+        desc.SampleDesc.Count = 1;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.Format = DXGI_FORMAT_R16_FLOAT;
+        desc.Usage = D3D11_USAGE_IMMUTABLE;
+
+        std::vector<D3D11_SUBRESOURCE_DATA> initData(arraySize);
+        for (uint32_t slice = 0; slice < arraySize; slice++) {
+            initData[slice].pSysMem = std::data(data) + size_t(slice) * width * height;
+            initData[slice].SysMemPitch = width * sizeof(DirectX::PackedVector::HALF);
+        }
+
+        Microsoft::WRL::ComPtr<ID3D11Texture2D> pTexture;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSRV;
+        DX::ThrowIfFailed(pDevice->CreateTexture2D(&desc, std::data(initData), pTexture.GetAddressOf()));
+        DX::ThrowIfFailed(pDevice->CreateShaderResourceView(pTexture.Get(), nullptr, pSRV.GetAddressOf()));
+        return pSRV;
+    }
+
+    // Texture1DArray of the material slices, default usage so that a slice can be written again
+    auto CreateMaterialTexture(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, void const* pDiffuseOpacity, void const* pSpecularRoughness, uint32_t sampling) -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+        D3D11_TEXTURE1D_DESC desc = {};
+        desc.Width = sampling;
+        desc.MipLevels = 1;
+        desc.ArraySize = MCTransferFunction::MaterialSliceCount;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+
+        D3D11_SUBRESOURCE_DATA initData[MCTransferFunction::MaterialSliceCount] = {};
+        initData[0].pSysMem = pDiffuseOpacity;
+        initData[1].pSysMem = pSpecularRoughness;
+
+        Microsoft::WRL::ComPtr<ID3D11Texture1D> pTexture;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSRV;
+        DX::ThrowIfFailed(pDevice->CreateTexture1D(&desc, initData, pTexture.GetAddressOf()));
+        DX::ThrowIfFailed(pDevice->CreateShaderResourceView(pTexture.Get(), nullptr, pSRV.GetAddressOf()));
+        return pSRV;
+    }
+
+    auto UpdateTexture(Microsoft::WRL::ComPtr<ID3D11DeviceContext> pContext, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSRV, uint32_t subresource, void const* pData, uint32_t rowPitch) -> void {
+        Microsoft::WRL::ComPtr<ID3D11Resource> pResource;
+        pSRV->GetResource(pResource.GetAddressOf());
+        pContext->UpdateSubresource(pResource.Get(), subresource, nullptr, pData, rowPitch, 0);
+    }
+
+    auto Write(std::ostream& stream, void const* pData, size_t size) -> void {
+        stream.write(static_cast<char const*>(pData), size);
+    }
+
+    auto Read(std::istream& stream, void* pData, size_t size) -> void {
+        if (!stream.read(static_cast<char*>(pData), size))
+            throw std::runtime_error("truncated compiled transfer function");
+    }
+
+    // bytes between the read position and the end of the stream, no count read from a file is trusted beyond them
+    auto GetRemainingSize(std::istream& stream) -> size_t {
+        const auto position = stream.tellg();
+        stream.seekg(0, std::ios::end);
+        const auto end = stream.tellg();
+        stream.seekg(position);
+        if (!stream.good() || position < 0 || end < position)
+            throw std::runtime_error("truncated compiled transfer function");
+        return static_cast<size_t>(end - position);
+    }
+
+    auto WriteFunction(std::ostream& stream, PiecewiseLinearFunction<> const& function) -> void {
+        Write(stream, &function.RangeMin, sizeof(F32));
+        Write(stream, &function.RangeMax, sizeof(F32));
+        Write(stream, &function.Count, sizeof(uint32_t));
+        Write(stream, std::data(function.Position), function.Count * sizeof(F32));
+        Write(stream, std::data(function.Value), function.Count * sizeof(F32));
+    }
+
+    auto ReadFunction(std::istream& stream, PiecewiseLinearFunction<>& function) -> void {
+        uint32_t count = 0;
+        Read(stream, &function.RangeMin, sizeof(F32));
+        Read(stream, &function.RangeMax, sizeof(F32));
+        Read(stream, &count, sizeof(uint32_t));
+        if (count > std::size(function.Position))
+            throw std::runtime_error("compiled transfer function with too many nodes");
+
+        std::array<F32, std::tuple_size_v<decltype(function.Position)>> position = {};
+        std::array<F32, std::tuple_size_v<decltype(function.Value)>> value = {};
+        Read(stream, std::data(position), count * sizeof(F32));
+        Read(stream, std::data(value), count * sizeof(F32));
+        for (uint32_t index = 0; index < count; index++)
+            function.AddNode(position[index], value[index]);
+    }
+
+    template<typename T>
+    auto WriteTable(std::ostream& stream, std::vector<T> const& table) -> void {
+        const uint32_t count = static_cast<uint32_t>(std::size(table));
+        Write(stream, &count, sizeof(uint32_t));
+        Write(stream, std::data(table), count * sizeof(T));
+    }
+
+    template<typename T>
+    auto ReadTable(std::istream& stream, std::vector<T>& table, size_t maxCount) -> void {
+        uint32_t count = 0;
+        Read(stream, &count, sizeof(uint32_t));
+        if (count > maxCount || count * sizeof(T) > GetRemainingSize(stream))
+            throw std::runtime_error("compiled transfer function with a table larger than its header or its file");
+        table.resize(count);
+        Read(stream, std::data(table), count * sizeof(T));
+    }
+}
+
 // initialize
 MCTransferFunction::MCTransferFunction(std::string fileName) {
-    nlohmann::json root;
-    std::ifstream ifs(fileName);
-    ifs >> root;
-
     opacityTF.Clear();
     diffuseTF.Clear();
     specularTF.Clear();
     emissionTF.Clear();
     roughnessTF.Clear();
+    opacity2DTF.Clear();
+
+    if (std::filesystem::path(fileName).extension() == CompiledExtension)
+        loadCompiled(fileName);
+    else
+        loadJson(fileName);
+
+    opacityTF.Compile();
+    diffuseTF.Compile();
+    specularTF.Compile();
+    emissionTF.Compile();
+    roughnessTF.Compile();
+    opacity2DTF.Compile();
+    for (auto& label : labelTFs) {
+        label.diffuseTF.Compile();
+        label.specularTF.Compile();
+        label.roughnessTF.Compile();
+        label.opacityTF.Compile();
+    }
+}
+
+auto MCTransferFunction::loadJson(std::string const& fileName) -> void {
+    nlohmann::json root;
+    std::ifstream ifs(fileName);
+    ifs >> root;
 
     auto ExtractVec3FromJson = [](auto const& tree, auto const& key) -> Hawk::Math::Vec3 {
         Hawk::Math::Vec3 v{};
@@ -25,17 +300,559 @@ MCTransferFunction::MCTransferFunction(std::string fileName) {
         return v;
     };
 
-    for (auto const& e : root["NodesColor"]) {
-        auto intensity = e["Intensity"].get<float>();
-        auto diffuse = ExtractVec3FromJson(e, "Diffuse");
-        auto specular = ExtractVec3FromJson(e, "Specular");
-        auto roughness = e["Roughness"].get<float>();
+    auto ExtractNodesColor = [&](auto const& tree, ColorTransferFunction1D& diffuseFunction, ColorTransferFunction1D& specularFunction, ScalarTransferFunction1D& roughnessFunction) -> void {
+        if (!tree.contains("NodesColor"))
+            return;
+        for (auto const& e : tree["NodesColor"]) {
+            auto intensity = e["Intensity"].get<float>();
+            auto diffuse = ExtractVec3FromJson(e, "Diffuse");
+            auto specular = ExtractVec3FromJson(e, "Specular");
+            auto roughness = e["Roughness"].get<float>();
+
+            diffuseFunction.AddNode(intensity, diffuse);
+            specularFunction.AddNode(intensity, specular);
+            roughnessFunction.AddNode(intensity, roughness);
+        }
+    };
+
+    auto ExtractNodesOpacity = [](auto const& tree, ScalarTransferFunction1D& opacityFunction) -> void {
+        if (!tree.contains("NodesOpacity"))
+            return;
+        for (auto const& e : tree["NodesOpacity"])
+            opacityFunction.AddNode(e["Intensity"].get<F32>(), e["Opacity"].get<F32>());
+    };
+
+    ExtractNodesColor(root, diffuseTF, specularTF, roughnessTF);
+    ExtractNodesOpacity(root, opacityTF);
+
+    // rows of opacity nodes at a gradient magnitude in Hounsfield units per voxel
+    if (root.contains("NodesOpacity2D")) {
+        opacity2DTF.GradientMagnitudeMax = root.value("GradientMagnitudeMax", 1.0f);
+        for (auto const& e : root["NodesOpacity2D"]) {
+            ScalarTransferFunction1D row;
+            for (auto const& node : e["NodesOpacity"])
+                row.AddNode(node["Intensity"].get<F32>(), node["Opacity"].get<F32>());
+            opacity2DTF.AddRow(e["GradientMagnitude"].get<F32>(), row);
+        }
+    }
+
+    // functions of the labels of a label volume, what an entry leaves out is taken from label 0
+    if (root.contains("Labels")) {
+        for (auto const& e : root["Labels"]) {
+            MCTransferFunctionLabel label;
+            label.Label = e["Label"].get<uint32_t>();
+            label.Name = e.value("Name", std::string());
+            label.diffuseTF = diffuseTF;
+            label.specularTF = specularTF;
+            label.roughnessTF = roughnessTF;
+            label.opacityTF = opacityTF;
+            if (e.contains("NodesColor")) {
+                label.diffuseTF.Clear();
+                label.specularTF.Clear();
+                label.roughnessTF.Clear();
+                ExtractNodesColor(e, label.diffuseTF, label.specularTF, label.roughnessTF);
+            }
+            if (e.contains("NodesOpacity")) {
+                label.opacityTF.Clear();
+                ExtractNodesOpacity(e, label.opacityTF);
+            }
+            addLabel(std::move(label));
+        }
+    }
+}
+
+auto MCTransferFunction::addLabel(MCTransferFunctionLabel label) -> void {
+    if (label.Label == 0 || label.Label >= MaxLabelCount)
+        throw std::runtime_error("label " + std::to_string(label.Label) + " outside of [1, " + std::to_string(MaxLabelCount) + ")");
+
+    auto const position = std::lower_bound(std::begin(labelTFs), std::end(labelTFs), label.Label, [](auto const& entry, uint32_t value) { return entry.Label < value; });
+    if (position != std::end(labelTFs) && position->Label == label.Label)
+        throw std::runtime_error("label " + std::to_string(label.Label) + " given twice");
+    labelTFs.insert(position, std::move(label));
+}
+
+auto MCTransferFunction::loadCompiled(std::string const& fileName) -> void {
+    std::ifstream stream(fileName, std::ios::binary);
+    if (!stream)
+        throw std::runtime_error("cannot open " + fileName);
+
+    CompiledHeader header = {};
+    Read(stream, &header, sizeof(header));
+    if (std::memcmp(header.Magic, CompiledMagic, sizeof(CompiledMagic)) != 0 || header.Version == 0 || header.Version > CompiledVersion)
+        throw std::runtime_error(fileName + " is not a compiled transfer function of this version");
+    for (const uint32_t sampling : { header.Sampling, header.RangeSampling, header.PreIntegrationSampling, header.GradientSampling }) {
+        if (sampling > MaxCompiledSamplingCount)
+            throw std::runtime_error(fileName + " has a sampling over " + std::to_string(MaxCompiledSamplingCount));
+    }
+
+    for (auto* pColorTF : { &diffuseTF, &specularTF, &emissionTF }) {
+        for (auto& function : pColorTF->PLF)
+            ReadFunction(stream, function);
+    }
+    ReadFunction(stream, roughnessTF.PLF);
+    ReadFunction(stream, opacityTF.PLF);
 
-        diffuseTF.AddNode(intensity, diffuse);
-        specularTF.AddNode(intensity, specular);
-        roughnessTF.AddNode(intensity, roughness);
+    uint32_t rowCount = 0;
+    Read(stream, &opacity2DTF.GradientMagnitudeMax, sizeof(F32));
+    Read(stream, &rowCount, sizeof(uint32_t));
+    // a row is at least its gradient magnitude, its range and its node count
+    if (size_t(rowCount) * 4 * sizeof(uint32_t) > GetRemainingSize(stream))
+        throw std::runtime_error(fileName + " has more rows than its size holds");
+    for (uint32_t index = 0; index < rowCount; index++) {
+        F32 gradientMagnitude = 0.0f;
+        ScalarTransferFunction1D row;
+        Read(stream, &gradientMagnitude, sizeof(F32));
+        ReadFunction(stream, row.PLF);
+        opacity2DTF.AddRow(gradientMagnitude, row);
     }
 
-    for (auto const& e : root["NodesOpacity"])
-        opacityTF.AddNode(e["Intensity"].get<F32>(), e["Opacity"].get<F32>());
+    uint32_t labelCount = 0;
+    if (header.Version >= 2)
+        Read(stream, &labelCount, sizeof(uint32_t));
+    if (labelCount >= MaxLabelCount)
+        throw std::runtime_error(fileName + " has too many labels");
+    for (uint32_t index = 0; index < labelCount; index++) {
+        MCTransferFunctionLabel label;
+        uint32_t nameLength = 0;
+        Read(stream, &label.Label, sizeof(uint32_t));
+        Read(stream, &nameLength, sizeof(uint32_t));
+        label.Name.resize((std::min)(nameLength, uint32_t(MAX_PATH)));
+        if (nameLength != std::size(label.Name))
+            throw std::runtime_error(fileName + " has a label name too long");
+        Read(stream, std::data(label.Name), nameLength);
+        for (auto* pColorTF : { &label.diffuseTF, &label.specularTF }) {
+            for (auto& function : pColorTF->PLF)
+                ReadFunction(stream, function);
+        }
+        ReadFunction(stream, label.roughnessTF.PLF);
+        ReadFunction(stream, label.opacityTF.PLF);
+        addLabel(std::move(label));
+    }
+
+    ReadTable(stream, m_Tables.Opacity, header.Sampling);
+    ReadTable(stream, m_Tables.OpacityRange, size_t(header.RangeSampling) * header.RangeSampling);
+    ReadTable(stream, m_Tables.OpacityPreIntegration, size_t(header.PreIntegrationSampling) * header.PreIntegrationSampling);
+    ReadTable(stream, m_Tables.Opacity2D, size_t(header.Sampling) * header.GradientSampling);
+    ReadTable(stream, m_Tables.Material, size_t(MaterialSliceCount) * header.Sampling);
+
+    // tables of other sizes than the bakes of this build are dropped, the nodes are baked again
+    const size_t sampling = header.Sampling;
+    const size_t rangeSampling = (std::min)(header.Sampling, MaxOpacityRangeSamplingCount);
+    const bool isMatching = header.RangeSampling == rangeSampling && header.PreIntegrationSampling == PreIntegrationSamplingCount && header.GradientSampling == Opacity2DGradientSamplingCount
+        && std::size(m_Tables.Opacity) == sampling && std::size(m_Tables.OpacityRange) == rangeSampling * rangeSampling && std::size(m_Tables.Material) == MaterialSliceCount * sampling
+        && std::size(m_Tables.OpacityPreIntegration) == (opacity2DTF.IsEmpty() ? size_t(PreIntegrationSamplingCount) * PreIntegrationSamplingCount : 0)
+        && std::size(m_Tables.Opacity2D) == (opacity2DTF.IsEmpty() ? 0 : sampling * Opacity2DGradientSamplingCount);
+    if (isMatching)
+        m_Tables.Sampling = header.Sampling;
+    else
+        m_Tables = {};
+}
+
+auto MCTransferFunction::save(std::string const& fileName, uint32_t sampling) const -> void {
+    const MCTransferFunctionTables tables = getTables(sampling);
+
+    std::ofstream stream(fileName, std::ios::binary);
+    if (!stream)
+        throw std::runtime_error("cannot write " + fileName);
+
+    CompiledHeader header = {};
+    std::memcpy(header.Magic, CompiledMagic, sizeof(CompiledMagic));
+    header.Version = CompiledVersion;
+    header.Sampling = sampling;
+    header.RangeSampling = (std::min)(sampling, MaxOpacityRangeSamplingCount);
+    header.PreIntegrationSampling = PreIntegrationSamplingCount;
+    header.GradientSampling = Opacity2DGradientSamplingCount;
+    Write(stream, &header, sizeof(header));
+
+    for (auto* pColorTF : { &diffuseTF, &specularTF, &emissionTF }) {
+        for (auto const& function : pColorTF->PLF)
+            WriteFunction(stream, function);
+    }
+    WriteFunction(stream, roughnessTF.PLF);
+    WriteFunction(stream, opacityTF.PLF);
+
+    const uint32_t rowCount = static_cast<uint32_t>(std::size(opacity2DTF.Rows));
+    Write(stream, &opacity2DTF.GradientMagnitudeMax, sizeof(F32));
+    Write(stream, &rowCount, sizeof(uint32_t));
+    for (uint32_t index = 0; index < rowCount; index++) {
+        Write(stream, &opacity2DTF.Position[index], sizeof(F32));
+        WriteFunction(stream, opacity2DTF.Rows[index].PLF);
+    }
+
+    const uint32_t labelCount = static_cast<uint32_t>(std::size(labelTFs));
+    Write(stream, &labelCount, sizeof(uint32_t));
+    for (auto const& label : labelTFs) {
+        const uint32_t nameLength = static_cast<uint32_t>(std::size(label.Name));
+        Write(stream, &label.Label, sizeof(uint32_t));
+        Write(stream, &nameLength, sizeof(uint32_t));
+        Write(stream, std::data(label.Name), nameLength);
+        for (auto* pColorTF : { &label.diffuseTF, &label.specularTF }) {
+            for (auto const& function : pColorTF->PLF)
+                WriteFunction(stream, function);
+        }
+        WriteFunction(stream, label.roughnessTF.PLF);
+        WriteFunction(stream, label.opacityTF.PLF);
+    }
+
+    WriteTable(stream, tables.Opacity);
+    WriteTable(stream, tables.OpacityRange);
+    WriteTable(stream, tables.OpacityPreIntegration);
+    WriteTable(stream, tables.Opacity2D);
+    WriteTable(stream, tables.Material);
+    if (!stream)
+        throw std::runtime_error("cannot write " + fileName);
+}
+
+auto MCTransferFunction::convert(std::string const& fileName, uint32_t sampling) -> std::string {
+    const std::string compiledFileName = std::filesystem::path(fileName).replace_extension(CompiledExtension).string();
+    MCTransferFunction(fileName).save(compiledFileName, sampling);
+    return compiledFileName;
+}
+
+auto MCTransferFunction::getOpacityHash(uint32_t sampling) const -> uint64_t {
+    return opacity2DTF.GetHash(opacityTF.GetHash(HashBytes(&sampling, sizeof(sampling))));
+}
+
+auto MCTransferFunction::getMaterialHash(uint32_t sampling, uint32_t slice) const -> uint64_t {
+    uint64_t hash = HashBytes(&sampling, sizeof(sampling));
+    hash = HashBytes(&slice, sizeof(slice), hash);
+    if (slice == 0)
+        return opacityTF.GetHash(diffuseTF.GetHash(hash));
+    return roughnessTF.GetHash(specularTF.GetHash(hash));
+}
+
+auto MCTransferFunction::getLabelHash(uint32_t sampling) const -> uint64_t {
+    uint64_t hash = opacityTF.GetHash(roughnessTF.GetHash(specularTF.GetHash(diffuseTF.GetHash(HashBytes(&sampling, sizeof(sampling))))));
+    for (auto const& label : labelTFs) {
+        hash = HashBytes(&label.Label, sizeof(label.Label), hash);
+        hash = label.opacityTF.GetHash(label.roughnessTF.GetHash(label.specularTF.GetHash(label.diffuseTF.GetHash(hash))));
+    }
+    return hash;
+}
+
+auto MCTransferFunction::generateMaterialSlice(uint32_t sampling, uint32_t slice) const -> std::vector<Hawk::Math::Vec4> {
+    const std::vector<F32> intensities = GenerateSampling(sampling);
+    if (slice == 0)
+        return BakeMaterialSlice(diffuseTF, opacityTF, intensities);
+    return BakeMaterialSlice(specularTF, roughnessTF, intensities);
+}
+
+auto MCTransferFunction::generateMaterialTable(uint32_t sampling) const -> std::vector<MCMaterialTexel> {
+    const std::vector<Hawk::Math::Vec4> diffuseOpacity = generateMaterialSlice(sampling, 0);
+    const std::vector<Hawk::Math::Vec4> specularRoughness = generateMaterialSlice(sampling, 1);
+
+    std::vector<MCMaterialTexel> table(sampling);
+    for (uint32_t index = 0; index < sampling; index++) {
+        table[index].DiffuseOpacity = diffuseOpacity[index];
+        table[index].SpecularRoughness = specularRoughness[index];
+    }
+    return table;
+}
+
+auto MCTransferFunction::getMaterialSliceTexels(uint32_t sampling, uint32_t slice) const -> std::vector<Hawk::Math::Vector<DirectX::PackedVector::HALF, 4>> {
+    if (m_Tables.Sampling == sampling) {
+        auto const begin = std::begin(m_Tables.Material) + size_t(slice) * sampling;
+        return { begin, begin + sampling };
+    }
+    return ToHalfTexels(generateMaterialSlice(sampling, slice));
+}
+
+auto MCTransferFunction::generateOpacityTables(uint32_t sampling, MCTransferFunctionTables& tables) const -> void {
+    std::vector<F32> opacity(sampling);
+    opacityTF.EvaluateBatch(GenerateSampling(sampling), opacity);
+    tables.Opacity = ToHalfValues(opacity);
+
+    const uint32_t rangeSampling = (std::min)(sampling, MaxOpacityRangeSamplingCount);
+    if (opacity2DTF.IsEmpty()) {
+        tables.OpacityRange = ToHalfValues(GenerateRangeMaxTable(opacity, rangeSampling));
+        tables.OpacityPreIntegration = ToHalfValues(opacityTF.GeneratePreIntegrationTable(sampling, PreIntegrationSamplingCount));
+    } else {
+        // the skipping stays conservative: the range table takes the largest opacity over all the gradient magnitudes
+        tables.OpacityRange = ToHalfValues(opacity2DTF.GenerateRangeMaxTable(sampling, rangeSampling));
+        tables.Opacity2D = ToHalfValues(opacity2DTF.GenerateTable(sampling, Opacity2DGradientSamplingCount));
+    }
+}
+
+auto MCTransferFunction::getTables(uint32_t sampling) const -> MCTransferFunctionTables {
+    return m_Tables.Sampling == sampling ? m_Tables : generateTables(sampling);
+}
+
+auto MCTransferFunction::generateTables(uint32_t sampling) const -> MCTransferFunctionTables {
+    MCTransferFunctionTables tables;
+    tables.Sampling = sampling;
+    generateOpacityTables(sampling, tables);
+    for (uint32_t slice = 0; slice < MaterialSliceCount; slice++) {
+        const auto texels = ToHalfTexels(generateMaterialSlice(sampling, slice));
+        tables.Material.insert(std::end(tables.Material), std::begin(texels), std::end(texels));
+    }
+    return tables;
+}
+
+auto MCTransferFunction::generateOpacityTextures(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling, MCTransferFunctionTextures& textures) const -> void {
+    // a compiled preset uploads the texels it stores at this sampling, anything else is baked here
+    MCTransferFunctionTables baked;
+    if (m_Tables.Sampling != sampling)
+        generateOpacityTables(sampling, baked);
+    MCTransferFunctionTables const& tables = m_Tables.Sampling == sampling ? m_Tables : baked;
+
+    const uint32_t rangeSampling = (std::min)(sampling, MaxOpacityRangeSamplingCount);
+    textures.m_pSRVOpacityTF = CreateTexture1D(pDevice, tables.Opacity);
+    textures.m_pSRVOpacityRangeTF = CreateTexture2D(pDevice, tables.OpacityRange, rangeSampling, rangeSampling);
+    textures.m_pSRVOpacityPreIntegrationTF = nullptr;
+    textures.m_pSRVOpacity2DTF = nullptr;
+    if (!std::empty(tables.OpacityPreIntegration))
+        textures.m_pSRVOpacityPreIntegrationTF = CreateTexture2D(pDevice, tables.OpacityPreIntegration, PreIntegrationSamplingCount, PreIntegrationSamplingCount);
+    if (!std::empty(tables.Opacity2D))
+        textures.m_pSRVOpacity2DTF = CreateTexture2D(pDevice, tables.Opacity2D, sampling, Opacity2DGradientSamplingCount);
+}
+
+auto MCTransferFunction::generateLabelTextures(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling, MCTransferFunctionTextures& textures) const -> void {
+    using HALF4 = Hawk::Math::Vector<DirectX::PackedVector::HALF, 4>;
+
+    const uint32_t rangeSampling = (std::min)(sampling, MaxOpacityRangeSamplingCount);
+    const std::vector<F32> intensities = GenerateSampling(sampling);
+
+    struct LabelSlices {
+        std::vector<DirectX::PackedVector::HALF> Opacity;
+        std::vector<DirectX::PackedVector::HALF> OpacityRange;
+        std::vector<HALF4>                       Material;
+    };
+
+    auto bakeLabel = [&](ColorTransferFunction1D const& diffuse, ColorTransferFunction1D const& specular, ScalarTransferFunction1D const& roughness, ScalarTransferFunction1D const& opacity) -> LabelSlices {
+        std::vector<F32> values(sampling);
+        opacity.EvaluateBatch(intensities, values);
+
+        LabelSlices slices;
+        slices.Opacity = ToHalfValues(values);
+        slices.OpacityRange = ToHalfValues(GenerateRangeMaxTable(values, rangeSampling));
+        slices.Material = ToHalfTexels(BakeMaterialSlice(diffuse, opacity, intensities));
+        const auto specularRoughness = ToHalfTexels(BakeMaterialSlice(specular, roughness, intensities));
+        slices.Material.insert(std::end(slices.Material), std::begin(specularRoughness), std::end(specularRoughness));
+        return slices;
+    };
+
+    // the labels without functions of their own repeat the slices of label 0
+    const LabelSlices base = bakeLabel(diffuseTF, specularTF, roughnessTF, opacityTF);
+    std::vector<DirectX::PackedVector::HALF> opacity;
+    std::vector<DirectX::PackedVector::HALF> opacityRange;
+    std::vector<HALF4> material;
+    for (uint32_t index = 0; index < MaxLabelCount; index++) {
+        auto const entry = std::find_if(std::begin(labelTFs), std::end(labelTFs), [index](auto const& label) { return label.Label == index; });
+        const LabelSlices slices = entry != std::end(labelTFs) ? bakeLabel(entry->diffuseTF, entry->specularTF, entry->roughnessTF, entry->opacityTF) : base;
+        opacity.insert(std::end(opacity), std::begin(slices.Opacity), std::end(slices.Opacity));
+        opacityRange.insert(std::end(opacityRange), std::begin(slices.OpacityRange), std::end(slices.OpacityRange));
+        material.insert(std::end(material), std::begin(slices.Material), std::end(slices.Material));
+    }
+
+    textures.m_pSRVLabelOpacityTF = CreateTextureArray1D(pDevice, DXGI_FORMAT_R16_FLOAT, std::data(opacity), sizeof(DirectX::PackedVector::HALF), sampling, MaxLabelCount);
+    textures.m_pSRVLabelOpacityRangeTF = CreateTextureArray2D(pDevice, opacityRange, rangeSampling, rangeSampling, MaxLabelCount);
+    textures.m_pSRVLabelMaterialTF = CreateTextureArray1D(pDevice, DXGI_FORMAT_R16G16B16A16_FLOAT, std::data(material), sizeof(HALF4), sampling, MaterialSliceCount * MaxLabelCount);
+}
+
+auto MCTransferFunction::generateMaterialTexture(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling) const -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+    const auto diffuseOpacity = getMaterialSliceTexels(sampling, 0);
+    const auto specularRoughness = getMaterialSliceTexels(sampling, 1);
+
+    // a preset that changes the functions of one slice only rewrites that slice
+    return CreateMaterialTexture(pDevice, std::data(diffuseOpacity), std::data(specularRoughness), sampling);
+}
+
+auto MCTransferFunction::updateMaterialTexture(Microsoft::WRL::ComPtr<ID3D11DeviceContext> pContext, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSRV, uint32_t sampling, uint32_t slice) const -> void {
+    const auto data = getMaterialSliceTexels(sampling, slice);
+    UpdateTexture(pContext, pSRV, D3D11CalcSubresource(0, slice, 1), std::data(data), 0);
+}
+
+auto MCTransferFunctionCache::find(std::string const& fileName, std::filesystem::file_time_type writeTime) -> Entry const* {
+    auto const iterator = m_Index.find(fileName);
+    if (iterator == std::end(m_Index) || iterator->second->second.WriteTime != writeTime)
+        return nullptr;
+    m_Entries.splice(std::begin(m_Entries), m_Entries, iterator->second);
+    return &iterator->second->second;
+}
+
+auto MCTransferFunctionCache::insert(std::string const& fileName, Entry entry) -> void {
+    if (auto const iterator = m_Index.find(fileName); iterator != std::end(m_Index)) {
+        m_Entries.erase(iterator->second);
+        m_Index.erase(iterator);
+    }
+    m_Entries.emplace_front(fileName, std::move(entry));
+    m_Index[fileName] = std::begin(m_Entries);
+
+    while (std::size(m_Entries) > m_Capacity) {
+        m_Index.erase(m_Entries.back().first);
+        m_Entries.pop_back();
+    }
+}
+
+auto MCTransferFunctionCache::isMaterialTextureShared(ID3D11ShaderResourceView* pSRV, std::string const& fileName) const -> bool {
+    return std::any_of(std::begin(m_Entries), std::end(m_Entries), [&](auto const& entry) {
+        return entry.first != fileName && entry.second.Textures.m_pSRVMaterialTF.Get() == pSRV;
+    });
+}
+
+MCTransferFunctionBlend::MCTransferFunctionBlend(std::shared_ptr<MCTransferFunction const> pFrom, std::shared_ptr<MCTransferFunction const> pTo, uint32_t sampling)
+    : m_pFrom(std::move(pFrom))
+    , m_pTo(std::move(pTo))
+    , m_Sampling(sampling) {
+
+    // the intensity range goes with the gradient magnitudes of the preset whose 2D table spans the blend
+    const bool isOpacity2D = !m_pFrom->opacity2DTF.IsEmpty() || !m_pTo->opacity2DTF.IsEmpty();
+    m_IntensityRange = m_pFrom->opacityTF.PLF.RangeMax - m_pFrom->opacityTF.PLF.RangeMin;
+    if (isOpacity2D) {
+        m_GradientMagnitudeMax = 0.0f;
+        for (auto const* pPreset : { m_pFrom.get(), m_pTo.get() }) {
+            if (!pPreset->opacity2DTF.IsEmpty() && pPreset->opacity2DTF.GradientMagnitudeMax > m_GradientMagnitudeMax) {
+                m_GradientMagnitudeMax = pPreset->opacity2DTF.GradientMagnitudeMax;
+                m_IntensityRange = pPreset->opacityTF.PLF.RangeMax - pPreset->opacityTF.PLF.RangeMin;
+            }
+        }
+    }
+    m_From = getTables(*m_pFrom, isOpacity2D);
+    m_To = getTables(*m_pTo, isOpacity2D);
+}
+
+auto MCTransferFunctionBlend::getTables(MCTransferFunction const& preset, bool isOpacity2D) const -> Tables {
+    const MCTransferFunctionTables tables = preset.getTables(m_Sampling);
+    constexpr uint32_t gradientSampling = MCTransferFunction::Opacity2DGradientSamplingCount;
+
+    Tables result;
+    result.Opacity = ToFloats(std::data(tables.Opacity), std::size(tables.Opacity));
+    result.OpacityRange = ToFloats(std::data(tables.OpacityRange), std::size(tables.OpacityRange));
+    result.Material = ToFloats(reinterpret_cast<DirectX::PackedVector::HALF const*>(std::data(tables.Material)), 4 * std::size(tables.Material));
+    if (!isOpacity2D) {
+        result.OpacityPreIntegration = ToFloats(std::data(tables.OpacityPreIntegration), std::size(tables.OpacityPreIntegration));
+        return result;
+    }
+
+    // a 1D opacity holds at every gradient magnitude
+    result.Opacity2D.reserve(size_t(m_Sampling) * gradientSampling);
+    if (preset.opacity2DTF.IsEmpty()) {
+        for (uint32_t line = 0; line < gradientSampling; line++)
+            result.Opacity2D.insert(std::end(result.Opacity2D), std::begin(result.Opacity), std::end(result.Opacity));
+        return result;
+    }
+
+    // line y of the blend is the gradient magnitude y / (gradientSampling - 1) of m_GradientMagnitudeMax, past the last line of the
+    // preset its opacity is clamped as the texture sampler does
+    const std::vector<F32> table = ToFloats(std::data(tables.Opacity2D), std::size(tables.Opacity2D));
+    const F32 scale = m_GradientMagnitudeMax / preset.opacity2DTF.GradientMagnitudeMax;
+    result.Opacity2D.resize(size_t(m_Sampling) * gradientSampling);
+    for (uint32_t line = 0; line < gradientSampling; line++) {
+        const F32 y = (std::min)(line * scale, static_cast<F32>(gradientSampling - 1));
+        const uint32_t y0 = (std::min)(static_cast<uint32_t>(y), gradientSampling - 2);
+        const F32 weight = y - y0;
+        for (uint32_t x = 0; x < m_Sampling; x++) {
+            const F32 value0 = table[size_t(y0) * m_Sampling + x];
+            const F32 value1 = table[size_t(y0 + 1) * m_Sampling + x];
+            result.Opacity2D[size_t(line) * m_Sampling + x] = value0 + weight * (value1 - value0);
+        }
+    }
+    return result;
+}
+
+auto MCTransferFunctionBlend::generateTextures(Microsoft::WRL::ComPtr<ID3D11Device> pDevice) -> void {
+    const uint32_t rangeSampling = (std::min)(m_Sampling, MCTransferFunction::MaxOpacityRangeSamplingCount);
+
+    m_Textures = {};
+    m_Textures.m_Sampling = m_Sampling;
+    BlendTable(m_From.Opacity, m_To.Opacity, m_Factor, m_Texels);
+    m_Textures.m_pSRVOpacityTF = CreateTexture1D(pDevice, m_Texels, D3D11_USAGE_DEFAULT);
+    BlendTable(m_From.OpacityRange, m_To.OpacityRange, m_Factor, m_Texels);
+    m_Textures.m_pSRVOpacityRangeTF = CreateTexture2D(pDevice, m_Texels, rangeSampling, rangeSampling, D3D11_USAGE_DEFAULT);
+    if (!isOpacity2D()) {
+        BlendTable(m_From.OpacityPreIntegration, m_To.OpacityPreIntegration, m_Factor, m_Texels);
+        m_Textures.m_pSRVOpacityPreIntegrationTF = CreateTexture2D(pDevice, m_Texels, MCTransferFunction::PreIntegrationSamplingCount, MCTransferFunction::PreIntegrationSamplingCount, D3D11_USAGE_DEFAULT);
+    } else {
+        BlendTable(m_From.Opacity2D, m_To.Opacity2D, m_Factor, m_Texels);
+        m_Textures.m_pSRVOpacity2DTF = CreateTexture2D(pDevice, m_Texels, m_Sampling, MCTransferFunction::Opacity2DGradientSamplingCount, D3D11_USAGE_DEFAULT);
+    }
+    BlendTable(m_From.Material, m_To.Material, m_Factor, m_Texels);
+    m_Textures.m_pSRVMaterialTF = CreateMaterialTexture(pDevice, std::data(m_Texels), std::data(m_Texels) + 4 * size_t(m_Sampling), m_Sampling);
+}
+
+auto MCTransferFunctionBlend::update(Microsoft::WRL::ComPtr<ID3D11DeviceContext> pContext, F32 factor) -> void {
+    const uint32_t rangeSampling = (std::min)(m_Sampling, MCTransferFunction::MaxOpacityRangeSamplingCount);
+    constexpr uint32_t halfSize = sizeof(DirectX::PackedVector::HALF);
+
+    m_Factor = factor;
+    BlendTable(m_From.Opacity, m_To.Opacity, m_Factor, m_Texels);
+    UpdateTexture(pContext, m_Textures.m_pSRVOpacityTF, 0, std::data(m_Texels), 0);
+    BlendTable(m_From.OpacityRange, m_To.OpacityRange, m_Factor, m_Texels);
+    UpdateTexture(pContext, m_Textures.m_pSRVOpacityRangeTF, 0, std::data(m_Texels), rangeSampling * halfSize);
+    if (!isOpacity2D()) {
+        BlendTable(m_From.OpacityPreIntegration, m_To.OpacityPreIntegration, m_Factor, m_Texels);
+        UpdateTexture(pContext, m_Textures.m_pSRVOpacityPreIntegrationTF, 0, std::data(m_Texels), MCTransferFunction::PreIntegrationSamplingCount * halfSize);
+    } else {
+        BlendTable(m_From.Opacity2D, m_To.Opacity2D, m_Factor, m_Texels);
+        UpdateTexture(pContext, m_Textures.m_pSRVOpacity2DTF, 0, std::data(m_Texels), m_Sampling * halfSize);
+    }
+    BlendTable(m_From.Material, m_To.Material, m_Factor, m_Texels);
+    for (uint32_t slice = 0; slice < MCTransferFunction::MaterialSliceCount; slice++)
+        UpdateTexture(pContext, m_Textures.m_pSRVMaterialTF, D3D11CalcSubresource(0, slice, 1), std::data(m_Texels) + 4 * size_t(slice) * m_Sampling, 0);
+}
+
+MCTransferFunctionBenchmark::MCTransferFunctionBenchmark(uint32_t evaluationCount)
+    : m_EvaluationCount(evaluationCount) {
+
+}
+
+auto MCTransferFunctionBenchmark::run(uint32_t nodeCount) const -> MCTransferFunctionBenchmarkResult {
+    std::mt19937 generator(nodeCount);
+    std::uniform_real_distribution<F32> distribution(0.0f, 1.0f);
+
+    // the end nodes span the range, the inner nodes are distinct whole Hounsfield units added out of order
+    PiecewiseLinearFunction<> function;
+    std::vector<F32> positions(size_t(function.RangeMax - function.RangeMin) - 1);
+    std::iota(std::begin(positions), std::end(positions), function.RangeMin + 1.0f);
+    std::shuffle(std::begin(positions), std::end(positions), generator);
+    function.AddNode(function.RangeMin, distribution(generator));
+    for (uint32_t index = 0; index + 2 < nodeCount; index++)
+        function.AddNode(positions[index], distribution(generator));
+    function.AddNode(function.RangeMax, distribution(generator));
+
+    // the scan runs on the nodes sorted as the compiled forms, only its search differs
+    PiecewiseLinearFunction<> linear = function;
+    linear.Compile();
+    function.CompileTable();
+
+    std::vector<F32> intensities(m_EvaluationCount);
+    for (auto& intensity : intensities)
+        intensity = distribution(generator);
+
+    F32 checksum = 0.0f;
+    auto measure = [&](auto&& evaluate) -> F64 {
+        auto const begin = std::chrono::high_resolution_clock::now();
+        for (auto intensity : intensities)
+            checksum += evaluate(intensity);
+        auto const end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<F64, std::nano>(end - begin).count() / std::size(intensities);
+    };
+
+    MCTransferFunctionBenchmarkResult result = {};
+    result.NodeCount = nodeCount;
+    result.LinearTime = measure([&](F32 intensity) { return linear.EvaluateLinear(intensity); });
+    result.BinarySearchTime = measure([&](F32 intensity) { return function.Evaluate(intensity); });
+    result.TableTime = measure([&](F32 intensity) { return function.EvaluateTable(intensity); });
+
+    std::vector<F32> values(std::size(intensities));
+    auto const begin = std::chrono::high_resolution_clock::now();
+    function.EvaluateBatch(intensities, values);
+    auto const end = std::chrono::high_resolution_clock::now();
+    result.BatchTime = std::chrono::duration<F64, std::nano>(end - begin).count() / std::size(intensities);
+    checksum += values.back();
+
+    for (auto intensity : intensities)
+        result.TableError = (std::max)(result.TableError, std::abs(function.EvaluateTable(intensity) - linear.EvaluateLinear(intensity)));
+
+    // keeps the timed loops from being optimized away
+    volatile F32 sink = checksum;
+    (void)sink;
+    return result;
+}
+
+auto MCTransferFunctionBenchmark::runAll() const -> std::vector<MCTransferFunctionBenchmarkResult> {
+    std::vector<MCTransferFunctionBenchmarkResult> results;
+    for (uint32_t nodeCount = 2; nodeCount <= 64; nodeCount *= 2)
+        results.push_back(run(nodeCount));
+    return results;
 }
\ No newline at end of file
@@ -1,14 +1,251 @@
 #pragma once
 #include "TransferFunction.h"
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// one texel of the interleaved material table, a scatter event reads both halves at the same intensity
+struct MCMaterialTexel {
+	Hawk::Math::Vec4 DiffuseOpacity;
+	Hawk::Math::Vec4 SpecularRoughness;
+};
+
+// float16 texels of every texture of a preset at one sampling, a compiled preset stores them next to its nodes
+struct MCTransferFunctionTables {
+	uint32_t                                                       Sampling = 0;
+	std::vector<DirectX::PackedVector::HALF>                       Opacity;
+	std::vector<DirectX::PackedVector::HALF>                       OpacityRange;
+	// the pre-integration table of a 1D opacity or the table of a 2D one, the other is empty
+	std::vector<DirectX::PackedVector::HALF>                       OpacityPreIntegration;
+	std::vector<DirectX::PackedVector::HALF>                       Opacity2D;
+	// the material slices one after the other
+	std::vector<Hawk::Math::Vector<DirectX::PackedVector::HALF, 4>> Material;
+};
+
+struct MCTransferFunctionTextures;
+
+// functions of one label of a label volume, a preset without NodesColor or NodesOpacity in the entry of a label keeps the ones of label 0
+struct MCTransferFunctionLabel {
+	uint32_t                 Label = 0;
+	std::string              Name;
+	ColorTransferFunction1D  diffuseTF;
+	ColorTransferFunction1D  specularTF;
+	ScalarTransferFunction1D roughnessTF;
+	ScalarTransferFunction1D opacityTF;
+};
 
 class MCTransferFunction {
 	public:
+		// a JSON preset, or a compiled one with the .mctf extension written by save
 		MCTransferFunction(std::string fileName);
 
+		// compiled preset: the nodes and the tables baked at sampling, read back without parsing and without baking at that sampling
+		auto save(std::string const& fileName, uint32_t sampling) const -> void;
+
+		// compiles a JSON preset into the .mctf file next to it, returns the name of the written file
+		static auto convert(std::string const& fileName, uint32_t sampling) -> std::string;
+
+		// content hashes of what a bake at sampling texels reads, a preset with equal hashes needs no new textures
+		auto getOpacityHash(uint32_t sampling) const -> uint64_t;
+
+		// slice 0 of the material texture reads diffuse and opacity, slice 1 specular and roughness
+		auto getMaterialHash(uint32_t sampling, uint32_t slice) const -> uint64_t;
+
+		// the label textures read every function of label 0 and of the labels of the preset
+		auto getLabelHash(uint32_t sampling) const -> uint64_t;
+
+		// sampling texels over the normalized intensities [0, 1], the CPU copy of generateMaterialTexture
+		auto generateMaterialTable(uint32_t sampling) const -> std::vector<MCMaterialTexel>;
+
+		// Texture1DArray of two RGBA16F slices: diffuse and opacity in slice 0, specular and roughness in slice 1
+		auto generateMaterialTexture(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling) const -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>;
+
+		// bakes one slice again into a texture of generateMaterialTexture with the same sampling
+		auto updateMaterialTexture(Microsoft::WRL::ComPtr<ID3D11DeviceContext> pContext, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSRV, uint32_t sampling, uint32_t slice) const -> void;
+
+		// the opacity texture with its range texture, and the pre-integration table of a 1D opacity or the table of a 2D one
+		auto generateOpacityTextures(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling, MCTransferFunctionTextures& textures) const -> void;
+
+		// the texels of every texture at sampling, the stored ones of a compiled preset at its sampling
+		auto getTables(uint32_t sampling) const -> MCTransferFunctionTables;
+
+		// MaxLabelCount slices of opacity and of opacity range, 2 * MaxLabelCount material slices with the layout of generateMaterialTexture.
+		// Label 0 and the labels without an entry in the preset are baked with the functions of the preset
+		auto generateLabelTextures(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling, MCTransferFunctionTextures& textures) const -> void;
+
+		static constexpr uint32_t MaterialSliceCount = 2;
+		// the range texture is sampling squared, it keeps a coarse conservative resolution
+		static constexpr uint32_t MaxOpacityRangeSamplingCount = 256;
+		static constexpr uint32_t PreIntegrationSamplingCount = 256;
+		// lines of the 2D opacity table over the gradient magnitude
+		static constexpr uint32_t Opacity2DGradientSamplingCount = 64;
+		// labels of a label volume, a bit each in the label masks of the skipping
+		static constexpr uint32_t MaxLabelCount = 16;
+
 		// transfer functions
 		ColorTransferFunction1D  diffuseTF;
 		ColorTransferFunction1D  specularTF;
 		ColorTransferFunction1D  emissionTF;
 		ScalarTransferFunction1D roughnessTF;
 		ScalarTransferFunction1D opacityTF;
+		// optional NodesOpacity2D of the preset, when present it classifies the GPU march instead of opacityTF
+		ScalarTransferFunction2D opacity2DTF;
+		// optional Labels of the preset, by increasing label in [1, MaxLabelCount)
+		std::vector<MCTransferFunctionLabel> labelTFs;
+
+	private:
+		auto loadJson(std::string const& fileName) -> void;
+
+		auto loadCompiled(std::string const& fileName) -> void;
+
+		// keeps labelTFs ordered by label, a label out of range or given twice throws
+		auto addLabel(MCTransferFunctionLabel label) -> void;
+
+		// evaluates only the two functions of a slice
+		auto generateMaterialSlice(uint32_t sampling, uint32_t slice) const -> std::vector<Hawk::Math::Vec4>;
+
+		// the stored texels of a compiled preset at its sampling, a bake otherwise
+		auto getMaterialSliceTexels(uint32_t sampling, uint32_t slice) const -> std::vector<Hawk::Math::Vector<DirectX::PackedVector::HALF, 4>>;
+
+		auto generateOpacityTables(uint32_t sampling, MCTransferFunctionTables& tables) const -> void;
+
+		auto generateTables(uint32_t sampling) const -> MCTransferFunctionTables;
+
+		MCTransferFunctionTables m_Tables;
+};
+
+// the textures of a preset at one sampling with the content hashes of their bakes, swapping presets swaps these pointers
+struct MCTransferFunctionTextures {
+	uint32_t                                                     m_Sampling = 0;
+	uint64_t                                                     m_OpacityHash = 0;
+	std::array<uint64_t, MCTransferFunction::MaterialSliceCount> m_MaterialHashes = {};
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>             m_pSRVMaterialTF;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>             m_pSRVOpacityTF;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>             m_pSRVOpacityRangeTF;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>             m_pSRVOpacityPreIntegrationTF;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>             m_pSRVOpacity2DTF;
+	uint64_t                                                     m_LabelHash = 0;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>             m_pSRVLabelOpacityTF;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>             m_pSRVLabelOpacityRangeTF;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>             m_pSRVLabelMaterialTF;
+};
+
+/*
+* The least recently used presets by file name with their textures. A preset whose file has not been written since it was cached
+* is switched to by swapping pointers, without parsing and without baking.
+*/
+class MCTransferFunctionCache {
+	public:
+		struct Entry {
+			std::shared_ptr<MCTransferFunction const> Preset;
+			MCTransferFunctionTextures                Textures;
+			std::filesystem::file_time_type           WriteTime;
+		};
+
+		explicit MCTransferFunctionCache(uint32_t capacity) : m_Capacity(capacity) {}
+
+		// the entry of fileName as the most recently used one, nullptr when it is not cached or was cached before writeTime
+		auto find(std::string const& fileName, std::filesystem::file_time_type writeTime) -> Entry const*;
+
+		// replaces the entry of fileName, the least recently used entry is evicted above the capacity
+		auto insert(std::string const& fileName, Entry entry) -> void;
+
+		// whether the entry of another file than fileName holds the material texture pSRV, such a texture is never written in place
+		auto isMaterialTextureShared(ID3D11ShaderResourceView* pSRV, std::string const& fileName) const -> bool;
+
+	private:
+		using EntryList = std::list<std::pair<std::string, Entry>>;
+
+		uint32_t                                               m_Capacity = 0;
+		EntryList                                              m_Entries;
+		std::unordered_map<std::string, EntryList::iterator>   m_Index;
+};
+
+/*
+* Two presets blended at t in [0, 1] in table space: the texels of both at one sampling are lerped eight at a time with AVX2, no node
+* is evaluated after construction. The opacity, material and pre-integration texels blend exactly, the pre-integration means are linear
+* in the opacity. The blended range maxima bound the range maxima of the blend from above, so the skipping stays conservative. A 1D
+* opacity blended with a 2D one is repeated along the gradient axis, and 2D tables of other GradientMagnitudeMax are resampled to the
+* larger one.
+*/
+class MCTransferFunctionBlend {
+	public:
+		MCTransferFunctionBlend(std::shared_ptr<MCTransferFunction const> pFrom, std::shared_ptr<MCTransferFunction const> pTo, uint32_t sampling);
+
+		// default usage textures owned by the blend at the current factor, their hashes match no preset
+		auto generateTextures(Microsoft::WRL::ComPtr<ID3D11Device> pDevice) -> void;
+
+		// blends at factor and rewrites the texels of the textures in place
+		auto update(Microsoft::WRL::ComPtr<ID3D11DeviceContext> pContext, F32 factor) -> void;
+
+		auto getTextures() const -> MCTransferFunctionTextures const& { return m_Textures; }
+
+		auto getFrom() const -> std::shared_ptr<MCTransferFunction const> const& { return m_pFrom; }
+
+		auto getTo() const -> std::shared_ptr<MCTransferFunction const> const& { return m_pTo; }
+
+		auto getFactor() const -> F32 { return m_Factor; }
+
+		auto getSampling() const -> uint32_t { return m_Sampling; }
+
+		// classifies with the 2D table when either preset does
+		auto isOpacity2D() const -> bool { return !std::empty(m_From.Opacity2D); }
+
+		auto getGradientMagnitudeMax() const -> F32 { return m_GradientMagnitudeMax; }
+
+		// width of the intensity range the gradient magnitudes of the blend are measured in
+		auto getIntensityRange() const -> F32 { return m_IntensityRange; }
+
+	private:
+		// the texels of one preset as floats, the material slices one after the other with four channels per texel
+		struct Tables {
+			std::vector<F32> Opacity;
+			std::vector<F32> OpacityRange;
+			std::vector<F32> OpacityPreIntegration;
+			std::vector<F32> Opacity2D;
+			std::vector<F32> Material;
+		};
+
+		auto getTables(MCTransferFunction const& preset, bool isOpacity2D) const -> Tables;
+
+		std::shared_ptr<MCTransferFunction const> m_pFrom;
+		std::shared_ptr<MCTransferFunction const> m_pTo;
+		uint32_t                                  m_Sampling = 0;
+		F32                                       m_Factor = 0.0f;
+		F32                                       m_GradientMagnitudeMax = 1.0f;
+		F32                                       m_IntensityRange = 1.0f;
+		Tables                                    m_From;
+		Tables                                    m_To;
+		// texels of the table being blended, sized for the largest one
+		std::vector<DirectX::PackedVector::HALF>  m_Texels;
+		MCTransferFunctionTextures                m_Textures;
+};
+
+struct MCTransferFunctionBenchmarkResult {
+	uint32_t NodeCount;
+	F64      LinearTime;
+	F64      BinarySearchTime;
+	F64      TableTime;
+	F64      BatchTime;
+	F32      TableError;
+};
+
+/*
+* Nanoseconds per evaluation of a piecewise linear function with random nodes on whole Hounsfield units: the linear scan,
+* the binary search over the compiled nodes, the uniform table and the AVX2 batch, with the largest deviation of the table from the scan
+*/
+class MCTransferFunctionBenchmark {
+	public:
+		MCTransferFunctionBenchmark(uint32_t evaluationCount);
+
+		auto run(uint32_t nodeCount) const -> MCTransferFunctionBenchmarkResult;
+
+		// 2, 4, 8 .. 64 nodes, the capacity of PiecewiseLinearFunction
+		auto runAll() const -> std::vector<MCTransferFunctionBenchmarkResult>;
+
+	private:
+		uint32_t m_EvaluationCount;
 };
\ No newline at end of file
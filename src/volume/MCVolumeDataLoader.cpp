@@ -4,30 +4,15 @@
 MCVolumeDataLoader::MCVolumeDataLoader(std::shared_ptr<DX::DeviceResources> deviceResource, MCVolumeDataLoaderInitializeSamplers samplers,
     MCVolumeDataLoaderInitializeShaders shaders,
     DX::ComPtr<ID3D11ShaderResourceView> m_pSRVOpacityTF)
+    : m_Samplers(samplers)
+    , m_Shaders(shaders)
 {
-    std::unique_ptr<FILE, decltype(&fclose)> pFile(fopen(fileName.c_str(), "rb"), fclose);
-
     auto m_pImmediateContext = deviceResource->GetD3DDeviceContext();
     auto m_pDevice = deviceResource->GetD3DDevice();
-    if (!pFile)
-        throw std::runtime_error("Failed to open file: " + fileName);
 
-    fread(reinterpret_cast<char*>(&m_DimensionX), sizeof(uint16_t), 1, pFile.get());
-    fread(reinterpret_cast<char*>(&m_DimensionY), sizeof(uint16_t), 1, pFile.get());
-    fread(reinterpret_cast<char*>(&m_DimensionZ), sizeof(uint16_t), 1, pFile.get());
-
-    std::vector<uint16_t> intensity(size_t(m_DimensionX) * size_t(m_DimensionY) * size_t(m_DimensionZ));
-    fread(reinterpret_cast<char*>(intensity.data()), sizeof(uint16_t), m_DimensionX * m_DimensionY * m_DimensionZ, pFile.get());
+    std::vector<uint16_t> intensity = readIntensity(fileName, 0, std::numeric_limits<uint16_t>::max(), m_DimensionX, m_DimensionY, m_DimensionZ);
     m_DimensionMipLevels = static_cast<uint16_t>(std::ceil(std::log2(std::max(std::max(m_DimensionX, m_DimensionY), m_DimensionZ)))) + 1;
-
-    auto NormalizeIntensity = [](uint16_t intensity, uint16_t min, uint16_t max) -> uint16_t {
-        return static_cast<uint16_t>(std::round(std::numeric_limits<uint16_t>::max() * ((intensity - min) / static_cast<F32>(max - min))));
-    };
-
-    uint16_t tmin = 0 << 12; // Min HU [0, 4096]
-    uint16_t tmax = 1 << 12; // Max HU [0, 4096]
-    for (size_t index = 0u; index < std::size(intensity); index++)
-        intensity[index] = NormalizeIntensity(intensity[index], tmin, tmax);
+    m_Intensity = intensity;
 
     {
         DX::ComPtr<ID3D11Texture3D> pTextureIntensity;
@@ -53,6 +38,15 @@ MCVolumeDataLoader::MCVolumeDataLoader(std::shared_ptr<DX::DeviceResources> devi
             m_pSRVVolumeIntensity.push_back(pSRVVolumeIntensity);
         }
 
+        {
+            D3D11_SHADER_RESOURCE_VIEW_DESC descSRV = {};
+            descSRV.Format = DXGI_FORMAT_R16_UNORM;
+            descSRV.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE3D;
+            descSRV.Texture3D.MipLevels = desc.MipLevels;
+            descSRV.Texture3D.MostDetailedMip = 0;
+            DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureIntensity.Get(), &descSRV, m_pSRVVolumeIntensityMips.GetAddressOf()));
+        }
+
         for (uint32_t mipLevelID = 0; mipLevelID < desc.MipLevels; mipLevelID++) {
             D3D11_UNORDERED_ACCESS_VIEW_DESC descUAV = {};
             descUAV.Format = DXGI_FORMAT_R16_UNORM;
@@ -69,7 +63,7 @@ MCVolumeDataLoader::MCVolumeDataLoader(std::shared_ptr<DX::DeviceResources> devi
         D3D11_BOX box = { 0, 0, 0,  desc.Width, desc.Height,  desc.Depth };
         m_pImmediateContext->UpdateSubresource(pTextureIntensity.Get(), 0, &box, std::data(intensity), sizeof(uint16_t) * desc.Width, sizeof(uint16_t) * desc.Height * desc.Width);
 
-        for (uint32_t mipLevelID = 1; mipLevelID < desc.MipLevels - 1; mipLevelID++) {
+        for (uint32_t mipLevelID = 1; mipLevelID < desc.MipLevels; mipLevelID++) {
             uint32_t threadGroupX = std::max(static_cast<uint32_t>(std::ceil((m_DimensionX >> mipLevelID) / 4.0f)), 1u);
             uint32_t threadGroupY = std::max(static_cast<uint32_t>(std::ceil((m_DimensionY >> mipLevelID) / 4.0f)), 1u);
             uint32_t threadGroupZ = std::max(static_cast<uint32_t>(std::ceil((m_DimensionZ >> mipLevelID) / 4.0f)), 1u);
@@ -100,7 +94,164 @@ MCVolumeDataLoader::MCVolumeDataLoader(std::shared_ptr<DX::DeviceResources> devi
     }
 
     {
-        DX::ComPtr<ID3D11Texture3D> pTextureGradient;
+        // padded so that every node of the coarsest level has its eight children
+        const uint32_t nodeAlignment = MinMaxCellSize << (MinMaxLevelCount - 1);
+        auto getNodeCount = [nodeAlignment](uint32_t dimension) -> uint32_t {
+            return (dimension + nodeAlignment - 1) / nodeAlignment * (nodeAlignment / MinMaxCellSize);
+        };
+
+        DX::ComPtr<ID3D11Texture3D> pTextureMinMax;
+        D3D11_TEXTURE3D_DESC desc = {};
+        desc.Width = getNodeCount(m_DimensionX);
+        desc.Height = getNodeCount(m_DimensionY);
+        desc.Depth = getNodeCount(m_DimensionZ);
+        desc.Format = DXGI_FORMAT_R16G16_UNORM;
+        desc.MipLevels = MinMaxLevelCount;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        DX::ThrowIfFailed(m_pDevice->CreateTexture3D(&desc, nullptr, pTextureMinMax.GetAddressOf()));
+        DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureMinMax.Get(), nullptr, m_pSRVMinMax.GetAddressOf()));
+
+        for (uint32_t levelID = 0; levelID < desc.MipLevels; levelID++) {
+            D3D11_SHADER_RESOURCE_VIEW_DESC descSRV = {};
+            descSRV.Format = desc.Format;
+            descSRV.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE3D;
+            descSRV.Texture3D.MipLevels = 1;
+            descSRV.Texture3D.MostDetailedMip = levelID;
+
+            D3D11_UNORDERED_ACCESS_VIEW_DESC descUAV = {};
+            descUAV.Format = desc.Format;
+            descUAV.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE3D;
+            descUAV.Texture3D.MipSlice = levelID;
+            descUAV.Texture3D.FirstWSlice = 0;
+            descUAV.Texture3D.WSize = desc.Depth >> levelID;
+
+            DX::ComPtr<ID3D11ShaderResourceView> pSRVMinMax;
+            DX::ComPtr<ID3D11UnorderedAccessView> pUAVMinMax;
+            DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureMinMax.Get(), &descSRV, pSRVMinMax.GetAddressOf()));
+            DX::ThrowIfFailed(m_pDevice->CreateUnorderedAccessView(pTextureMinMax.Get(), &descUAV, pUAVMinMax.GetAddressOf()));
+            m_pSRVMinMaxLevel.push_back(pSRVMinMax);
+            m_pUAVMinMaxLevel.push_back(pUAVMinMax);
+        }
+
+        for (uint32_t levelID = 0; levelID < desc.MipLevels; levelID++) {
+            uint32_t threadGroupX = std::max(static_cast<uint32_t>(std::ceil((desc.Width >> levelID) / 4.0f)), 1u);
+            uint32_t threadGroupY = std::max(static_cast<uint32_t>(std::ceil((desc.Height >> levelID) / 4.0f)), 1u);
+            uint32_t threadGroupZ = std::max(static_cast<uint32_t>(std::ceil((desc.Depth >> levelID) / 4.0f)), 1u);
+
+            ID3D11ShaderResourceView* ppSRVTextures[] = { m_pSRVVolumeIntensity[0].Get(), levelID > 0 ? m_pSRVMinMaxLevel[levelID - 1].Get() : nullptr };
+            ID3D11UnorderedAccessView* ppUAVTextures[] = { m_pUAVMinMaxLevel[levelID].Get() };
+
+            ID3D11UnorderedAccessView* ppUAVClear[] = { nullptr };
+            ID3D11ShaderResourceView* ppSRVClear[] = { nullptr, nullptr };
+
+            auto renderPassName = fmt::format("Render Pass: Compute Min Max Level [{}] ", levelID);
+            auto renderPassNameWide = std::wstring(renderPassName.begin(), renderPassName.end());
+            deviceResource->PIXBeginEvent(renderPassNameWide.c_str());
+            (levelID > 0 ? shaders.m_PSOGenerateMinMaxLevel : shaders.m_PSOGenerateMinMaxBase).Apply(m_pImmediateContext);
+            m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVTextures), ppSRVTextures);
+            m_pImmediateContext->CSSetUnorderedAccessViews(1, _countof(ppUAVTextures), ppUAVTextures, nullptr);
+            m_pImmediateContext->Dispatch(threadGroupX, threadGroupY, threadGroupZ);
+
+            m_pImmediateContext->CSSetUnorderedAccessViews(1, _countof(ppUAVClear), ppUAVClear, nullptr);
+            m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVClear), ppSRVClear);
+            deviceResource->PIXEndEvent();
+        }
+        m_pImmediateContext->Flush();
+    }
+
+    const std::vector<uint8_t> labels = readLabels(std::filesystem::path(fileName).replace_extension(".labels").string(), m_DimensionX, m_DimensionY, m_DimensionZ);
+    if (!std::empty(labels)) {
+        {
+            DX::ComPtr<ID3D11Texture3D> pTextureLabel;
+            D3D11_TEXTURE3D_DESC desc = {};
+            desc.Width = m_DimensionX;
+            desc.Height = m_DimensionY;
+            desc.Depth = m_DimensionZ;
+            desc.Format = DXGI_FORMAT_R8_UINT;
+            desc.MipLevels = 1;
+            desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+            desc.Usage = D3D11_USAGE_IMMUTABLE;
+
+            D3D11_SUBRESOURCE_DATA initData = {};
+            initData.pSysMem = std::data(labels);
+            initData.SysMemPitch = desc.Width;
+            initData.SysMemSlicePitch = desc.Width * desc.Height;
+            DX::ThrowIfFailed(m_pDevice->CreateTexture3D(&desc, &initData, pTextureLabel.GetAddressOf()));
+            DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureLabel.Get(), nullptr, m_pSRVLabel.GetAddressOf()));
+        }
+
+        D3D11_TEXTURE3D_DESC desc = {};
+        {
+            DX::ComPtr<ID3D11Resource> pResource;
+            DX::ComPtr<ID3D11Texture3D> pTexture;
+            m_pSRVMinMax->GetResource(pResource.GetAddressOf());
+            DX::ThrowIfFailed(pResource.As(&pTexture));
+            pTexture->GetDesc(&desc);
+        }
+        desc.Format = DXGI_FORMAT_R16_UINT;
+
+        DX::ComPtr<ID3D11Texture3D> pTextureLabelMask;
+        DX::ThrowIfFailed(m_pDevice->CreateTexture3D(&desc, nullptr, pTextureLabelMask.GetAddressOf()));
+        DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureLabelMask.Get(), nullptr, m_pSRVLabelMask.GetAddressOf()));
+
+        for (uint32_t levelID = 0; levelID < desc.MipLevels; levelID++) {
+            D3D11_SHADER_RESOURCE_VIEW_DESC descSRV = {};
+            descSRV.Format = desc.Format;
+            descSRV.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE3D;
+            descSRV.Texture3D.MipLevels = 1;
+            descSRV.Texture3D.MostDetailedMip = levelID;
+
+            D3D11_UNORDERED_ACCESS_VIEW_DESC descUAV = {};
+            descUAV.Format = desc.Format;
+            descUAV.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE3D;
+            descUAV.Texture3D.MipSlice = levelID;
+            descUAV.Texture3D.FirstWSlice = 0;
+            descUAV.Texture3D.WSize = desc.Depth >> levelID;
+
+            DX::ComPtr<ID3D11ShaderResourceView> pSRVLabelMask;
+            DX::ComPtr<ID3D11UnorderedAccessView> pUAVLabelMask;
+            DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureLabelMask.Get(), &descSRV, pSRVLabelMask.GetAddressOf()));
+            DX::ThrowIfFailed(m_pDevice->CreateUnorderedAccessView(pTextureLabelMask.Get(), &descUAV, pUAVLabelMask.GetAddressOf()));
+            m_pSRVLabelMaskLevel.push_back(pSRVLabelMask);
+            m_pUAVLabelMaskLevel.push_back(pUAVLabelMask);
+        }
+
+        for (uint32_t levelID = 0; levelID < desc.MipLevels; levelID++) {
+            uint32_t threadGroupX = std::max(static_cast<uint32_t>(std::ceil((desc.Width >> levelID) / 4.0f)), 1u);
+            uint32_t threadGroupY = std::max(static_cast<uint32_t>(std::ceil((desc.Height >> levelID) / 4.0f)), 1u);
+            uint32_t threadGroupZ = std::max(static_cast<uint32_t>(std::ceil((desc.Depth >> levelID) / 4.0f)), 1u);
+
+            ID3D11ShaderResourceView* ppSRVTextures[] = { m_pSRVLabel.Get(), levelID > 0 ? m_pSRVLabelMaskLevel[levelID - 1].Get() : nullptr };
+            ID3D11UnorderedAccessView* ppUAVTextures[] = { m_pUAVLabelMaskLevel[levelID].Get() };
+
+            ID3D11UnorderedAccessView* ppUAVClear[] = { nullptr };
+            ID3D11ShaderResourceView* ppSRVClear[] = { nullptr, nullptr };
+
+            auto renderPassName = fmt::format("Render Pass: Compute Label Mask Level [{}] ", levelID);
+            auto renderPassNameWide = std::wstring(renderPassName.begin(), renderPassName.end());
+            deviceResource->PIXBeginEvent(renderPassNameWide.c_str());
+            (levelID > 0 ? shaders.m_PSOGenerateLabelMaskLevel : shaders.m_PSOGenerateLabelMaskBase).Apply(m_pImmediateContext);
+            m_pImmediateContext->CSSetShaderResources(2, _countof(ppSRVTextures), ppSRVTextures);
+            m_pImmediateContext->CSSetUnorderedAccessViews(2, _countof(ppUAVTextures), ppUAVTextures, nullptr);
+            m_pImmediateContext->Dispatch(threadGroupX, threadGroupY, threadGroupZ);
+
+            m_pImmediateContext->CSSetUnorderedAccessViews(2, _countof(ppUAVClear), ppUAVClear, nullptr);
+            m_pImmediateContext->CSSetShaderResources(2, _countof(ppSRVClear), ppSRVClear);
+            deviceResource->PIXEndEvent();
+        }
+        m_pImmediateContext->Flush();
+    }
+
+    computeGradient(deviceResource, m_pSRVOpacityTF);
+}
+
+void MCVolumeDataLoader::computeGradient(std::shared_ptr<DX::DeviceResources> deviceResource, DX::ComPtr<ID3D11ShaderResourceView> pSRVOpacityTF)
+{
+    auto m_pImmediateContext = deviceResource->GetD3DDeviceContext();
+    auto m_pDevice = deviceResource->GetD3DDevice();
+
+    {
         D3D11_TEXTURE3D_DESC desc = {};
         desc.Width = m_DimensionX;
         desc.Height = m_DimensionY;
@@ -109,24 +260,29 @@ MCVolumeDataLoader::MCVolumeDataLoader(std::shared_ptr<DX::DeviceResources> devi
         desc.MipLevels = 1;
         desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
         desc.Usage = D3D11_USAGE_DEFAULT;
-        DX::ThrowIfFailed(m_pDevice->CreateTexture3D(&desc, nullptr, pTextureGradient.ReleaseAndGetAddressOf()));
-        DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureGradient.Get(), nullptr, m_pSRVGradient.ReleaseAndGetAddressOf()));
-        DX::ThrowIfFailed(m_pDevice->CreateUnorderedAccessView(pTextureGradient.Get(), nullptr, m_pUAVGradient.ReleaseAndGetAddressOf()));
+
+        // a new opacity function reuses the texture of the previous gradient
+        if (!m_pSRVGradient) {
+            DX::ComPtr<ID3D11Texture3D> pTextureGradient;
+            DX::ThrowIfFailed(m_pDevice->CreateTexture3D(&desc, nullptr, pTextureGradient.ReleaseAndGetAddressOf()));
+            DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureGradient.Get(), nullptr, m_pSRVGradient.ReleaseAndGetAddressOf()));
+            DX::ThrowIfFailed(m_pDevice->CreateUnorderedAccessView(pTextureGradient.Get(), nullptr, m_pUAVGradient.ReleaseAndGetAddressOf()));
+        }
         {
             uint32_t threadGroupX = static_cast<uint32_t>(std::ceil(m_DimensionX / 4.0f));
             uint32_t threadGroupY = static_cast<uint32_t>(std::ceil(m_DimensionY / 4.0f));
             uint32_t threadGroupZ = static_cast<uint32_t>(std::ceil(m_DimensionZ / 4.0f));
 
-            ID3D11ShaderResourceView* ppSRVTextures[] = { m_pSRVVolumeIntensity[0].Get(), m_pSRVOpacityTF.Get() };
+            ID3D11ShaderResourceView* ppSRVTextures[] = { m_pSRVVolumeIntensity[0].Get(), pSRVOpacityTF.Get() };
             ID3D11UnorderedAccessView* ppUAVTextures[] = { m_pUAVGradient.Get() };
-            ID3D11SamplerState* ppSamplers[] = { samplers.m_pSamplerPoint.Get(), samplers.m_pSamplerLinear.Get() };
+            ID3D11SamplerState* ppSamplers[] = { m_Samplers.m_pSamplerPoint.Get(), m_Samplers.m_pSamplerLinear.Get() };
 
             ID3D11UnorderedAccessView* ppUAVClear[] = { nullptr };
             ID3D11ShaderResourceView* ppSRVClear[] = { nullptr, nullptr };
             ID3D11SamplerState* ppSamplerClear[] = { nullptr, nullptr };
 
             deviceResource->PIXBeginEvent(L"Render Pass: Compute Gradient");
-            shaders.m_PSOComputeGradient.Apply(m_pImmediateContext);
+            m_Shaders.m_PSOComputeGradient.Apply(m_pImmediateContext);
             m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVTextures), ppSRVTextures);
             m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVTextures), ppUAVTextures, nullptr);
             m_pImmediateContext->CSSetSamplers(0, _countof(ppSamplers), ppSamplers);
@@ -140,3 +296,59 @@ MCVolumeDataLoader::MCVolumeDataLoader(std::shared_ptr<DX::DeviceResources> devi
         m_pImmediateContext->Flush();
     }
 }
+
+auto MCVolumeDataLoader::readIntensity(std::string const& fileName, uint32_t sliceBegin, uint32_t sliceEnd, uint16_t& dimensionX, uint16_t& dimensionY, uint16_t& dimensionZ) -> std::vector<uint16_t>
+{
+    std::unique_ptr<FILE, decltype(&fclose)> pFile(fopen(fileName.c_str(), "rb"), fclose);
+    if (!pFile)
+        throw std::runtime_error("Failed to open file: " + fileName);
+
+    fread(reinterpret_cast<char*>(&dimensionX), sizeof(uint16_t), 1, pFile.get());
+    fread(reinterpret_cast<char*>(&dimensionY), sizeof(uint16_t), 1, pFile.get());
+    fread(reinterpret_cast<char*>(&dimensionZ), sizeof(uint16_t), 1, pFile.get());
+
+    // the slices are stored one after the other behind the header, only the requested ones are read
+    sliceEnd = (std::min)(sliceEnd, static_cast<uint32_t>(dimensionZ));
+    sliceBegin = (std::min)(sliceBegin, sliceEnd);
+    const size_t sliceSize = size_t(dimensionX) * size_t(dimensionY);
+    std::vector<uint16_t> intensity(sliceSize * (sliceEnd - sliceBegin));
+    _fseeki64(pFile.get(), static_cast<int64_t>(3 * sizeof(uint16_t) + sliceSize * sliceBegin * sizeof(uint16_t)), SEEK_SET);
+    fread(reinterpret_cast<char*>(intensity.data()), sizeof(uint16_t), std::size(intensity), pFile.get());
+
+    auto NormalizeIntensity = [](uint16_t intensity, uint16_t min, uint16_t max) -> uint16_t {
+        return static_cast<uint16_t>(std::round(std::numeric_limits<uint16_t>::max() * ((intensity - min) / static_cast<F32>(max - min))));
+    };
+
+    uint16_t tmin = 0 << 12; // Min HU [0, 4096]
+    uint16_t tmax = 1 << 12; // Max HU [0, 4096]
+    for (size_t index = 0u; index < std::size(intensity); index++)
+        intensity[index] = NormalizeIntensity(intensity[index], tmin, tmax);
+    return intensity;
+}
+
+auto MCVolumeDataLoader::readLabels(std::string const& fileName, uint16_t dimensionX, uint16_t dimensionY, uint16_t dimensionZ) -> std::vector<uint8_t>
+{
+    std::unique_ptr<FILE, decltype(&fclose)> pFile(fopen(fileName.c_str(), "rb"), fclose);
+    if (!pFile)
+        return {};
+
+    uint16_t dimension[3] = {};
+    fread(reinterpret_cast<char*>(dimension), sizeof(uint16_t), 3, pFile.get());
+    if (dimension[0] != dimensionX || dimension[1] != dimensionY || dimension[2] != dimensionZ)
+        throw std::runtime_error("Label volume of other dimensions than the volume: " + fileName);
+
+    std::vector<uint8_t> labels(size_t(dimensionX) * size_t(dimensionY) * size_t(dimensionZ));
+    if (fread(reinterpret_cast<char*>(labels.data()), sizeof(uint8_t), std::size(labels), pFile.get()) != std::size(labels))
+        throw std::runtime_error("Truncated label volume: " + fileName);
+
+    size_t outsideCount = 0;
+    for (auto& label : labels) {
+        if (label >= MCTransferFunction::MaxLabelCount) {
+            label = 0;
+            outsideCount++;
+        }
+    }
+    if (outsideCount > 0)
+        OutputDebugStringA(fmt::format("Label volume: {} voxels of {} have a label from {} on, read as label 0\n", outsideCount, fileName, MCTransferFunction::MaxLabelCount).c_str());
+    return labels;
+}
@@ -20,6 +20,10 @@ struct MCVolumeDataLoaderInitializeSamplers {
 struct MCVolumeDataLoaderInitializeShaders {
 	DX::ComputePSO  m_PSOGenerateMipLevel;
 	DX::ComputePSO m_PSOComputeGradient;
+	DX::ComputePSO m_PSOGenerateMinMaxBase;
+	DX::ComputePSO m_PSOGenerateMinMaxLevel;
+	DX::ComputePSO m_PSOGenerateLabelMaskBase;
+	DX::ComputePSO m_PSOGenerateLabelMaskLevel;
 };
 
 class MCVolumeDataLoader
@@ -35,13 +39,47 @@ public:
 	// volume texture
 	D3D11ArrayShadeResourceView   m_pSRVVolumeIntensity;
 	D3D11ArrayUnorderedAccessView m_pUAVVolumeIntensity;
+	// the whole mip chain, for passes choosing the level per sample
+	DX::ComPtr<ID3D11ShaderResourceView> m_pSRVVolumeIntensityMips;
 	// volume gradient texture
 	DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVGradient;
 	DX::ComPtr<ID3D11UnorderedAccessView> m_pUAVGradient;
+	// conservative min / max intensity pyramid for empty space skipping, see EmptySpaceSkipping.hlsl
+	static constexpr uint32_t MinMaxCellSize = 4;
+	static constexpr uint32_t MinMaxLevelCount = 6;
+	DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVMinMax;
+	D3D11ArrayShadeResourceView           m_pSRVMinMaxLevel;
+	D3D11ArrayUnorderedAccessView         m_pUAVMinMaxLevel;
+	// optional label volume of the .labels file next to the volume file, point sampled, see LevelOfDetail.hlsl
+	DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVLabel;
+	// bit l of a node is set when label l occurs among the voxels of its min / max, the same nodes and levels as m_pSRVMinMax
+	DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVLabelMask;
+	D3D11ArrayShadeResourceView           m_pSRVLabelMaskLevel;
+	D3D11ArrayUnorderedAccessView         m_pUAVLabelMaskLevel;
+	// normalized intensity kept on the CPU for the CPU renderer
+	std::vector<uint16_t> m_Intensity;
 
 	uint16_t m_DimensionX = 0;
 	uint16_t m_DimensionY = 0;
 	uint16_t m_DimensionZ = 0;
 	uint16_t m_DimensionMipLevels = 0;
+
+	// slices [sliceBegin, sliceEnd) of a volume file normalized as the textures, a sort-last domain never reads the whole volume
+	static auto readIntensity(std::string const& fileName, uint32_t sliceBegin, uint32_t sliceEnd, uint16_t& dimensionX, uint16_t& dimensionY, uint16_t& dimensionZ) -> std::vector<uint16_t>;
+
+	// the three dimensions of the volume behind the same header and one byte per voxel, empty when the file does not exist.
+	// Labels from MCTransferFunction::MaxLabelCount on are read as label 0
+	static auto readLabels(std::string const& fileName, uint16_t dimensionX, uint16_t dimensionY, uint16_t dimensionZ) -> std::vector<uint8_t>;
+
+	auto getFileName() const -> std::string const& { return fileName; }
+
+	auto hasLabels() const -> bool { return m_pSRVLabel != nullptr; }
+
+	// the gradient of the opacity, again after the opacity transfer function changed
+	void computeGradient(std::shared_ptr<DX::DeviceResources> deviceResource, DX::ComPtr<ID3D11ShaderResourceView> pSRVOpacityTF);
+
+private:
+	MCVolumeDataLoaderInitializeSamplers m_Samplers;
+	MCVolumeDataLoaderInitializeShaders  m_Shaders;
 };
 
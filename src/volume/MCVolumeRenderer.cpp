@@ -7,16 +7,26 @@ MCVolumeRenderer::MCVolumeRenderer(std::shared_ptr<DX::DeviceResources> deviceRe
 	initialize();
 }
 
+MCVolumeRenderer::~MCVolumeRenderer() {
+	if (m_TransferFunctionWatch != INVALID_HANDLE_VALUE)
+		FindCloseChangeNotification(m_TransferFunctionWatch);
+}
+
 void MCVolumeRenderer::initialize() {
 	DX::ComPtr<ID3D11Device1> m_pDevice = m_deviceResources->GetD3DDevice();
 
 	// initialize shaders
 	m_shaders = std::make_unique<MCShaders>(m_pDevice);
+	m_profiler = std::make_unique<MCProfiler>(m_pDevice);
 	
 	// parse transfer functions and generate textures
-	std::string transferFunctionJSON = "data/config/transferFunction.json";
-	m_transferFunctions = std::make_unique<MCTransferFunction>(transferFunctionJSON);
+	std::error_code error;
+	const auto writeTime = std::filesystem::last_write_time(m_TransferFunctionFileName, error);
+	m_transferFunctions = std::make_shared<MCTransferFunction const>(m_TransferFunctionFileName);
 	generateTransferFunctionTextures(m_pDevice);
+	m_TransferFunctionCache.insert(m_TransferFunctionFileName, { m_transferFunctions, m_TransferFunctionTextures, writeTime });
+	if (m_IsTransferFunctionWatchEnabled)
+		watchTransferFunction();
 
 	// initialize samplers
 	initializeSamplers(m_pDevice);
@@ -29,16 +39,38 @@ void MCVolumeRenderer::initialize() {
 
     initializeRenderTextures();
 
+    initializeHistoryTextures();
+
+    initializeDenoiseResources();
+
     initializeTileBuffers();
 
     initializeBuffers();
 
     initializeEnvironmentMap();
+
+    updateClipBox();
+
+    if (m_IsCPUBenchmarkEnabled)
+        runCPUBenchmark();
 }
 
 void MCVolumeRenderer::update(float deltaTime)
 {
     m_DeltaTime = deltaTime;
+
+    // leave interactive mode once the camera has been still long enough and restart full resolution accumulation
+    if (m_IsCameraMoving) {
+        m_MotionIdleTime += deltaTime;
+        if (m_MotionIdleTime > m_MotionSettleTime) {
+            m_IsCameraMoving = false;
+            m_FrameIndex = 0;
+        }
+    }
+    if (m_DistributedCoordinator || m_DistributedWorker)
+        updateDistributed();
+    if (m_TransferFunctionWatch != INVALID_HANDLE_VALUE)
+        pollTransferFunction();
     updateState();
 }
 
@@ -79,27 +111,41 @@ void MCVolumeRenderer::blit(DX::ComPtr<ID3D11ShaderResourceView>  pSrc, DX::ComP
 
 void MCVolumeRenderer::renderFrame(DX::ComPtr<ID3D11RenderTargetView> pRTV)
 {
-    if (m_FrameIndex > m_MaximumSamples) {
+    const uint32_t maximumSamples = getMaximumSamples();
+    if (m_FrameIndex > maximumSamples) {
+        if (m_IsDistributedMergePending)
+            presentDistributedMerge(m_deviceResources->GetOutputSize().right, m_deviceResources->GetOutputSize().bottom);
         blit(m_pSRVToneMap, pRTV);
         return;
     };
     auto width = m_deviceResources->GetOutputSize().right;
     auto height = m_deviceResources->GetOutputSize().bottom;
     auto m_pImmediateContext = m_deviceResources->GetD3DDeviceContext();
+    m_profiler->beginFrame(m_pImmediateContext);
 
-    for (size_t i = 0; i < 8; i++) {
+    // while the camera moves render fewer samples at reduced resolution, the result is upsampled below
+    const uint32_t renderScale = getRenderScale();
+    const uint32_t sampleCount = m_IsCameraMoving ? m_MinRotateSamples : 8;
+    const uint32_t renderWidth = width / renderScale;
+    const uint32_t renderHeight = height / renderScale;
+
+    for (size_t i = 0; i < sampleCount; i++) {
         ID3D11UnorderedAccessView* ppUAVClear[] = { nullptr, nullptr, nullptr, nullptr };
-        ID3D11ShaderResourceView* ppSRVClear[] = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+        ID3D11ShaderResourceView* ppSRVClear[] = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+
+        // the first full resolution frame after a camera move is seeded with the reprojected history
+        const bool isReprojecting = m_FrameIndex < 1 && !m_IsCameraMoving && m_IsHistoryValid;
 
-        uint32_t threadGroupsX = static_cast<uint32_t>(std::ceil(width / 8));
-        uint32_t threadGroupsY = static_cast<uint32_t>(std::ceil(height / 8));
+        uint32_t threadGroupsX = static_cast<uint32_t>(std::ceil(renderWidth / 8.0f));
+        uint32_t threadGroupsY = static_cast<uint32_t>(std::ceil(renderHeight / 8.0f));
 
         m_pImmediateContext->VSSetConstantBuffers(0, 1, m_pConstantBufferFrame.GetAddressOf());
         m_pImmediateContext->GSSetConstantBuffers(0, 1, m_pConstantBufferFrame.GetAddressOf());
         m_pImmediateContext->PSSetConstantBuffers(0, 1, m_pConstantBufferFrame.GetAddressOf());
         m_pImmediateContext->CSSetConstantBuffers(0, 1, m_pConstantBufferFrame.GetAddressOf());
+        m_pImmediateContext->CSSetConstantBuffers(2, 1, m_pConstantBufferClip.GetAddressOf());
 
-        if (m_FrameIndex < 1) {
+        if (m_FrameIndex < 1 || m_IsCameraMoving) {
             ID3D11UnorderedAccessView* ppUAVResources[] = { m_pUAVDispersionTiles.Get() };
             uint32_t pCounters[] = { 0 };
 
@@ -131,6 +177,8 @@ void MCVolumeRenderer::renderFrame(DX::ComPtr<ID3D11RenderTargetView> pRTV)
         m_pImmediateContext->ClearUnorderedAccessViewFloat(m_pUAVNormal.Get(), clearColor);
         m_pImmediateContext->ClearUnorderedAccessViewFloat(m_pUAVDepth.Get(), clearColor);
         m_pImmediateContext->ClearUnorderedAccessViewFloat(m_pUAVRadiance.Get(), clearColor);
+        if (m_FrameIndex < 1 && !isReprojecting)
+            m_pImmediateContext->ClearUnorderedAccessViewFloat(m_pUAVColorSum.Get(), clearColor);
         m_deviceResources->PIXEndEvent();
 
         m_deviceResources->PIXBeginEvent(L"Render Pass: Copy counters of tiles");
@@ -147,11 +195,18 @@ void MCVolumeRenderer::renderFrame(DX::ComPtr<ID3D11RenderTargetView> pRTV)
             ID3D11ShaderResourceView* ppSRVResources[] = {
                 m_volume->m_pSRVVolumeIntensity[m_MipLevel].Get(),
                 m_volume->m_pSRVGradient.Get(),
-                m_pSRVDiffuseTF.Get(),
-                m_pSRVSpecularTF.Get(),
-                m_pSRVRoughnessTF.Get(),
-                m_pSRVOpacityTF.Get(),
-                m_pSRVDispersionTiles.Get()
+                m_TransferFunctionTextures.m_pSRVMaterialTF.Get(),
+                m_TransferFunctionTextures.m_pSRVOpacityTF.Get(),
+                m_pSRVDispersionTiles.Get(),
+                m_volume->m_pSRVMinMax.Get(),
+                m_TransferFunctionTextures.m_pSRVOpacityRangeTF.Get(),
+                m_TransferFunctionTextures.m_pSRVOpacityPreIntegrationTF.Get(),
+                m_TransferFunctionTextures.m_pSRVOpacity2DTF.Get(),
+                m_volume->m_pSRVLabel.Get(),
+                m_volume->m_pSRVLabelMask.Get(),
+                m_TransferFunctionTextures.m_pSRVLabelOpacityTF.Get(),
+                m_TransferFunctionTextures.m_pSRVLabelOpacityRangeTF.Get(),
+                m_TransferFunctionTextures.m_pSRVLabelMaterialTF.Get()
             };
 
             ID3D11UnorderedAccessView* ppUAVResources[] = {
@@ -172,6 +227,29 @@ void MCVolumeRenderer::renderFrame(DX::ComPtr<ID3D11RenderTargetView> pRTV)
             m_deviceResources->PIXEndEvent();
         }
 
+        if (isReprojecting) {
+            ID3D11ShaderResourceView* ppSRVResources[] = {
+                m_pSRVColorSumHistory.Get(),
+                m_pSRVNormalHistory.Get(),
+                m_pSRVDepthHistory.Get(),
+                m_pSRVNormal.Get(),
+                m_pSRVDepth.Get(),
+                m_pSRVDispersionTiles.Get()
+            };
+
+            ID3D11UnorderedAccessView* ppUAVResources[] = { m_pUAVColorSum.Get() };
+
+            m_deviceResources->PIXBeginEvent(L"Render Pass: Reproject [History] -> [Color Sum]");
+            m_shaders->m_PSOReproject.Apply(m_pImmediateContext);
+            m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVResources), ppSRVResources);
+            m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVResources), ppUAVResources, nullptr);
+            m_pImmediateContext->DispatchIndirect(m_pDispathIndirectBufferArgs.Get(), 0);
+            m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVClear), ppUAVClear, nullptr);
+            m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVClear), ppSRVClear);
+            m_deviceResources->PIXEndEvent();
+            m_IsHistoryValid = false;
+        }
+
         {
             ID3D11SamplerState* ppSamplers[] = {
                 m_pSamplerPoint.Get(),
@@ -180,21 +258,40 @@ void MCVolumeRenderer::renderFrame(DX::ComPtr<ID3D11RenderTargetView> pRTV)
             };
 
             ID3D11ShaderResourceView* ppSRVResources[] = {
-                m_volume->m_pSRVVolumeIntensity[m_MipLevel].Get(),
-                m_pSRVOpacityTF.Get(),
+                m_volume->m_pSRVVolumeIntensityMips.Get(),
+                m_TransferFunctionTextures.m_pSRVOpacityTF.Get(),
                 m_pSRVDiffuse.Get(),
                 m_pSRVSpecular.Get(),
                 m_pSRVNormal.Get(),
                 m_pSRVDepth.Get(),
                 m_pSRVEnviroment.Get(),
-                m_pSRVDispersionTiles.Get()
+                m_pSRVDispersionTiles.Get(),
+                m_pSRVEnvironmentAliasTable.Get(),
+                m_volume->m_pSRVGradient.Get(),
+                m_TransferFunctionTextures.m_pSRVMaterialTF.Get(),
+                m_volume->m_pSRVMinMax.Get(),
+                m_TransferFunctionTextures.m_pSRVOpacityRangeTF.Get(),
+                m_TransferFunctionTextures.m_pSRVOpacityPreIntegrationTF.Get(),
+                m_TransferFunctionTextures.m_pSRVOpacity2DTF.Get(),
+                m_volume->m_pSRVLabel.Get(),
+                m_volume->m_pSRVLabelMask.Get(),
+                m_TransferFunctionTextures.m_pSRVLabelOpacityTF.Get(),
+                m_TransferFunctionTextures.m_pSRVLabelOpacityRangeTF.Get(),
+                m_TransferFunctionTextures.m_pSRVLabelMaterialTF.Get()
             };
 
             ID3D11UnorderedAccessView* ppUAVResources[] = {
-                m_pUAVRadiance.Get()
+                m_pUAVRadiance.Get(),
+                m_pUAVBounceStatistics.Get()
             };
 
+            if (m_IsBounceStatisticsEnabled && m_FrameIndex < 1) {
+                uint32_t pValues[] = { 0, 0, 0, 0 };
+                m_pImmediateContext->ClearUnorderedAccessViewUint(m_pUAVBounceStatistics.Get(), pValues);
+            }
+
             m_deviceResources->PIXBeginEvent(L"Render pass: Compute Radiance");
+            m_profiler->begin(m_pImmediateContext, "Compute Radiance");
             m_shaders->m_PSOComputeDiffuseLight.Apply(m_pImmediateContext);
             m_pImmediateContext->CSSetSamplers(0, _countof(ppSamplers), ppSamplers);
             m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVResources), ppSRVResources);
@@ -202,7 +299,11 @@ void MCVolumeRenderer::renderFrame(DX::ComPtr<ID3D11RenderTargetView> pRTV)
             m_pImmediateContext->DispatchIndirect(m_pDispathIndirectBufferArgs.Get(), 0);
             m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVClear), ppUAVClear, nullptr);
             m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVClear), ppSRVClear);
+            m_profiler->end(m_pImmediateContext, "Compute Radiance");
             m_deviceResources->PIXEndEvent();
+
+            if (m_IsBounceStatisticsEnabled && !m_IsCameraMoving && m_FrameIndex + 1 == maximumSamples)
+                reportBounceStatistics();
         }
 
         {
@@ -219,8 +320,12 @@ void MCVolumeRenderer::renderFrame(DX::ComPtr<ID3D11RenderTargetView> pRTV)
             m_deviceResources->PIXEndEvent();
         }
 
+        // only the presented image and the one at the denoiser sample budget are filtered
+        const bool isDenoising = m_IsDenoiseEnabled && (i + 1 == sampleCount || m_FrameIndex + 1 == m_DenoiseMaximumSamples);
+        auto pSRVColorHDR = isDenoising ? denoise(renderWidth, renderHeight) : m_pSRVColorSum;
+
         {
-            ID3D11ShaderResourceView* ppSRVResources[] = { m_pSRVColorSum.Get(), m_pSRVDispersionTiles.Get() };
+            ID3D11ShaderResourceView* ppSRVResources[] = { pSRVColorHDR.Get(), m_pSRVDispersionTiles.Get() };
             ID3D11UnorderedAccessView* ppUAVResources[] = { m_pUAVToneMap.Get() };
 
             m_deviceResources->PIXBeginEvent(L"Render Pass: Tone Map");
@@ -232,10 +337,47 @@ void MCVolumeRenderer::renderFrame(DX::ComPtr<ID3D11RenderTargetView> pRTV)
             m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVClear), ppSRVClear);
             m_deviceResources->PIXEndEvent();
         }
+
+        if (m_IsDenoiseEnabled && m_IsDenoiseMetricsEnabled && !m_IsCameraMoving) {
+            if (m_FrameIndex + 1 == m_DenoiseMaximumSamples) {
+                copyTexture(pSRVColorHDR, m_pSRVDenoiseSnapshot);
+                copyTexture(m_pSRVColorSum, m_pSRVColorSumSnapshot);
+            }
+            if (m_FrameIndex + 1 == m_MaximumSamples)
+                computeDenoiseMetrics(renderWidth, renderHeight);
+        }
         m_FrameIndex++;
+        if (m_IsLodSweepEnabled && !m_IsCameraMoving && m_FrameIndex == maximumSamples)
+            updateLodSweep(renderWidth, renderHeight);
+        if ((m_DistributedCoordinator || m_DistributedWorker) && !m_IsCameraMoving && m_FrameIndex == maximumSamples)
+            finishDistributedStream(renderWidth, renderHeight);
         // update
         updateState();
     }
+    m_profiler->endFrame(m_pImmediateContext);
+
+    if (m_IsCameraMoving) {
+        ID3D11UnorderedAccessView* ppUAVClear[] = { nullptr };
+        ID3D11ShaderResourceView* ppSRVClear[] = { nullptr, nullptr, nullptr };
+
+        ID3D11ShaderResourceView* ppSRVResources[] = { m_pSRVToneMap.Get(), m_pSRVNormal.Get(), m_pSRVDepth.Get() };
+        ID3D11UnorderedAccessView* ppUAVResources[] = { m_pUAVUpsample.Get() };
+
+        uint32_t threadGroupsX = static_cast<uint32_t>(std::ceil(width / 8.0f));
+        uint32_t threadGroupsY = static_cast<uint32_t>(std::ceil(height / 8.0f));
+
+        m_deviceResources->PIXBeginEvent(L"Render Pass: Upsample [Tone Map] -> [Upsample]");
+        m_shaders->m_PSOUpsample.Apply(m_pImmediateContext);
+        m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVResources), ppSRVResources);
+        m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVResources), ppUAVResources, nullptr);
+        m_pImmediateContext->Dispatch(threadGroupsX, threadGroupsY, 1);
+        m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVClear), ppUAVClear, nullptr);
+        m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVClear), ppSRVClear);
+        m_deviceResources->PIXEndEvent();
+
+        blit(m_pSRVUpsample, pRTV);
+        return;
+    }
     blit(m_pSRVToneMap, pRTV);
     /*   if (m_IsDrawDegugTiles) {
            ID3D11ShaderResourceView* ppSRVResources[] = { m_pSRVDispersionTiles.Get() };
@@ -259,10 +401,88 @@ void MCVolumeRenderer::renderFrame(DX::ComPtr<ID3D11RenderTargetView> pRTV)
 
 void MCVolumeRenderer::generateTransferFunctionTextures(DX::ComPtr<ID3D11Device> m_pDevice)
 {
-	m_pSRVOpacityTF = m_transferFunctions->opacityTF.GenerateTexture(m_pDevice, m_SamplingCount);
-	m_pSRVDiffuseTF = m_transferFunctions->diffuseTF.GenerateTexture(m_pDevice, m_SamplingCount);
-	m_pSRVSpecularTF = m_transferFunctions->specularTF.GenerateTexture(m_pDevice, m_SamplingCount);
-	m_pSRVRoughnessTF = m_transferFunctions->roughnessTF.GenerateTexture(m_pDevice, m_SamplingCount);
+	auto& textures = m_TransferFunctionTextures;
+	const uint64_t opacityHash = m_transferFunctions->getOpacityHash(m_SamplingCount);
+	if (opacityHash != textures.m_OpacityHash) {
+		m_transferFunctions->generateOpacityTextures(m_pDevice, m_SamplingCount, textures);
+		textures.m_OpacityHash = opacityHash;
+	}
+
+	std::array<uint64_t, MCTransferFunction::MaterialSliceCount> materialHashes = {};
+	uint32_t changedSliceCount = 0;
+	for (uint32_t slice = 0; slice < MCTransferFunction::MaterialSliceCount; slice++) {
+		materialHashes[slice] = m_transferFunctions->getMaterialHash(m_SamplingCount, slice);
+		changedSliceCount += materialHashes[slice] != textures.m_MaterialHashes[slice];
+	}
+
+	// the sampling is part of every slice hash, a new one changes them all along with the size of the texture. The texture of
+	// another cached preset is left as it is, the changed slices go to a new one
+	const bool isShared = m_TransferFunctionCache.isMaterialTextureShared(textures.m_pSRVMaterialTF.Get(), m_TransferFunctionFileName);
+	if (changedSliceCount == MCTransferFunction::MaterialSliceCount || (changedSliceCount > 0 && isShared)) {
+		textures.m_pSRVMaterialTF = m_transferFunctions->generateMaterialTexture(m_pDevice, m_SamplingCount);
+	} else if (changedSliceCount > 0) {
+		for (uint32_t slice = 0; slice < MCTransferFunction::MaterialSliceCount; slice++) {
+			if (materialHashes[slice] != textures.m_MaterialHashes[slice])
+				m_transferFunctions->updateMaterialTexture(m_deviceResources->GetD3DDeviceContext(), textures.m_pSRVMaterialTF, m_SamplingCount, slice);
+		}
+	}
+	textures.m_MaterialHashes = materialHashes;
+	textures.m_Sampling = m_SamplingCount;
+
+	// the label textures are small and baked for every preset, a label volume can come with the next one
+	const uint64_t labelHash = m_transferFunctions->getLabelHash(m_SamplingCount);
+	if (labelHash != textures.m_LabelHash) {
+		m_transferFunctions->generateLabelTextures(m_pDevice, m_SamplingCount, textures);
+		textures.m_LabelHash = labelHash;
+	}
+}
+
+void MCVolumeRenderer::updateTransferFunctionTextures(MCTransferFunctionTextures previous)
+{
+	generateTransferFunctionTextures(m_deviceResources->GetD3DDevice());
+
+	// the visible bounds are a function of the opacity, the gradient is one of the intensity only
+	const bool isLabelChanged = m_volume->hasLabels() && m_TransferFunctionTextures.m_LabelHash != previous.m_LabelHash;
+	if (m_TransferFunctionTextures.m_OpacityHash != previous.m_OpacityHash || isLabelChanged)
+		updateClipBox();
+	if (m_TransferFunctionTextures.m_OpacityHash != previous.m_OpacityHash || m_TransferFunctionTextures.m_MaterialHashes != previous.m_MaterialHashes || isLabelChanged) {
+		m_FrameIndex = 0;
+		m_IsHistoryValid = false;
+	}
+}
+
+void MCVolumeRenderer::watchTransferFunction()
+{
+	if (m_TransferFunctionWatch != INVALID_HANDLE_VALUE)
+		FindCloseChangeNotification(m_TransferFunctionWatch);
+
+	const std::filesystem::path path = std::filesystem::absolute(m_TransferFunctionFileName);
+	m_TransferFunctionWatch = FindFirstChangeNotificationW(path.parent_path().c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+
+	std::error_code error;
+	m_TransferFunctionWriteTime = std::filesystem::last_write_time(path, error);
+}
+
+void MCVolumeRenderer::pollTransferFunction()
+{
+	if (WaitForSingleObject(m_TransferFunctionWatch, 0) != WAIT_OBJECT_0)
+		return;
+	FindNextChangeNotification(m_TransferFunctionWatch);
+
+	// the notification covers the whole directory, the write time tells whether the preset itself was saved
+	std::error_code error;
+	const auto writeTime = std::filesystem::last_write_time(m_TransferFunctionFileName, error);
+	if (error || writeTime == m_TransferFunctionWriteTime)
+		return;
+	m_TransferFunctionWriteTime = writeTime;
+
+	// an editor may save in several writes, a preset that does not parse yet is picked up by the next one
+	try {
+		loadTransferFunction(m_TransferFunctionFileName);
+		OutputDebugStringA(fmt::format("Transfer function: reloaded {}\n", m_TransferFunctionFileName).c_str());
+	} catch (std::exception const& exception) {
+		OutputDebugStringA(fmt::format("Transfer function: {} not reloaded, {}\n", m_TransferFunctionFileName, exception.what()).c_str());
+	}
 }
 
 void MCVolumeRenderer::initializeSamplers(DX::ComPtr<ID3D11Device> m_pDevice)
@@ -422,9 +642,13 @@ void MCVolumeRenderer::initializeVolume(std::shared_ptr<DX::DeviceResources> dev
     MCVolumeDataLoaderInitializeShaders shaders = {};
     shaders.m_PSOGenerateMipLevel = m_shaders->m_PSOGenerateMipLevel;
     shaders.m_PSOComputeGradient = m_shaders->m_PSOComputeGradient;
+    shaders.m_PSOGenerateMinMaxBase = m_shaders->m_PSOGenerateMinMaxBase;
+    shaders.m_PSOGenerateMinMaxLevel = m_shaders->m_PSOGenerateMinMaxLevel;
+    shaders.m_PSOGenerateLabelMaskBase = m_shaders->m_PSOGenerateLabelMaskBase;
+    shaders.m_PSOGenerateLabelMaskLevel = m_shaders->m_PSOGenerateLabelMaskLevel;
 
     m_volume = std::make_unique<MCVolumeDataLoader>(
-        m_deviceResources, samplers, shaders, m_pSRVOpacityTF);
+        m_deviceResources, samplers, shaders, m_TransferFunctionTextures.m_pSRVOpacityTF);
 }
 
 void MCVolumeRenderer::initializeRenderTextures()
@@ -550,6 +774,107 @@ void MCVolumeRenderer::initializeRenderTextures()
         DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureToneMap.Get(), nullptr, m_pSRVToneMap.GetAddressOf()));
         DX::ThrowIfFailed(m_pDevice->CreateUnorderedAccessView(pTextureToneMap.Get(), nullptr, m_pUAVToneMap.GetAddressOf()));
     }
+
+    {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.ArraySize = 1;
+        desc.MipLevels = 1;
+        desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        desc.Width = width;
+        desc.Height = height;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+        desc.SampleDesc.Count = 1;
+        desc.SampleDesc.Quality = 0;
+
+        Microsoft::WRL::ComPtr<ID3D11Texture2D> pTextureUpsample;
+        DX::ThrowIfFailed(m_pDevice->CreateTexture2D(&desc, nullptr, pTextureUpsample.ReleaseAndGetAddressOf()));
+        DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureUpsample.Get(), nullptr, m_pSRVUpsample.ReleaseAndGetAddressOf()));
+        DX::ThrowIfFailed(m_pDevice->CreateUnorderedAccessView(pTextureUpsample.Get(), nullptr, m_pUAVUpsample.ReleaseAndGetAddressOf()));
+    }
+}
+
+void MCVolumeRenderer::initializeHistoryTextures()
+{
+    createTextureCopy(m_pSRVColorSum, m_pSRVColorSumHistory);
+    createTextureCopy(m_pSRVNormal, m_pSRVNormalHistory);
+    createTextureCopy(m_pSRVDepth, m_pSRVDepthHistory);
+}
+
+void MCVolumeRenderer::initializeDenoiseResources()
+{
+    auto width = m_deviceResources->GetOutputSize().right;
+    auto height = m_deviceResources->GetOutputSize().bottom;
+    auto m_pDevice = m_deviceResources->GetD3DDevice();
+
+    for (size_t index = 0; index < std::size(m_pSRVDenoise); index++) {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.ArraySize = 1;
+        desc.MipLevels = 1;
+        desc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+        desc.Width = width;
+        desc.Height = height;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+        desc.SampleDesc.Count = 1;
+        desc.SampleDesc.Quality = 0;
+
+        Microsoft::WRL::ComPtr<ID3D11Texture2D> pTextureDenoise;
+        DX::ThrowIfFailed(m_pDevice->CreateTexture2D(&desc, nullptr, pTextureDenoise.ReleaseAndGetAddressOf()));
+        DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureDenoise.Get(), nullptr, m_pSRVDenoise[index].ReleaseAndGetAddressOf()));
+        DX::ThrowIfFailed(m_pDevice->CreateUnorderedAccessView(pTextureDenoise.Get(), nullptr, m_pUAVDenoise[index].ReleaseAndGetAddressOf()));
+    }
+
+    createTextureCopy(m_pSRVDenoise[0], m_pSRVDenoiseSnapshot);
+    createTextureCopy(m_pSRVColorSum, m_pSRVColorSumSnapshot);
+    createTextureCopy(m_pSRVColorSum, m_pSRVLodReference);
+
+    uint32_t threadGroupsX = static_cast<uint32_t>(std::ceil(width / 8.0f));
+    uint32_t threadGroupsY = static_cast<uint32_t>(std::ceil(height / 8.0f));
+    m_pBufferDenoiseError = DX::CreateStructuredBuffer<Hawk::Math::Vec2>(m_pDevice, threadGroupsX * threadGroupsY, false, true, nullptr);
+    {
+        D3D11_UNORDERED_ACCESS_VIEW_DESC desc = {};
+        desc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+        desc.Buffer.FirstElement = 0;
+        desc.Buffer.NumElements = threadGroupsX * threadGroupsY;
+        DX::ThrowIfFailed(m_pDevice->CreateUnorderedAccessView(m_pBufferDenoiseError.Get(), &desc, m_pUAVDenoiseError.ReleaseAndGetAddressOf()));
+    }
+
+    {
+        D3D11_BUFFER_DESC desc = {};
+        m_pBufferDenoiseError->GetDesc(&desc);
+        desc.BindFlags = 0;
+        desc.MiscFlags = 0;
+        desc.Usage = D3D11_USAGE_STAGING;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        DX::ThrowIfFailed(m_pDevice->CreateBuffer(&desc, nullptr, m_pBufferDenoiseErrorStaging.ReleaseAndGetAddressOf()));
+    }
+
+    m_pConstantBufferDenoise = DX::CreateConstantBuffer<DenoiseBuffer>(m_pDevice);
+}
+
+void MCVolumeRenderer::createTextureCopy(DX::ComPtr<ID3D11ShaderResourceView> pSRVSource, DX::ComPtr<ID3D11ShaderResourceView>& pSRVCopy)
+{
+    auto m_pDevice = m_deviceResources->GetD3DDevice();
+    DX::ComPtr<ID3D11Resource> pResourceSource;
+    DX::ComPtr<ID3D11Texture2D> pTextureSource;
+    pSRVSource->GetResource(pResourceSource.GetAddressOf());
+    DX::ThrowIfFailed(pResourceSource.As(&pTextureSource));
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    pTextureSource->GetDesc(&desc);
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+    Microsoft::WRL::ComPtr<ID3D11Texture2D> pTextureCopy;
+    DX::ThrowIfFailed(m_pDevice->CreateTexture2D(&desc, nullptr, pTextureCopy.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pTextureCopy.Get(), nullptr, pSRVCopy.ReleaseAndGetAddressOf()));
+}
+
+void MCVolumeRenderer::copyTexture(DX::ComPtr<ID3D11ShaderResourceView> pSRVSource, DX::ComPtr<ID3D11ShaderResourceView> pSRVCopy)
+{
+    DX::ComPtr<ID3D11Resource> pResourceSource;
+    DX::ComPtr<ID3D11Resource> pResourceCopy;
+    pSRVSource->GetResource(pResourceSource.GetAddressOf());
+    pSRVCopy->GetResource(pResourceCopy.GetAddressOf());
+    m_deviceResources->GetD3DDeviceContext()->CopyResource(pResourceCopy.Get(), pResourceSource.Get());
 }
 
 void MCVolumeRenderer::initializeTileBuffers()
@@ -583,8 +908,48 @@ void MCVolumeRenderer::initializeBuffers()
 {
     auto m_pDevice = m_deviceResources->GetD3DDevice();
     m_pConstantBufferFrame = DX::CreateConstantBuffer<FrameBuffer>(m_pDevice);
+    m_pConstantBufferClip = DX::CreateConstantBuffer<ClipBuffer>(m_pDevice);
+    m_pConstantBufferClipBox = DX::CreateConstantBuffer<ClipBoxBuffer>(m_pDevice);
     m_pDispathIndirectBufferArgs = DX::CreateIndirectBuffer<DispathIndirectBuffer>(m_pDevice, DispathIndirectBuffer{ 1, 1, 1 });
     m_pDrawInstancedIndirectBufferArgs = DX::CreateIndirectBuffer<DrawInstancedIndirectBuffer>(m_pDevice, DrawInstancedIndirectBuffer{ 0, 1, 0, 0 });
+
+    m_pBufferBounceStatistics = DX::CreateStructuredBuffer<uint32_t>(m_pDevice, 2 * m_MaximumBounceCount, false, true, nullptr);
+    {
+        D3D11_UNORDERED_ACCESS_VIEW_DESC desc = {};
+        desc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+        desc.Buffer.FirstElement = 0;
+        desc.Buffer.NumElements = 2 * m_MaximumBounceCount;
+        DX::ThrowIfFailed(m_pDevice->CreateUnorderedAccessView(m_pBufferBounceStatistics.Get(), &desc, m_pUAVBounceStatistics.ReleaseAndGetAddressOf()));
+    }
+
+    {
+        D3D11_BUFFER_DESC desc = {};
+        m_pBufferBounceStatistics->GetDesc(&desc);
+        desc.BindFlags = 0;
+        desc.MiscFlags = 0;
+        desc.Usage = D3D11_USAGE_STAGING;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        DX::ThrowIfFailed(m_pDevice->CreateBuffer(&desc, nullptr, m_pBufferBounceStatisticsStaging.ReleaseAndGetAddressOf()));
+    }
+
+    m_pBufferClipBox = DX::CreateStructuredBuffer<uint32_t>(m_pDevice, 6, false, true, nullptr);
+    {
+        D3D11_UNORDERED_ACCESS_VIEW_DESC desc = {};
+        desc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+        desc.Buffer.FirstElement = 0;
+        desc.Buffer.NumElements = 6;
+        DX::ThrowIfFailed(m_pDevice->CreateUnorderedAccessView(m_pBufferClipBox.Get(), &desc, m_pUAVClipBox.ReleaseAndGetAddressOf()));
+    }
+
+    {
+        D3D11_BUFFER_DESC desc = {};
+        m_pBufferClipBox->GetDesc(&desc);
+        desc.BindFlags = 0;
+        desc.MiscFlags = 0;
+        desc.Usage = D3D11_USAGE_STAGING;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        DX::ThrowIfFailed(m_pDevice->CreateBuffer(&desc, nullptr, m_pBufferClipBoxStaging.ReleaseAndGetAddressOf()));
+    }
 }
 
 void MCVolumeRenderer::initializeEnvironmentMap()
@@ -593,6 +958,136 @@ void MCVolumeRenderer::initializeEnvironmentMap()
     const wchar_t* filename = L"data/textures/clear_puresky_2k.dds";
     //const wchar_t* filename2 = L"data/textures/thatch_chapel_2k.dds";
     DX::ThrowIfFailed(DirectX::CreateDDSTextureFromFile(m_pDevice, filename, nullptr, m_pSRVEnviroment.GetAddressOf()));
+    initializeEnvironmentSampling();
+}
+
+void MCVolumeRenderer::initializeEnvironmentSampling()
+{
+    auto m_pDevice = m_deviceResources->GetD3DDevice();
+    auto m_pImmediateContext = m_deviceResources->GetD3DDeviceContext();
+
+    DX::ComPtr<ID3D11Resource> pResourceEnvironment;
+    DX::ComPtr<ID3D11Texture2D> pTextureEnvironment;
+    m_pSRVEnviroment->GetResource(pResourceEnvironment.GetAddressOf());
+    DX::ThrowIfFailed(pResourceEnvironment.As(&pTextureEnvironment));
+
+    // the environment is block compressed, the luminance is read back from the first mip level not wider than m_EnvironmentSamplingWidth
+    D3D11_TEXTURE2D_DESC descEnvironment = {};
+    pTextureEnvironment->GetDesc(&descEnvironment);
+    uint32_t mipLevel = 0;
+    while (mipLevel + 1 < descEnvironment.MipLevels && (descEnvironment.Width >> mipLevel) > m_EnvironmentSamplingWidth)
+        mipLevel++;
+    m_EnvironmentWidth = (std::max)(descEnvironment.Width >> mipLevel, 1u);
+    m_EnvironmentHeight = (std::max)(descEnvironment.Height >> mipLevel, 1u);
+
+    DX::ComPtr<ID3D11Texture2D> pTextureLuminance;
+    DX::ComPtr<ID3D11Texture2D> pTextureLuminanceStaging;
+    DX::ComPtr<ID3D11UnorderedAccessView> pUAVLuminance;
+    {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.ArraySize = 1;
+        desc.MipLevels = 1;
+        desc.Format = DXGI_FORMAT_R32_FLOAT;
+        desc.Width = m_EnvironmentWidth;
+        desc.Height = m_EnvironmentHeight;
+        desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+        desc.SampleDesc.Count = 1;
+        desc.SampleDesc.Quality = 0;
+        DX::ThrowIfFailed(m_pDevice->CreateTexture2D(&desc, nullptr, pTextureLuminance.GetAddressOf()));
+        DX::ThrowIfFailed(m_pDevice->CreateUnorderedAccessView(pTextureLuminance.Get(), nullptr, pUAVLuminance.GetAddressOf()));
+
+        desc.BindFlags = 0;
+        desc.Usage = D3D11_USAGE_STAGING;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        DX::ThrowIfFailed(m_pDevice->CreateTexture2D(&desc, nullptr, pTextureLuminanceStaging.GetAddressOf()));
+    }
+
+    auto pConstantBufferEnvironment = DX::CreateConstantBuffer<EnvironmentBuffer>(m_pDevice);
+    {
+        DX::MapHelper<EnvironmentBuffer> map(m_pImmediateContext, pConstantBufferEnvironment, D3D11_MAP_WRITE_DISCARD, 0);
+        map->MipLevel = mipLevel;
+        map->Width = m_EnvironmentWidth;
+        map->Height = m_EnvironmentHeight;
+    }
+
+    {
+        ID3D11UnorderedAccessView* ppUAVClear[] = { nullptr };
+        ID3D11ShaderResourceView* ppSRVClear[] = { nullptr };
+        ID3D11ShaderResourceView* ppSRVResources[] = { m_pSRVEnviroment.Get() };
+        ID3D11UnorderedAccessView* ppUAVResources[] = { pUAVLuminance.Get() };
+
+        uint32_t threadGroupsX = static_cast<uint32_t>(std::ceil(m_EnvironmentWidth / 8.0f));
+        uint32_t threadGroupsY = static_cast<uint32_t>(std::ceil(m_EnvironmentHeight / 8.0f));
+
+        m_shaders->m_PSOEnvironmentLuminance.Apply(m_pImmediateContext);
+        m_pImmediateContext->CSSetConstantBuffers(0, 1, pConstantBufferEnvironment.GetAddressOf());
+        m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVResources), ppSRVResources);
+        m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVResources), ppUAVResources, nullptr);
+        m_pImmediateContext->Dispatch(threadGroupsX, threadGroupsY, 1);
+        m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVClear), ppUAVClear, nullptr);
+        m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVClear), ppSRVClear);
+        m_pImmediateContext->CopyResource(pTextureLuminanceStaging.Get(), pTextureLuminance.Get());
+    }
+
+    // an equirectangular texel covers a solid angle proportional to sin(theta)
+    std::vector<F32> weights(size_t(m_EnvironmentWidth) * size_t(m_EnvironmentHeight));
+    {
+        D3D11_MAPPED_SUBRESOURCE resource = {};
+        DX::ThrowIfFailed(m_pImmediateContext->Map(pTextureLuminanceStaging.Get(), 0, D3D11_MAP_READ, 0, &resource));
+        for (uint32_t y = 0; y < m_EnvironmentHeight; y++) {
+            auto pLuminance = reinterpret_cast<const F32*>(static_cast<const uint8_t*>(resource.pData) + size_t(y) * resource.RowPitch);
+            const F32 sinTheta = std::sin(Hawk::Math::PI<F32> * (y + 0.5f) / m_EnvironmentHeight);
+            for (uint32_t x = 0; x < m_EnvironmentWidth; x++)
+                weights[size_t(y) * m_EnvironmentWidth + x] = (std::max)(pLuminance[x], 0.0f) * sinTheta;
+        }
+        m_pImmediateContext->Unmap(pTextureLuminanceStaging.Get(), 0);
+    }
+
+    auto table = buildEnvironmentAliasTable(weights);
+    auto pBuffer = DX::CreateStructuredBuffer<EnvironmentAliasEntry>(m_pDevice, static_cast<uint32_t>(std::size(table)), false, false, table.data());
+    {
+        D3D11_SHADER_RESOURCE_VIEW_DESC desc = {};
+        desc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+        desc.BufferEx.FirstElement = 0;
+        desc.BufferEx.NumElements = static_cast<uint32_t>(std::size(table));
+        DX::ThrowIfFailed(m_pDevice->CreateShaderResourceView(pBuffer.Get(), &desc, m_pSRVEnvironmentAliasTable.ReleaseAndGetAddressOf()));
+    }
+}
+
+auto MCVolumeRenderer::buildEnvironmentAliasTable(std::vector<F32> const& weights) const -> std::vector<EnvironmentAliasEntry>
+{
+    const size_t count = std::size(weights);
+    const F64 sum = std::accumulate(std::begin(weights), std::end(weights), 0.0);
+
+    std::vector<EnvironmentAliasEntry> table(count);
+    std::vector<F32> scaled(count);
+    for (size_t index = 0; index < count; index++) {
+        scaled[index] = sum > 0.0 ? static_cast<F32>(weights[index] * count / sum) : 1.0f;
+        table[index].Threshold = 1.0f;
+        table[index].Alias = static_cast<uint32_t>(index);
+        table[index].Pdf = scaled[index];
+    }
+
+    std::vector<uint32_t> small;
+    std::vector<uint32_t> large;
+    for (size_t index = 0; index < count; index++)
+        (scaled[index] < 1.0f ? small : large).push_back(static_cast<uint32_t>(index));
+
+    // Vose: every small entry is topped up to one by a large entry, which is demoted once it drops below one
+    while (!std::empty(small) && !std::empty(large)) {
+        const uint32_t indexSmall = small.back();
+        const uint32_t indexLarge = large.back();
+        small.pop_back();
+
+        table[indexSmall].Threshold = scaled[indexSmall];
+        table[indexSmall].Alias = indexLarge;
+        scaled[indexLarge] = (scaled[indexLarge] + scaled[indexSmall]) - 1.0f;
+        if (scaled[indexLarge] < 1.0f) {
+            large.pop_back();
+            small.push_back(indexLarge);
+        }
+    }
+    return table;
 }
 
 void MCVolumeRenderer::updateState()
@@ -603,45 +1098,712 @@ void MCVolumeRenderer::updateState()
     Hawk::Math::Vec3 scaleVector = { 0.488f * m_volume->m_DimensionX, 0.488f * m_volume->m_DimensionY, 0.7f * m_volume->m_DimensionZ };
     scaleVector /= (std::max)({ scaleVector.x, scaleVector.y, scaleVector.z });
 
-    auto const& matrixView = m_Camera.ToMatrix();
+    // a worker renders the view of the coordinator
+    const Hawk::Math::Mat4x4 matrixView = m_DistributedWorker && m_DistributedView.Generation ? m_DistributedView.ViewMatrix : m_Camera.ToMatrix();
     Hawk::Math::Mat4x4 matrixProjection = Hawk::Math::Orthographic(m_Zoom * (width / static_cast<F32>(height)), m_Zoom, -1.0f, 1.0f);
     Hawk::Math::Mat4x4 matrixWorld = Hawk::Math::RotateX(Hawk::Math::Radians(-90.0f));
     Hawk::Math::Mat4x4 matrixNormal = Hawk::Math::Inverse(Hawk::Math::Transpose(matrixWorld));
 
+    m_FrameState.BoundingBoxMin = scaleVector * m_BoundingBoxMin;
+    m_FrameState.BoundingBoxMax = scaleVector * m_BoundingBoxMax;
+
+    m_WorldViewProjectionMatrix = matrixProjection * matrixView * matrixWorld;
+
+    m_FrameState.ViewProjectionMatrix = matrixProjection * matrixView;
+    m_FrameState.NormalViewMatrix = matrixView * matrixNormal;
+    m_FrameState.WorldViewProjectionMatrix = matrixProjection * matrixView * matrixWorld;
+    m_FrameState.ViewMatrix = matrixView;
+    m_FrameState.WorldMatrix = matrixWorld;
+    m_FrameState.NormalMatrix = matrixNormal;
+
+    m_FrameState.InvViewProjectionMatrix = Hawk::Math::Inverse(m_FrameState.ViewProjectionMatrix);
+    m_FrameState.InvNormalViewMatrix = Hawk::Math::Inverse(m_FrameState.NormalViewMatrix);
+    m_FrameState.InvWorldViewProjectionMatrix = Hawk::Math::Inverse(m_FrameState.WorldViewProjectionMatrix);
+    m_FrameState.InvViewMatrix = Hawk::Math::Inverse(m_FrameState.InvViewMatrix);
+    m_FrameState.InvWorldMatrix = Hawk::Math::Inverse(m_FrameState.WorldMatrix);
+    m_FrameState.InvNormalMatrix = Hawk::Math::Inverse(m_FrameState.NormalMatrix);
+    m_FrameState.PrevWorldViewProjectionMatrix = m_HistoryWorldViewProjectionMatrix;
+    m_FrameState.StepSize = Hawk::Math::Distance(m_FrameState.BoundingBoxMin, m_FrameState.BoundingBoxMax) / (isPreIntegrated() ? m_PreIntegratedStepCount : m_StepCount);
+
+    m_FrameState.Density = m_Density;
+    m_FrameState.FrameIndex = m_FrameIndex;
+    m_FrameState.Exposure = m_Exposure;
+
+    m_FrameState.FrameOffset = Hawk::Math::Vec2(m_RandomDistribution(m_RandomGenerator), m_RandomDistribution(m_RandomGenerator));
+    m_FrameState.RenderScale = getRenderScale();
+    m_FrameState.EnvironmentWidth = m_EnvironmentWidth;
+    m_FrameState.EnvironmentHeight = m_EnvironmentHeight;
+    m_FrameState.BounceCount = (std::min)(m_BounceCount, m_MaximumBounceCount);
+    m_FrameState.IsBounceStatisticsEnabled = m_IsBounceStatisticsEnabled;
+    m_FrameState.IsEmptySpaceSkippingEnabled = m_IsEmptySpaceSkippingEnabled;
+    m_FrameState.IsPreIntegrationEnabled = isPreIntegrated();
+    m_FrameState.IsOpacity2DEnabled = isOpacity2D();
+    // the Sobel weights of Gradient.hlsl sum to 16 on each side, a slope of one normalized intensity per voxel has a magnitude of 32
+    const F32 gradientMagnitudeMax = m_TransferFunctionBlend ? m_TransferFunctionBlend->getGradientMagnitudeMax() : m_transferFunctions->opacity2DTF.GradientMagnitudeMax;
+    const F32 intensityRange = m_TransferFunctionBlend ? m_TransferFunctionBlend->getIntensityRange() : m_transferFunctions->opacityTF.PLF.RangeMax - m_transferFunctions->opacityTF.PLF.RangeMin;
+    m_FrameState.GradientMagnitudeScale = intensityRange / (32.0f * gradientMagnitudeMax);
+    m_FrameState.IsLabelEnabled = m_volume->hasLabels();
+    m_FrameState.LabelVisibilityMask = m_LabelVisibilityMask;
+    m_FrameState.RadianceLodBias = m_MipLevel + m_RadianceLodBias;
+    m_FrameState.RadianceLodBounceScale = m_RadianceLodBounceScale;
+    m_FrameState.SampleOffset = m_DistributedWorker ? m_DistributedWorker->getWorkerIndex() * getMaximumSamples() : 0;
+    m_FrameState.ClipBoxMin = m_FrameState.BoundingBoxMin;
+    m_FrameState.ClipBoxMax = m_FrameState.BoundingBoxMax;
+    if (m_IsClipBoxEnabled) {
+        m_FrameState.ClipBoxMin += m_ClipBoxMin * (m_FrameState.BoundingBoxMax - m_FrameState.BoundingBoxMin);
+        m_FrameState.ClipBoxMax = m_FrameState.BoundingBoxMin + m_ClipBoxMax * (m_FrameState.BoundingBoxMax - m_FrameState.BoundingBoxMin);
+    }
+    m_FrameState.RenderTargetDim = Hawk::Math::Vec2(static_cast<F32>(width), static_cast<F32>(height)) / static_cast<F32>(m_FrameState.RenderScale);
+    m_FrameState.InvRenderTargetDim = Hawk::Math::Vec2(1.0f, 1.0f) / m_FrameState.RenderTargetDim;
+
     {
         DX::MapHelper<FrameBuffer> map(m_pImmediateContext, m_pConstantBufferFrame, D3D11_MAP_WRITE_DISCARD, 0);
-        map->BoundingBoxMin = scaleVector * m_BoundingBoxMin;
-        map->BoundingBoxMax = scaleVector * m_BoundingBoxMax;
+        *map = m_FrameState;
+    }
+
+    {
+        DX::MapHelper<ClipBuffer> map(m_pImmediateContext, m_pConstantBufferClip, D3D11_MAP_WRITE_DISCARD, 0);
+        *map = buildClipBuffer(scaleVector);
+    }
+}
+
+auto MCVolumeRenderer::buildClipBuffer(Hawk::Math::Vec3 const& scale) const -> ClipBuffer
+{
+    std::vector<Hawk::Math::Plane> planes = m_ClipPlanes;
+    if (m_IsCropBoxEnabled) {
+        // two opposite faces per box axis, -HalfExtent <= Dot(axis, p - Center) <= HalfExtent
+        auto const rotation = Hawk::Math::Convert<Hawk::Math::Quat, Hawk::Math::Mat3x3>(Hawk::Math::Normalize(m_CropBoxOrientation));
+        for (uint32_t axis = 0; axis < 3; axis++) {
+            auto const normal = Hawk::Math::Vec3(rotation(0, axis), rotation(1, axis), rotation(2, axis));
+            auto const center = Hawk::Math::Dot(normal, m_CropBoxCenter);
+            planes.emplace_back(normal, m_CropBoxHalfExtent[axis] - center);
+            planes.emplace_back(-normal, m_CropBoxHalfExtent[axis] + center);
+        }
+    }
+
+    // the rays live in the volume space scaled by scale, Dot(n, p / scale) = Dot(n / scale, p)
+    ClipBuffer buffer = {};
+    buffer.PlaneCount = static_cast<uint32_t>((std::min)(std::size(planes), std::size(buffer.Planes)));
+    for (uint32_t index = 0; index < buffer.PlaneCount; index++)
+        buffer.Planes[index] = Hawk::Math::Vec4(planes[index].Normal / scale, planes[index].Offset);
+    return buffer;
+}
+
+void MCVolumeRenderer::updateClipBox()
+{
+    auto m_pImmediateContext = m_deviceResources->GetD3DDeviceContext();
+
+    D3D11_TEXTURE3D_DESC desc = {};
+    {
+        DX::ComPtr<ID3D11Resource> pResource;
+        DX::ComPtr<ID3D11Texture3D> pTexture;
+        m_volume->m_pSRVMinMax->GetResource(pResource.GetAddressOf());
+        DX::ThrowIfFailed(pResource.As(&pTexture));
+        pTexture->GetDesc(&desc);
+    }
+
+    uint32_t threadGroupsX = static_cast<uint32_t>(std::ceil(desc.Width / 4.0f));
+    uint32_t threadGroupsY = static_cast<uint32_t>(std::ceil(desc.Height / 4.0f));
+    uint32_t threadGroupsZ = static_cast<uint32_t>(std::ceil(desc.Depth / 4.0f));
+
+    ID3D11UnorderedAccessView* ppUAVClear[] = { nullptr };
+    ID3D11ShaderResourceView* ppSRVClear[] = { nullptr, nullptr, nullptr, nullptr };
+
+    ID3D11ShaderResourceView* ppSRVResources[] = {
+        m_volume->m_pSRVMinMaxLevel[0].Get(),
+        m_TransferFunctionTextures.m_pSRVOpacityRangeTF.Get(),
+        m_volume->hasLabels() ? m_volume->m_pSRVLabelMaskLevel[0].Get() : nullptr,
+        m_TransferFunctionTextures.m_pSRVLabelOpacityRangeTF.Get()
+    };
+    ID3D11UnorderedAccessView* ppUAVResources[] = { m_pUAVClipBox.Get() };
+
+    {
+        DX::MapHelper<ClipBoxBuffer> map(m_pImmediateContext, m_pConstantBufferClipBox, D3D11_MAP_WRITE_DISCARD, 0);
+        map->IsLabelEnabled = m_volume->hasLabels();
+        map->LabelVisibilityMask = m_LabelVisibilityMask;
+    }
+
+    uint32_t pValues[] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+    m_pImmediateContext->ClearUnorderedAccessViewUint(m_pUAVClipBox.Get(), pValues);
+
+    m_deviceResources->PIXBeginEvent(L"Render Pass: Compute Clip Box [Min Max, Opacity Range, Label Mask] -> [Clip Box]");
+    m_shaders->m_PSOComputeClipBox.Apply(m_pImmediateContext);
+    m_pImmediateContext->CSSetConstantBuffers(1, 1, m_pConstantBufferClipBox.GetAddressOf());
+    m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVResources), ppSRVResources);
+    m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVResources), ppUAVResources, nullptr);
+    m_pImmediateContext->Dispatch(threadGroupsX, threadGroupsY, threadGroupsZ);
+    m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVClear), ppUAVClear, nullptr);
+    m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVClear), ppSRVClear);
+    m_pImmediateContext->CopyResource(m_pBufferClipBoxStaging.Get(), m_pBufferClipBox.Get());
+    m_deviceResources->PIXEndEvent();
+
+    // runs only when the transfer function changes, stalling on the readback is acceptable here
+    std::array<uint32_t, 6> bounds = {};
+    {
+        D3D11_MAPPED_SUBRESOURCE resource = {};
+        DX::ThrowIfFailed(m_pImmediateContext->Map(m_pBufferClipBoxStaging.Get(), 0, D3D11_MAP_READ, 0, &resource));
+        std::memcpy(bounds.data(), resource.pData, sizeof(uint32_t) * std::size(bounds));
+        m_pImmediateContext->Unmap(m_pBufferClipBoxStaging.Get(), 0);
+    }
+
+    // nothing visible, an inverted box that no ray intersects
+    if (bounds[0] == 0xFFFFFFFF) {
+        m_ClipBoxMin = Hawk::Math::Vec3(1.0f, 1.0f, 1.0f);
+        m_ClipBoxMax = Hawk::Math::Vec3(0.0f, 0.0f, 0.0f);
+        return;
+    }
+
+    // node n spans the voxel centers [n, n + 1] * MinMaxCellSize, voxel centers sit at (i + 0.5) / dimension
+    const Hawk::Math::Vec3 dimension = Hawk::Math::Vec3(m_volume->m_DimensionX, m_volume->m_DimensionY, m_volume->m_DimensionZ);
+    const F32 cellSize = static_cast<F32>(MCVolumeDataLoader::MinMaxCellSize);
+    const Hawk::Math::Vec3 nodeMin = Hawk::Math::Vec3(static_cast<F32>(bounds[0]), static_cast<F32>(bounds[1]), static_cast<F32>(bounds[2]));
+    const Hawk::Math::Vec3 nodeMax = Hawk::Math::Vec3(static_cast<F32>(~bounds[3]), static_cast<F32>(~bounds[4]), static_cast<F32>(~bounds[5]));
+    const Hawk::Math::Vec3 texcoordMin = (cellSize * nodeMin + Hawk::Math::Vec3(0.5f)) / dimension;
+    const Hawk::Math::Vec3 texcoordMax = (cellSize * (nodeMax + Hawk::Math::Vec3(1.0f)) + Hawk::Math::Vec3(0.5f)) / dimension;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        m_ClipBoxMin[axis] = Hawk::Math::Clamp(texcoordMin[axis], 0.0f, 1.0f);
+        m_ClipBoxMax[axis] = Hawk::Math::Clamp(texcoordMax[axis], 0.0f, 1.0f);
+    }
+
+    const Hawk::Math::Vec3 extent = m_ClipBoxMax - m_ClipBoxMin;
+    auto message = fmt::format("Clip box: [{:.3f}, {:.3f}, {:.3f}] - [{:.3f}, {:.3f}, {:.3f}], {:.1f}% of the volume\n",
+        m_ClipBoxMin.x, m_ClipBoxMin.y, m_ClipBoxMin.z, m_ClipBoxMax.x, m_ClipBoxMax.y, m_ClipBoxMax.z, 100.0f * extent.x * extent.y * extent.z);
+    OutputDebugStringA(message.c_str());
+}
+
+void MCVolumeRenderer::saveHistory()
+{
+    m_deviceResources->PIXBeginEvent(L"Render Pass: Copy [Color Sum, Normal, Depth] -> [History]");
+    copyTexture(m_pSRVColorSum, m_pSRVColorSumHistory);
+    copyTexture(m_pSRVNormal, m_pSRVNormalHistory);
+    copyTexture(m_pSRVDepth, m_pSRVDepthHistory);
+    m_deviceResources->PIXEndEvent();
+
+    m_HistoryWorldViewProjectionMatrix = m_WorldViewProjectionMatrix;
+    m_IsHistoryValid = m_FrameIndex > 0;
+}
+
+auto MCVolumeRenderer::denoise(uint32_t renderWidth, uint32_t renderHeight) -> DX::ComPtr<ID3D11ShaderResourceView>
+{
+    auto m_pImmediateContext = m_deviceResources->GetD3DDeviceContext();
+    uint32_t threadGroupsX = static_cast<uint32_t>(std::ceil(renderWidth / 8.0f));
+    uint32_t threadGroupsY = static_cast<uint32_t>(std::ceil(renderHeight / 8.0f));
+
+    ID3D11UnorderedAccessView* ppUAVClear[] = { nullptr };
+    ID3D11ShaderResourceView* ppSRVClear[] = { nullptr, nullptr, nullptr, nullptr };
+
+    m_deviceResources->PIXBeginEvent(L"Render Pass: Denoise [Color Sum] -> [Denoise]");
+    m_profiler->begin(m_pImmediateContext, "Denoise");
+    m_shaders->m_PSODenoise.Apply(m_pImmediateContext);
+    m_pImmediateContext->CSSetConstantBuffers(1, 1, m_pConstantBufferDenoise.GetAddressOf());
+
+    DX::ComPtr<ID3D11ShaderResourceView> pSRVSource = m_pSRVColorSum;
+    size_t targetIndex = 0;
+    for (uint32_t iteration = 0; iteration < m_DenoiseIterations; iteration++) {
+        {
+            DX::MapHelper<DenoiseBuffer> map(m_pImmediateContext, m_pConstantBufferDenoise, D3D11_MAP_WRITE_DISCARD, 0);
+            map->StepWidth = 1u << iteration;
+            map->SigmaColor = m_DenoiseSigmaColor;
+            map->SigmaNormal = m_DenoiseSigmaNormal;
+            map->SigmaDepth = m_DenoiseSigmaDepth;
+            map->SigmaAlbedo = m_DenoiseSigmaAlbedo;
+        }
+
+        ID3D11ShaderResourceView* ppSRVResources[] = { pSRVSource.Get(), m_pSRVDiffuse.Get(), m_pSRVNormal.Get(), m_pSRVDepth.Get() };
+        ID3D11UnorderedAccessView* ppUAVResources[] = { m_pUAVDenoise[targetIndex].Get() };
+
+        m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVResources), ppSRVResources);
+        m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVResources), ppUAVResources, nullptr);
+        m_pImmediateContext->Dispatch(threadGroupsX, threadGroupsY, 1);
+        m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVClear), ppUAVClear, nullptr);
+        m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVClear), ppSRVClear);
+
+        pSRVSource = m_pSRVDenoise[targetIndex];
+        targetIndex = 1 - targetIndex;
+    }
+    m_profiler->end(m_pImmediateContext, "Denoise");
+    m_deviceResources->PIXEndEvent();
+    return pSRVSource;
+}
+
+void MCVolumeRenderer::computeDenoiseMetrics(uint32_t renderWidth, uint32_t renderHeight)
+{
+    const Hawk::Math::Vec2 errorSum = computeRelativeError(m_pSRVColorSum, m_pSRVDenoiseSnapshot, m_pSRVColorSumSnapshot, renderWidth, renderHeight);
+    const F32 pixelCount = static_cast<F32>(renderWidth * renderHeight);
+    auto message = fmt::format("Denoise: {} spp relMSE filtered {:.6f} unfiltered {:.6f} against {} spp reference, {} iterations in {:.3f} ms\n",
+        m_DenoiseMaximumSamples, errorSum.x / pixelCount, errorSum.y / pixelCount, m_MaximumSamples, m_DenoiseIterations, m_profiler->getElapsedTime("Denoise"));
+    OutputDebugStringA(message.c_str());
+}
+
+auto MCVolumeRenderer::computeRelativeError(DX::ComPtr<ID3D11ShaderResourceView> pSRVReference, DX::ComPtr<ID3D11ShaderResourceView> pSRVFiltered, DX::ComPtr<ID3D11ShaderResourceView> pSRVUnfiltered, uint32_t renderWidth, uint32_t renderHeight) -> Hawk::Math::Vec2
+{
+    auto m_pImmediateContext = m_deviceResources->GetD3DDeviceContext();
+    uint32_t threadGroupsX = static_cast<uint32_t>(std::ceil(renderWidth / 8.0f));
+    uint32_t threadGroupsY = static_cast<uint32_t>(std::ceil(renderHeight / 8.0f));
+
+    ID3D11UnorderedAccessView* ppUAVClear[] = { nullptr };
+    ID3D11ShaderResourceView* ppSRVClear[] = { nullptr, nullptr, nullptr };
+
+    ID3D11ShaderResourceView* ppSRVResources[] = { pSRVReference.Get(), pSRVFiltered.Get(), pSRVUnfiltered.Get() };
+    ID3D11UnorderedAccessView* ppUAVResources[] = { m_pUAVDenoiseError.Get() };
+
+    m_deviceResources->PIXBeginEvent(L"Render Pass: Relative error [Reference, Filtered, Unfiltered] -> [Error]");
+    m_shaders->m_PSOComputeError.Apply(m_pImmediateContext);
+    m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVResources), ppSRVResources);
+    m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVResources), ppUAVResources, nullptr);
+    m_pImmediateContext->Dispatch(threadGroupsX, threadGroupsY, 1);
+    m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVClear), ppUAVClear, nullptr);
+    m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVClear), ppSRVClear);
+    m_pImmediateContext->CopyResource(m_pBufferDenoiseErrorStaging.Get(), m_pBufferDenoiseError.Get());
+    m_deviceResources->PIXEndEvent();
+
+    // metrics are an offline measurement, stalling on the readback is acceptable here
+    Hawk::Math::Vec2 errorSum = {};
+    {
+        D3D11_MAPPED_SUBRESOURCE resource = {};
+        DX::ThrowIfFailed(m_pImmediateContext->Map(m_pBufferDenoiseErrorStaging.Get(), 0, D3D11_MAP_READ, 0, &resource));
+        auto pErrors = static_cast<const Hawk::Math::Vec2*>(resource.pData);
+        for (uint32_t index = 0; index < threadGroupsX * threadGroupsY; index++)
+            errorSum += pErrors[index];
+        m_pImmediateContext->Unmap(m_pBufferDenoiseErrorStaging.Get(), 0);
+    }
+    return errorSum;
+}
+
+void MCVolumeRenderer::updateLodSweep(uint32_t renderWidth, uint32_t renderHeight)
+{
+    const Hawk::Math::Vec2 setting = m_LodSweepSettings[m_LodSweepIndex];
+    if (m_LodSweepIndex == 0) {
+        copyTexture(m_pSRVColorSum, m_pSRVLodReference);
+        m_LodSweepReport = fmt::format("LOD sweep: {} spp, {} bounces, Compute Radiance ms per sample against relMSE to the first setting\n", m_MaximumSamples, m_BounceCount);
+    }
+
+    const Hawk::Math::Vec2 errorSum = computeRelativeError(m_pSRVLodReference, m_pSRVColorSum, m_pSRVColorSum, renderWidth, renderHeight);
+    m_LodSweepReport += fmt::format("  bias {:.1f} bounce scale {:.1f}: {:.3f} ms, relMSE {:.6f}\n", setting.x, setting.y,
+        m_profiler->getElapsedTime("Compute Radiance"), errorSum.x / static_cast<F32>(renderWidth * renderHeight));
+
+    // restart the accumulation with the next setting, the last one restores the first
+    m_LodSweepIndex = (m_LodSweepIndex + 1) % static_cast<uint32_t>(std::size(m_LodSweepSettings));
+    m_RadianceLodBias = m_LodSweepSettings[m_LodSweepIndex].x;
+    m_RadianceLodBounceScale = m_LodSweepSettings[m_LodSweepIndex].y;
+    m_FrameIndex = 0;
+    if (m_LodSweepIndex == 0) {
+        m_IsLodSweepEnabled = false;
+        OutputDebugStringA(m_LodSweepReport.c_str());
+    }
+}
+
+void MCVolumeRenderer::reportBounceStatistics()
+{
+    auto m_pImmediateContext = m_deviceResources->GetD3DDeviceContext();
+    m_pImmediateContext->CopyResource(m_pBufferBounceStatisticsStaging.Get(), m_pBufferBounceStatistics.Get());
+
+    std::vector<uint32_t> statistics(2 * m_MaximumBounceCount);
+    {
+        D3D11_MAPPED_SUBRESOURCE resource = {};
+        DX::ThrowIfFailed(m_pImmediateContext->Map(m_pBufferBounceStatisticsStaging.Get(), 0, D3D11_MAP_READ, 0, &resource));
+        std::memcpy(statistics.data(), resource.pData, sizeof(uint32_t) * std::size(statistics));
+        m_pImmediateContext->Unmap(m_pBufferBounceStatisticsStaging.Get(), 0);
+    }
+
+    // the ray marching steps split the measured Compute Radiance time between the bounces
+    uint64_t pathCount = statistics[0];
+    uint64_t segmentCount = 0;
+    uint64_t stepCount = 0;
+    for (uint32_t bounce = 0; bounce < m_MaximumBounceCount; bounce++) {
+        segmentCount += statistics[2 * bounce + 0];
+        stepCount += statistics[2 * bounce + 1];
+    }
+    if (pathCount == 0)
+        return;
+
+    const F32 elapsedTime = m_profiler->getElapsedTime("Compute Radiance");
+    std::string message = fmt::format("Bounces: {} of {}, average path length {:.3f}, Compute Radiance {:.3f} ms per sample\n",
+        m_BounceCount, m_MaximumBounceCount, segmentCount / static_cast<F64>(pathCount), elapsedTime);
+    for (uint32_t bounce = 0; bounce < (std::min)(m_BounceCount, m_MaximumBounceCount); bounce++) {
+        const uint32_t segments = statistics[2 * bounce + 0];
+        const uint32_t steps = statistics[2 * bounce + 1];
+        message += fmt::format("  bounce {}: {:.1f}% of paths, {:.1f} steps per path, ~{:.3f} ms\n", bounce, 100.0 * segments / pathCount,
+            segments ? steps / static_cast<F64>(segments) : 0.0, stepCount ? elapsedTime * steps / static_cast<F64>(stepCount) : 0.0);
+    }
+    OutputDebugStringA(message.c_str());
+}
+
+void MCVolumeRenderer::runCPUBenchmark()
+{
+    const MCCPUFrame frame = getCPUFrame(m_CPUBenchmarkWidth);
+    MCCPURenderer renderer(m_volume->m_Intensity.data(), m_volume->m_DimensionX, m_volume->m_DimensionY, m_volume->m_DimensionZ, *m_transferFunctions, m_SamplingCount);
+    std::string message = renderer.runBenchmark(frame, m_CPUBenchmarkSamples) + renderer.runSortingBenchmark(frame, m_CPUBenchmarkSamples);
+    if (m_IsCPUScalingBenchmarkEnabled)
+        message += MCCPUParallelRenderer::runScalingBenchmark(m_volume->m_Intensity, m_volume->m_DimensionX, m_volume->m_DimensionY, m_volume->m_DimensionZ, *m_transferFunctions, m_SamplingCount, frame, m_CPUBenchmarkSamples);
+    OutputDebugStringA(message.c_str());
+}
+
+auto MCVolumeRenderer::getCPUFrame(uint32_t width) -> MCCPUFrame
+{
+    updateState();
+
+    const auto outputWidth = m_deviceResources->GetOutputSize().right;
+    const auto outputHeight = m_deviceResources->GetOutputSize().bottom;
+
+    MCCPUFrame frame = {};
+    frame.InvWorldViewProjectionMatrix = m_FrameState.InvWorldViewProjectionMatrix;
+    frame.BoundingBoxMin = m_FrameState.BoundingBoxMin;
+    frame.BoundingBoxMax = m_FrameState.BoundingBoxMax;
+    frame.FrameOffset = m_FrameState.FrameOffset;
+    frame.StepSize = m_FrameState.StepSize;
+    frame.Density = m_FrameState.Density;
+    frame.IsPreIntegrationEnabled = m_IsPreIntegrationEnabled;
+    frame.Width = width;
+    frame.Height = (std::max)(1u, static_cast<uint32_t>(width * outputHeight / static_cast<F32>(outputWidth)));
+    if (m_IsClipBoxEnabled) {
+        frame.ClipBoxMin = m_ClipBoxMin;
+        frame.ClipBoxMax = m_ClipBoxMax;
+    }
+    return frame;
+}
+
+void MCVolumeRenderer::runSortLastBenchmark(uint32_t maxRankCount)
+{
+    MCSortLastSetup setup = {};
+    setup.Frame = getCPUFrame(m_CPUBenchmarkWidth);
+    setup.SampleCount = m_SortLastSamples;
+    setup.SamplingCount = m_SamplingCount;
+    strncpy_s(setup.VolumeFileName, m_volume->getFileName().c_str(), _TRUNCATE);
+    strncpy_s(setup.TransferFunctionFileName, m_TransferFunctionFileName.c_str(), _TRUNCATE);
+    try {
+        OutputDebugStringA(MCSortLastNode::runScalingBenchmark(setup, maxRankCount).c_str());
+    } catch (std::exception const& e) {
+        OutputDebugStringA(fmt::format("Sort-last: benchmark failed: {}\n", e.what()).c_str());
+    }
+}
+
+auto MCVolumeRenderer::setClipPlanes(std::vector<Hawk::Math::Plane> const& planes) -> void {
+    const size_t maxCount = MaxClipPlaneCount - (m_IsCropBoxEnabled ? 6 : 0);
+    if (std::size(planes) > maxCount)
+        OutputDebugStringA(fmt::format("Clip planes: {} planes given, only the first {} are used\n", std::size(planes), maxCount).c_str());
+    m_ClipPlanes.assign(std::begin(planes), std::begin(planes) + (std::min)(std::size(planes), maxCount));
+    m_FrameIndex = 0;
+}
+
+auto MCVolumeRenderer::setCropBox(Hawk::Math::Vec3 const& center, Hawk::Math::Vec3 const& halfExtent, Hawk::Math::Quat const& orientation) -> void {
+    m_IsCropBoxEnabled = true;
+    m_CropBoxCenter = center;
+    m_CropBoxHalfExtent = halfExtent;
+    m_CropBoxOrientation = orientation;
+    if (std::size(m_ClipPlanes) > MaxClipPlaneCount - 6)
+        m_ClipPlanes.resize(MaxClipPlaneCount - 6);
+    m_FrameIndex = 0;
+}
+
+auto MCVolumeRenderer::resetCropBox() -> void {
+    m_IsCropBoxEnabled = false;
+    m_FrameIndex = 0;
+}
+
+auto MCVolumeRenderer::setLabelVisible(uint32_t label, bool isVisible) -> void {
+    if (label >= MCTransferFunction::MaxLabelCount)
+        return;
+
+    const uint32_t mask = isVisible ? m_LabelVisibilityMask | (1u << label) : m_LabelVisibilityMask & ~(1u << label);
+    if (mask == m_LabelVisibilityMask)
+        return;
 
-        map->ViewProjectionMatrix = matrixProjection * matrixView;
-        map->NormalViewMatrix = matrixView * matrixNormal;
-        map->WorldViewProjectionMatrix = matrixProjection * matrixView * matrixWorld;
-        map->ViewMatrix = matrixView;
-        map->WorldMatrix = matrixWorld;
-        map->NormalMatrix = matrixNormal;
+    m_LabelVisibilityMask = mask;
+    if (!m_volume->hasLabels())
+        return;
+
+    // the hidden labels bound the visible voxels like a zero opacity
+    updateClipBox();
+    m_FrameIndex = 0;
+    m_IsHistoryValid = false;
+}
+
+auto MCVolumeRenderer::loadTransferFunction(std::string const& fileName) -> void {
+    const MCTransferFunctionTextures previous = m_TransferFunctionTextures;
+
+    // taken before parsing, a save racing with the load leaves an entry older than the file for the next poll to replace
+    std::error_code error;
+    const auto writeTime = std::filesystem::last_write_time(fileName, error);
+
+    // a cached preset keeps its textures until the sampling changes, a switch to it then bakes nothing
+    if (auto const* pEntry = m_TransferFunctionCache.find(fileName, writeTime)) {
+        m_transferFunctions = pEntry->Preset;
+        if (pEntry->Textures.m_Sampling == m_SamplingCount)
+            m_TransferFunctionTextures = pEntry->Textures;
+    } else {
+        m_transferFunctions = std::make_shared<MCTransferFunction const>(fileName);
+    }
+
+    if (fileName != m_TransferFunctionFileName) {
+        m_TransferFunctionFileName = fileName;
+        if (m_IsTransferFunctionWatchEnabled)
+            watchTransferFunction();
+    }
+
+    // the textures of a blend match no preset hash, the ones of the preset are all baked or swapped in again
+    m_TransferFunctionBlend.reset();
+    updateTransferFunctionTextures(previous);
+    m_TransferFunctionCache.insert(fileName, { m_transferFunctions, m_TransferFunctionTextures, writeTime });
+}
+
+auto MCVolumeRenderer::setTransferFunctionSampling(uint32_t samplingCount) -> void {
+    m_SamplingCount = std::clamp(samplingCount, 2u, MaxSamplingCount);
+    if (m_TransferFunctionBlend) {
+        beginTransferFunctionBlend(m_TransferFunctionBlend->getFrom(), m_TransferFunctionBlend->getTo(), m_TransferFunctionBlend->getFactor());
+        return;
+    }
+    updateTransferFunctionTextures(m_TransferFunctionTextures);
+}
+
+auto MCVolumeRenderer::blendTransferFunctions(std::string const& fileNameFrom, std::string const& fileNameTo) -> void {
+    beginTransferFunctionBlend(findTransferFunction(fileNameFrom), findTransferFunction(fileNameTo), 0.0f);
+}
+
+auto MCVolumeRenderer::setTransferFunctionBlendFactor(F32 factor) -> void {
+    factor = std::clamp(factor, 0.0f, 1.0f);
+    if (!m_TransferFunctionBlend || factor == m_TransferFunctionBlend->getFactor())
+        return;
+
+    // the clip box of the blend holds for every factor, only the texels change
+    m_TransferFunctionBlend->update(m_deviceResources->GetD3DDeviceContext(), factor);
+    m_FrameIndex = 0;
+    m_IsHistoryValid = false;
+}
+
+auto MCVolumeRenderer::findTransferFunction(std::string const& fileName) -> std::shared_ptr<MCTransferFunction const> {
+    std::error_code error;
+    const auto writeTime = std::filesystem::last_write_time(fileName, error);
+    if (auto const* pEntry = m_TransferFunctionCache.find(fileName, writeTime))
+        return pEntry->Preset;
+
+    // cached without textures, a later switch to the preset parses nothing
+    auto pPreset = std::make_shared<MCTransferFunction const>(fileName);
+    m_TransferFunctionCache.insert(fileName, { pPreset, {}, writeTime });
+    return pPreset;
+}
+
+auto MCVolumeRenderer::beginTransferFunctionBlend(std::shared_ptr<MCTransferFunction const> pFrom, std::shared_ptr<MCTransferFunction const> pTo, F32 factor) -> void {
+    auto pContext = m_deviceResources->GetD3DDeviceContext();
+    m_TransferFunctionBlend = std::make_unique<MCTransferFunctionBlend>(std::move(pFrom), std::move(pTo), m_SamplingCount);
+    m_TransferFunctionBlend->generateTextures(m_deviceResources->GetD3DDevice());
+
+    // a label volume keeps classifying with the labels of m_transferFunctions, the blend has no label textures of its own
+    MCTransferFunctionTextures textures = m_TransferFunctionBlend->getTextures();
+    textures.m_LabelHash = m_TransferFunctionTextures.m_LabelHash;
+    textures.m_pSRVLabelOpacityTF = m_TransferFunctionTextures.m_pSRVLabelOpacityTF;
+    textures.m_pSRVLabelOpacityRangeTF = m_TransferFunctionTextures.m_pSRVLabelOpacityRangeTF;
+    textures.m_pSRVLabelMaterialTF = m_TransferFunctionTextures.m_pSRVLabelMaterialTF;
+    m_TransferFunctionTextures = textures;
+    const uint64_t labelHash = m_transferFunctions->getLabelHash(m_SamplingCount);
+    if (labelHash != m_TransferFunctionTextures.m_LabelHash) {
+        m_transferFunctions->generateLabelTextures(m_deviceResources->GetD3DDevice(), m_SamplingCount, m_TransferFunctionTextures);
+        m_TransferFunctionTextures.m_LabelHash = labelHash;
+    }
 
-        map->InvViewProjectionMatrix = Hawk::Math::Inverse(map->ViewProjectionMatrix);
-        map->InvNormalViewMatrix = Hawk::Math::Inverse(map->NormalViewMatrix);
-        map->InvWorldViewProjectionMatrix = Hawk::Math::Inverse(map->WorldViewProjectionMatrix);
-        map->InvViewMatrix = Hawk::Math::Inverse(map->InvViewMatrix);
-        map->InvWorldMatrix = Hawk::Math::Inverse(map->WorldMatrix);
-        map->InvNormalMatrix = Hawk::Math::Inverse(map->NormalMatrix);
-        map->StepSize = Hawk::Math::Distance(map->BoundingBoxMin, map->BoundingBoxMax) / m_StepCount;
+    // the blended opacity is positive wherever the opacity of either preset is, the union of the clip boxes at both ends bounds
+    // every factor and the factor changes without a readback
+    updateClipBox();
+    Hawk::Math::Vec3 clipBoxMin = m_ClipBoxMin;
+    Hawk::Math::Vec3 clipBoxMax = m_ClipBoxMax;
+    m_TransferFunctionBlend->update(pContext, 1.0f);
+    updateClipBox();
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        m_ClipBoxMin[axis] = (std::min)(m_ClipBoxMin[axis], clipBoxMin[axis]);
+        m_ClipBoxMax[axis] = (std::max)(m_ClipBoxMax[axis], clipBoxMax[axis]);
+    }
+
+    m_TransferFunctionBlend->update(pContext, factor);
+    m_FrameIndex = 0;
+    m_IsHistoryValid = false;
+}
 
-        map->Density = m_Density;
-        map->FrameIndex = m_FrameIndex;
-        map->Exposure = m_Exposure;
+void MCVolumeRenderer::initializeDistributed(MCDistributedSettings const& settings)
+{
+    if (settings.IsWorker)
+        m_DistributedWorker = std::make_unique<MCDistributedWorker>(settings.WorkerIndex, settings.Port);
+    else if (settings.WorkerCount > 0)
+        m_DistributedCoordinator = std::make_unique<MCDistributedCoordinator>(settings.WorkerCount, settings.Port);
+    if (settings.SortLastRankCount > 0)
+        runSortLastBenchmark(settings.SortLastRankCount);
+    m_FrameIndex = 0;
+}
 
-        map->FrameOffset = Hawk::Math::Vec2(m_RandomDistribution(m_RandomGenerator), m_RandomDistribution(m_RandomGenerator));
-        map->RenderTargetDim = Hawk::Math::Vec2(static_cast<F32>(width), static_cast<F32>(height));
-        map->InvRenderTargetDim = Hawk::Math::Vec2(1.0f, 1.0f) / map->RenderTargetDim;
+void MCVolumeRenderer::updateDistributed()
+{
+    if (m_DistributedWorker) {
+        MCDistributedView view = {};
+        if (m_DistributedWorker->poll(view)) {
+            // the accumulations are merged pixel by pixel, a worker renders at the size of the coordinator
+            if (view.Width > 0 && view.Height > 0)
+                resizeRenderTargets(view.Width, view.Height);
+            m_DistributedView = view;
+            m_Zoom = view.Zoom;
+            m_FrameIndex = 0;
+        }
+        return;
     }
+
+    // a new view is published once the camera settles, the accumulations of the previous one are dropped
+    const Hawk::Math::Mat4x4 matrixView = m_Camera.ToMatrix();
+    const bool isViewChanged = m_DistributedView.Generation == 0 || m_DistributedView.Zoom != m_Zoom
+        || std::memcmp(&m_DistributedView.ViewMatrix, &matrixView, sizeof(matrixView)) != 0;
+    if (!m_IsCameraMoving && isViewChanged) {
+        m_DistributedView.ViewMatrix = matrixView;
+        m_DistributedView.Zoom = m_Zoom;
+        m_DistributedView.Generation++;
+        m_DistributedView.Width = m_deviceResources->GetOutputSize().right;
+        m_DistributedView.Height = m_deviceResources->GetOutputSize().bottom;
+        m_DistributedCoordinator->broadcastView(m_DistributedView);
+        m_DistributedColorSum.clear();
+    }
+
+    if (m_DistributedCoordinator->poll() && !std::empty(m_DistributedColorSum))
+        m_IsDistributedMergePending = true;
+}
+
+void MCVolumeRenderer::resizeRenderTargets(uint32_t width, uint32_t height)
+{
+    if (!m_deviceResources->WindowSizeChanged(width, height))
+        return;
+    initializeRenderTextures(m_deviceResources->GetD3DDevice());
+    initializeRenderTextures();
+    initializeHistoryTextures();
+    initializeDenoiseResources();
+    initializeTileBuffers();
+    m_IsHistoryValid = false;
+}
+
+void MCVolumeRenderer::finishDistributedStream(uint32_t renderWidth, uint32_t renderHeight)
+{
+    MCDistributedAccumulation accumulation;
+    accumulation.Generation = m_DistributedView.Generation;
+    accumulation.Width = renderWidth;
+    accumulation.Height = renderHeight;
+    accumulation.Pixels = readColorSum(renderWidth, renderHeight);
+
+    if (m_DistributedWorker) {
+        m_DistributedWorker->sendAccumulation(accumulation);
+        return;
+    }
+    // the workers that finished first are merged as soon as the coordinator has its own stream
+    m_DistributedColorSum = std::move(accumulation.Pixels);
+    m_IsDistributedMergePending = true;
+}
+
+void MCVolumeRenderer::presentDistributedMerge(uint32_t renderWidth, uint32_t renderHeight)
+{
+    m_IsDistributedMergePending = false;
+    std::vector<Hawk::Math::Vec4> colorSum = m_DistributedColorSum;
+    const uint32_t mergedCount = m_DistributedCoordinator->merge(colorSum, renderWidth, renderHeight);
+    if (mergedCount == 0)
+        return;
+
+    auto m_pImmediateContext = m_deviceResources->GetD3DDeviceContext();
+    {
+        DX::ComPtr<ID3D11Resource> pResource;
+        m_pSRVColorSum->GetResource(pResource.GetAddressOf());
+        D3D11_BOX box = { 0, 0, 0, renderWidth, renderHeight, 1 };
+        m_pImmediateContext->UpdateSubresource(pResource.Get(), 0, &box, colorSum.data(), renderWidth * sizeof(Hawk::Math::Vec4), 0);
+    }
+
+    ID3D11UnorderedAccessView* ppUAVClear[] = { nullptr };
+    ID3D11ShaderResourceView* ppSRVClear[] = { nullptr, nullptr };
+
+    uint32_t threadGroupsX = static_cast<uint32_t>(std::ceil(renderWidth / 8.0f));
+    uint32_t threadGroupsY = static_cast<uint32_t>(std::ceil(renderHeight / 8.0f));
+
+    // every pixel changed, the tone map has to cover all the tiles again
+    {
+        ID3D11UnorderedAccessView* ppUAVResources[] = { m_pUAVDispersionTiles.Get() };
+        uint32_t pCounters[] = { 0 };
+
+        m_deviceResources->PIXBeginEvent(L"Render Pass: Reset computed tiles");
+        m_shaders->m_PSOResetTiles.Apply(m_pImmediateContext);
+        m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVResources), ppUAVResources, pCounters);
+        m_pImmediateContext->Dispatch(threadGroupsX, threadGroupsY, 1);
+        m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVClear), ppUAVClear, nullptr);
+        m_pImmediateContext->CopyStructureCount(m_pDispathIndirectBufferArgs.Get(), 0, m_pUAVDispersionTiles.Get());
+        m_deviceResources->PIXEndEvent();
+    }
+
+    {
+        ID3D11ShaderResourceView* ppSRVResources[] = { m_pSRVColorSum.Get(), m_pSRVDispersionTiles.Get() };
+        ID3D11UnorderedAccessView* ppUAVResources[] = { m_pUAVToneMap.Get() };
+
+        m_deviceResources->PIXBeginEvent(L"Render Pass: Tone Map [Merged Color Sum]");
+        m_shaders->m_PSOToneMap.Apply(m_pImmediateContext);
+        m_pImmediateContext->CSSetConstantBuffers(0, 1, m_pConstantBufferFrame.GetAddressOf());
+        m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVResources), ppSRVResources);
+        m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVResources), ppUAVResources, nullptr);
+        m_pImmediateContext->DispatchIndirect(m_pDispathIndirectBufferArgs.Get(), 0);
+        m_pImmediateContext->CSSetUnorderedAccessViews(0, _countof(ppUAVClear), ppUAVClear, nullptr);
+        m_pImmediateContext->CSSetShaderResources(0, _countof(ppSRVClear), ppSRVClear);
+        m_deviceResources->PIXEndEvent();
+    }
+
+    const size_t centerIndex = size_t(renderHeight / 2) * renderWidth + renderWidth / 2;
+    auto message = fmt::format("Distributed: merged {} of {} workers, {:.0f} samples per pixel\n", mergedCount, m_DistributedCoordinator->getWorkerCount(), colorSum[centerIndex].w);
+    OutputDebugStringA(message.c_str());
+}
+
+auto MCVolumeRenderer::readColorSum(uint32_t renderWidth, uint32_t renderHeight) -> std::vector<Hawk::Math::Vec4>
+{
+    auto m_pDevice = m_deviceResources->GetD3DDevice();
+    auto m_pImmediateContext = m_deviceResources->GetD3DDeviceContext();
+
+    DX::ComPtr<ID3D11Resource> pResource;
+    DX::ComPtr<ID3D11Texture2D> pTexture;
+    m_pSRVColorSum->GetResource(pResource.GetAddressOf());
+    DX::ThrowIfFailed(pResource.As(&pTexture));
+
+    DX::ComPtr<ID3D11Texture2D> pTextureStaging;
+    {
+        D3D11_TEXTURE2D_DESC desc = {};
+        pTexture->GetDesc(&desc);
+        desc.BindFlags = 0;
+        desc.Usage = D3D11_USAGE_STAGING;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        DX::ThrowIfFailed(m_pDevice->CreateTexture2D(&desc, nullptr, pTextureStaging.GetAddressOf()));
+    }
+    m_pImmediateContext->CopyResource(pTextureStaging.Get(), pTexture.Get());
+
+    std::vector<Hawk::Math::Vec4> colorSum(size_t(renderWidth) * renderHeight);
+    {
+        D3D11_MAPPED_SUBRESOURCE resource = {};
+        DX::ThrowIfFailed(m_pImmediateContext->Map(pTextureStaging.Get(), 0, D3D11_MAP_READ, 0, &resource));
+        for (uint32_t y = 0; y < renderHeight; y++)
+            std::memcpy(colorSum.data() + size_t(y) * renderWidth, static_cast<const uint8_t*>(resource.pData) + size_t(y) * resource.RowPitch, renderWidth * sizeof(Hawk::Math::Vec4));
+        m_pImmediateContext->Unmap(pTextureStaging.Get(), 0);
+    }
+    return colorSum;
+}
+
+auto MCVolumeRenderer::getMaximumSamples() const -> uint32_t {
+    return m_IsDenoiseEnabled && !m_IsDenoiseMetricsEnabled ? m_DenoiseMaximumSamples : m_MaximumSamples;
+}
+
+auto MCVolumeRenderer::getRenderScale() const -> uint32_t {
+    return m_IsCameraMoving ? m_MotionRenderScale : 1;
+}
+
+auto MCVolumeRenderer::isPreIntegrated() const -> bool {
+    return m_IsPreIntegrationEnabled && !isOpacity2D() && !m_volume->hasLabels();
+}
+
+auto MCVolumeRenderer::isOpacity2D() const -> bool {
+    return m_TransferFunctionBlend ? m_TransferFunctionBlend->isOpacity2D() : !m_transferFunctions->opacity2DTF.IsEmpty();
 }
 
 auto MCVolumeRenderer::handleMouseMove(float x, float y) -> void {
     if (x != 0.0f || y != 0.0f) {
+        // keep the full resolution accumulation of the view we are leaving
+        if (!m_IsCameraMoving)
+            saveHistory();
         m_Camera.Rotate(Hawk::Components::Camera::LocalUp, m_DeltaTime * -m_RotateSensivity * x);
         m_Camera.Rotate(m_Camera.Right(), m_DeltaTime * -m_RotateSensivity * y);
         m_FrameIndex = 0;
+        m_MotionIdleTime = 0.0f;
+        m_IsCameraMoving = true;
     }
 }
\ No newline at end of file
@@ -5,11 +5,19 @@
 #include "../DeviceResources.h"
 #include "MCShaders.h"
 #include "MCVolumeDataLoader.h"
+#include "MCProfiler.h"
+#include "MCCPURenderer.h"
+#include "MCDistributed.h"
+#include "MCSortLast.h"
 #include <Hawk/Components/Camera.hpp>
 #include <Hawk/Math/Functions.hpp>
 #include <Hawk/Math/Transform.hpp>
 #include <Hawk/Math/Converters.hpp>
+#include <Hawk/Math/Geometry.hpp>
 #include <Hawk/Math/Transform.hpp>
+#include <array>
+#include <filesystem>
+#include <numeric>
 #include <random>
 
 
@@ -28,6 +36,8 @@ struct FrameBuffer {
 	Hawk::Math::Mat4x4 InvWorldMatrix;
 	Hawk::Math::Mat4x4 InvNormalMatrix;
 
+	Hawk::Math::Mat4x4 PrevWorldViewProjectionMatrix;
+
 	uint32_t         FrameIndex;
 	float            StepSize;
 	Hawk::Math::Vec2 FrameOffset;
@@ -40,6 +50,66 @@ struct FrameBuffer {
 
 	float Exposure;
 	Hawk::Math::Vec3 BoundingBoxMax;
+
+	uint32_t RenderScale;
+	uint32_t EnvironmentWidth;
+	uint32_t EnvironmentHeight;
+	uint32_t BounceCount;
+
+	uint32_t IsBounceStatisticsEnabled;
+	uint32_t IsEmptySpaceSkippingEnabled;
+	float    RadianceLodBias;
+	float    RadianceLodBounceScale;
+
+	Hawk::Math::Vec3 ClipBoxMin;
+	uint32_t SampleOffset;
+
+	Hawk::Math::Vec3 ClipBoxMax;
+	uint32_t IsPreIntegrationEnabled;
+
+	uint32_t IsOpacity2DEnabled;
+	float    GradientMagnitudeScale;
+	uint32_t IsLabelEnabled;
+	uint32_t LabelVisibilityMask;
+};
+
+struct EnvironmentBuffer {
+	uint32_t MipLevel;
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t Padding;
+};
+
+// Walker / Vose alias table entry, Pdf is the probability density of the texel over the [0, 1]^2 texture domain
+struct EnvironmentAliasEntry {
+	float    Threshold;
+	uint32_t Alias;
+	float    Pdf;
+	float    Padding;
+};
+
+struct DenoiseBuffer {
+	uint32_t StepWidth;
+	float    SigmaColor;
+	float    SigmaNormal;
+	float    SigmaDepth;
+
+	float            SigmaAlbedo;
+	Hawk::Math::Vec3 Padding;
+};
+
+// half-spaces Dot(Planes[i].xyz, p) + Planes[i].w >= 0 in the volume space of the rays, the first PlaneCount are used
+struct ClipBuffer {
+	std::array<Hawk::Math::Vec4, 16> Planes;
+	uint32_t         PlaneCount;
+	Hawk::Math::Vec3 Padding;
+};
+
+// the labels of the volume hidden by the clip box pass, see ClipBox.hlsl
+struct ClipBoxBuffer {
+	uint32_t         IsLabelEnabled;
+	uint32_t         LabelVisibilityMask;
+	Hawk::Math::Vec2 Padding;
 };
 
 struct DispathIndirectBuffer {
@@ -63,16 +133,25 @@ class MCVolumeRenderer
 	private:
 		// D3D Device Resource reference
 		std::shared_ptr<DX::DeviceResources> m_deviceResources;
-		// collection of transfer functions
-		std::unique_ptr<MCTransferFunction> m_transferFunctions;
+		// collection of transfer functions, shared with its entry of m_TransferFunctionCache
+		std::shared_ptr<MCTransferFunction const> m_transferFunctions;
 		// collection of shaders
 		std::unique_ptr<MCShaders> m_shaders;
 		// volume information
 		std::unique_ptr<MCVolumeDataLoader> m_volume;
+		// GPU timings
+		std::unique_ptr<MCProfiler> m_profiler;
 		// camera
 		Hawk::Components::Camera m_Camera = {};
 		Hawk::Math::Vec3 m_BoundingBoxMin = Hawk::Math::Vec3(-0.5f, -0.5f, -0.5f);
 		Hawk::Math::Vec3 m_BoundingBoxMax = Hawk::Math::Vec3(+0.5f, +0.5f, +0.5f);
+		// rays are clipped to the voxels visible under the opacity transfer function, in normalized texture coordinates
+		Hawk::Math::Vec3 m_ClipBoxMin = Hawk::Math::Vec3(0.0f, 0.0f, 0.0f);
+		Hawk::Math::Vec3 m_ClipBoxMax = Hawk::Math::Vec3(1.0f, 1.0f, 1.0f);
+		bool             m_IsClipBoxEnabled = true;
+		Hawk::Math::Mat4x4 m_WorldViewProjectionMatrix = {};
+		Hawk::Math::Mat4x4 m_HistoryWorldViewProjectionMatrix = {};
+		bool               m_IsHistoryValid = false;
 
 		// samplers
 		DX::ComPtr<ID3D11SamplerState>  m_pSamplerPoint;
@@ -83,11 +162,9 @@ class MCVolumeRenderer
 		using D3D11ArrayUnorderedAccessView = std::vector< DX::ComPtr<ID3D11UnorderedAccessView>>;
 		using D3D11ArrayShadeResourceView = std::vector< DX::ComPtr<ID3D11ShaderResourceView>>;
 
-		DX::ComPtr<ID3D11ShaderResourceView> m_pSRVDiffuseTF;
-		DX::ComPtr<ID3D11ShaderResourceView> m_pSRVSpecularTF;
-		DX::ComPtr<ID3D11ShaderResourceView> m_pSRVRoughnessTF;
-		DX::ComPtr<ID3D11ShaderResourceView> m_pSRVOpacityTF;
+		MCTransferFunctionTextures           m_TransferFunctionTextures;
 		DX::ComPtr<ID3D11ShaderResourceView> m_pSRVEnviroment;
+		DX::ComPtr<ID3D11ShaderResourceView> m_pSRVEnvironmentAliasTable;
 
 		DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVRadiance;
 		DX::ComPtr<ID3D11UnorderedAccessView> m_pUAVRadiance;
@@ -108,11 +185,41 @@ class MCVolumeRenderer
 		DX::ComPtr<ID3D11UnorderedAccessView> m_pUAVToneMap;
 		DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVToneMapPrev;
 
+		DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVUpsample;
+		DX::ComPtr<ID3D11UnorderedAccessView> m_pUAVUpsample;
+
+		// accumulation state saved before the camera moves, reprojected into the new view once it settles
+		DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVColorSumHistory;
+		DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVNormalHistory;
+		DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVDepthHistory;
+
+		// a-trous denoiser ping-pong targets and the snapshots used to measure its error
+		std::array<DX::ComPtr<ID3D11ShaderResourceView>, 2>  m_pSRVDenoise;
+		std::array<DX::ComPtr<ID3D11UnorderedAccessView>, 2> m_pUAVDenoise;
+		DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVDenoiseSnapshot;
+		DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVColorSumSnapshot;
+		DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVLodReference;
+		DX::ComPtr<ID3D11UnorderedAccessView> m_pUAVDenoiseError;
+
+		// paths entering and ray marching steps taken per bounce, two counters per bounce
+		DX::ComPtr<ID3D11UnorderedAccessView> m_pUAVBounceStatistics;
+
+		DX::ComPtr<ID3D11UnorderedAccessView> m_pUAVClipBox;
+
 		DX::ComPtr<ID3D11ShaderResourceView>  m_pSRVDispersionTiles;
 		DX::ComPtr<ID3D11UnorderedAccessView> m_pUAVDispersionTiles;
 
 		//buffers
 		DX::ComPtr<ID3D11Buffer> m_pConstantBufferFrame;
+		DX::ComPtr<ID3D11Buffer> m_pConstantBufferDenoise;
+		DX::ComPtr<ID3D11Buffer> m_pConstantBufferClip;
+		DX::ComPtr<ID3D11Buffer> m_pConstantBufferClipBox;
+		DX::ComPtr<ID3D11Buffer> m_pBufferDenoiseError;
+		DX::ComPtr<ID3D11Buffer> m_pBufferDenoiseErrorStaging;
+		DX::ComPtr<ID3D11Buffer> m_pBufferBounceStatistics;
+		DX::ComPtr<ID3D11Buffer> m_pBufferBounceStatisticsStaging;
+		DX::ComPtr<ID3D11Buffer> m_pBufferClipBox;
+		DX::ComPtr<ID3D11Buffer> m_pBufferClipBoxStaging;
 		DX::ComPtr<ID3D11Buffer> m_pDispathIndirectBufferArgs;
 		DX::ComPtr<ID3D11Buffer> m_pDrawInstancedIndirectBufferArgs;
 
@@ -127,9 +234,92 @@ class MCVolumeRenderer
 		uint32_t m_StepCount = 180;
 		uint32_t m_FrameIndex = 0;
 		uint32_t m_SampleDispersion = 8;
-		uint32_t m_SamplingCount = 256;
+		uint32_t m_SamplingCount = 4096;
+		static constexpr uint32_t MaxSamplingCount = 4096;
+		static constexpr char const* TransferFunctionFileName = "data/config/transferFunction.json";
+		std::string m_TransferFunctionFileName = TransferFunctionFileName;
+		// reloads m_TransferFunctionFileName when it is written, through a change notification on its directory
+		bool     m_IsTransferFunctionWatchEnabled = true;
+		HANDLE   m_TransferFunctionWatch = INVALID_HANDLE_VALUE;
+		std::filesystem::file_time_type m_TransferFunctionWriteTime = {};
+		// the presets switched to recently with their textures, a switch back to one of them swaps pointers
+		static constexpr uint32_t TransferFunctionCacheCapacity = 16;
+		MCTransferFunctionCache m_TransferFunctionCache = MCTransferFunctionCache(TransferFunctionCacheCapacity);
+		// the blend of two presets whose textures are bound instead of the ones of m_transferFunctions, until the next loadTransferFunction
+		std::unique_ptr<MCTransferFunctionBlend> m_TransferFunctionBlend;
 		uint32_t m_MaximumSamples = 64;
 		uint32_t m_MinRotateSamples = 8;
+		uint32_t m_EnvironmentWidth = 0;
+		uint32_t m_EnvironmentHeight = 0;
+		uint32_t m_EnvironmentSamplingWidth = 512;
+
+		// path length of ComputeRadiance, 1 is single scattering, longer paths are cut by Russian roulette
+		uint32_t m_BounceCount = 1;
+		uint32_t m_MaximumBounceCount = 16;
+		bool     m_IsBounceStatisticsEnabled = false;
+
+		// mip level read by the n-th segment of ComputeRadiance: m_MipLevel + m_RadianceLodBias + n * m_RadianceLodBounceScale
+		float    m_RadianceLodBias = 0.0f;
+		float    m_RadianceLodBounceScale = 0.0f;
+
+		// renders m_MaximumSamples for each (bias, bounce scale) pair and reports time against error, the first pair is the reference
+		bool     m_IsLodSweepEnabled = false;
+		uint32_t m_LodSweepIndex = 0;
+		std::vector<Hawk::Math::Vec2> m_LodSweepSettings = { { 0.0f, 0.0f }, { 0.0f, 0.5f }, { 0.0f, 1.0f }, { 1.0f, 0.0f }, { 1.0f, 1.0f }, { 2.0f, 0.0f }, { 2.0f, 1.0f } };
+		std::string m_LodSweepReport;
+
+		// region of interest in the normalized volume space of m_BoundingBoxMin / Max, rays are cut to it before marching
+		std::vector<Hawk::Math::Plane> m_ClipPlanes;
+		bool             m_IsCropBoxEnabled = false;
+		Hawk::Math::Vec3 m_CropBoxCenter = Hawk::Math::Vec3(0.0f, 0.0f, 0.0f);
+		Hawk::Math::Vec3 m_CropBoxHalfExtent = Hawk::Math::Vec3(0.5f, 0.5f, 0.5f);
+		Hawk::Math::Quat m_CropBoxOrientation = Hawk::Math::Quat(Hawk::Math::Vec3(0.0f, 0.0f, 0.0f), 1.0f);
+
+		// hierarchical skipping over the min / max pyramid of the volume, the skipped samples have zero opacity so the image is unchanged
+		bool     m_IsEmptySpaceSkippingEnabled = true;
+
+		// the march integrates the opacity over the segments between its samples with the pre-integration table, a transfer function
+		// peak between two samples is not missed: at the default density its free paths are as accurate as m_StepCount point samples
+		bool     m_IsPreIntegrationEnabled = true;
+		uint32_t m_PreIntegratedStepCount = 60;
+
+		// bit l shows label l of the label volume, a hidden label has zero opacity and the skipping culls the nodes holding only hidden labels
+		uint32_t m_LabelVisibilityMask = (1u << MCTransferFunction::MaxLabelCount) - 1;
+
+		// compares the wavefront and the megakernel CPU path tracers once at startup, on a m_CPUBenchmarkWidth wide image
+		bool     m_IsCPUBenchmarkEnabled = false;
+		uint32_t m_CPUBenchmarkWidth = 256;
+		uint32_t m_CPUBenchmarkSamples = 4;
+		// persistent NUMA pinned worker pool from 1 to all the nodes, first touch / interleaved / replicated volume
+		bool     m_IsCPUScalingBenchmarkEnabled = false;
+		// samples per pixel of every rank in the sort-last benchmark started with -sort-last N, on the m_CPUBenchmarkWidth wide image
+		uint32_t m_SortLastSamples = 16;
+
+		// interactive mode: render at 1 / m_MotionRenderScale (2 or 4) while the camera moves
+		bool     m_IsCameraMoving = false;
+		float    m_MotionIdleTime = 0.0f;
+		float    m_MotionSettleTime = 0.15f;
+		uint32_t m_MotionRenderScale = 2;
+
+		// edge-avoiding a-trous denoiser between Accumulate and Tone Map, lets the accumulation stop at m_DenoiseMaximumSamples
+		bool     m_IsDenoiseEnabled = false;
+		bool     m_IsDenoiseMetricsEnabled = false;
+		uint32_t m_DenoiseIterations = 5;
+		uint32_t m_DenoiseMaximumSamples = 16;
+		float    m_DenoiseSigmaColor = 1.0f;
+		float    m_DenoiseSigmaNormal = 32.0f;
+		float    m_DenoiseSigmaDepth = 0.01f;
+		float    m_DenoiseSigmaAlbedo = 0.2f;
+
+		// sort-first distribution of the sample streams over local processes, the coordinator merges the finished accumulations
+		std::unique_ptr<MCDistributedCoordinator> m_DistributedCoordinator;
+		std::unique_ptr<MCDistributedWorker>      m_DistributedWorker;
+		MCDistributedView                         m_DistributedView = {};
+		std::vector<Hawk::Math::Vec4>             m_DistributedColorSum;
+		bool                                      m_IsDistributedMergePending = false;
+
+		// constants of the last updateState, mirrored into m_pConstantBufferFrame
+		FrameBuffer m_FrameState = {};
 
 		std::random_device m_RandomDevice;
 		std::mt19937       m_RandomGenerator;
@@ -137,6 +327,7 @@ class MCVolumeRenderer
 
 	public:
 		MCVolumeRenderer(const std::shared_ptr<DX::DeviceResources> deviceResource);
+		~MCVolumeRenderer();
 		void initialize();
 
 		void update(float deltaTime);
@@ -147,10 +338,53 @@ class MCVolumeRenderer
 
 		void handleMouseMove(float x, float y);
 
+		void initializeDistributed(MCDistributedSettings const& settings);
+
+		// keeps the side of each plane where Dot(Normal, p) + Offset >= 0, the crop box uses 6 of the MaxClipPlaneCount planes
+		void setClipPlanes(std::vector<Hawk::Math::Plane> const& planes);
+
+		void setCropBox(Hawk::Math::Vec3 const& center, Hawk::Math::Vec3 const& halfExtent, Hawk::Math::Quat const& orientation);
+
+		void resetCropBox();
+
+		// swaps the transfer function preset, a JSON or a compiled .mctf file. A cached preset whose file is unchanged is swapped in
+		// with its textures, otherwise only the textures of the functions that changed are baked and uploaded again
+		void loadTransferFunction(std::string const& fileName);
+
+		// texels of the transfer function bakes, clamped to [2, MaxSamplingCount]
+		void setTransferFunctionSampling(uint32_t samplingCount);
+
+		// animates from one preset to another, the blend starts at factor 0. The GPU passes classify with the blend, the CPU renderer
+		// keeps m_transferFunctions. loadTransferFunction ends the blend, so does a reload of the watched preset
+		void blendTransferFunctions(std::string const& fileNameFrom, std::string const& fileNameTo);
+
+		// clamped to [0, 1], rewrites the texels of the blend in place without parsing or baking
+		void setTransferFunctionBlendFactor(F32 factor);
+
+		// shows or hides a label of the label volume, the clip box shrinks to the visible labels. Ignored without a label volume
+		void setLabelVisible(uint32_t label, bool isVisible);
+
+		static constexpr uint32_t MaxClipPlaneCount = 16;
+
 	private:
-		// bind transfer function data to shader resources
+		// bind transfer function data to shader resources, skips the bakes whose content hash is unchanged
 		void generateTransferFunctionTextures(DX::ComPtr<ID3D11Device> m_pDevice);
 
+		// rebakes and refreshes what depends on the baked textures of the preset, the visible bounds and the accumulation, compared to previous
+		void updateTransferFunctionTextures(MCTransferFunctionTextures previous);
+
+		// the preset of fileName in m_TransferFunctionCache, or parsed and cached without textures
+		auto findTransferFunction(std::string const& fileName) -> std::shared_ptr<MCTransferFunction const>;
+
+		// binds the textures of a new blend at factor, its clip box is the union of the clip boxes of both presets
+		auto beginTransferFunctionBlend(std::shared_ptr<MCTransferFunction const> pFrom, std::shared_ptr<MCTransferFunction const> pTo, F32 factor) -> void;
+
+		// arms the change notification on the directory of m_TransferFunctionFileName
+		void watchTransferFunction();
+
+		// reloads the preset once its file has a new write time, a file that does not parse leaves the current preset in place
+		void pollTransferFunction();
+
 		void initializeSamplers(DX::ComPtr<ID3D11Device> m_pDevice);
 
 		void initializeRenderTextures(DX::ComPtr<ID3D11Device> m_pDevice);
@@ -159,12 +393,75 @@ class MCVolumeRenderer
 
 		void initializeRenderTextures();
 
+		void initializeHistoryTextures();
+
+		void initializeDenoiseResources();
+
+		void createTextureCopy(DX::ComPtr<ID3D11ShaderResourceView> pSRVSource, DX::ComPtr<ID3D11ShaderResourceView>& pSRVCopy);
+
+		void copyTexture(DX::ComPtr<ID3D11ShaderResourceView> pSRVSource, DX::ComPtr<ID3D11ShaderResourceView> pSRVCopy);
+
 		void initializeTileBuffers();
 
 		void initializeBuffers();
 
 		void initializeEnvironmentMap();
 
+		void initializeEnvironmentSampling();
+
+		auto buildEnvironmentAliasTable(std::vector<F32> const& weights) const -> std::vector<EnvironmentAliasEntry>;
+
 		void updateState();
+
+		// the user planes and the faces of the crop box, scaled from the normalized volume space to the space of the rays
+		auto buildClipBuffer(Hawk::Math::Vec3 const& scale) const -> ClipBuffer;
+
+		// reduces the visible bricks of the min / max pyramid to m_ClipBoxMin / Max, the brick ranges do not depend
+		// on the transfer function so a new opacity transfer function only needs this pass again
+		void updateClipBox();
+
+		void saveHistory();
+
+		auto denoise(uint32_t renderWidth, uint32_t renderHeight) -> DX::ComPtr<ID3D11ShaderResourceView>;
+
+		void computeDenoiseMetrics(uint32_t renderWidth, uint32_t renderHeight);
+
+		// per pixel relative squared luminance error of two images against a reference, summed over the render target
+		auto computeRelativeError(DX::ComPtr<ID3D11ShaderResourceView> pSRVReference, DX::ComPtr<ID3D11ShaderResourceView> pSRVFiltered, DX::ComPtr<ID3D11ShaderResourceView> pSRVUnfiltered, uint32_t renderWidth, uint32_t renderHeight) -> Hawk::Math::Vec2;
+
+		void updateLodSweep(uint32_t renderWidth, uint32_t renderHeight);
+
+		void reportBounceStatistics();
+
+		void runCPUBenchmark();
+
+		// the constants of the CPU renderer for the current view at the given width
+		auto getCPUFrame(uint32_t width) -> MCCPUFrame;
+
+		// sort-last domain decomposition over 1, 2, 4 .. maxRankCount local processes, reported on the debug output
+		void runSortLastBenchmark(uint32_t maxRankCount);
+
+		// publishes the view of the coordinator, or picks it up on a worker, and collects the accumulations that arrived
+		void updateDistributed();
+
+		// swap chain and every screen sized target at width x height, the history is dropped
+		void resizeRenderTargets(uint32_t width, uint32_t height);
+
+		// the accumulation of this process reached its sample budget: kept by the coordinator, sent by a worker
+		void finishDistributedStream(uint32_t renderWidth, uint32_t renderHeight);
+
+		void presentDistributedMerge(uint32_t renderWidth, uint32_t renderHeight);
+
+		auto readColorSum(uint32_t renderWidth, uint32_t renderHeight) -> std::vector<Hawk::Math::Vec4>;
+
+		auto getMaximumSamples() const -> uint32_t;
+
+		auto getRenderScale() const -> uint32_t;
+
+		// the table has no gradient magnitude axis nor labels, a preset with a 2D opacity or a label volume is point sampled at m_StepCount
+		auto isPreIntegrated() const -> bool;
+
+		// the preset or the blend classifies with a 2D opacity
+		auto isOpacity2D() const -> bool;
 };
 
@@ -3,8 +3,110 @@
 #include <Hawk/Math/Functions.hpp>
 #include <Hawk/Math/Transform.hpp>
 #include <Hawk/Math/Converters.hpp>
+#include <DirectXPackedVector.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <execution>
+#include <immintrin.h>
+#include <intrin.h>
+#include <numeric>
+#include <span>
 #include <vector>
 
+// the project targets SSE2, the batched evaluations check for AVX2 once at run time
+inline auto IsAVX2Supported() -> bool {
+    static const bool isSupported = IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE);
+    return isSupported;
+}
+
+// the float16 conversions of _mm256_cvtps_ph, CPUID leaf 1 ECX bit 29. Not implied by AVX2
+inline auto IsF16CSupported() -> bool {
+    static const bool isSupported = []() {
+        int registers[4] = {};
+        __cpuid(registers, 1);
+        return (registers[2] & (1 << 29)) != 0;
+    }();
+    return isSupported;
+}
+
+// the normalized intensities of the texels of a baked transfer function texture
+inline auto GenerateSampling(uint32_t sampling) -> std::vector<F32> {
+    std::vector<F32> intensities(sampling);
+    for (auto index = 0u; index < sampling; index++)
+        intensities[index] = index / static_cast<F32>(sampling - 1);
+    return intensities;
+}
+
+// float16 texel of a baked texture, a positive value never rounds to zero so that it stays visible to the range textures
+inline auto ToHalf(F32 value) -> DirectX::PackedVector::HALF {
+    const DirectX::PackedVector::HALF half = DirectX::PackedVector::XMConvertFloatToHalf(value);
+    return value > 0.0f && (half & 0x7FFF) == 0 ? DirectX::PackedVector::HALF(1) : half;
+}
+
+constexpr uint64_t TransferFunctionHashSeed = 14695981039346656037ull;
+
+// FNV-1a, chained through hash to cover several functions and the bake settings
+inline auto HashBytes(void const* pData, size_t size, uint64_t hash = TransferFunctionHashSeed) -> uint64_t {
+    for (size_t index = 0; index < size; index++)
+        hash = (hash ^ static_cast<uint8_t const*>(pData)[index]) * 1099511628211ull;
+    return hash;
+}
+
+// texel (x, y) of the rangeSampling^2 table holds the largest of the values baked at GenerateSampling between the cells x and y.
+// A cell takes the maximum over the texels within half a cell of it, plus one texel of filter footprint, so that a sharp peak
+// of a fine bake is never lost to a coarse range texture
+inline auto GenerateRangeMaxTable(std::span<F32 const> valuesFine, uint32_t rangeSampling) -> std::vector<F32> {
+    const uint32_t sampling = static_cast<uint32_t>(std::size(valuesFine));
+    std::vector<F32> values(rangeSampling, 0.0f);
+    for (auto index = 0u; index < rangeSampling; index++) {
+        const F32 intensityMin = (index - 0.5f) / rangeSampling;
+        const F32 intensityMax = (index + 1.5f) / rangeSampling;
+        const int32_t indexBegin = (std::max)(static_cast<int32_t>(std::floor(intensityMin * (sampling - 1))) - 1, 0);
+        const int32_t indexEnd = (std::min)(static_cast<int32_t>(std::ceil(intensityMax * (sampling - 1))) + 1, static_cast<int32_t>(sampling) - 1);
+        for (auto indexFine = indexBegin; indexFine <= indexEnd; indexFine++)
+            values[index] = (std::max)(values[index], valuesFine[indexFine]);
+    }
+
+    std::vector<F32> table(size_t(rangeSampling) * rangeSampling, 0.0f);
+    for (auto indexMin = 0u; indexMin < rangeSampling; indexMin++) {
+        F32 value = 0.0f;
+        for (auto indexMax = indexMin; indexMax < rangeSampling; indexMax++) {
+            value = (std::max)(value, values[indexMax]);
+            table[size_t(indexMax) * rangeSampling + indexMin] = value;
+        }
+    }
+    return table;
+}
+
+// Texture2D R16F of GenerateRangeMaxTable
+inline auto GenerateRangeMaxTexture(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, std::span<F32 const> valuesFine, uint32_t rangeSampling) -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+    const std::vector<F32> table = GenerateRangeMaxTable(valuesFine, rangeSampling);
+    std::vector<DirectX::PackedVector::HALF> data(std::size(table));
+    std::transform(std::begin(table), std::end(table), std::begin(data), ToHalf);
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = rangeSampling;
+    desc.Height = rangeSampling;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.SampleDesc.Count = 1;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    desc.Format = DXGI_FORMAT_R16_FLOAT;
+    desc.Usage = D3D11_USAGE_IMMUTABLE;
+
+    D3D11_SUBRESOURCE_DATA initData = {};
+    initData.pSysMem = std::data(data);
+    initData.SysMemPitch = rangeSampling * sizeof(DirectX::PackedVector::HALF);
+
+    Microsoft::WRL::ComPtr<ID3D11Texture2D> pTexture;
+    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSRV;
+    DX::ThrowIfFailed(pDevice->CreateTexture2D(&desc, &initData, pTexture.GetAddressOf()));
+    DX::ThrowIfFailed(pDevice->CreateShaderResourceView(pTexture.Get(), nullptr, pSRV.GetAddressOf()));
+
+    return pSRV;
+}
+
 template<uint32_t N>
 struct PiecewiseFunction {
     F32                RangeMin = -1024.0f;
@@ -21,9 +123,11 @@ public:
         this->Position[this->Count] = position;
         this->Value[this->Count] = value;
         this->Count++;
+        m_IsCompiled = false;
     }
 
-    auto Evaluate(F32 positionNormalized) const -> F32 {
+    // reference linear scan over the nodes in the order they were added
+    auto EvaluateLinear(F32 positionNormalized) const -> F32 {
         auto position = positionNormalized * (this->RangeMax - this->RangeMin) + this->RangeMin;
 
         if (this->Count <= 0)
@@ -35,6 +139,10 @@ public:
         if (position > this->RangeMax)
             return this->Value[this->Count - 1];
 
+        // the segments are half open, the last node closes the last one
+        if (position == this->Position[this->Count - 1])
+            return this->Value[this->Count - 1];
+
         for (size_t i = 1; i < this->Count; i++) {
             auto const p1 = this->Position[i - 1];
             auto const p2 = this->Position[i];
@@ -46,9 +154,146 @@ public:
         return 0.0f;
     }
 
+    // O(log n) binary search over the nodes sorted by Compile, the linear scan before
+    auto Evaluate(F32 positionNormalized) const -> F32 {
+        if (!m_IsCompiled)
+            return EvaluateLinear(positionNormalized);
+
+        auto const position = positionNormalized * (this->RangeMax - this->RangeMin) + this->RangeMin;
+
+        if (this->Count <= 0)
+            return 0.0f;
+
+        if (position < this->RangeMin)
+            return this->Value[0];
+
+        if (position > this->RangeMax)
+            return this->Value[this->Count - 1];
+
+        // the segment ends at the first node past the position, outside of the nodes the function is zero as for the scan
+        auto const index = static_cast<uint32_t>(std::upper_bound(std::begin(this->Position), std::begin(this->Position) + this->Count, position) - std::begin(this->Position));
+        if (index == 0)
+            return 0.0f;
+        if (index == this->Count)
+            return position == this->Position[this->Count - 1] ? this->Value[this->Count - 1] : 0.0f;
+        return this->Value[index - 1] + (position - this->Position[index - 1]) * m_Slope[index];
+    }
+
+    // O(1): one cell of the table resampled by CompileTable, exact where the nodes fall on cell boundaries. Evaluate until the table is built
+    auto EvaluateTable(F32 positionNormalized) const -> F32 {
+        if (m_TableCellCount == 0)
+            return Evaluate(positionNormalized);
+
+        auto const x = Hawk::Math::Clamp(positionNormalized, 0.0f, 1.0f) * m_TableCellCount;
+        auto const index = (std::min)(static_cast<uint32_t>(x), m_TableCellCount - 1);
+        return m_Table[index].x + (x - index) * m_Table[index].y;
+    }
+
+    // Evaluate for every intensity of the span, eight at a time with AVX2 once compiled
+    auto EvaluateBatch(std::span<F32 const> intensities, std::span<F32> values) const -> void {
+        size_t index = 0;
+        if (IsBatchCompiled() && IsAVX2Supported()) {
+            for (; index + 8 <= std::size(intensities); index += 8) {
+                auto const position = ToPosition8(_mm256_loadu_ps(&intensities[index]));
+                _mm256_storeu_ps(&values[index], Interpolate8(position, SearchSegment8(position)));
+            }
+        }
+        for (; index < std::size(intensities); index++)
+            values[index] = Evaluate(intensities[index]);
+    }
+
+    auto IsBatchCompiled() const -> bool { return m_IsCompiled && this->Count > 0; }
+
+    auto ToPosition8(__m256 positionNormalized) const -> __m256 {
+        return _mm256_add_ps(_mm256_mul_ps(positionNormalized, _mm256_set1_ps(this->RangeMax - this->RangeMin)), _mm256_set1_ps(this->RangeMin));
+    }
+
+    // number of nodes at or before the position of every lane, the upper_bound of Evaluate without branches
+    auto SearchSegment8(__m256 position) const -> __m256i {
+        auto index = _mm256_setzero_si256();
+        for (uint32_t i = 0; i < this->Count; i++)
+            index = _mm256_sub_epi32(index, _mm256_castps_si256(_mm256_cmp_ps(_mm256_set1_ps(this->Position[i]), position, _CMP_LE_OQ)));
+        return index;
+    }
+
+    // Evaluate of eight positions in the segments of SearchSegment8, any function with the same node positions can share the search
+    auto Interpolate8(__m256 position, __m256i index) const -> __m256 {
+        auto const count = _mm256_set1_epi32(this->Count);
+        auto const indexBegin = _mm256_max_epi32(_mm256_sub_epi32(index, _mm256_set1_epi32(1)), _mm256_setzero_si256());
+        auto const indexEnd = _mm256_min_epi32(index, _mm256_sub_epi32(count, _mm256_set1_epi32(1)));
+
+        auto const p1 = _mm256_i32gather_ps(std::data(this->Position), indexBegin, sizeof(F32));
+        auto const v1 = _mm256_i32gather_ps(std::data(this->Value), indexBegin, sizeof(F32));
+        auto const slope = _mm256_i32gather_ps(std::data(m_Slope), indexEnd, sizeof(F32));
+        auto value = _mm256_add_ps(v1, _mm256_mul_ps(_mm256_sub_ps(position, p1), slope));
+
+        // zero outside of the nodes, the last value exactly on the last node, clamped outside of the range
+        auto const valueLast = _mm256_set1_ps(this->Value[this->Count - 1]);
+        auto const isFirst = _mm256_castsi256_ps(_mm256_cmpeq_epi32(index, _mm256_setzero_si256()));
+        auto const isLast = _mm256_castsi256_ps(_mm256_cmpeq_epi32(index, count));
+        auto const isOnLast = _mm256_and_ps(isLast, _mm256_cmp_ps(position, _mm256_set1_ps(this->Position[this->Count - 1]), _CMP_EQ_OQ));
+        value = _mm256_blendv_ps(value, _mm256_setzero_ps(), _mm256_or_ps(isFirst, isLast));
+        value = _mm256_blendv_ps(value, valueLast, isOnLast);
+        value = _mm256_blendv_ps(value, _mm256_set1_ps(this->Value[0]), _mm256_cmp_ps(position, _mm256_set1_ps(this->RangeMin), _CMP_LT_OQ));
+        value = _mm256_blendv_ps(value, valueLast, _mm256_cmp_ps(position, _mm256_set1_ps(this->RangeMax), _CMP_GT_OQ));
+        return value;
+    }
+
+    // sorts the nodes by position, nodes on the same position keep their order, and precomputes the slope of every segment
+    auto Compile() -> void {
+        std::array<uint32_t, N> order;
+        std::iota(std::begin(order), std::begin(order) + this->Count, 0u);
+        std::stable_sort(std::begin(order), std::begin(order) + this->Count, [this](uint32_t lhs, uint32_t rhs) { return this->Position[lhs] < this->Position[rhs]; });
+
+        auto const position = this->Position;
+        auto const value = this->Value;
+        for (uint32_t i = 0; i < this->Count; i++) {
+            this->Position[i] = position[order[i]];
+            this->Value[i] = value[order[i]];
+        }
+
+        for (uint32_t i = 1; i < this->Count; i++) {
+            auto const width = this->Position[i] - this->Position[i - 1];
+            m_Slope[i] = width > 0.0f ? (this->Value[i] - this->Value[i - 1]) / width : 0.0f;
+        }
+        m_IsCompiled = true;
+    }
+
+    // value and slope of cellCount uniform cells over [0, 1], one cell per unit of the range by default: a Hounsfield unit
+    auto CompileTable(uint32_t cellCount = 0) -> void {
+        if (!m_IsCompiled)
+            Compile();
+
+        m_TableCellCount = cellCount > 0 ? cellCount : (std::max)(static_cast<uint32_t>(std::round(this->RangeMax - this->RangeMin)), 1u);
+        m_Table.resize(m_TableCellCount);
+        for (uint32_t index = 0; index < m_TableCellCount; index++) {
+            auto const v0 = Evaluate(index / static_cast<F32>(m_TableCellCount));
+            auto const v1 = Evaluate((index + 1) / static_cast<F32>(m_TableCellCount));
+            m_Table[index] = Hawk::Math::Vec2(v0, v1 - v0);
+        }
+    }
+
+    // equal functions bake equal textures, the nodes are hashed in their compiled order
+    auto GetHash(uint64_t hash = TransferFunctionHashSeed) const -> uint64_t {
+        hash = HashBytes(&this->RangeMin, sizeof(F32), hash);
+        hash = HashBytes(&this->RangeMax, sizeof(F32), hash);
+        hash = HashBytes(&this->Count, sizeof(uint32_t), hash);
+        hash = HashBytes(std::data(this->Position), this->Count * sizeof(F32), hash);
+        return HashBytes(std::data(this->Value), this->Count * sizeof(F32), hash);
+    }
+
     auto Clear() -> void {
         this->Count = 0;
+        m_IsCompiled = false;
+        m_TableCellCount = 0;
+        m_Table.clear();
     }
+
+private:
+    std::array<F32, N>            m_Slope = {};
+    std::vector<Hawk::Math::Vec2> m_Table;
+    uint32_t                      m_TableCellCount = 0;
+    bool                          m_IsCompiled = false;
 };
 
 class ScalarTransferFunction1D {
@@ -57,17 +302,29 @@ public:
 
     auto Evaluate(F32 intensity) -> F32 { return this->PLF.Evaluate(intensity); }
 
+    auto EvaluateTable(F32 intensity) const -> F32 { return this->PLF.EvaluateTable(intensity); }
+
+    auto EvaluateBatch(std::span<F32 const> intensities, std::span<F32> values) const -> void { this->PLF.EvaluateBatch(intensities, values); }
+
+    // binary search for Evaluate and the uniform table for EvaluateTable, after the last AddNode
+    auto Compile() -> void { this->PLF.CompileTable(); }
+
+    auto GetHash(uint64_t hash = TransferFunctionHashSeed) const -> uint64_t { return this->PLF.GetHash(hash); }
+
     auto GenerateTexture(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling = 64) -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
-        std::vector<uint8_t> data(sampling);
+        std::vector<F32> values(sampling);
+        this->EvaluateBatch(GenerateSampling(sampling), values);
+
+        std::vector<DirectX::PackedVector::HALF> data(sampling);
         for (auto index = 0u; index < sampling; index++)
-            data[index] = static_cast<uint8_t>(std::round(255.0f * this->Evaluate(index / static_cast<F32>(sampling - 1))));
+            data[index] = ToHalf(values[index]);
 
         D3D11_TEXTURE1D_DESC desc = {};
         desc.Width = sampling;
         desc.MipLevels = 1;
         desc.ArraySize = 1;
         desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-        desc.Format = DXGI_FORMAT_R8_UNORM;
+        desc.Format = DXGI_FORMAT_R16_FLOAT;
         desc.Usage = D3D11_USAGE_IMMUTABLE;
 
         D3D11_SUBRESOURCE_DATA initData = {};
@@ -81,6 +338,90 @@ public:
         return pSRV;
     }
 
+    // texel (x, y) of the rangeSampling^2 texture holds the largest value of GenerateTexture between the cells x and y, a zero marks
+    // an intensity range without opacity
+    auto GenerateRangeMaxTexture(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling = 64, uint32_t rangeSampling = 64) -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+        std::vector<F32> valuesFine(sampling);
+        this->EvaluateBatch(GenerateSampling(sampling), valuesFine);
+        return ::GenerateRangeMaxTexture(pDevice, valuesFine, rangeSampling);
+    }
+
+    auto GenerateRangeMaxTable(uint32_t sampling = 64, uint32_t rangeSampling = 64) const -> std::vector<F32> {
+        std::vector<F32> valuesFine(sampling);
+        this->EvaluateBatch(GenerateSampling(sampling), valuesFine);
+        return ::GenerateRangeMaxTable(valuesFine, rangeSampling);
+    }
+
+    /*
+    * Pre-integration table of tableSampling^2 texels: texel (x, y) holds the mean value over a ray segment whose intensity runs
+    * linearly from cell x at its front to cell y at its back, the optical depth of the segment is that mean times its length.
+    * The means are differences of the running integral of a bake at sampling texels, the rows are filled in parallel.
+    */
+    auto GeneratePreIntegrationTable(uint32_t sampling = 4096, uint32_t tableSampling = 256) const -> std::vector<F32> {
+        std::vector<F32> values(sampling);
+        this->EvaluateBatch(GenerateSampling(sampling), values);
+
+        // summed values of the bake in units of its texels, trapezoids between the texels
+        std::vector<F64> sums(sampling, 0.0);
+        for (auto index = 1u; index < sampling; index++)
+            sums[index] = sums[index - 1] + 0.5 * (F64(values[index - 1]) + values[index]);
+
+        // exact integral of the linear interpolation of the bake up to intensity
+        auto getIntegral = [&](F32 intensity, F64& value) -> F64 {
+            const F64 x = F64(intensity) * (sampling - 1);
+            const uint32_t x0 = (std::min)(static_cast<uint32_t>(x), sampling - 2);
+            const F64 t = x - x0;
+            value = values[x0] + t * (F64(values[x0 + 1]) - values[x0]);
+            return sums[x0] + 0.5 * t * (values[x0] + value);
+        };
+
+        const std::vector<F32> intensities = GenerateSampling(tableSampling);
+        std::vector<F64> integrals(tableSampling);
+        std::vector<F64> points(tableSampling);
+        for (auto index = 0u; index < tableSampling; index++)
+            integrals[index] = getIntegral(intensities[index], points[index]);
+
+        std::vector<F32> table(size_t(tableSampling) * tableSampling);
+        std::vector<uint32_t> rows(tableSampling);
+        std::iota(std::begin(rows), std::end(rows), 0u);
+        std::for_each(std::execution::par, std::begin(rows), std::end(rows), [&](uint32_t back) {
+            for (auto front = 0u; front < tableSampling; front++) {
+                const F64 length = (F64(intensities[back]) - intensities[front]) * (sampling - 1);
+                const F64 mean = front == back ? points[front] : (integrals[back] - integrals[front]) / length;
+                table[size_t(back) * tableSampling + front] = static_cast<F32>(mean);
+            }
+        });
+        return table;
+    }
+
+    // Texture2D R16F of GeneratePreIntegrationTable, u is the front and v the back intensity of a segment
+    auto GeneratePreIntegrationTexture(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling = 4096, uint32_t tableSampling = 256) const -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+        const std::vector<F32> table = this->GeneratePreIntegrationTable(sampling, tableSampling);
+        std::vector<DirectX::PackedVector::HALF> data(std::size(table));
+        std::transform(std::begin(table), std::end(table), std::begin(data), ToHalf);
+
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = tableSampling;
+        desc.Height = tableSampling;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.SampleDesc.Count = 1;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.Format = DXGI_FORMAT_R16_FLOAT;
+        desc.Usage = D3D11_USAGE_IMMUTABLE;
+
+        D3D11_SUBRESOURCE_DATA initData = {};
+        initData.pSysMem = std::data(data);
+        initData.SysMemPitch = tableSampling * sizeof(DirectX::PackedVector::HALF);
+
+        Microsoft::WRL::ComPtr<ID3D11Texture2D> pTexture;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSRV;
+        DX::ThrowIfFailed(pDevice->CreateTexture2D(&desc, &initData, pTexture.GetAddressOf()));
+        DX::ThrowIfFailed(pDevice->CreateShaderResourceView(pTexture.Get(), nullptr, pSRV.GetAddressOf()));
+
+        return pSRV;
+    }
+
     auto Clear() -> void { this->PLF.Clear(); }
 
     PiecewiseLinearFunction<> PLF;
@@ -98,22 +439,55 @@ public:
         return Hawk::Math::Vec3(this->PLF[0].Evaluate(intensity), this->PLF[1].Evaluate(intensity), this->PLF[2].Evaluate(intensity));
     }
 
-    auto GenerateTexture(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling = 64) -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
-        std::vector<Hawk::Math::Vector<uint8_t, 4>> data(sampling);
-        for (size_t index = 0; index < sampling; index++) {
-            Hawk::Math::Vec3 v = this->Evaluate(index / static_cast<F32>(sampling - 1));
-            uint8_t x = static_cast<uint8_t>(std::round(255.0f * v.x));
-            uint8_t y = static_cast<uint8_t>(std::round(255.0f * v.y));
-            uint8_t z = static_cast<uint8_t>(std::round(255.0f * v.z));
-            data[index] = Hawk::Math::Vector<uint8_t, 4>(x, y, z, static_cast<uint8_t>(0));
+    auto EvaluateTable(F32 intensity) const -> Hawk::Math::Vec3 {
+        return Hawk::Math::Vec3(this->PLF[0].EvaluateTable(intensity), this->PLF[1].EvaluateTable(intensity), this->PLF[2].EvaluateTable(intensity));
+    }
+
+    // the channels share their node positions, one segment search per eight intensities serves all three
+    auto EvaluateBatch(std::span<F32 const> intensities, std::span<F32> red, std::span<F32> green, std::span<F32> blue) const -> void {
+        size_t index = 0;
+        if (this->PLF[0].IsBatchCompiled() && this->PLF[1].IsBatchCompiled() && this->PLF[2].IsBatchCompiled() && IsAVX2Supported()) {
+            for (; index + 8 <= std::size(intensities); index += 8) {
+                auto const position = this->PLF[0].ToPosition8(_mm256_loadu_ps(&intensities[index]));
+                auto const segment = this->PLF[0].SearchSegment8(position);
+                _mm256_storeu_ps(&red[index], this->PLF[0].Interpolate8(position, segment));
+                _mm256_storeu_ps(&green[index], this->PLF[1].Interpolate8(position, segment));
+                _mm256_storeu_ps(&blue[index], this->PLF[2].Interpolate8(position, segment));
+            }
+        }
+        for (; index < std::size(intensities); index++) {
+            red[index] = this->PLF[0].Evaluate(intensities[index]);
+            green[index] = this->PLF[1].Evaluate(intensities[index]);
+            blue[index] = this->PLF[2].Evaluate(intensities[index]);
         }
+    }
+
+    auto Compile() -> void {
+        this->PLF[0].CompileTable();
+        this->PLF[1].CompileTable();
+        this->PLF[2].CompileTable();
+    }
+
+    auto GetHash(uint64_t hash = TransferFunctionHashSeed) const -> uint64_t {
+        return this->PLF[2].GetHash(this->PLF[1].GetHash(this->PLF[0].GetHash(hash)));
+    }
+
+    auto GenerateTexture(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling = 64) -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+        std::vector<F32> red(sampling);
+        std::vector<F32> green(sampling);
+        std::vector<F32> blue(sampling);
+        this->EvaluateBatch(GenerateSampling(sampling), red, green, blue);
+
+        std::vector<Hawk::Math::Vector<DirectX::PackedVector::HALF, 4>> data(sampling);
+        for (size_t index = 0; index < sampling; index++)
+            data[index] = Hawk::Math::Vector<DirectX::PackedVector::HALF, 4>(ToHalf(red[index]), ToHalf(green[index]), ToHalf(blue[index]), ToHalf(0.0f));
 
         D3D11_TEXTURE1D_DESC desc = {};
         desc.Width = sampling;
         desc.MipLevels = 1;
         desc.ArraySize = 1;
         desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-        desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        desc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
         desc.Usage = D3D11_USAGE_IMMUTABLE;
 
         D3D11_SUBRESOURCE_DATA initData = {};
@@ -134,4 +508,145 @@ public:
     }
 
     std::array<PiecewiseLinearFunction<>, 3> PLF;
-};
\ No newline at end of file
+};
+/*
+* Opacity over the intensity and the gradient magnitude, for boundary emphasizing presets. A row is a function of the intensity at one
+* gradient magnitude in Hounsfield units per voxel, the rows are interpolated linearly in between and clamped outside of them.
+* The baked table spans the gradient magnitudes [0, GradientMagnitudeMax]: the intensity runs along u and the magnitude along v.
+*/
+class ScalarTransferFunction2D {
+public:
+    auto AddRow(F32 gradientMagnitude, ScalarTransferFunction1D const& row) -> void {
+        this->Position.push_back(gradientMagnitude);
+        this->Rows.push_back(row);
+    }
+
+    auto IsEmpty() const -> bool { return std::empty(this->Rows); }
+
+    auto Evaluate(F32 intensity, F32 gradientMagnitudeNormalized) const -> F32 {
+        const F32 gradientMagnitude = gradientMagnitudeNormalized * this->GradientMagnitudeMax;
+        const size_t index = std::upper_bound(std::begin(this->Position), std::end(this->Position), gradientMagnitude) - std::begin(this->Position);
+        if (index == 0)
+            return this->Rows.front().EvaluateTable(intensity);
+        if (index == std::size(this->Rows))
+            return this->Rows.back().EvaluateTable(intensity);
+        const F32 t = (gradientMagnitude - this->Position[index - 1]) / (this->Position[index] - this->Position[index - 1]);
+        return std::lerp(this->Rows[index - 1].EvaluateTable(intensity), this->Rows[index].EvaluateTable(intensity), t);
+    }
+
+    // sorts the rows by their gradient magnitude and compiles them, after the last AddRow
+    auto Compile() -> void {
+        std::vector<size_t> order(std::size(this->Rows));
+        std::iota(std::begin(order), std::end(order), size_t(0));
+        std::stable_sort(std::begin(order), std::end(order), [&](size_t lhs, size_t rhs) { return this->Position[lhs] < this->Position[rhs]; });
+
+        std::vector<F32> position(std::size(order));
+        std::vector<ScalarTransferFunction1D> rows(std::size(order));
+        for (size_t index = 0; index < std::size(order); index++) {
+            position[index] = this->Position[order[index]];
+            rows[index] = this->Rows[order[index]];
+            rows[index].Compile();
+        }
+        this->Position = std::move(position);
+        this->Rows = std::move(rows);
+    }
+
+    auto GetHash(uint64_t hash = TransferFunctionHashSeed) const -> uint64_t {
+        hash = HashBytes(&this->GradientMagnitudeMax, sizeof(F32), hash);
+        hash = HashBytes(std::data(this->Position), std::size(this->Position) * sizeof(F32), hash);
+        for (auto const& row : this->Rows)
+            hash = row.GetHash(hash);
+        return hash;
+    }
+
+    /*
+    * Table of sampling x gradientSampling texels, line y holds the gradient magnitude y / (gradientSampling - 1) of GradientMagnitudeMax.
+    * Every row is baked once with the batched evaluation, the lines are interpolated between the two bakes around them in parallel.
+    */
+    auto GenerateTable(uint32_t sampling = 4096, uint32_t gradientSampling = 64) const -> std::vector<F32> {
+        const std::vector<std::vector<F32>> bakes = this->GenerateRowBakes(sampling);
+
+        std::vector<F32> table(size_t(sampling) * gradientSampling, 0.0f);
+        if (std::empty(bakes))
+            return table;
+
+        std::vector<uint32_t> lines(gradientSampling);
+        std::iota(std::begin(lines), std::end(lines), 0u);
+        std::for_each(std::execution::par, std::begin(lines), std::end(lines), [&](uint32_t line) {
+            const F32 gradientMagnitude = line / static_cast<F32>((std::max)(gradientSampling - 1, 1u)) * this->GradientMagnitudeMax;
+            const size_t index = std::upper_bound(std::begin(this->Position), std::end(this->Position), gradientMagnitude) - std::begin(this->Position);
+            const size_t index0 = index == 0 ? 0 : index - 1;
+            const size_t index1 = (std::min)(index, std::size(bakes) - 1);
+            const F32 t = index0 == index1 ? 0.0f : (gradientMagnitude - this->Position[index0]) / (this->Position[index1] - this->Position[index0]);
+
+            F32* pLine = &table[size_t(line) * sampling];
+            for (auto texel = 0u; texel < sampling; texel++)
+                pLine[texel] = std::lerp(bakes[index0][texel], bakes[index1][texel], t);
+        });
+        return table;
+    }
+
+    // Texture2D R16F of GenerateTable
+    auto GenerateTexture(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling = 4096, uint32_t gradientSampling = 64) const -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+        const std::vector<F32> table = this->GenerateTable(sampling, gradientSampling);
+        std::vector<DirectX::PackedVector::HALF> data(std::size(table));
+        std::transform(std::begin(table), std::end(table), std::begin(data), ToHalf);
+
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = sampling;
+        desc.Height = gradientSampling;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.SampleDesc.Count = 1;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.Format = DXGI_FORMAT_R16_FLOAT;
+        desc.Usage = D3D11_USAGE_IMMUTABLE;
+
+        D3D11_SUBRESOURCE_DATA initData = {};
+        initData.pSysMem = std::data(data);
+        initData.SysMemPitch = sampling * sizeof(DirectX::PackedVector::HALF);
+
+        Microsoft::WRL::ComPtr<ID3D11Texture2D> pTexture;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> pSRV;
+        DX::ThrowIfFailed(pDevice->CreateTexture2D(&desc, &initData, pTexture.GetAddressOf()));
+        DX::ThrowIfFailed(pDevice->CreateShaderResourceView(pTexture.Get(), nullptr, pSRV.GetAddressOf()));
+
+        return pSRV;
+    }
+
+    // the range texture of the largest value over all the gradient magnitudes, the min / max pyramid only bounds the intensity of a node.
+    // Between two rows the value is linear in the magnitude, its maximum over the magnitudes is the maximum over the rows
+    auto GenerateRangeMaxTexture(Microsoft::WRL::ComPtr<ID3D11Device> pDevice, uint32_t sampling = 64, uint32_t rangeSampling = 64) const -> Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> {
+        return ::GenerateRangeMaxTexture(pDevice, this->GenerateRowMax(sampling), rangeSampling);
+    }
+
+    auto GenerateRangeMaxTable(uint32_t sampling = 64, uint32_t rangeSampling = 64) const -> std::vector<F32> {
+        return ::GenerateRangeMaxTable(this->GenerateRowMax(sampling), rangeSampling);
+    }
+
+    auto Clear() -> void {
+        this->Position.clear();
+        this->Rows.clear();
+        this->GradientMagnitudeMax = 1.0f;
+    }
+
+    F32                                   GradientMagnitudeMax = 1.0f;
+    std::vector<F32>                      Position;
+    std::vector<ScalarTransferFunction1D> Rows;
+
+private:
+    auto GenerateRowBakes(uint32_t sampling) const -> std::vector<std::vector<F32>> {
+        const std::vector<F32> intensities = GenerateSampling(sampling);
+        std::vector<std::vector<F32>> bakes(std::size(this->Rows), std::vector<F32>(sampling));
+        for (size_t index = 0; index < std::size(this->Rows); index++)
+            this->Rows[index].EvaluateBatch(intensities, bakes[index]);
+        return bakes;
+    }
+
+    auto GenerateRowMax(uint32_t sampling) const -> std::vector<F32> {
+        std::vector<F32> values(sampling, 0.0f);
+        for (auto const& bake : this->GenerateRowBakes(sampling))
+            std::transform(std::begin(bake), std::end(bake), std::begin(values), std::begin(values), [](F32 lhs, F32 rhs) { return (std::max)(lhs, rhs); });
+        return values;
+    }
+};